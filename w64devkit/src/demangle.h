@@ -0,0 +1,2405 @@
+// demangle.h: C++ symbol demangler for MSVC and Itanium names (header-only)
+//
+// Decodes Visual C++ decorated names ("?f@@YAHH@Z") and Itanium ABI
+// mangled names as produced by GCC and Clang ("_Z1fi") into readable
+// declarations. Output follows the conventions of llvm-undname and
+// c++filt respectively. Self-contained: no libc, no allocation. All
+// working memory, including the result, comes from a caller-supplied
+// buffer, so it's safe to call from many threads at once:
+//
+//   static u8 mem[1<<17];
+//   dmname r = demangle(name, len, DEMANGLE_NOACCESS, mem, sizeof(mem));
+//   if (r.data) {
+//       // r.data[0..r.len) is the demangled name
+//   }
+//
+// Names that are not mangled, use an unsupported feature, or need more
+// memory than given produce a null result, and callers generally print
+// the original name instead. Parser state takes about 64 KiB, and a few
+// KiB beyond that handles typical names. Nothing is read past the given
+// length and no terminator is required.
+//
+// Requires GCC or Clang.
+//
+// This is free and unencumbered software released into the public domain.
+#ifndef DEMANGLE_H
+#define DEMANGLE_H
+
+typedef unsigned char       u8;
+typedef   signed int        b32;
+typedef   signed int        i32;
+typedef unsigned int        u32;
+typedef   signed long long  i64;
+typedef unsigned long long  u64;
+typedef __PTRDIFF_TYPE__    iz;
+
+enum {
+    DEMANGLE_NOACCESS = 1<<0,  // omit MSVC "public:" etc.
+    DEMANGLE_NAMEONLY = 1<<1,  // only the qualified name
+    DEMANGLE_NOPTR64  = 1<<2,  // omit MSVC __ptr64 (32-bit view)
+    DEMANGLE_UNDNAME  = 1<<3,  // MSVC spacing like DbgHelp: "a,b", "> >"
+};
+
+typedef struct {
+    u8 *data;
+    iz  len;
+} dmname;
+
+#define DMS(s)  (dmname){(u8 *)s, sizeof(s)-1}
+
+// Length of a table string, without calling into a CRT.
+static iz dmlen(const char *s)
+{
+    iz len = 0;
+    for (; s[len]; len++) {}
+    return len;
+}
+
+// A declarator split around the position of its name, so that types
+// compose: int (*name)[3] is left "int (*" and right ")[3]".
+typedef struct {
+    dmname left;
+    dmname right;
+    dmname conv;  // calling convention of a function type
+    i32    kind;
+} dmtype;
+
+enum { DM_PLAIN, DM_POINTER, DM_FUNCTION, DM_ARRAY, DM_LREF, DM_RREF, DM_EMPTY };
+
+// Itanium template argument: one type, or a pack of several.
+typedef struct {
+    i32 first;
+    i32 count;
+    b32 pack;
+} dmarg;
+
+enum {
+    DM_MAXDEPTH = 192,
+    DM_MAXSUBS  = 1024,
+    DM_MAXARGS  = 64,
+};
+
+typedef struct {
+    u8    *in;
+    u8    *inend;
+    u8    *beg;     // free pool memory
+    u8    *end;
+    i32    flags;
+    i32    depth;
+    b32    err;
+
+    // MSVC backreferences
+    dmname names[10];
+    dmname keys[10];
+    i32    nnames;
+    dmtype params[10];
+    i32    nparams;
+    dmname leaf;    // unqualified name of the last symbol
+
+    // Itanium substitutions and template arguments
+    i32    nsubs;
+    dmtype *targs;      // arguments of the innermost template name
+    dmarg  *args;
+    i32     nargs;
+    i32     packindex;  // element under expansion, or -1
+    i32     packsize;
+    dmname lastname;  // for constructor and destructor names
+    dmname cvquals;   // of the last nested name
+    b32    intype;
+    b32    lambda;    // template parameters are the lambda's own auto
+
+    // Large tables last, left uninitialized: entries are written before
+    // they're counted, so only the fields above need clearing per call.
+    dmtype subs[DM_MAXSUBS];
+    i32    subparam[DM_MAXSUBS];  // template parameter plus one, or zero
+    u8    *subin[DM_MAXSUBS];     // source of a lambda parameter type, or null
+} dm;
+
+static dmname dmfail(dm *d)
+{
+    dmname r = {0};
+    d->err = 1;
+    return r;
+}
+
+static b32 dmequals(dmname a, dmname b)
+{
+    if (a.len != b.len) {
+        return 0;
+    }
+    for (iz i = 0; i < a.len; i++) {
+        if (a.data[i] != b.data[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static b32 dmendswith(dmname s, dmname suffix)
+{
+    if (s.len < suffix.len) {
+        return 0;
+    }
+    dmname tail = {s.data+s.len-suffix.len, suffix.len};
+    return dmequals(tail, suffix);
+}
+
+static u8 dmpeek(dm *d, iz i)
+{
+    return i < d->inend-d->in ? d->in[i] : 0;
+}
+
+static u8 dmnext(dm *d)
+{
+    if (d->in == d->inend) {
+        d->err = 1;
+        return 0;
+    }
+    return *d->in++;
+}
+
+// Consume the prefix if the input starts with it.
+static b32 dmeat(dm *d, dmname prefix)
+{
+    if (prefix.len > d->inend-d->in) {
+        return 0;
+    }
+    for (iz i = 0; i < prefix.len; i++) {
+        if (d->in[i] != prefix.data[i]) {
+            return 0;
+        }
+    }
+    d->in += prefix.len;
+    return 1;
+}
+
+// Concatenate into the pool. The string most recently built is extended
+// in place, so building left to right costs no copies.
+static dmname dmcat(dm *d, dmname a, dmname b)
+{
+    if (d->err) {
+        return dmfail(d);
+    }
+    dmname r = a;
+    if (!a.len || a.data+a.len!=d->beg) {
+        if (a.len > d->end-d->beg) {
+            return dmfail(d);
+        }
+        r.data = d->beg;
+        if (a.len) __builtin_memcpy(r.data, a.data, a.len);
+        d->beg += a.len;
+    }
+    if (b.len > d->end-d->beg) {
+        return dmfail(d);
+    }
+    if (b.len) __builtin_memcpy(d->beg, b.data, b.len);
+    d->beg += b.len;
+    r.len += b.len;
+    return r;
+}
+
+static dmname dmcat3(dm *d, dmname a, dmname b, dmname c)
+{
+    return dmcat(d, dmcat(d, a, b), c);
+}
+
+// Allocate from the far end of the pool, away from string building.
+static void *dmalloc(dm *d, iz size)
+{
+    iz pad = (iz)((__UINTPTR_TYPE__)d->end & 7);
+    if (d->err || size > d->end-d->beg-pad) {
+        d->err = 1;
+        return 0;
+    }
+    d->end -= pad + size;
+    return d->end;
+}
+
+static u8 dmlast(dmname s)
+{
+    return s.len ? s.data[s.len-1] : 0;
+}
+
+// Digits come from subtracting powers of ten, as 64-bit division is a
+// libgcc call on 32-bit hosts, which link without libgcc.
+static dmname dmint(dm *d, u64 x, b32 negative)
+{
+    u64 pow[20];
+    for (i32 i = 0; i < 20; i++) {
+        pow[i] = i ? pow[i-1]*10 : 1;
+    }
+
+    u8 buf[24];
+    iz len = 0;
+    if (negative) {
+        buf[len++] = '-';
+    }
+    for (i32 i = 19; i >= 0; i--) {
+        u8 digit = '0';
+        for (; x >= pow[i]; x -= pow[i]) {
+            digit++;
+        }
+        if (digit>'0' || len>negative || !i) {
+            buf[len++] = digit;
+        }
+    }
+    dmname r = {buf, len};
+    return dmcat(d, (dmname){0}, r);
+}
+
+static b32 dmenter(dm *d)
+{
+    d->err |= ++d->depth > DM_MAXDEPTH;
+    return !d->err;
+}
+
+static b32 dmdigit(u8 c)
+{
+    return c>='0' && c<='9';
+}
+
+
+// MSVC
+
+static dmname mssymbol(dm *d);
+static dmtype mstype(dm *d, i32 mode);
+static dmname msfullname(dm *d, b32 symbol);
+
+enum { MS_MANGLE, MS_RESULT, MS_DROP };  // qualifier modes
+
+enum {
+    MQ_CONST    = 1<<0,
+    MQ_VOLATILE = 1<<1,
+    MQ_PTR64    = 1<<2,
+    MQ_RESTRICT = 1<<3,
+    MQ_UNALIGN  = 1<<4,
+    MQ_MEMBER   = 1<<5,
+};
+
+enum {
+    FC_PRIVATE   = 1<<0,
+    FC_PROTECTED = 1<<1,
+    FC_PUBLIC    = 1<<2,
+    FC_GLOBAL    = 1<<3,
+    FC_STATIC    = 1<<4,
+    FC_VIRTUAL   = 1<<5,
+    FC_THUNK     = 1<<6,
+    FC_VTORDISP  = 1<<7,
+    FC_VTORDISPX = 1<<8,
+    FC_EXTERNC   = 1<<9,
+    FC_NOPARAMS  = 1<<10,
+};
+
+// Space between tokens, as llvm-undname places it.
+static dmname msspace(dm *d, dmname s)
+{
+    u8 c = dmlast(s);
+    b32 alnum = (c>='0' && c<='9') || (c>='a' && c<='z') || (c>='A' && c<='Z');
+    return alnum || c=='>' ? dmcat(d, s, DMS(" ")) : s;
+}
+
+// List separator for parameters and template arguments.
+static dmname mscomma(dm *d)
+{
+    return d->flags&DEMANGLE_UNDNAME ? DMS(",") : DMS(", ");
+}
+
+static dmname msquals(dm *d, dmname s, i32 q, b32 before)
+{
+    static const struct { i32 q; u8 *s; } t[] = {
+        {MQ_CONST, (u8 *)"const"},
+        {MQ_VOLATILE, (u8 *)"volatile"},
+        {MQ_RESTRICT, (u8 *)"__restrict"},
+        {MQ_UNALIGN, (u8 *)"__unaligned"},
+    };
+    for (i32 i = 0; i < (i32)(sizeof(t)/sizeof(*t)); i++) {
+        if (q & t[i].q) {
+            dmname w = {t[i].s, dmlen((char *)t[i].s)};
+            if (before) s = dmcat(d, s, DMS(" "));
+            s = dmcat(d, s, w);
+            before = 1;
+        }
+    }
+    return s;
+}
+
+// Encoded number: 0-9 mean 1-10, otherwise hex digits A-P ending with @.
+static u64 msnumber(dm *d, b32 *negative)
+{
+    *negative = dmeat(d, DMS("?"));
+    u8 c = dmnext(d);
+    if (dmdigit(c)) {
+        return c - '0' + 1;
+    }
+    u64 n = 0;
+    for (i32 i = 0; c != '@'; c = dmnext(d), i++) {
+        if (c<'A' || c>'P' || i==16) {
+            d->err = 1;
+            return 0;
+        }
+        n = n*16 + c - 'A';
+    }
+    return n;
+}
+
+static dmname mssigned(dm *d)
+{
+    b32 negative;
+    u64 n = msnumber(d, &negative);
+    return dmint(d, n, negative);
+}
+
+// Offsets are 32-bit and wrap around to negative.
+static dmname msoffset(dm *d)
+{
+    b32 negative;
+    i32 n = (i32)msnumber(d, &negative);
+    n = negative ? -n : n;
+    return dmint(d, n<0 ? -(u64)n : (u64)n, n<0);
+}
+
+static void msmemorize(dm *d, dmname key, dmname name)
+{
+    if (d->nnames < 10) {
+        for (i32 i = 0; i < d->nnames; i++) {
+            if (dmequals(d->keys[i], key)) {
+                return;
+            }
+        }
+        d->keys[d->nnames] = key;
+        d->names[d->nnames++] = name;
+    }
+}
+
+static dmname mssimple(dm *d, b32 memorize)
+{
+    dmname r = {d->in, 0};
+    for (; dmpeek(d, r.len) != '@'; r.len++) {
+        if (r.data+r.len == d->inend) {
+            return dmfail(d);
+        }
+    }
+    if (!r.len) {
+        return dmfail(d);
+    }
+    d->in += r.len + 1;
+    if (memorize) {
+        msmemorize(d, r, r);
+    }
+    return r;
+}
+
+static dmname msbackref(dm *d)
+{
+    i32 i = dmnext(d) - '0';
+    if (i >= d->nnames) {
+        return dmfail(d);
+    }
+    return d->names[i];
+}
+
+// Template argument list following a template name, through the @.
+static dmname mstargs(dm *d)
+{
+    dmname r = DMS("<");
+    b32 first = 1;
+    while (!d->err && !dmeat(d, DMS("@"))) {
+        if (dmeat(d, DMS("$S")) || dmeat(d, DMS("$$V")) ||
+            dmeat(d, DMS("$$$V")) || dmeat(d, DMS("$$Z"))) {
+            continue;  // empty parameter pack
+        }
+
+        dmname arg = {0};
+        if (dmeat(d, DMS("$$Y"))) {
+            arg = msfullname(d, 0);
+        } else if (dmeat(d, DMS("$$B"))) {
+            dmtype t = mstype(d, MS_DROP);
+            arg = dmcat(d, t.left, t.right);
+        } else if (dmeat(d, DMS("$$C"))) {
+            dmtype t = mstype(d, MS_MANGLE);
+            arg = dmcat(d, t.left, t.right);
+        } else if (dmeat(d, DMS("$1"))) {
+            if (dmpeek(d, 0) != '?') {
+                return dmfail(d);
+            }
+            dmname sym = mssymbol(d);
+            msmemorize(d, d->leaf, d->leaf);
+            arg = dmcat(d, DMS("&"), sym);
+        } else if (dmeat(d, DMS("$E?"))) {
+            d->in--;
+            arg = mssymbol(d);
+        } else if (dmeat(d, DMS("$0"))) {
+            arg = mssigned(d);
+        } else {
+            dmtype t = mstype(d, MS_DROP);
+            arg = dmcat(d, t.left, t.right);
+        }
+        r = dmcat(d, r, first ? (dmname){0} : mscomma(d));
+        r = dmcat(d, r, arg);
+        first = 0;
+    }
+    if ((d->flags & DEMANGLE_UNDNAME) && dmlast(r)=='>') {
+        r = dmcat(d, r, DMS(" "));
+    }
+    return dmcat(d, r, DMS(">"));
+}
+
+enum { MS_NAME, MS_CTOR, MS_DTOR, MS_CONVERSION };
+
+typedef struct {
+    dmname name;
+    dmname targs;
+    i32    kind;
+} msleaf;
+
+static msleaf msoperator(dm *d)
+{
+    static const char basic[] =
+        "\0\0new\0delete\0=\0>>\0<<\0!\0==\0!=\0[]\0\0->\0*\0++\0--\0-\0+\0"
+        "&\0->*\0/\0%\0<\0<=\0>\0>=\0,\0()\0~\0^\0|\0&&\0||\0*=\0+=\0-=";
+    static const char under[] =
+        "/=\0%=\0>>=\0<<=\0&=\0|=\0^=\0`vftable'\0`vbtable'\0`vcall'\0"
+        "`typeof'\0`local static guard'\0`string'\0`vbase dtor'\0"
+        "`vector deleting dtor'\0`default ctor closure'\0"
+        "`scalar deleting dtor'\0`vector ctor iterator'\0"
+        "`vector dtor iterator'\0`vector vbase ctor iterator'\0"
+        "`virtual displacement map'\0`eh vector ctor iterator'\0"
+        "`eh vector dtor iterator'\0`eh vector vbase ctor iterator'\0"
+        "`copy ctor closure'\0`udt returning'\0\0\0`local vftable'\0"
+        "`local vftable ctor closure'\0new[]\0delete[]\0\0"
+        "`placement delete closure'\0`placement delete[] closure'";
+    static const char codes[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+    msleaf r = {0};
+    const char *table = basic;
+    i32 ntable = 36;
+    if (dmeat(d, DMS("__"))) {
+        u8 c = dmnext(d);
+        switch (c) {
+        case 'L': r.name = DMS("operator co_await"); return r;
+        case 'M': r.name = DMS("operator<=>");       return r;
+        }
+        d->err = 1;
+        return r;
+    } else if (dmeat(d, DMS("_"))) {
+        table  = under;
+        ntable = 35;
+    }
+
+    u8 c = dmnext(d);
+    i32 code = 0;
+    for (; code<ntable && codes[code]!=c; code++) {}
+    if (code == ntable) {
+        d->err = 1;
+        return r;
+    }
+
+    if (table == basic) {
+        switch (code) {
+        case  0: r.kind = MS_CTOR;       return r;
+        case  1: r.kind = MS_DTOR;       return r;
+        case 11: r.kind = MS_CONVERSION; return r;
+        }
+    }
+    const char *s = table;
+    for (i32 i = 0; i < code; i++) {
+        s += dmlen(s) + 1;
+    }
+    dmname name = {(u8 *)s, dmlen(s)};
+    if (!name.len) {
+        d->err = 1;
+    } else if (name.data[0] == '`') {
+        r.name = name;
+    } else {
+        r.name = dmcat(d, DMS("operator"), name);
+        if (name.data[0]>='a' && name.data[0]<='z') {
+            r.name = dmcat3(d, DMS("operator"), DMS(" "), name);
+        }
+    }
+    return r;
+}
+
+// The innermost name of a symbol: simple, template, operator, or backref.
+static msleaf msunqualified(dm *d)
+{
+    msleaf r = {0};
+    if (dmdigit(dmpeek(d, 0))) {
+        r.name = msbackref(d);
+    } else if (dmeat(d, DMS("?$"))) {
+        // Template arguments have their own backreference context
+        dmname saved[20];
+        i32    nsaved = d->nnames;
+        __builtin_memcpy(saved, d->names, sizeof(d->names));
+        __builtin_memcpy(saved+10, d->keys, sizeof(d->keys));
+        d->nnames = 0;
+        if (dmpeek(d, 0) == '?') {
+            d->in++;
+            r = msoperator(d);
+        } else {
+            r.name = mssimple(d, 1);
+        }
+        r.targs = mstargs(d);
+        d->nnames = nsaved;
+        __builtin_memcpy(d->names, saved, sizeof(d->names));
+        __builtin_memcpy(d->keys, saved+10, sizeof(d->keys));
+    } else if (dmeat(d, DMS("?"))) {
+        r = msoperator(d);
+    } else {
+        r.name = mssimple(d, 1);
+    }
+    return r;
+}
+
+// Does a local scope number follow: ?N? or ?<encoded>@? (but not ??)?
+static b32 mslocalscope(dm *d)
+{
+    if (dmpeek(d, 0) != '?') {
+        return 0;
+    }
+    u8 c = dmpeek(d, 1);
+    if (dmdigit(c) || c=='@') {
+        return dmpeek(d, 2) == '?';
+    }
+    if (c<'B' || c>'P') {
+        return 0;
+    }
+    for (iz i = 2;; i++) {
+        c = dmpeek(d, i);
+        if (c == '@') {
+            return dmpeek(d, i+1) == '?';
+        } else if (c<'A' || c>'P') {
+            return 0;
+        }
+    }
+}
+
+static dmname msscope(dm *d)
+{
+    if (dmdigit(dmpeek(d, 0))) {
+        return msbackref(d);
+    }
+
+    if (dmeat(d, DMS("?$"))) {
+        d->in -= 2;
+        msleaf t = msunqualified(d);
+        dmname r = dmcat(d, t.name, t.targs);
+        msmemorize(d, r, r);
+        return r;
+    }
+
+    if (dmeat(d, DMS("?A"))) {
+        d->in -= 1;
+        dmname key = mssimple(d, 0);
+        dmname r = DMS("`anonymous namespace'");
+        msmemorize(d, key, r);
+        return r;
+    }
+
+    if (mslocalscope(d)) {
+        d->in++;
+        b32 negative;
+        u64 n = dmpeek(d, 0)=='@' ? (d->in++, 0) : msnumber(d, &negative);
+        dmeat(d, DMS("?"));
+        i32 flags = d->flags;
+        d->flags &= ~(DEMANGLE_NOACCESS | DEMANGLE_NAMEONLY);
+        dmname sym = mssymbol(d);
+        d->flags = flags;
+        dmname r = dmcat3(d, DMS("`"), sym, DMS("'::`"));
+        r = dmcat(d, r, dmint(d, n, 0));
+        return dmcat(d, r, DMS("'"));
+    }
+
+    return mssimple(d, 1);
+}
+
+// Parse scopes through @, prefixing them to the given name.
+static dmname msscopes(dm *d, dmname name, dmname *last)
+{
+    dmname scopes[32];
+    i32    nscopes = 0;
+    while (!d->err && !dmeat(d, DMS("@"))) {
+        if (nscopes == (i32)(sizeof(scopes)/sizeof(*scopes))) {
+            return dmfail(d);
+        }
+        scopes[nscopes++] = msscope(d);
+    }
+
+    dmname r = {0};
+    for (i32 i = nscopes-1; i >= 0; i--) {
+        r = dmcat3(d, r, scopes[i], DMS("::"));
+    }
+    if (last) {
+        *last = nscopes ? scopes[0] : (dmname){0};
+    }
+    return dmcat(d, r, name);
+}
+
+// A qualified type name, as in a class type or member pointer.
+static dmname msfullname(dm *d, b32 symbol)
+{
+    (void)symbol;
+    dmname name = {0};
+    if (dmdigit(dmpeek(d, 0))) {
+        name = msbackref(d);
+    } else if (dmeat(d, DMS("?$"))) {
+        d->in -= 2;
+        msleaf t = msunqualified(d);
+        name = dmcat(d, t.name, t.targs);
+        msmemorize(d, name, name);
+    } else {
+        name = mssimple(d, 1);
+    }
+    return msscopes(d, name, 0);
+}
+
+static i32 msqualifiers(dm *d)
+{
+    switch (dmnext(d)) {
+    case 'A': return 0;
+    case 'B': return MQ_CONST;
+    case 'C': return MQ_VOLATILE;
+    case 'D': return MQ_CONST | MQ_VOLATILE;
+    case 'Q': return MQ_MEMBER;
+    case 'R': return MQ_MEMBER | MQ_CONST;
+    case 'S': return MQ_MEMBER | MQ_VOLATILE;
+    case 'T': return MQ_MEMBER | MQ_CONST | MQ_VOLATILE;
+    }
+    d->err = 1;
+    return 0;
+}
+
+static i32 msextquals(dm *d)
+{
+    i32 q = 0;
+    for (;;) {
+        switch (dmpeek(d, 0)) {
+        case 'E': q |= MQ_PTR64;    break;
+        case 'I': q |= MQ_RESTRICT; break;
+        case 'F': q |= MQ_UNALIGN;  break;
+        default:  return q;
+        }
+        d->in++;
+    }
+}
+
+static dmname mscallconv(dm *d)
+{
+    switch (dmnext(d)) {
+    case 'A': case 'B': return DMS("__cdecl");
+    case 'C': case 'D': return DMS("__pascal");
+    case 'E': case 'F': return DMS("__thiscall");
+    case 'G': case 'H': return DMS("__stdcall");
+    case 'I': case 'J': return DMS("__fastcall");
+    case 'M': case 'N': return DMS("__clrcall");
+    case 'O': case 'P': return DMS("__eabi");
+    case 'Q':           return DMS("__vectorcall");
+    }
+    return dmfail(d);
+}
+
+static dmname msptr64(dm *d, dmname s, i32 q)
+{
+    if ((q & MQ_PTR64) && !(d->flags & DEMANGLE_NOPTR64)) {
+        b32 spaced = (d->flags & DEMANGLE_UNDNAME) || !s.len;  // after ')'
+        s = spaced ? dmcat(d, s, DMS(" ")) : msspace(d, s);
+        s = dmcat(d, s, DMS("__ptr64"));
+    }
+    return s;
+}
+
+typedef struct {
+    dmtype ret;
+    dmname conv;
+    dmname params;
+    dmname post;    // qualifiers after the parameter list
+    b32    hasret;
+} msfunc;
+
+static dmname msparams(dm *d)
+{
+    if (dmeat(d, DMS("X"))) {
+        return DMS("void");
+    }
+
+    dmname r = {0};
+    b32 first = 1;
+    while (!d->err && dmpeek(d, 0)!='@' && dmpeek(d, 0)!='Z') {
+        dmtype t = {0};
+        if (dmdigit(dmpeek(d, 0))) {
+            i32 i = dmnext(d) - '0';
+            if (i >= d->nparams) {
+                return dmfail(d);
+            }
+            t = d->params[i];
+        } else {
+            u8 *beg = d->in;
+            t = mstype(d, MS_DROP);
+            if (d->nparams<10 && d->in-beg>1) {
+                d->params[d->nparams++] = t;
+            }
+        }
+        r = dmcat(d, r, first ? (dmname){0} : mscomma(d));
+        r = dmcat3(d, r, t.left, t.right);
+        first = 0;
+    }
+
+    if (dmeat(d, DMS("Z"))) {
+        r = dmcat3(d, r, first ? (dmname){0} : mscomma(d), DMS("..."));
+    } else if (!dmeat(d, DMS("@"))) {
+        return dmfail(d);
+    }
+    return r;
+}
+
+static msfunc msfunction(dm *d, b32 thisquals)
+{
+    msfunc f = {0};
+    i32 q = 0;
+    dmname ref = {0};
+    if (thisquals) {
+        q = msextquals(d);
+        if (dmeat(d, DMS("G"))) {
+            ref = DMS(" &");
+        } else if (dmeat(d, DMS("H"))) {
+            ref = DMS(" &&");
+        }
+        q |= msqualifiers(d) & ~MQ_MEMBER;
+    }
+    f.conv = mscallconv(d);
+    if (!dmeat(d, DMS("@"))) {
+        f.ret = mstype(d, MS_RESULT);
+        f.hasret = 1;
+    }
+    f.params = msparams(d);
+
+    f.post = msquals(d, (dmname){0}, q, 1);
+    f.post = msptr64(d, f.post, q);
+    if (dmeat(d, DMS("_E"))) {
+        f.post = dmcat(d, f.post, DMS(" noexcept"));
+    } else if (!dmeat(d, DMS("Z"))) {
+        d->err = 1;
+    }
+    f.post = dmcat(d, f.post, ref);
+    return f;
+}
+
+// Function type as the pointee of a function pointer.
+static dmtype msfunctype(dm *d, b32 thisquals)
+{
+    msfunc f = msfunction(d, thisquals);
+    dmtype r = {0};
+    r.kind  = DM_FUNCTION;
+    r.left  = f.hasret ? f.ret.left : (dmname){0};
+    r.right = dmcat3(d, DMS("("), f.params, DMS(")"));
+    r.right = dmcat3(d, r.right, f.post, f.ret.right);
+    r.conv  = f.conv;
+    return r;
+}
+
+static dmtype mspointer(dm *d, dmname op, i32 q, dmtype pointee, dmname cls)
+{
+    dmtype r = {0};
+    r.kind = DM_POINTER;
+    if (pointee.kind == DM_FUNCTION) {
+        r.left = dmcat3(d, pointee.left, DMS(" ("), pointee.conv);
+        r.left = dmcat(d, r.left, DMS(" "));
+    } else {
+        r.left = msspace(d, pointee.left);
+        if (pointee.kind == DM_ARRAY) {
+            r.left = dmcat(d, r.left, DMS("("));
+        }
+    }
+    if (q & MQ_UNALIGN) {
+        r.left = dmcat(d, r.left, DMS("__unaligned "));
+    }
+    if (cls.len) {
+        r.left = dmcat(d, r.left, cls);
+        r.left = dmcat(d, r.left, DMS("::"));
+    }
+    r.left = dmcat(d, r.left, op);
+    b32 spaced = !!(d->flags & DEMANGLE_UNDNAME);
+    r.left = msquals(d, r.left, q & ~MQ_UNALIGN, spaced);
+    r.left = msptr64(d, r.left, q);
+    r.right = pointee.right;
+    if (pointee.kind==DM_FUNCTION || pointee.kind==DM_ARRAY) {
+        r.right = dmcat(d, DMS(")"), pointee.right);
+    }
+    return r;
+}
+
+static dmtype msprimitive(dm *d, i32 q)
+{
+    static const char basic[] =
+        "signed char\0char\0unsigned char\0short\0unsigned short\0int\0"
+        "unsigned int\0long\0unsigned long\0\0float\0double\0long double";
+    dmtype r = {0};
+    dmname name = {0};
+    u8 c = dmnext(d);
+    if (c>='C' && c<='O' && c!='L') {
+        const char *s = basic;
+        for (i32 i = 'C'; i < c; i++) {
+            s += dmlen(s) + 1;
+        }
+        name = (dmname){(u8 *)s, dmlen(s)};
+    } else if (c == 'X') {
+        name = DMS("void");
+    } else if (c == '_') {
+        switch (dmnext(d)) {
+        case 'D': name = DMS("__int8");             break;
+        case 'E': name = DMS("unsigned __int8");    break;
+        case 'F': name = DMS("__int16");            break;
+        case 'G': name = DMS("unsigned __int16");   break;
+        case 'H': name = DMS("__int32");            break;
+        case 'I': name = DMS("unsigned __int32");   break;
+        case 'J': name = DMS("__int64");            break;
+        case 'K': name = DMS("unsigned __int64");   break;
+        case 'L': name = DMS("__int128");           break;
+        case 'M': name = DMS("unsigned __int128");  break;
+        case 'N': name = DMS("bool");               break;
+        case 'Q': name = DMS("char8_t");            break;
+        case 'S': name = DMS("char16_t");           break;
+        case 'U': name = DMS("char32_t");           break;
+        case 'W': name = DMS("wchar_t");            break;
+        default:  d->err = 1;
+        }
+    } else {
+        d->err = 1;
+    }
+    r.left = msquals(d, dmcat(d, (dmname){0}, name), q, 1);
+    return r;
+}
+
+static dmtype mstype(dm *d, i32 mode)
+{
+    dmtype r = {0};
+    if (!dmenter(d)) {
+        return r;
+    }
+
+    i32 q = 0;
+    if (mode == MS_MANGLE) {
+        q = msqualifiers(d);
+    } else if (mode==MS_RESULT && dmeat(d, DMS("?"))) {
+        q = msqualifiers(d);
+    }
+    q &= ~MQ_MEMBER;
+
+    u8 c = dmpeek(d, 0);
+    if (c=='T' || c=='U' || c=='V' || (c=='W' && dmpeek(d, 1)=='4')) {
+        d->in += c=='W' ? 2 : 1;
+        dmname tag = c=='T' ? DMS("union ") :
+                     c=='U' ? DMS("struct ") :
+                     c=='V' ? DMS("class ") : DMS("enum ");
+        r.left = dmcat(d, tag, msfullname(d, 0));
+        r.left = msquals(d, r.left, q, 1);
+
+    } else if (dmeat(d, DMS("$$T"))) {
+        r.left = msquals(d, DMS("std::nullptr_t"), q, 1);
+
+    } else if (c=='P' || c=='Q' || c=='R' || c=='S' || c=='A' || c=='B' ||
+               (c=='$' && dmpeek(d, 1)=='$' &&
+                (dmpeek(d, 2)=='Q' || dmpeek(d, 2)=='R'))) {
+        dmname op = DMS("*");
+        i32 pq = 0;
+        switch (c) {
+        case 'A': op = DMS("&");                          break;
+        case 'B': op = DMS("&");  pq = MQ_VOLATILE;       break;
+        case 'Q': pq = MQ_CONST;                          break;
+        case 'R': pq = MQ_VOLATILE;                       break;
+        case 'S': pq = MQ_CONST | MQ_VOLATILE;            break;
+        case '$': op = DMS("&&"); pq = dmpeek(d, 2)=='R' ? MQ_VOLATILE : 0;
+                  d->in += 2;
+        }
+        d->in++;
+
+        if (dmeat(d, DMS("6"))) {
+            r = mspointer(d, op, pq|q, msfunctype(d, 0), (dmname){0});
+        } else if (dmeat(d, DMS("8"))) {
+            if (c=='A' || c=='B' || c=='$') {
+                d->err = 1;
+            }
+            dmname cls = msfullname(d, 0);
+            r = mspointer(d, op, pq|q, msfunctype(d, 1), cls);
+        } else {
+            pq |= msextquals(d);
+            i32 pointee = msqualifiers(d);
+            if (pointee & MQ_MEMBER) {
+                if (c=='A' || c=='B' || c=='$') {
+                    d->err = 1;
+                }
+                dmname cls = msfullname(d, 0);
+                dmtype t = mstype(d, MS_DROP);
+                t.left = msquals(d, t.left, pointee & ~MQ_MEMBER, 1);
+                r = mspointer(d, op, pq|q, t, cls);
+            } else {
+                d->in--;
+                r = mspointer(d, op, pq|q, mstype(d, MS_MANGLE), (dmname){0});
+            }
+        }
+
+    } else if (dmeat(d, DMS("Y"))) {
+        b32 negative;
+        u64 rank = msnumber(d, &negative);
+        if (negative || !rank || rank>16) {
+            d->err = 1;
+        }
+        dmname dims = {0};
+        for (u64 i = 0; !d->err && i < rank; i++) {
+            dims = dmcat3(d, dims, DMS("["), mssigned(d));
+            dims = dmcat(d, dims, DMS("]"));
+        }
+        i32 aq = 0;
+        if (dmeat(d, DMS("$$C"))) {
+            aq = msqualifiers(d);
+        }
+        dmtype elem = mstype(d, MS_DROP);
+        r.kind  = DM_ARRAY;
+        r.left  = msquals(d, elem.left, aq|q, 1);
+        r.right = dmcat(d, dims, elem.right);
+
+    } else if (dmeat(d, DMS("$$A6"))) {
+        r = msfunctype(d, 0);
+        r.left = dmcat3(d, r.left, DMS(" "), r.conv);
+        r.kind = DM_PLAIN;
+
+    } else {
+        r = msprimitive(d, q);
+    }
+
+    d->depth--;
+    return r;
+}
+
+// The remainder of a symbol after its qualified name.
+static dmname msencoded(dm *d, dmname scope, msleaf leaf, dmname last)
+{
+    b32 noaccess = d->flags & DEMANGLE_NOACCESS;
+    b32 nameonly = d->flags & DEMANGLE_NAMEONLY;
+    dmname name = {0};
+
+    u8 c = dmpeek(d, 0);
+    if (c>='0' && c<='4') {
+        d->in++;
+        if (leaf.kind != MS_NAME) {
+            return dmfail(d);
+        }
+        name = dmcat3(d, scope, leaf.name, leaf.targs);
+        dmtype t = mstype(d, MS_DROP);
+        if (t.kind == DM_POINTER) {
+            msextquals(d);
+            i32 q = msqualifiers(d);
+            if (q & MQ_MEMBER) {
+                msfullname(d, 0);
+            }
+        } else {
+            t.left = msquals(d, t.left, msqualifiers(d), 1);
+        }
+        if (nameonly) {
+            return name;
+        }
+        dmname r = {0};
+        switch (c) {
+        case '0': r = noaccess ? r : DMS("private: ");   break;
+        case '1': r = noaccess ? r : DMS("protected: "); break;
+        case '2': r = noaccess ? r : DMS("public: ");    break;
+        }
+        if (c <= '2') {
+            r = dmcat(d, r, DMS("static "));
+        }
+        r = dmcat(d, r, t.left);
+        r = msspace(d, r);
+        return dmcat3(d, r, name, t.right);
+    }
+
+    if (c=='6' || c=='7') {
+        d->in++;
+        i32 q = msqualifiers(d);
+        dmname target = {0};
+        while (!d->err && !dmeat(d, DMS("@"))) {
+            target = dmcat3(d, target, target.len ? DMS("'s `") : (dmname){0},
+                            msfullname(d, 0));
+        }
+        name = dmcat3(d, scope, leaf.name, leaf.targs);
+        if (nameonly) {
+            return name;
+        }
+        dmname r = msquals(d, (dmname){0}, q, 0);
+        r = dmcat(d, r, r.len ? DMS(" ") : (dmname){0});
+        r = dmcat(d, r, name);
+        if (target.len) {
+            r = dmcat3(d, r, DMS("{for `"), target);
+            r = dmcat(d, r, DMS("'}"));
+        }
+        return r;
+    }
+
+    if (c == '8') {
+        d->in++;
+        return dmcat3(d, scope, leaf.name, leaf.targs);
+    }
+
+    i32 fc = 0;
+    if (dmeat(d, DMS("$$J0"))) {
+        fc |= FC_EXTERNC;
+    }
+    c = dmnext(d);
+    static const i32 classes[] = {
+        FC_PRIVATE,
+        FC_PRIVATE|FC_STATIC,
+        FC_PRIVATE|FC_VIRTUAL,
+        FC_PRIVATE|FC_VIRTUAL|FC_THUNK,
+        FC_PROTECTED,
+        FC_PROTECTED|FC_STATIC,
+        FC_PROTECTED|FC_VIRTUAL,
+        FC_PROTECTED|FC_VIRTUAL|FC_THUNK,
+        FC_PUBLIC,
+        FC_PUBLIC|FC_STATIC,
+        FC_PUBLIC|FC_VIRTUAL,
+        FC_PUBLIC|FC_VIRTUAL|FC_THUNK,
+        FC_GLOBAL,
+    };
+    if (c>='A' && c<='Z') {
+        fc |= classes[(c-'A')/2];
+    } else if (c == '9') {
+        fc |= FC_EXTERNC | FC_NOPARAMS;
+    } else if (c == '$') {
+        fc |= FC_VTORDISP;
+        if (dmeat(d, DMS("R"))) {
+            fc |= FC_VTORDISPX;
+        }
+        static const i32 access[] = {FC_PRIVATE, FC_PROTECTED, FC_PUBLIC};
+        c = dmnext(d);
+        if (c<'0' || c>'5') {
+            return dmfail(d);
+        }
+        fc |= access[(c-'0')/2] | FC_VIRTUAL;
+    } else {
+        return dmfail(d);
+    }
+
+    dmname adjust = {0};
+    if (fc & FC_THUNK) {
+        adjust = dmcat3(d, DMS("`adjustor{"), msoffset(d), DMS("}'"));
+    } else if (fc & FC_VTORDISPX) {
+        adjust = DMS("`vtordispex{");
+        adjust = dmcat3(d, adjust, msoffset(d), DMS(", "));
+        adjust = dmcat3(d, adjust, msoffset(d), DMS(", "));
+        adjust = dmcat3(d, adjust, msoffset(d), DMS(", "));
+        adjust = dmcat3(d, adjust, msoffset(d), DMS("}'"));
+    } else if (fc & FC_VTORDISP) {
+        adjust = DMS("`vtordisp{");
+        adjust = dmcat3(d, adjust, msoffset(d), DMS(", "));
+        adjust = dmcat3(d, adjust, msoffset(d), DMS("}'"));
+    }
+
+    msfunc f = {0};
+    if (!(fc & FC_NOPARAMS)) {
+        f = msfunction(d, !(fc & (FC_GLOBAL|FC_STATIC)));
+    }
+
+    switch (leaf.kind) {
+    case MS_CTOR:
+        name = dmcat(d, last, leaf.targs);
+        break;
+    case MS_DTOR:
+        name = dmcat3(d, DMS("~"), last, leaf.targs);
+        break;
+    case MS_CONVERSION:
+        if (!f.hasret) {
+            return dmfail(d);
+        }
+        name = dmcat3(d, DMS("operator "), f.ret.left, f.ret.right);
+        name = dmcat(d, name, leaf.targs);
+        break;
+    case MS_NAME:
+        name = dmcat(d, leaf.name, leaf.targs);
+        break;
+    }
+    name = dmcat(d, scope, name);
+    if (nameonly) {
+        return name;
+    }
+
+    dmname r = {0};
+    if (fc & (FC_THUNK|FC_VTORDISP)) {
+        r = DMS("[thunk]: ");
+    }
+    if (!noaccess) {
+        if (fc & FC_PUBLIC)    r = dmcat(d, r, DMS("public: "));
+        if (fc & FC_PROTECTED) r = dmcat(d, r, DMS("protected: "));
+        if (fc & FC_PRIVATE)   r = dmcat(d, r, DMS("private: "));
+    }
+    if (!(fc & FC_GLOBAL) && (fc & FC_STATIC)) {
+        r = dmcat(d, r, DMS("static "));
+    }
+    if (fc & FC_VIRTUAL) {
+        r = dmcat(d, r, DMS("virtual "));
+    }
+    if (fc & FC_EXTERNC) {
+        r = dmcat(d, r, DMS("extern \"C\" "));
+    }
+    if (f.hasret) {
+        r = dmcat3(d, r, f.ret.left, DMS(" "));
+    }
+    r = dmcat(d, r, f.conv);
+    r = dmcat(d, msspace(d, r), name);
+    r = dmcat(d, r, adjust);
+    if (!(fc & FC_NOPARAMS)) {
+        r = dmcat3(d, r, DMS("("), f.params);
+        r = dmcat3(d, r, DMS(")"), f.post);
+    }
+    return dmcat(d, r, f.ret.right);
+}
+
+static u8 msstrchar(dm *d)
+{
+    u8 c = dmnext(d);
+    if (c != '?') {
+        return c;
+    }
+    c = dmnext(d);
+    if (c == '$') {
+        u8 hi = dmnext(d) - 'A';
+        u8 lo = dmnext(d) - 'A';
+        d->err |= hi>15 || lo>15;
+        return (u8)(hi<<4 | lo);
+    } else if (dmdigit(c)) {
+        return (u8)",/\\:. \n\t'-"[c-'0'];
+    } else if (c>='a' && c<='z') {
+        return c - 'a' + 0xe1;
+    } else if (c>='A' && c<='Z') {
+        return c - 'A' + 0xc1;
+    }
+    d->err = 1;
+    return 0;
+}
+
+// ??_C@_<width><length><crc>@<chars>@
+static dmname msstring(dm *d)
+{
+    u8 w = dmnext(d);
+    if (w!='0' && w!='1') {
+        return dmfail(d);
+    }
+    b32 wide = w == '1';
+    b32 negative;
+    u64 len = msnumber(d, &negative);
+    mssimple(d, 0);  // CRC
+
+    dmname r = wide ? DMS("L\"") : DMS("\"");
+    u64 count = 0;
+    while (!d->err && !dmeat(d, DMS("@"))) {
+        u32 c = msstrchar(d);
+        if (wide) {
+            c = c<<8 | msstrchar(d);
+        }
+        count += wide ? 2 : 1;
+        if (!c && count==len && dmpeek(d, 0)=='@') {
+            continue;  // terminator, unless truncated
+        }
+        u8 buf[8];
+        dmname s = {buf, 0};
+        if (c=='"' || c=='\\' || c=='\'') {
+            buf[s.len++] = '\\';
+            buf[s.len++] = (u8)c;
+        } else if (c>=0x20 && c<0x7f) {
+            buf[s.len++] = (u8)c;
+        } else if (c==0 || (c>=7 && c<=13)) {
+            buf[s.len++] = '\\';
+            buf[s.len++] = c ? "abtnvfr"[c-7] : '0';
+        } else {
+            buf[s.len++] = '\\';
+            buf[s.len++] = 'x';
+            for (i32 shift = c>0xff ? 12 : 4; shift >= 0; shift -= 4) {
+                buf[s.len++] = "0123456789ABCDEF"[c>>shift & 15];
+            }
+        }
+        r = dmcat(d, r, s);
+    }
+    r = dmcat(d, r, DMS("\""));
+    if (count < len) {
+        r = dmcat(d, r, DMS("..."));
+    }
+    return r;
+}
+
+static dmname mssymbol(dm *d)
+{
+    dmname r = {0};
+    if (!dmenter(d) || !dmeat(d, DMS("?"))) {
+        return dmfail(d);
+    }
+
+    if (dmeat(d, DMS("?_C@_"))) {
+        r = msstring(d);
+
+    } else if (dmeat(d, DMS("?_R0"))) {
+        dmtype t = mstype(d, MS_RESULT);
+        if (!dmeat(d, DMS("@8"))) {
+            return dmfail(d);
+        }
+        r = dmcat3(d, t.left, t.right, DMS(" `RTTI Type Descriptor'"));
+
+    } else if (dmeat(d, DMS("?_R1"))) {
+        dmname name = DMS("`RTTI Base Class Descriptor at (");
+        name = dmcat3(d, name, msoffset(d), DMS(", "));
+        name = dmcat3(d, name, msoffset(d), DMS(", "));
+        name = dmcat3(d, name, msoffset(d), DMS(", "));
+        name = dmcat3(d, name, msoffset(d), DMS(")'"));
+        r = msscopes(d, name, 0);
+        if (!dmeat(d, DMS("8"))) {
+            return dmfail(d);
+        }
+
+    } else if (dmeat(d, DMS("?_R2")) || dmeat(d, DMS("?_R3"))) {
+        dmname name = d->in[-1]=='2' ? DMS("`RTTI Base Class Array'")
+                                     : DMS("`RTTI Class Hierarchy Descriptor'");
+        r = msscopes(d, name, 0);
+        if (!dmeat(d, DMS("8"))) {
+            return dmfail(d);
+        }
+
+    } else {
+        msleaf leaf = {0};
+        if (dmeat(d, DMS("?_R4"))) {
+            leaf.name = DMS("`RTTI Complete Object Locator'");
+        } else {
+            leaf = msunqualified(d);
+        }
+        dmname last = {0};
+        dmname scope = msscopes(d, (dmname){0}, &last);
+        d->leaf = leaf.name;
+        r = msencoded(d, scope, leaf, last);
+    }
+
+    d->depth--;
+    return r;
+}
+
+
+// Itanium
+
+static dmtype ittype(dm *d);
+static dmname itencoding(dm *d, b32 top);
+static dmname itname(dm *d, b32 *template, i32 *cdkind);
+
+enum { IT_NAME, IT_CTOR, IT_DTOR, IT_CONVERSION };
+
+static dmtype itplain(dmname s)
+{
+    dmtype r = {0};
+    r.left = s;
+    return r;
+}
+
+static dmname itjoin(dm *d, dmtype t)
+{
+    return dmcat(d, t.left, t.right);
+}
+
+static void itsub(dm *d, dmtype t)
+{
+    if (d->nsubs == DM_MAXSUBS) {
+        d->err = 1;
+        return;
+    }
+    d->subparam[d->nsubs] = 0;
+    d->subin[d->nsubs] = 0;
+    d->subs[d->nsubs++] = t;
+}
+
+static i64 itnumber(dm *d)
+{
+    b32 negative = dmeat(d, DMS("n"));
+    if (!dmdigit(dmpeek(d, 0))) {
+        d->err = 1;
+        return 0;
+    }
+    i64 n = 0;
+    while (dmdigit(dmpeek(d, 0))) {
+        n = n*10 + dmnext(d) - '0';
+        if (n > 1<<30) {
+            d->err = 1;
+            return 0;
+        }
+    }
+    return negative ? -n : n;
+}
+
+// <seq-id> _ as used by substitutions and template parameters: _ is 0,
+// otherwise base 36 plus one.
+static i32 itseqid(dm *d)
+{
+    if (dmeat(d, DMS("_"))) {
+        return 0;
+    }
+    i64 n = 0;
+    for (u8 c = dmnext(d); c != '_'; c = dmnext(d)) {
+        if (dmdigit(c)) {
+            n = n*36 + c - '0';
+        } else if (c>='A' && c<='Z') {
+            n = n*36 + c - 'A' + 10;
+        } else {
+            d->err = 1;
+            return 0;
+        }
+        if (n > 1<<20) {
+            d->err = 1;
+            return 0;
+        }
+    }
+    return (i32)n + 1;
+}
+
+static dmname itsource(dm *d)
+{
+    i64 len = itnumber(d);
+    if (len<=0 || len>d->inend-d->in) {
+        return dmfail(d);
+    }
+    dmname r = {d->in, len};
+    d->in += len;
+    dmname anon = DMS("_GLOBAL__N");
+    if (r.len>anon.len && dmequals((dmname){r.data, anon.len}, anon)) {
+        u8 c = r.data[anon.len];
+        if (c=='.' || c=='_' || c=='$') {
+            return DMS("(anonymous namespace)");
+        }
+    }
+    return r;
+}
+
+static dmname itabitags(dm *d, dmname name)
+{
+    while (!d->err && dmeat(d, DMS("B"))) {
+        name = dmcat3(d, name, DMS("[abi:"), itsource(d));
+        name = dmcat(d, name, DMS("]"));
+    }
+    return name;
+}
+
+// Append a template argument list, spacing nested closing brackets.
+static dmname itclose(dm *d, dmname s)
+{
+    return dmcat(d, s, dmlast(s)=='>' ? DMS(" >") : DMS(">"));
+}
+
+static dmname itliteral(dm *d);
+
+static dmname ittargs(dm *d, b32 record);
+
+// <simple-id> in an unresolved name: source name and template arguments
+static dmname itsimpleid(dm *d)
+{
+    dmname r = itsource(d);
+    if (dmpeek(d, 0) == 'I') {
+        r = dmcat(d, r, ittargs(d, 0));
+    }
+    return r;
+}
+
+// Only the simplest expressions: template parameters, literals, and
+// scoped names like std::is_signed<T>::value.
+static dmname itexpr(dm *d)
+{
+    if (dmpeek(d, 0) == 'T') {
+        return itjoin(d, ittype(d));
+    } else if (dmpeek(d, 0) == 'L') {
+        return itliteral(d);
+    } else if (!dmeat(d, DMS("sr"))) {
+        return dmfail(d);
+    }
+
+    dmname r = {0};
+    if (dmeat(d, DMS("N"))) {
+        r = itjoin(d, ittype(d));
+        while (!d->err && !dmeat(d, DMS("E"))) {
+            r = dmcat3(d, r, DMS("::"), itsimpleid(d));
+        }
+    } else if (dmdigit(dmpeek(d, 0))) {
+        r = itsimpleid(d);
+        while (!d->err && !dmeat(d, DMS("E"))) {
+            r = dmcat3(d, r, DMS("::"), itsimpleid(d));
+        }
+    } else {
+        r = itjoin(d, ittype(d));
+    }
+    if (!dmdigit(dmpeek(d, 0))) {
+        return dmfail(d);  // operator and destructor names unsupported
+    }
+    return dmcat3(d, r, DMS("::"), itsimpleid(d));
+}
+
+static dmname itliteral(dm *d)
+{
+    if (!dmeat(d, DMS("L"))) {
+        return dmfail(d);
+    }
+    dmname r = {0};
+    if (dmeat(d, DMS("_Z"))) {
+        r = itencoding(d, 0);
+    } else {
+        u8 *save = d->in;
+        dmtype t = ittype(d);
+        u8 c = *save;
+        b32 negative = dmeat(d, DMS("n"));
+        dmname digits = {d->in, 0};
+        while (dmpeek(d, digits.len) && dmpeek(d, digits.len)!='E') {
+            digits.len++;
+        }
+        d->in += digits.len;
+        dmname value = dmcat(d, negative ? DMS("-") : (dmname){0}, digits);
+        switch (c) {
+        case 'b':
+            if (dmequals(digits, DMS("0"))) {
+                r = DMS("false");
+            } else if (dmequals(digits, DMS("1"))) {
+                r = DMS("true");
+            } else {
+                r = dmcat3(d, DMS("(bool)"), value, (dmname){0});
+            }
+            break;
+        case 'i': r = value;                             break;
+        case 'j': r = dmcat(d, value, DMS("u"));         break;
+        case 'l': r = dmcat(d, value, DMS("l"));         break;
+        case 'm': r = dmcat(d, value, DMS("ul"));        break;
+        case 'x': r = dmcat(d, value, DMS("ll"));        break;
+        case 'y': r = dmcat(d, value, DMS("ull"));       break;
+        default:
+            r = dmcat3(d, DMS("("), itjoin(d, t), DMS(")"));
+            r = dmcat(d, r, value);
+        }
+    }
+    if (!dmeat(d, DMS("E"))) {
+        return dmfail(d);
+    }
+    return r;
+}
+
+static dmtype ittarg(dm *d)
+{
+    if (dmpeek(d, 0) == 'L') {
+        return itplain(itliteral(d));
+    } else if (dmeat(d, DMS("X"))) {
+        dmtype r = itplain(itexpr(d));
+        if (!dmeat(d, DMS("E"))) {
+            d->err = 1;
+        }
+        return r;
+    }
+    return ittype(d);
+}
+
+// Template arguments, including the brackets. Arguments of the
+// encoding's own name become the referents of template parameters.
+static dmname ittargs(dm *d, b32 record)
+{
+    dmtype *elems  = dmalloc(d, DM_MAXARGS*sizeof(*elems));
+    dmarg  *args   = dmalloc(d, DM_MAXARGS*sizeof(*args));
+    i32     nelems = 0;
+    i32     nargs  = 0;
+    dmname  last   = d->lastname;
+    b32     empty  = 0;
+    if (!dmeat(d, DMS("I"))) {
+        return dmfail(d);
+    }
+
+    dmname r = DMS("<");
+    while (!d->err && !dmeat(d, DMS("E"))) {
+        if (nargs == DM_MAXARGS) {
+            return dmfail(d);
+        }
+        iz len = r.len;
+        dmarg *a = args + nargs++;
+        a->first = nelems;
+        a->pack  = dmeat(d, DMS("J"));
+        do {
+            if (a->pack && dmeat(d, DMS("E"))) {
+                break;
+            } else if (nelems == DM_MAXARGS) {
+                return dmfail(d);
+            }
+            dmtype t = elems[nelems++] = ittarg(d);
+            if (t.kind != DM_EMPTY) {
+                r = dmcat3(d, r, r.len>1 ? DMS(", ") : (dmname){0}, itjoin(d, t));
+            }
+        } while (!d->err && a->pack);
+        a->count = nelems - a->first;
+        empty = nargs>1 && r.len==len;
+    }
+    // Like c++filt, no space when a trailing empty pack follows a >
+    r = empty ? dmcat(d, r, DMS(">")) : itclose(d, r);
+    d->lastname = last;
+
+    if (record && !d->err) {
+        d->targs = elems;
+        d->args  = args;
+        d->nargs = nargs;
+    }
+    return r;
+}
+
+static dmname itoperator(dm *d, i32 *kind)
+{
+    static const char ops[] =
+        "nwnew\0nanew[]\0dldelete\0dadelete[]\0ps+\0ng-\0ad&\0de*\0co~\0pl+\0"
+        "mi-\0ml*\0dv/\0rm%\0an&\0or|\0eo^\0aS=\0pL+=\0mI-=\0mL*=\0dV/=\0rM%=\0"
+        "aN&=\0oR|=\0eO^=\0ls<<\0rs>>\0lS<<=\0rS>>=\0eq==\0ne!=\0lt<\0gt>\0"
+        "le<=\0ge>=\0ss<=>\0nt!\0aa&&\0oo||\0pp++\0mm--\0cm,\0pm->*\0pt->\0"
+        "cl()\0ix[]\0qu?\0awco_await\0";
+    u8 a = dmnext(d);
+    u8 b = dmnext(d);
+    if (a=='c' && b=='v') {
+        *kind = IT_CONVERSION;
+        b32 saved = d->intype;
+        d->intype = 1;
+        dmname r = dmcat(d, DMS("operator "), itjoin(d, ittype(d)));
+        d->intype = saved;
+        return r;
+    }
+    if (a=='l' && b=='i') {
+        return dmcat(d, DMS("operator\"\" "), itsource(d));
+    }
+    if (a=='v' && dmdigit(b)) {
+        return dmcat(d, DMS("operator "), itsource(d));
+    }
+    for (const char *p = ops; *p; p += dmlen(p) + 1) {
+        if (p[0]==a && p[1]==b) {
+            dmname op = {(u8 *)p+2, dmlen(p+2)};
+            u8 c = op.data[0];
+            b32 word = c>='a' && c<='z';
+            return dmcat3(d, DMS("operator"), word ? DMS(" ") : (dmname){0}, op);
+        }
+    }
+    return dmfail(d);
+}
+
+// Lambda and unnamed type names: {lambda(int)#1}, {unnamed type#1}
+static dmname itunnamed(dm *d)
+{
+    dmname r = {0};
+    if (dmeat(d, DMS("Ut"))) {
+        r = DMS("{unnamed type#");
+    } else if (dmeat(d, DMS("Ul"))) {
+        r = DMS("{lambda(");
+        b32 lambda = d->lambda;
+        d->lambda = 1;
+        if (dmeat(d, DMS("v"))) {
+            // no parameters
+        } else {
+            for (b32 first = 1; !d->err && dmpeek(d, 0)!='E'; first = 0) {
+                r = dmcat3(d, r, first ? (dmname){0} : DMS(", "), itjoin(d, ittype(d)));
+            }
+        }
+        d->lambda = lambda;
+        if (!dmeat(d, DMS("E"))) {
+            return dmfail(d);
+        }
+        r = dmcat(d, r, DMS(")#"));
+    } else {
+        return dmfail(d);
+    }
+    i64 n = dmdigit(dmpeek(d, 0)) ? itnumber(d) + 2 : 1;
+    if (!dmeat(d, DMS("_"))) {
+        return dmfail(d);
+    }
+    return dmcat3(d, r, dmint(d, n, 0), DMS("}"));
+}
+
+static dmname itunqualified(dm *d, i32 *kind)
+{
+    dmname r = {0};
+    u8 c = dmpeek(d, 0);
+    *kind = IT_NAME;
+    if (dmdigit(c)) {
+        r = itsource(d);
+        d->lastname = r;
+    } else if (c=='C' && dmpeek(d, 1)!='I') {
+        d->in++;
+        u8 k = dmnext(d);
+        if (k<'1' || k>'5') {
+            return dmfail(d);
+        }
+        *kind = IT_CTOR;
+        r = d->lastname;
+    } else if (c=='C') {
+        d->in += 2;  // inheriting constructor: CI1 <type>
+        if (dmnext(d)<'1' || dmnext(d)<'0') {
+            return dmfail(d);
+        }
+        ittype(d);
+        *kind = IT_CTOR;
+        r = d->lastname;
+    } else if (c=='D' && dmpeek(d, 1)>='0' && dmpeek(d, 1)<='5') {
+        d->in += 2;
+        *kind = IT_DTOR;
+        r = dmcat(d, DMS("~"), d->lastname);
+    } else if (c == 'U') {
+        r = itunnamed(d);
+    } else if (c=='L') {
+        d->in++;  // internal linkage
+        return itunqualified(d, kind);
+    } else if (c>='a' && c<='z') {
+        r = itoperator(d, kind);
+    } else {
+        return dmfail(d);
+    }
+    r = itabitags(d, r);
+    if (c=='L' || (c>='0' && c<='9')) {
+        // discriminators only follow local names
+    }
+    return r;
+}
+
+static dmname itsubstitution(dm *d, dmtype *type)
+{
+    // Expanded in full like c++filt (DMGL_VERBOSE)
+    static const struct {
+        char c;
+        const char *name;
+        const char *last;
+    } std[] = {
+        {'t', "std", 0},
+        {'a', "std::allocator", "allocator"},
+        {'b', "std::basic_string", "basic_string"},
+        {'s', "std::basic_string<char, std::char_traits<char>, "
+              "std::allocator<char> >", "basic_string"},
+        {'i', "std::basic_istream<char, std::char_traits<char> >",
+              "basic_istream"},
+        {'o', "std::basic_ostream<char, std::char_traits<char> >",
+              "basic_ostream"},
+        {'d', "std::basic_iostream<char, std::char_traits<char> >",
+              "basic_iostream"},
+    };
+
+    if (!dmeat(d, DMS("S"))) {
+        return dmfail(d);
+    }
+    u8 c = dmpeek(d, 0);
+    if (c>='a' && c<='z') {
+        d->in++;
+        for (i32 i = 0; i < (i32)(sizeof(std)/sizeof(*std)); i++) {
+            if (std[i].c == c) {
+                const char *s = std[i].name;
+                if (std[i].last) {
+                    d->lastname = (dmname){(u8 *)std[i].last, dmlen(std[i].last)};
+                }
+                dmname r = {(u8 *)s, dmlen(s)};
+                *type = itplain(r);
+                return r;
+            }
+        }
+        return dmfail(d);
+    }
+
+    i32 i = itseqid(d);
+    if (d->err || i>=d->nsubs) {
+        return dmfail(d);
+    }
+    *type = d->subs[i];
+    i32 p = d->subparam[i] - 1;
+    if (p>=0 && d->lambda) {
+        *type = itplain(dmcat(d, DMS("auto:"), dmint(d, p+1, 0)));
+    } else if (d->subin[i] && !d->lambda) {
+        // Lambda parameter types name auto:N, but outside the lambda
+        // signature they resolve against the operator's own arguments
+        u8 *in    = d->in;
+        i32 nsubs = d->nsubs;
+        d->in = d->subin[i];
+        *type = ittype(d);
+        d->in    = in;
+        d->nsubs = nsubs;
+    } else if (p>=0 && p<d->nargs && !d->args[p].pack) {
+        // Parameters resolve where referenced, not where substituted
+        *type = d->targs[d->args[p].first];
+    }
+    return itjoin(d, *type);
+}
+
+// Does a template argument list follow that completes the name?
+static b32 itnexttargs(dm *d)
+{
+    return dmpeek(d, 0) == 'I';
+}
+
+// <nested-name>, after the N: the qualified name, and cv-qualifiers of
+// a member function.
+static dmname itnested(dm *d, dmname *quals, b32 *template, i32 *kind)
+{
+    dmname cv = {0};
+    if (dmeat(d, DMS("r"))) cv = dmcat(d, cv, DMS(" restrict"));
+    if (dmeat(d, DMS("V"))) cv = dmcat(d, cv, DMS(" volatile"));
+    if (dmeat(d, DMS("K"))) cv = dmcat(d, cv, DMS(" const"));
+    if (dmeat(d, DMS("R"))) {
+        cv = dmcat(d, cv, DMS(" &"));
+    } else if (dmeat(d, DMS("O"))) {
+        cv = dmcat(d, cv, DMS(" &&"));
+    }
+    *quals = cv;
+
+    dmname r = {0};
+    b32 any = 0;
+    *template = 0;
+    while (!d->err) {
+        u8 c = dmpeek(d, 0);
+        b32 sub = 0;
+        if (c == 'E') {
+            d->in++;
+            break;
+        }
+
+        if (c == 'S') {
+            dmtype t;
+            dmname s = itsubstitution(d, &t);
+            r = any ? dmcat3(d, r, DMS("::"), s) : s;
+            sub = 1;
+            *kind = IT_NAME;
+            *template = 0;
+        } else if (c == 'I') {
+            if (!any) {
+                return dmfail(d);
+            }
+            r = dmcat(d, r, dmlast(r)=='<' ? DMS(" ") : (dmname){0});
+            r = dmcat(d, r, ittargs(d, !d->intype));
+            *template = 1;
+        } else if (c == 'T') {
+            dmtype t = ittype(d);  // adds its own substitution
+            r = any ? dmcat3(d, r, DMS("::"), itjoin(d, t)) : itjoin(d, t);
+            sub = 1;
+            *template = 0;
+        } else if (c == 'M') {
+            d->in++;  // lambda initializer scope
+            continue;
+        } else {
+            dmname u = itunqualified(d, kind);
+            r = any ? dmcat3(d, r, DMS("::"), u) : u;
+            *template = 0;
+        }
+        any = 1;
+
+        if (!sub && dmpeek(d, 0)!='E') {
+            itsub(d, itplain(r));
+        }
+    }
+    return r;
+}
+
+// <local-name>: Z <encoding> E <entity name> [<discriminator>]
+static dmname itlocal(dm *d, b32 *template, i32 *kind)
+{
+    // The scope has its own template arguments, which must not leak
+    dmtype *targs = d->targs;
+    dmarg  *args  = d->args;
+    i32     nargs = d->nargs;
+    b32     intype = d->intype;
+    dmname scope = itencoding(d, 2);
+    d->targs  = targs;
+    d->args   = args;
+    d->nargs  = nargs;
+    d->intype = intype;
+    if (!dmeat(d, DMS("E"))) {
+        return dmfail(d);
+    }
+    dmname r = {0};
+    if (dmeat(d, DMS("s"))) {
+        r = dmcat(d, scope, DMS("::string literal"));
+        *template = 0;
+    } else {
+        if (dmeat(d, DMS("d"))) {
+            // default argument scope: d [<number>] _
+            if (dmdigit(dmpeek(d, 0))) itnumber(d);
+            if (!dmeat(d, DMS("_"))) return dmfail(d);
+        }
+        r = dmcat3(d, scope, DMS("::"), itname(d, template, kind));
+    }
+    if (dmeat(d, DMS("_"))) {
+        if (dmeat(d, DMS("_"))) {
+            itnumber(d);
+            if (!dmeat(d, DMS("_"))) return dmfail(d);
+        } else {
+            itnumber(d);
+        }
+    }
+    return r;
+}
+
+static dmname itname(dm *d, b32 *template, i32 *kind)
+{
+    dmname r = {0};
+    *template = 0;
+    *kind = IT_NAME;
+    if (!dmenter(d)) {
+        return r;
+    }
+
+    u8 c = dmpeek(d, 0);
+    if (c == 'N') {
+        d->in++;
+        dmname quals;
+        r = itnested(d, &quals, template, kind);
+        d->cvquals = quals;
+    } else if (c == 'Z') {
+        d->in++;
+        r = itlocal(d, template, kind);
+    } else if (c=='S' && dmpeek(d, 1)=='t') {
+        d->in += 2;
+        r = dmcat(d, DMS("std::"), itunqualified(d, kind));
+        if (itnexttargs(d)) {
+            itsub(d, itplain(r));
+            r = dmcat(d, r, dmlast(r)=='<' ? DMS(" ") : (dmname){0});
+            r = dmcat(d, r, ittargs(d, !d->intype));
+            *template = 1;
+        }
+    } else if (c == 'S') {
+        dmtype t;
+        r = itsubstitution(d, &t);
+        if (!itnexttargs(d)) {
+            return dmfail(d);  // only an unscoped template may be substituted
+        }
+        r = dmcat(d, r, ittargs(d, !d->intype));
+        *template = 1;
+    } else {
+        r = itunqualified(d, kind);
+        if (itnexttargs(d)) {
+            itsub(d, itplain(r));
+            r = dmcat(d, r, dmlast(r)=='<' ? DMS(" ") : (dmname){0});
+            r = dmcat(d, r, ittargs(d, !d->intype));
+            *template = 1;
+        }
+    }
+
+    d->depth--;
+    return r;
+}
+
+static dmtype itpointer(dm *d, dmtype t, dmname op)
+{
+    i32 kind = DM_POINTER;
+    if (op.data[0] == '&') {
+        // Reference collapsing: & & is &, && & is &, && && is &&
+        kind = op.len==1 ? DM_LREF : DM_RREF;
+        if (t.kind == DM_LREF) {
+            return t;
+        } else if (t.kind == DM_RREF) {
+            if (kind == DM_LREF) {
+                t.left.len--;  // "&&" becomes "&"
+                t.left = dmcat(d, t.left, (dmname){0});
+                t.kind = DM_LREF;
+            }
+            return t;
+        }
+    }
+
+    dmtype r = t;
+    if (t.kind == DM_FUNCTION) {
+        r.left  = dmcat3(d, t.left, DMS("("), op);
+        r.right = dmcat(d, DMS(")"), t.right);
+    } else if (t.kind == DM_ARRAY) {
+        r.left  = dmcat3(d, t.left, DMS(" ("), op);
+        r.right = dmcat(d, DMS(")"), t.right);
+    } else {
+        r.left = dmcat(d, t.left, op);
+    }
+    r.kind = kind;
+    return r;
+}
+
+// Does the parameter list end here? An encoding's list ends with the
+// input, a clone suffix, or the E closing a local name.
+static b32 itparamsend(dm *d, iz i, u8 end)
+{
+    u8 c = dmpeek(d, i);
+    return end ? c==end : !c || c=='.' || c=='E';
+}
+
+// Parameter list of a function type, through the end of the list.
+static dmname itparams(dm *d, u8 end)
+{
+    dmname r = DMS("(");
+    if (dmpeek(d, 0)=='v' && itparamsend(d, 1, end)) {
+        d->in++;
+        return dmcat(d, r, DMS(")"));
+    }
+    while (!d->err && !itparamsend(d, 0, end)) {
+        dmtype t = dmeat(d, DMS("z")) ? itplain(DMS("...")) : ittype(d);
+        if (t.kind != DM_EMPTY) {
+            r = dmcat3(d, r, r.len>1 ? DMS(", ") : (dmname){0}, itjoin(d, t));
+        }
+    }
+    return dmcat(d, r, DMS(")"));
+}
+
+static dmtype itfunction(dm *d, dmname spec)
+{
+    dmtype r = {0};
+    dmeat(d, DMS("Y"));  // extern "C"
+    dmtype ret = ittype(d);
+    dmname params = itparams(d, 'E');
+    dmname ref = {0};
+    if (dmeat(d, DMS("R"))) {
+        ref = DMS(" &");
+    } else if (dmeat(d, DMS("O"))) {
+        ref = DMS(" &&");
+    }
+    if (!dmeat(d, DMS("E"))) {
+        d->err = 1;
+    }
+    // A return type with a right side already opened a declarator
+    r.kind  = DM_FUNCTION;
+    r.left  = ret.right.len ? ret.left : dmcat(d, ret.left, DMS(" "));
+    r.right = dmcat3(d, params, ref, spec);
+    r.right = dmcat(d, r.right, ret.right);
+    return r;
+}
+
+static dmtype ittype(dm *d)
+{
+    static const char builtins[] =
+        "vvoid\0wwchar_t\0bbool\0cchar\0asigned char\0hunsigned char\0"
+        "sshort\0tunsigned short\0iint\0junsigned int\0llong\0munsigned long\0"
+        "xlong long\0yunsigned long long\0n__int128\0ounsigned __int128\0"
+        "ffloat\0ddouble\0elong double\0g__float128\0z...\0";
+    static const char dbuiltins[] =
+        "ddecimal64\0edecimal128\0fdecimal32\0hhalf\0ichar32_t\0schar16_t\0"
+        "uchar8_t\0aauto\0cdecltype(auto)\0ndecltype(nullptr)\0";
+
+    dmtype r = {0};
+    if (!dmenter(d)) {
+        return r;
+    }
+    b32 saved = d->intype;
+    d->intype = 1;
+
+    u8 *start = d->in;
+    u8 c = dmpeek(d, 0);
+    b32 sub = 1;
+    i32 param = 0;
+    for (const char *p = builtins; *p; p += dmlen(p) + 1) {
+        if (*p == c) {
+            d->in++;
+            r.left = (dmname){(u8 *)p+1, dmlen(p+1)};
+            sub = 0;
+            goto done;
+        }
+    }
+
+    switch (c) {
+    case 'D':
+        if (dmpeek(d, 1) == 'p') {
+            // Pack expansion: re-parse the pattern once per element
+            d->in += 2;
+            u8 *beg = d->in;
+            i32 nsubs = d->nsubs;
+            i32 index = d->packindex;
+            i32 size  = d->packsize;
+            d->packindex = 0;
+            d->packsize  = -1;
+            r = ittype(d);
+            i32 n = d->packsize;
+            if (!n) {
+                r = (dmtype){0};
+                r.kind = DM_EMPTY;
+            } else if (n > 1) {
+                dmname list = itjoin(d, r);
+                for (i32 i = 1; !d->err && i < n; i++) {
+                    d->in = beg;
+                    d->nsubs = nsubs;
+                    d->packindex = i;
+                    list = dmcat3(d, list, DMS(", "), itjoin(d, ittype(d)));
+                }
+                r = itplain(list);
+            }
+            d->packindex = index;
+            d->packsize  = size;
+            break;
+        }
+        for (const char *p = dbuiltins; *p; p += dmlen(p) + 1) {
+            if (*p == dmpeek(d, 1)) {
+                d->in += 2;
+                r.left = (dmname){(u8 *)p+1, dmlen(p+1)};
+                sub = 0;
+                goto done;
+            }
+        }
+        if (dmpeek(d, 1)=='o' && dmpeek(d, 2)=='F') {
+            d->in += 3;
+            r = itfunction(d, DMS(" noexcept"));
+            break;
+        }
+        if (dmpeek(d, 1)=='F') {
+            d->in += 2;
+            dmname n = dmint(d, itnumber(d), 0);
+            if (!dmeat(d, DMS("_"))) {
+                d->err = 1;
+            }
+            r.left = dmcat(d, DMS("_Float"), n);
+            sub = 0;
+            break;
+        }
+        d->err = 1;
+        break;
+
+    case 'r': case 'V': case 'K': {
+        b32 isr = dmeat(d, DMS("r"));
+        b32 isv = dmeat(d, DMS("V"));
+        b32 isk = dmeat(d, DMS("K"));
+        b32 isf = dmpeek(d, 0)=='F' ||
+                  (dmpeek(d, 0)=='D' && dmpeek(d, 1)=='o' && dmpeek(d, 2)=='F');
+        dmtype t = ittype(d);
+        if (isf && !d->err) {
+            d->nsubs--;  // only the qualified function type is a candidate
+        }
+        // Qualifiers already applied by a template argument are not repeated
+        dmname q = {0};
+        if (isk && !dmendswith(t.left, DMS(" const"))) {
+            q = dmcat(d, q, DMS(" const"));
+        }
+        if (isv && !dmendswith(t.left, DMS(" volatile"))) {
+            q = dmcat(d, q, DMS(" volatile"));
+        }
+        if (isr) q = dmcat(d, q, DMS(" restrict"));
+        r = t;
+        if (t.kind == DM_FUNCTION) {
+            r.right = dmcat(d, t.right, q);
+        } else {
+            r.left = dmcat(d, t.left, q);
+        }
+        break;
+    }
+
+    case 'P':
+        d->in++;
+        r = itpointer(d, ittype(d), DMS("*"));
+        break;
+    case 'R':
+        d->in++;
+        r = itpointer(d, ittype(d), DMS("&"));
+        break;
+    case 'O':
+        d->in++;
+        r = itpointer(d, ittype(d), DMS("&&"));
+        break;
+    case 'C':
+        d->in++;
+        r = ittype(d);
+        r.left = dmcat(d, r.left, DMS(" _Complex"));
+        break;
+    case 'G':
+        d->in++;
+        r = ittype(d);
+        r.left = dmcat(d, r.left, DMS(" _Imaginary"));
+        break;
+
+    case 'F':
+        d->in++;
+        r = itfunction(d, (dmname){0});
+        break;
+
+    case 'A': {
+        d->in++;
+        dmname dim = {0};
+        if (dmdigit(dmpeek(d, 0))) {
+            dim = dmint(d, itnumber(d), 0);
+        } else if (dmpeek(d, 0) != '_') {
+            d->err = 1;
+        }
+        if (!dmeat(d, DMS("_"))) {
+            d->err = 1;
+        }
+        dmtype t = ittype(d);
+        r.kind  = DM_ARRAY;
+        r.left  = t.left;
+        r.right = dmcat3(d, DMS(" ["), dim, DMS("]"));
+        r.right = dmcat(d, r.right, t.right);
+        if (t.kind == DM_ARRAY) {
+            // Nested arrays print dimensions adjacent: int [2][3]
+            r.right = dmcat3(d, DMS(" ["), dim, DMS("]"));
+            r.right = dmcat(d, r.right, (dmname){t.right.data+1, t.right.len-1});
+        }
+        break;
+    }
+
+    case 'M': {
+        d->in++;
+        dmname cls = itjoin(d, ittype(d));
+        dmtype t = ittype(d);
+        dmname op = dmcat(d, cls, DMS("::*"));
+        if (t.kind == DM_FUNCTION) {
+            r = itpointer(d, t, op);
+        } else {
+            r.left = dmcat3(d, t.left, DMS(" "), op);
+            r.right = t.right;
+            r.kind = DM_POINTER;
+        }
+        break;
+    }
+
+    case 'T': {
+        d->in++;
+        i32 i = itseqid(d);
+        if (!d->err && d->lambda) {
+            // Generic lambda parameter, like c++filt: auto:1, auto:2, ...
+            param = i + 1;
+            r.left = dmcat(d, DMS("auto:"), dmint(d, param, 0));
+            break;
+        } else if (d->err || i>=d->nargs) {
+            d->err = 1;
+            break;
+        }
+        dmarg a = d->args[i];
+        if (!a.pack) {
+            param = i + 1;
+            r = d->targs[a.first];
+        } else if (d->packindex >= 0) {
+            d->packsize = a.count;
+            if (d->packindex < a.count) {
+                r = d->targs[a.first+d->packindex];
+            }
+        } else {
+            for (i32 e = 0; e < a.count; e++) {
+                dmname t = itjoin(d, d->targs[a.first+e]);
+                r.left = dmcat3(d, r.left, e ? DMS(", ") : (dmname){0}, t);
+            }
+        }
+        if (itnexttargs(d)) {
+            r = itplain(itjoin(d, r));
+            // template template parameter
+            param = 0;
+            itsub(d, r);
+            r.left = dmcat(d, r.left, ittargs(d, 0));
+        }
+        break;
+    }
+
+    case 'S':
+        if (dmpeek(d, 1) == 't') {
+            b32 template; i32 kind;
+            r.left = itname(d, &template, &kind);
+            break;
+        } else {
+            dmtype t;
+            itsubstitution(d, &t);
+            r = t;
+            if (!itnexttargs(d)) {
+                sub = 0;
+                break;
+            }
+            r.left = dmcat(d, itjoin(d, r), ittargs(d, 0));
+            r.right = (dmname){0};
+            r.kind = DM_PLAIN;
+        }
+        break;
+
+    case 'u':
+        d->in++;
+        r.left = itsource(d);
+        break;
+
+    case 'N': case 'Z':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9': {
+        b32 template; i32 kind;
+        r.left = itname(d, &template, &kind);
+        break;
+    }
+
+    default:
+        d->err = 1;
+    }
+
+    if (sub && !d->err) {
+        itsub(d, r);
+        d->subparam[d->nsubs-1] = param;
+        d->subin[d->nsubs-1] = d->lambda ? start : 0;
+    }
+
+done:
+    d->intype = saved;
+    d->depth--;
+    return r;
+}
+
+static dmname itcalloffset(dm *d)
+{
+    if (dmeat(d, DMS("h"))) {
+        itnumber(d);
+    } else if (dmeat(d, DMS("v"))) {
+        itnumber(d);
+        if (!dmeat(d, DMS("_"))) return dmfail(d);
+        itnumber(d);
+    } else {
+        return dmfail(d);
+    }
+    if (!dmeat(d, DMS("_"))) {
+        return dmfail(d);
+    }
+    return (dmname){0};
+}
+
+static dmname itspecial(dm *d)
+{
+    static const struct { const char *code, *text; i32 what; } t[] = {
+        {"TV", "vtable for ", 0},
+        {"TT", "VTT for ", 0},
+        {"TI", "typeinfo for ", 0},
+        {"TS", "typeinfo name for ", 0},
+        {"TH", "TLS init function for ", 1},
+        {"TW", "TLS wrapper function for ", 1},
+        {"GV", "guard variable for ", 1},
+        {"Th", "non-virtual thunk to ", 2},
+        {"Tv", "virtual thunk to ", 2},
+        {"Tc", "covariant return thunk to ", 3},
+        {"GTt", "transaction clone for ", 4},
+    };
+    for (i32 i = 0; i < (i32)(sizeof(t)/sizeof(*t)); i++) {
+        dmname code = {(u8 *)t[i].code, dmlen(t[i].code)};
+        if (!dmeat(d, code)) {
+            continue;
+        }
+        dmname text = {(u8 *)t[i].text, dmlen(t[i].text)};
+        dmname r = {0};
+        b32 template; i32 kind;
+        switch (t[i].what) {
+        case 0: r = itjoin(d, ittype(d));        break;
+        case 1: r = itname(d, &template, &kind); break;
+        case 2: d->in--;          // h or v begins the offset
+                itcalloffset(d);
+                r = itencoding(d, 0);
+                break;
+        case 3: itcalloffset(d);
+                itcalloffset(d);  // fallthrough
+        case 4: r = itencoding(d, 0);
+        }
+        return dmcat(d, text, r);
+    }
+
+    if (dmeat(d, DMS("TC"))) {
+        dmname a = itjoin(d, ittype(d));
+        itnumber(d);
+        if (!dmeat(d, DMS("_"))) return dmfail(d);
+        dmname b = itjoin(d, ittype(d));
+        dmname r = dmcat3(d, DMS("construction vtable for "), b, DMS("-in-"));
+        return dmcat(d, r, a);
+    }
+
+    if (dmeat(d, DMS("GR"))) {
+        b32 template; i32 kind;
+        dmname name = itname(d, &template, &kind);
+        i32 n = dmpeek(d, 0)=='_' ? (d->in++, 0) : itseqid(d);
+        dmname r = dmcat3(d, DMS("reference temporary #"), dmint(d, n, 0), DMS(" for "));
+        return dmcat(d, r, name);
+    }
+    return dmfail(d);
+}
+
+static dmname itencoding(dm *d, b32 top)
+{
+    dmname r = {0};
+    if (!dmenter(d)) {
+        return r;
+    }
+
+    u8 c = dmpeek(d, 0);
+    if ((c=='T' && dmpeek(d, 1)!='_') || (c=='G' && dmpeek(d, 1)!='_')) {
+        r = itspecial(d);
+        d->depth--;
+        return r;
+    }
+
+    b32 template; i32 kind;
+    d->intype = 0;
+    d->cvquals = (dmname){0};
+    dmname name  = itname(d, &template, &kind);
+    dmname quals = d->cvquals;
+    u8 next = dmpeek(d, 0);
+    if (!next || next=='E' || (top && next=='.')) {
+        d->depth--;
+        return name;  // data
+    }
+
+    dmtype ret = {0};
+    b32 hasret = template && kind!=IT_CTOR && kind!=IT_DTOR && kind!=IT_CONVERSION;
+    if (hasret) {
+        ret = ittype(d);
+        if (top == 2) {
+            hasret = 0;  // local scopes omit the return type
+            ret = (dmtype){0};
+        }
+    }
+    dmname params = itparams(d, 0);
+
+    if (d->flags & DEMANGLE_NAMEONLY) {
+        r = name;
+    } else {
+        if (hasret) {
+            r = dmcat(d, ret.left, ret.right.len ? (dmname){0} : DMS(" "));
+        }
+        r = dmcat3(d, r, name, params);
+        r = dmcat3(d, r, quals, ret.right);
+    }
+    d->depth--;
+    return r;
+}
+
+
+// Entry point
+
+static dmname demangle(u8 *name, iz len, i32 flags, u8 *mem, iz cap)
+{
+    dmname null = {0};
+    if (cap < (iz)sizeof(dm) + 64) {
+        return null;
+    }
+
+    dm *d = (dm *)(mem + (-(__UINTPTR_TYPE__)mem & (_Alignof(dm) - 1)));
+    if ((u8 *)(d+1) > mem+cap) {
+        return null;
+    }
+    __builtin_memset(d, 0, __builtin_offsetof(dm, subs));
+    d->in    = name;
+    d->inend = name + len;
+    d->beg   = (u8 *)(d + 1);
+    d->end   = mem + cap;
+    d->flags = flags;
+    d->packindex = -1;
+
+    dmname r = {0};
+    if (len>1 && name[0]=='?') {
+        r = mssymbol(d);
+        if (d->in != d->inend) {
+            return null;
+        }
+
+    } else if (len>2 && name[0]=='_' && name[1]=='Z') {
+        d->in += 2;
+        r = itencoding(d, 1);
+        // Clone suffixes: .cold, .isra.0, .constprop.1, ...
+        while (!d->err && dmpeek(d, 0)=='.') {
+            dmname s = {d->in, 1};
+            u8 c = dmpeek(d, 1);
+            if ((c>='a' && c<='z') || c=='_') {
+                while ((c = dmpeek(d, s.len))==('_') || (c>='a' && c<='z')) {
+                    s.len++;
+                }
+            }
+            while (dmpeek(d, s.len)=='.' && dmdigit(dmpeek(d, s.len+1))) {
+                s.len++;
+                while (dmdigit(dmpeek(d, s.len))) {
+                    s.len++;
+                }
+            }
+            if (s.len == 1) {
+                return null;
+            }
+            d->in += s.len;
+            r = dmcat3(d, r, DMS(" [clone "), s);
+            r = dmcat(d, r, DMS("]"));
+        }
+        if (d->in != d->inend) {
+            return null;
+        }
+    }
+    return d->err ? null : r;
+}
+
+#endif
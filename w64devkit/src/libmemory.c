@@ -1,11 +1,15 @@
 #if 0
-# memset, memcpy, memmove, and memcmp via x86 string instructions
+# memset, memcpy, memmove, memcmp, strlen, memchr, memrchr, strchr, strcmp,
+# strnlen, and bcmp via x86 string instructions and SIMD, chosen on first
+# call from CPUID.
 # Execute this source with a shell to build libmemory.a.
 # This is free and unencumbered software released into the public domain.
 set -e
-CFLAGS="-Os -fno-builtin -fno-asynchronous-unwind-tables -fno-ident"
+CFLAGS="-Os -fno-builtin -fno-tree-loop-distribute-patterns"
+CFLAGS="$CFLAGS -fno-asynchronous-unwind-tables -fno-ident"
 objects=""
-for func in memset memcpy memmove memcmp strlen; do
+for func in memset memcpy memmove memcmp strlen \
+            memchr memrchr strchr strcmp strnlen bcmp; do
     FUNC="$(echo $func | tr '[:lower:]' '[:upper:]')"
     objects="$objects $func.o"
     (set -x; ${CC:-cc} -c -D$FUNC -Wa,--no-pad-sections $CFLAGS -o $func.o $0)
@@ -19,8 +23,104 @@ exit 0
 typedef __SIZE_TYPE__    size_t;
 typedef __UINTPTR_TYPE__ uintptr_t;
 
+#ifdef TEST
+// Build everything into the test so that it can reach each variant
+#  define MEMSET
+#  define MEMCPY
+#  define MEMMOVE
+#  define MEMCMP
+#  define STRLEN
+#  define MEMCHR
+#  define MEMRCHR
+#  define STRCHR
+#  define STRCMP
+#  define STRNLEN
+#  define BCMP
+#endif
+
+// Each function is its own object with its own copy of this section. A
+// function pointer starts at an "init" variant which detects the CPU,
+// picks the best variant, and replaces itself.
+
+typedef unsigned short     u16u __attribute((aligned(1), may_alias));
+typedef unsigned           u32u __attribute((aligned(1), may_alias));
+typedef unsigned long long u64u __attribute((aligned(1), may_alias));
+typedef char v16  __attribute((vector_size(16), aligned(1), may_alias));
+typedef char v16a __attribute((vector_size(16), may_alias));
+typedef char v32  __attribute((vector_size(32), aligned(1), may_alias));
+typedef char v32a __attribute((vector_size(32), may_alias));
+
+enum {
+    CPU_SSE2 = 1<<0,
+    CPU_AVX2 = 1<<1,
+    CPU_ERMS = 1<<2,  // fast "rep movsb" and "rep stosb"
+};
+
+// Beyond this size, fast string instructions beat vector loops.
+enum { REP_MIN = 1<<11 };
+
+// Beyond the non-temporal threshold, copies and fills bypass the cache
+// with streaming stores rather than evict the whole working set. It is
+// half the largest cache, which a larger copy would mostly evict anyway,
+// or this default if CPUID reports no cache.
+enum { NT_DEFAULT = 1<<22, PREFETCH_AHEAD = 512 };
+
+static int    cpu;         // CPU_*, stored before publishing a variant
+#if defined(MEMSET) || defined(MEMCPY) || defined(MEMMOVE)
+static size_t ntmin = -1;  // smallest non-temporal size
+#endif
+
+static int cpuinit(void)
+{
+    int max, eax, ebx, ecx, edx, r = 0;
+    asm ("cpuid" : "=a"(max), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0));
+    asm ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    r |= edx & 1<<26 ? CPU_SSE2 : 0;
+    int osxsave = ecx & 1<<27;
+    if (max >= 7) {
+        asm ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                     : "a"(7), "c"(0));
+        r |= ebx & 1<<9 ? CPU_ERMS : 0;
+        if (osxsave && ebx&1<<5) {
+            // AVX2 also requires that the OS saves YMM registers
+            int lo, hi;
+            asm ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+            r |= (lo&6)==6 ? CPU_AVX2 : 0;
+        }
+    }
+
+    #if defined(MEMSET) || defined(MEMCPY) || defined(MEMMOVE)
+    // Intel describes each cache level in leaf 4, while AMD reports its
+    // last level cache in 512 KiB units in leaf 0x80000006.
+    size_t cache = 0;
+    for (int i = 0; max>=4 && i<8; i++) {
+        asm ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                     : "a"(4), "c"(i));
+        if (!(eax & 31)) {
+            break;
+        }
+        size_t size = (size_t)((unsigned)ebx>>22 & 1023) + 1;  // ways
+        size *= ((unsigned)ebx>>12 & 1023) + 1;                // partitions
+        size *= ((unsigned)ebx & 4095) + 1;                    // line size
+        size *= (size_t)(unsigned)ecx + 1;                     // sets
+        cache = size>cache ? size : cache;
+    }
+    asm ("cpuid" : "=a"(max), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                 : "a"(0x80000000));
+    if (!cache && (unsigned)max>=0x80000006) {
+        asm ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+                     : "a"(0x80000006));
+        cache = (size_t)((unsigned)edx >> 18) << 19;
+    }
+    __atomic_store_n(&ntmin, cache ? cache/2 : NT_DEFAULT, __ATOMIC_RELAXED);
+    #endif
+
+    __atomic_store_n(&cpu, r, __ATOMIC_RELAXED);
+    return r;
+}
+
 #ifdef MEMSET
-void *memset(void *dst, int c, size_t len)
+static void *memset_rep(void *dst, int c, size_t len)
 {
     void *r = dst;
     asm volatile (
@@ -31,10 +131,114 @@ void *memset(void *dst, int c, size_t len)
     );
     return r;
 }
+
+// Set up to 16 bytes with two overlapping stores.
+__attribute((always_inline))
+static inline void memset_small(char *d, int c, size_t len)
+{
+    unsigned long long v = 0x0101010101010101 * (unsigned char)c;
+    if (len >= 8) {
+        *(u64u *)d = v;
+        *(u64u *)(d + len - 8) = v;
+    } else if (len >= 4) {
+        *(u32u *)d = v;
+        *(u32u *)(d + len - 4) = v;
+    } else if (len >= 2) {
+        *(u16u *)d = v;
+        *(u16u *)(d + len - 2) = v;
+    } else if (len) {
+        *d = v;
+    }
+}
+
+__attribute((target("sse2")))
+static void *memset_sse2(void *dst, int c, size_t len)
+{
+    char *d = dst;
+    v16 v = (v16){0} + (char)c;
+    if (len <= 16) {
+        memset_small(d, c, len);
+    } else if (len <= 32) {
+        *(v16 *)d = *(v16 *)(d + len - 16) = v;
+    } else if (len <= 64) {
+        *(v16 *)(d +  0) = *(v16 *)(d + len - 16) = v;
+        *(v16 *)(d + 16) = *(v16 *)(d + len - 32) = v;
+    } else if (len >= ntmin) {
+        typedef long long v2di __attribute((vector_size(16)));
+        *(v16 *)d = *(v16 *)(d + len - 16) = v;
+        for (size_t i = 16 - ((uintptr_t)d&15); i < len-16; i += 16) {
+            __builtin_ia32_movntdq((v2di *)(d + i), (v2di)v);
+        }
+        __builtin_ia32_sfence();
+    } else if (len>=REP_MIN && cpu&CPU_ERMS) {
+        memset_rep(d, c, len);
+    } else {
+        // Aligned stores between unaligned head and tail stores
+        *(v16 *)d = *(v16 *)(d + len - 16) = v;
+        for (size_t i = 16 - ((uintptr_t)d&15); i < len-16; i += 16) {
+            *(v16a *)(d + i) = v;
+        }
+    }
+    return dst;
+}
+
+__attribute((target("avx2")))
+static void *memset_avx2(void *dst, int c, size_t len)
+{
+    char *d = dst;
+    v32 v = (v32){0} + (char)c;
+    if (len <= 16) {
+        memset_small(d, c, len);
+    } else if (len <= 32) {
+        v16 h = (v16){0} + (char)c;
+        *(v16 *)d = *(v16 *)(d + len - 16) = h;
+    } else if (len <= 64) {
+        *(v32 *)d = *(v32 *)(d + len - 32) = v;
+    } else if (len <= 128) {
+        *(v32 *)(d +  0) = *(v32 *)(d + len - 32) = v;
+        *(v32 *)(d + 32) = *(v32 *)(d + len - 64) = v;
+    } else if (len >= ntmin) {
+        typedef long long v4di __attribute((vector_size(32)));
+        *(v32 *)d = *(v32 *)(d + len - 32) = v;
+        for (size_t i = 32 - ((uintptr_t)d&31); i < len-32; i += 32) {
+            __builtin_ia32_movntdq256((v4di *)(d + i), (v4di)v);
+        }
+        __builtin_ia32_sfence();
+    } else if (len>=REP_MIN && cpu&CPU_ERMS) {
+        memset_rep(d, c, len);
+    } else {
+        *(v32 *)d = *(v32 *)(d + len - 32) = v;
+        for (size_t i = 32 - ((uintptr_t)d&31); i < len-32; i += 32) {
+            *(v32a *)(d + i) = v;
+        }
+    }
+    return dst;
+}
+
+static void *memset_init(void *, int, size_t);
+static void *(*memset_impl)(void *, int, size_t) = memset_init;
+
+static void *memset_init(void *dst, int c, size_t len)
+{
+    int features = cpuinit();
+    void *(*f)(void *, int, size_t) = memset_rep;
+    f = features&CPU_SSE2 ? memset_sse2 : f;
+    f = features&CPU_AVX2 ? memset_avx2 : f;
+    __atomic_store_n(&memset_impl, f, __ATOMIC_RELEASE);
+    return f(dst, c, len);
+}
+
+void *memset(void *dst, int c, size_t len)
+{
+    return __atomic_load_n(&memset_impl, __ATOMIC_ACQUIRE)(dst, c, len);
+}
 #endif
 
-#ifdef MEMCPY
-void *memcpy(void *restrict dst, void *restrict src, size_t len)
+#if defined(MEMCPY) || defined(MEMMOVE)
+// Every load precedes any store that might overlap it, so these variants
+// also serve memmove when dst is below src.
+
+static void *memcpy_rep(void *dst, void *src, size_t len)
 {
     void *r = dst;
     asm volatile (
@@ -45,10 +249,156 @@ void *memcpy(void *restrict dst, void *restrict src, size_t len)
     );
     return r;
 }
+
+// Copy up to 16 bytes with two overlapping moves, loading before storing.
+__attribute((always_inline))
+static inline void memcpy_small(char *d, char *s, size_t len)
+{
+    if (len >= 8) {
+        unsigned long long a = *(u64u *)s, b = *(u64u *)(s + len - 8);
+        *(u64u *)d = a;
+        *(u64u *)(d + len - 8) = b;
+    } else if (len >= 4) {
+        unsigned a = *(u32u *)s, b = *(u32u *)(s + len - 4);
+        *(u32u *)d = a;
+        *(u32u *)(d + len - 4) = b;
+    } else if (len >= 2) {
+        unsigned short a = *(u16u *)s, b = *(u16u *)(s + len - 2);
+        *(u16u *)d = a;
+        *(u16u *)(d + len - 2) = b;
+    } else if (len) {
+        *d = *s;
+    }
+}
+
+__attribute((target("sse2")))
+static void *memcpy_sse2(void *dst, void *src, size_t len)
+{
+    char *d = dst, *s = src;
+    if (len <= 16) {
+        memcpy_small(d, s, len);
+    } else if (len <= 32) {
+        v16 a = *(v16 *)s, b = *(v16 *)(s + len - 16);
+        *(v16 *)d = a;
+        *(v16 *)(d + len - 16) = b;
+    } else if (len <= 64) {
+        v16 a = *(v16 *)(s +  0), b = *(v16 *)(s + len - 16);
+        v16 c = *(v16 *)(s + 16), e = *(v16 *)(s + len - 32);
+        *(v16 *)(d +  0) = a;
+        *(v16 *)(d + len - 16) = b;
+        *(v16 *)(d + 16) = c;
+        *(v16 *)(d + len - 32) = e;
+    } else if (len >= ntmin) {
+        // Streaming stores, prefetching the source around the cache
+        typedef long long v2di __attribute((vector_size(16)));
+        v16 head = *(v16 *)s, tail = *(v16 *)(s + len - 16);
+        size_t i = 16 - ((uintptr_t)d&15);
+        for (; i+64 <= len-16; i += 64) {
+            __builtin_prefetch(s + i + PREFETCH_AHEAD, 0, 0);
+            v2di a = (v2di)*(v16 *)(s + i +  0);
+            v2di b = (v2di)*(v16 *)(s + i + 16);
+            v2di c = (v2di)*(v16 *)(s + i + 32);
+            v2di e = (v2di)*(v16 *)(s + i + 48);
+            __builtin_ia32_movntdq((v2di *)(d + i +  0), a);
+            __builtin_ia32_movntdq((v2di *)(d + i + 16), b);
+            __builtin_ia32_movntdq((v2di *)(d + i + 32), c);
+            __builtin_ia32_movntdq((v2di *)(d + i + 48), e);
+        }
+        for (; i < len-16; i += 16) {
+            __builtin_ia32_movntdq((v2di *)(d + i), (v2di)*(v16 *)(s + i));
+        }
+        __builtin_ia32_sfence();
+        *(v16 *)d = head;
+        *(v16 *)(d + len - 16) = tail;
+    } else if (len>=REP_MIN && cpu&CPU_ERMS) {
+        memcpy_rep(d, s, len);
+    } else {
+        // Aligned stores between unaligned head and tail moves
+        v16 head = *(v16 *)s, tail = *(v16 *)(s + len - 16);
+        for (size_t i = 16 - ((uintptr_t)d&15); i < len-16; i += 16) {
+            *(v16a *)(d + i) = *(v16 *)(s + i);
+        }
+        *(v16 *)d = head;
+        *(v16 *)(d + len - 16) = tail;
+    }
+    return dst;
+}
+
+__attribute((target("avx2")))
+static void *memcpy_avx2(void *dst, void *src, size_t len)
+{
+    char *d = dst, *s = src;
+    if (len <= 16) {
+        memcpy_small(d, s, len);
+    } else if (len <= 32) {
+        v16 a = *(v16 *)s, b = *(v16 *)(s + len - 16);
+        *(v16 *)d = a;
+        *(v16 *)(d + len - 16) = b;
+    } else if (len <= 64) {
+        v32 a = *(v32 *)s, b = *(v32 *)(s + len - 32);
+        *(v32 *)d = a;
+        *(v32 *)(d + len - 32) = b;
+    } else if (len <= 128) {
+        v32 a = *(v32 *)(s +  0), b = *(v32 *)(s + len - 32);
+        v32 c = *(v32 *)(s + 32), e = *(v32 *)(s + len - 64);
+        *(v32 *)(d +  0) = a;
+        *(v32 *)(d + len - 32) = b;
+        *(v32 *)(d + 32) = c;
+        *(v32 *)(d + len - 64) = e;
+    } else if (len >= ntmin) {
+        typedef long long v4di __attribute((vector_size(32)));
+        v32 head = *(v32 *)s, tail = *(v32 *)(s + len - 32);
+        size_t i = 32 - ((uintptr_t)d&31);
+        for (; i+64 <= len-32; i += 64) {
+            __builtin_prefetch(s + i + PREFETCH_AHEAD, 0, 0);
+            v4di a = (v4di)*(v32 *)(s + i +  0);
+            v4di b = (v4di)*(v32 *)(s + i + 32);
+            __builtin_ia32_movntdq256((v4di *)(d + i +  0), a);
+            __builtin_ia32_movntdq256((v4di *)(d + i + 32), b);
+        }
+        for (; i < len-32; i += 32) {
+            __builtin_ia32_movntdq256((v4di *)(d + i), (v4di)*(v32 *)(s + i));
+        }
+        __builtin_ia32_sfence();
+        *(v32 *)d = head;
+        *(v32 *)(d + len - 32) = tail;
+    } else if (len>=REP_MIN && cpu&CPU_ERMS) {
+        memcpy_rep(d, s, len);
+    } else {
+        v32 head = *(v32 *)s, tail = *(v32 *)(s + len - 32);
+        for (size_t i = 32 - ((uintptr_t)d&31); i < len-32; i += 32) {
+            *(v32a *)(d + i) = *(v32 *)(s + i);
+        }
+        *(v32 *)d = head;
+        *(v32 *)(d + len - 32) = tail;
+    }
+    return dst;
+}
+
+#endif
+
+#ifdef MEMCPY
+static void *memcpy_init(void *, void *, size_t);
+static void *(*memcpy_impl)(void *, void *, size_t) = memcpy_init;
+
+static void *memcpy_init(void *dst, void *src, size_t len)
+{
+    int features = cpuinit();
+    void *(*f)(void *, void *, size_t) = memcpy_rep;
+    f = features&CPU_SSE2 ? memcpy_sse2 : f;
+    f = features&CPU_AVX2 ? memcpy_avx2 : f;
+    __atomic_store_n(&memcpy_impl, f, __ATOMIC_RELEASE);
+    return f(dst, src, len);
+}
+
+void *memcpy(void *restrict dst, void *restrict src, size_t len)
+{
+    return __atomic_load_n(&memcpy_impl, __ATOMIC_ACQUIRE)(dst, src, len);
+}
 #endif
 
 #ifdef MEMMOVE
-void *memmove(void *dst, void *src, size_t len)
+static void *memmove_rep(void *dst, void *src, size_t len)
 {
     // Use uintptr_t to bypass pointer semantics:
     // (1) comparing unrelated pointers
@@ -56,7 +406,9 @@ void *memmove(void *dst, void *src, size_t len)
     // (3) pointer overflow ("one-before-the-beginning" in reversed copy)
     uintptr_t d = (uintptr_t)dst;
     uintptr_t s = (uintptr_t)src;
-    if (d > s) {
+    if (d-s < len) {
+        // Only copy backwards when dst overlaps the end of src, as fast
+        // string microcode only runs forwards
         d += len - 1;
         s += len - 1;
         asm ("std");
@@ -69,10 +421,66 @@ void *memmove(void *dst, void *src, size_t len)
     );
     return dst;
 }
+
+// Backwards copies mirror the memcpy loop, walking aligned stores down
+// from the end between unaligned head and tail moves. Up to the loop
+// sizes, memcpy already loads everything before storing.
+
+__attribute((target("sse2")))
+static void *memmove_sse2(void *dst, void *src, size_t len)
+{
+    char *d = dst, *s = src;
+    if (len<=64 || (uintptr_t)d-(uintptr_t)s>=len) {
+        return memcpy_sse2(dst, src, len);
+    }
+    v16 head = *(v16 *)s, tail = *(v16 *)(s + len - 16);
+    for (size_t i = len - ((uintptr_t)(d + len)&15); i > 16;) {
+        i -= 16;
+        *(v16a *)(d + i) = *(v16 *)(s + i);
+    }
+    *(v16 *)d = head;
+    *(v16 *)(d + len - 16) = tail;
+    return dst;
+}
+
+__attribute((target("avx2")))
+static void *memmove_avx2(void *dst, void *src, size_t len)
+{
+    char *d = dst, *s = src;
+    if (len<=128 || (uintptr_t)d-(uintptr_t)s>=len) {
+        return memcpy_avx2(dst, src, len);
+    }
+    v32 head = *(v32 *)s, tail = *(v32 *)(s + len - 32);
+    for (size_t i = len - ((uintptr_t)(d + len)&31); i > 32;) {
+        i -= 32;
+        *(v32a *)(d + i) = *(v32 *)(s + i);
+    }
+    *(v32 *)d = head;
+    *(v32 *)(d + len - 32) = tail;
+    return dst;
+}
+
+static void *memmove_init(void *, void *, size_t);
+static void *(*memmove_impl)(void *, void *, size_t) = memmove_init;
+
+static void *memmove_init(void *dst, void *src, size_t len)
+{
+    int features = cpuinit();
+    void *(*f)(void *, void *, size_t) = memmove_rep;
+    f = features&CPU_SSE2 ? memmove_sse2 : f;
+    f = features&CPU_AVX2 ? memmove_avx2 : f;
+    __atomic_store_n(&memmove_impl, f, __ATOMIC_RELEASE);
+    return f(dst, src, len);
+}
+
+void *memmove(void *dst, void *src, size_t len)
+{
+    return __atomic_load_n(&memmove_impl, __ATOMIC_ACQUIRE)(dst, src, len);
+}
 #endif
 
 #ifdef MEMCMP
-int memcmp(void *s1, void *s2, size_t len)
+static int memcmp_rep(void *s1, void *s2, size_t len)
 {
     // CCa "after"  == CF=0 && ZF=0
     // CCb "before" == CF=1
@@ -86,10 +494,130 @@ int memcmp(void *s1, void *s2, size_t len)
     );
     return b - a;
 }
+
+// Compare up to 16 bytes, as big endian integers so that the first
+// difference decides, with overlapping loads like memcpy_small.
+__attribute((always_inline))
+static inline int memcmp_small(unsigned char *a, unsigned char *b, size_t len)
+{
+    if (len >= 8) {
+        unsigned long long x = __builtin_bswap64(*(u64u *)a);
+        unsigned long long y = __builtin_bswap64(*(u64u *)b);
+        if (x == y) {
+            x = __builtin_bswap64(*(u64u *)(a + len - 8));
+            y = __builtin_bswap64(*(u64u *)(b + len - 8));
+        }
+        return (x > y) - (x < y);
+    } else if (len >= 4) {
+        unsigned x = __builtin_bswap32(*(u32u *)a);
+        unsigned y = __builtin_bswap32(*(u32u *)b);
+        if (x == y) {
+            x = __builtin_bswap32(*(u32u *)(a + len - 4));
+            y = __builtin_bswap32(*(u32u *)(b + len - 4));
+        }
+        return (x > y) - (x < y);
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (a[i] != b[i]) {
+            return (a[i] > b[i]) - (a[i] < b[i]);
+        }
+    }
+    return 0;
+}
+
+// Order by the first differing byte flagged in an equality mask.
+__attribute((always_inline))
+static inline int memcmp_diff(unsigned char *a, unsigned char *b, unsigned ne)
+{
+    int i = __builtin_ctz(ne);
+    return (a[i] > b[i]) - (a[i] < b[i]);
+}
+
+__attribute((target("sse2")))
+static int memcmp_sse2(void *s1, void *s2, size_t len)
+{
+    unsigned char *a = s1, *b = s2;
+    if (len < 16) {
+        return memcmp_small(a, b, len);
+    }
+    size_t i = 0;
+    for (; len-i >= 16; i += 16) {
+        v16 x = *(v16 *)(a + i), y = *(v16 *)(b + i);
+        unsigned ne = __builtin_ia32_pmovmskb128((v16)(x == y)) ^ 0xffff;
+        if (ne) {
+            return memcmp_diff(a+i, b+i, ne);
+        }
+    }
+    if (i < len) {
+        // Overlapping tail, where the bytes before i are already equal
+        i = len - 16;
+        v16 x = *(v16 *)(a + i), y = *(v16 *)(b + i);
+        unsigned ne = __builtin_ia32_pmovmskb128((v16)(x == y)) ^ 0xffff;
+        if (ne) {
+            return memcmp_diff(a+i, b+i, ne);
+        }
+    }
+    return 0;
+}
+
+__attribute((target("avx2")))
+static int memcmp_avx2(void *s1, void *s2, size_t len)
+{
+    unsigned char *a = s1, *b = s2;
+    if (len < 16) {
+        return memcmp_small(a, b, len);
+    } else if (len <= 32) {
+        v16 x = *(v16 *)a, y = *(v16 *)b;
+        unsigned ne = __builtin_ia32_pmovmskb128((v16)(x == y)) ^ 0xffff;
+        if (ne) {
+            return memcmp_diff(a, b, ne);
+        }
+        size_t i = len - 16;
+        x = *(v16 *)(a + i);
+        y = *(v16 *)(b + i);
+        ne = __builtin_ia32_pmovmskb128((v16)(x == y)) ^ 0xffff;
+        return ne ? memcmp_diff(a+i, b+i, ne) : 0;
+    }
+    size_t i = 0;
+    for (; len-i >= 32; i += 32) {
+        v32 x = *(v32 *)(a + i), y = *(v32 *)(b + i);
+        unsigned ne = ~__builtin_ia32_pmovmskb256((v32)(x == y));
+        if (ne) {
+            return memcmp_diff(a+i, b+i, ne);
+        }
+    }
+    if (i < len) {
+        i = len - 32;
+        v32 x = *(v32 *)(a + i), y = *(v32 *)(b + i);
+        unsigned ne = ~__builtin_ia32_pmovmskb256((v32)(x == y));
+        if (ne) {
+            return memcmp_diff(a+i, b+i, ne);
+        }
+    }
+    return 0;
+}
+
+static int memcmp_init(void *, void *, size_t);
+static int (*memcmp_impl)(void *, void *, size_t) = memcmp_init;
+
+static int memcmp_init(void *s1, void *s2, size_t len)
+{
+    int features = cpuinit();
+    int (*f)(void *, void *, size_t) = memcmp_rep;
+    f = features&CPU_SSE2 ? memcmp_sse2 : f;
+    f = features&CPU_AVX2 ? memcmp_avx2 : f;
+    __atomic_store_n(&memcmp_impl, f, __ATOMIC_RELEASE);
+    return f(s1, s2, len);
+}
+
+int memcmp(void *s1, void *s2, size_t len)
+{
+    return __atomic_load_n(&memcmp_impl, __ATOMIC_ACQUIRE)(s1, s2, len);
+}
 #endif
 
 #ifdef STRLEN
-size_t strlen(char *s)
+static size_t strlen_rep(char *s)
 {
     size_t n = -1;
     asm volatile (
@@ -100,19 +628,525 @@ size_t strlen(char *s)
     );
     return -n - 2;
 }
+
+// The vector variants only read aligned blocks, which never straddle a
+// page boundary, so they cannot fault past the terminator. The bytes in
+// the first block before the string are masked off.
+
+__attribute((target("sse2")))
+static size_t strlen_sse2(char *s)
+{
+    uintptr_t off = (uintptr_t)s & 15;
+    v16a *p = (v16a *)((uintptr_t)s - off);
+    unsigned mask = __builtin_ia32_pmovmskb128((v16)(*p == 0)) >> off;
+    while (!mask) {
+        mask = __builtin_ia32_pmovmskb128((v16)(*++p == 0));
+        off = 0;
+    }
+    return (char *)p + off - s + __builtin_ctz(mask);
+}
+
+__attribute((target("avx2")))
+static size_t strlen_avx2(char *s)
+{
+    uintptr_t off = (uintptr_t)s & 31;
+    v32a *p = (v32a *)((uintptr_t)s - off);
+    unsigned mask = __builtin_ia32_pmovmskb256((v32)(*p == 0));
+    mask >>= off;
+    while (!mask) {
+        mask = __builtin_ia32_pmovmskb256((v32)(*++p == 0));
+        off = 0;
+    }
+    return (char *)p + off - s + __builtin_ctz(mask);
+}
+
+static size_t strlen_init(char *);
+static size_t (*strlen_impl)(char *) = strlen_init;
+
+static size_t strlen_init(char *s)
+{
+    int features = cpuinit();
+    size_t (*f)(char *) = strlen_rep;
+    f = features&CPU_SSE2 ? strlen_sse2 : f;
+    f = features&CPU_AVX2 ? strlen_avx2 : f;
+    __atomic_store_n(&strlen_impl, f, __ATOMIC_RELEASE);
+    return f(s);
+}
+
+size_t strlen(char *s)
+{
+    return __atomic_load_n(&strlen_impl, __ATOMIC_ACQUIRE)(s);
+}
+#endif
+
+#if defined(MEMCHR) || defined(STRNLEN)
+// Like strlen, the vector variants read whole aligned blocks, and only
+// those holding at least one byte of the buffer.
+
+static void *memchr_rep(void *s, int c, size_t len)
+{
+    if (!len) {
+        return 0;
+    }
+    char *p = s;
+    int found;
+    asm volatile (
+        "repne scasb"
+        : "+D"(p), "+c"(len), "=@ccz"(found)
+        : "a"(c)
+        : "memory"
+    );
+    return found ? p-1 : 0;
+}
+
+__attribute((target("sse2")))
+static void *memchr_sse2(void *s, int c, size_t len)
+{
+    if (!len) {
+        return 0;
+    }
+    uintptr_t off = (uintptr_t)s & 15;
+    v16a *p = (v16a *)((uintptr_t)s - off);
+    v16 pattern = (v16){0} + (char)c;
+    unsigned mask = __builtin_ia32_pmovmskb128((v16)(*p == pattern)) >> off;
+    size_t i = 0;         // offset of the block's first unmasked byte
+    size_t n = 16 - off;  // offset past the block
+    while (!mask) {
+        if (n >= len) {
+            return 0;
+        }
+        mask = __builtin_ia32_pmovmskb128((v16)(*++p == pattern));
+        i = n;
+        n += 16;
+    }
+    i += __builtin_ctz(mask);
+    return i<len ? (char *)s+i : 0;
+}
+
+__attribute((target("avx2")))
+static void *memchr_avx2(void *s, int c, size_t len)
+{
+    if (!len) {
+        return 0;
+    }
+    uintptr_t off = (uintptr_t)s & 31;
+    v32a *p = (v32a *)((uintptr_t)s - off);
+    v32 pattern = (v32){0} + (char)c;
+    unsigned mask = __builtin_ia32_pmovmskb256((v32)(*p == pattern));
+    mask >>= off;
+    size_t i = 0;
+    size_t n = 32 - off;
+    while (!mask) {
+        if (n >= len) {
+            return 0;
+        }
+        mask = __builtin_ia32_pmovmskb256((v32)(*++p == pattern));
+        i = n;
+        n += 32;
+    }
+    i += __builtin_ctz(mask);
+    return i<len ? (char *)s+i : 0;
+}
+#endif
+
+#ifdef MEMCHR
+static void *memchr_init(void *, int, size_t);
+static void *(*memchr_impl)(void *, int, size_t) = memchr_init;
+
+static void *memchr_init(void *s, int c, size_t len)
+{
+    int features = cpuinit();
+    void *(*f)(void *, int, size_t) = memchr_rep;
+    f = features&CPU_SSE2 ? memchr_sse2 : f;
+    f = features&CPU_AVX2 ? memchr_avx2 : f;
+    __atomic_store_n(&memchr_impl, f, __ATOMIC_RELEASE);
+    return f(s, c, len);
+}
+
+void *memchr(void *s, int c, size_t len)
+{
+    return __atomic_load_n(&memchr_impl, __ATOMIC_ACQUIRE)(s, c, len);
+}
+#endif
+
+#ifdef MEMRCHR
+static void *memrchr_rep(void *s, int c, size_t len)
+{
+    if (!len) {
+        return 0;
+    }
+    uintptr_t p = (uintptr_t)s + len - 1;
+    int found;
+    asm volatile (
+        "std; repne scasb; cld"
+        : "+D"(p), "+c"(len), "=@ccz"(found)
+        : "a"(c)
+        : "memory"
+    );
+    return found ? (char *)p+1 : 0;
+}
+
+// Mirrors memchr, walking aligned blocks down from the last byte.
+
+__attribute((target("sse2")))
+static void *memrchr_sse2(void *s, int c, size_t len)
+{
+    if (!len) {
+        return 0;
+    }
+    uintptr_t last = (uintptr_t)s + len - 1;
+    v16a *p = (v16a *)(last & -16);
+    v16 pattern = (v16){0} + (char)c;
+    unsigned mask = __builtin_ia32_pmovmskb128((v16)(*p == pattern));
+    mask &= (2u << (last&15)) - 1;
+    while (!mask) {
+        if ((uintptr_t)p <= (uintptr_t)s) {
+            return 0;
+        }
+        mask = __builtin_ia32_pmovmskb128((v16)(*--p == pattern));
+    }
+    uintptr_t r = (uintptr_t)p + 31 - __builtin_clz(mask);
+    return r>=(uintptr_t)s ? (void *)r : 0;
+}
+
+__attribute((target("avx2")))
+static void *memrchr_avx2(void *s, int c, size_t len)
+{
+    if (!len) {
+        return 0;
+    }
+    uintptr_t last = (uintptr_t)s + len - 1;
+    v32a *p = (v32a *)(last & -32);
+    v32 pattern = (v32){0} + (char)c;
+    unsigned mask = __builtin_ia32_pmovmskb256((v32)(*p == pattern));
+    mask &= (2u << (last&31)) - 1;  // 2u<<31 wraps to all ones
+    while (!mask) {
+        if ((uintptr_t)p <= (uintptr_t)s) {
+            return 0;
+        }
+        mask = __builtin_ia32_pmovmskb256((v32)(*--p == pattern));
+    }
+    uintptr_t r = (uintptr_t)p + 31 - __builtin_clz(mask);
+    return r>=(uintptr_t)s ? (void *)r : 0;
+}
+
+static void *memrchr_init(void *, int, size_t);
+static void *(*memrchr_impl)(void *, int, size_t) = memrchr_init;
+
+static void *memrchr_init(void *s, int c, size_t len)
+{
+    int features = cpuinit();
+    void *(*f)(void *, int, size_t) = memrchr_rep;
+    f = features&CPU_SSE2 ? memrchr_sse2 : f;
+    f = features&CPU_AVX2 ? memrchr_avx2 : f;
+    __atomic_store_n(&memrchr_impl, f, __ATOMIC_RELEASE);
+    return f(s, c, len);
+}
+
+void *memrchr(void *s, int c, size_t len)
+{
+    return __atomic_load_n(&memrchr_impl, __ATOMIC_ACQUIRE)(s, c, len);
+}
+#endif
+
+#ifdef STRCHR
+// No string instruction stops on either of two bytes.
+static char *strchr_byte(char *s, int c)
+{
+    for (;; s++) {
+        if (*s == (char)c) {
+            return s;
+        } else if (!*s) {
+            return 0;
+        }
+    }
+}
+
+// Like strlen, scanning aligned blocks for either c or the terminator.
+
+__attribute((target("sse2")))
+static char *strchr_sse2(char *s, int c)
+{
+    uintptr_t off = (uintptr_t)s & 15;
+    v16a *p = (v16a *)((uintptr_t)s - off);
+    v16 pattern = (v16){0} + (char)c;
+    unsigned mask = __builtin_ia32_pmovmskb128((v16)((*p==pattern) | (*p==0)));
+    mask >>= off;
+    while (!mask) {
+        p++;
+        mask = __builtin_ia32_pmovmskb128((v16)((*p==pattern) | (*p==0)));
+        off = 0;
+    }
+    char *r = (char *)p + off + __builtin_ctz(mask);
+    return *r==(char)c ? r : 0;
+}
+
+__attribute((target("avx2")))
+static char *strchr_avx2(char *s, int c)
+{
+    uintptr_t off = (uintptr_t)s & 31;
+    v32a *p = (v32a *)((uintptr_t)s - off);
+    v32 pattern = (v32){0} + (char)c;
+    unsigned mask = __builtin_ia32_pmovmskb256((v32)((*p==pattern) | (*p==0)));
+    mask >>= off;
+    while (!mask) {
+        p++;
+        mask = __builtin_ia32_pmovmskb256((v32)((*p==pattern) | (*p==0)));
+        off = 0;
+    }
+    char *r = (char *)p + off + __builtin_ctz(mask);
+    return *r==(char)c ? r : 0;
+}
+
+static char *strchr_init(char *, int);
+static char *(*strchr_impl)(char *, int) = strchr_init;
+
+static char *strchr_init(char *s, int c)
+{
+    int features = cpuinit();
+    char *(*f)(char *, int) = strchr_byte;
+    f = features&CPU_SSE2 ? strchr_sse2 : f;
+    f = features&CPU_AVX2 ? strchr_avx2 : f;
+    __atomic_store_n(&strchr_impl, f, __ATOMIC_RELEASE);
+    return f(s, c);
+}
+
+char *strchr(char *s, int c)
+{
+    return __atomic_load_n(&strchr_impl, __ATOMIC_ACQUIRE)(s, c);
+}
+#endif
+
+#ifdef STRCMP
+// Like memcmp, bytes compare unsigned and results are -1, 0, or 1.
+static int strcmp_byte(char *s1, char *s2)
+{
+    unsigned char *a = (unsigned char *)s1, *b = (unsigned char *)s2;
+    for (; *a==*b && *a; a++, b++) {}
+    return (*a > *b) - (*a < *b);
+}
+
+// The two strings rarely share an alignment, so the vector variants use
+// unaligned loads, stepping bytewise where either load would touch the
+// next page.
+enum { PAGE = 1<<12 };
+
+__attribute((target("sse2")))
+static int strcmp_sse2(char *s1, char *s2)
+{
+    unsigned char *a = (unsigned char *)s1, *b = (unsigned char *)s2;
+    for (size_t i = 0;;) {
+        if (((uintptr_t)(a+i)&(PAGE-1)) <= PAGE-16 &&
+            ((uintptr_t)(b+i)&(PAGE-1)) <= PAGE-16) {
+            v16 x = *(v16 *)(a + i), y = *(v16 *)(b + i);
+            unsigned stop = __builtin_ia32_pmovmskb128((v16)((x!=y) | (x==0)));
+            if (stop) {
+                i += __builtin_ctz(stop);
+                return (a[i] > b[i]) - (a[i] < b[i]);
+            }
+            i += 16;
+        } else {
+            if (a[i]!=b[i] || !a[i]) {
+                return (a[i] > b[i]) - (a[i] < b[i]);
+            }
+            i++;
+        }
+    }
+}
+
+__attribute((target("avx2")))
+static int strcmp_avx2(char *s1, char *s2)
+{
+    unsigned char *a = (unsigned char *)s1, *b = (unsigned char *)s2;
+    for (size_t i = 0;;) {
+        if (((uintptr_t)(a+i)&(PAGE-1)) <= PAGE-32 &&
+            ((uintptr_t)(b+i)&(PAGE-1)) <= PAGE-32) {
+            v32 x = *(v32 *)(a + i), y = *(v32 *)(b + i);
+            unsigned stop = __builtin_ia32_pmovmskb256((v32)((x!=y) | (x==0)));
+            if (stop) {
+                i += __builtin_ctz(stop);
+                return (a[i] > b[i]) - (a[i] < b[i]);
+            }
+            i += 32;
+        } else {
+            if (a[i]!=b[i] || !a[i]) {
+                return (a[i] > b[i]) - (a[i] < b[i]);
+            }
+            i++;
+        }
+    }
+}
+
+static int strcmp_init(char *, char *);
+static int (*strcmp_impl)(char *, char *) = strcmp_init;
+
+static int strcmp_init(char *s1, char *s2)
+{
+    int features = cpuinit();
+    int (*f)(char *, char *) = strcmp_byte;
+    f = features&CPU_SSE2 ? strcmp_sse2 : f;
+    f = features&CPU_AVX2 ? strcmp_avx2 : f;
+    __atomic_store_n(&strcmp_impl, f, __ATOMIC_RELEASE);
+    return f(s1, s2);
+}
+
+int strcmp(char *s1, char *s2)
+{
+    return __atomic_load_n(&strcmp_impl, __ATOMIC_ACQUIRE)(s1, s2);
+}
+#endif
+
+#ifdef STRNLEN
+static size_t strnlen_rep(char *s, size_t max)
+{
+    char *r = memchr_rep(s, 0, max);
+    return r ? (size_t)(r - s) : max;
+}
+
+__attribute((target("sse2")))
+static size_t strnlen_sse2(char *s, size_t max)
+{
+    char *r = memchr_sse2(s, 0, max);
+    return r ? (size_t)(r - s) : max;
+}
+
+__attribute((target("avx2")))
+static size_t strnlen_avx2(char *s, size_t max)
+{
+    char *r = memchr_avx2(s, 0, max);
+    return r ? (size_t)(r - s) : max;
+}
+
+static size_t strnlen_init(char *, size_t);
+static size_t (*strnlen_impl)(char *, size_t) = strnlen_init;
+
+static size_t strnlen_init(char *s, size_t max)
+{
+    int features = cpuinit();
+    size_t (*f)(char *, size_t) = strnlen_rep;
+    f = features&CPU_SSE2 ? strnlen_sse2 : f;
+    f = features&CPU_AVX2 ? strnlen_avx2 : f;
+    __atomic_store_n(&strnlen_impl, f, __ATOMIC_RELEASE);
+    return f(s, max);
+}
+
+size_t strnlen(char *s, size_t max)
+{
+    return __atomic_load_n(&strnlen_impl, __ATOMIC_ACQUIRE)(s, max);
+}
+#endif
+
+#ifdef BCMP
+// Like memcmp, but only for equality, so no search for the first
+// difference and no byte ordering.
+
+static int bcmp_rep(void *s1, void *s2, size_t len)
+{
+    int ne;
+    asm volatile (
+        "xor %%eax, %%eax\n"  // ZF=1
+        "repz cmpsb\n"
+        : "+D"(s1), "+S"(s2), "+c"(len), "=@ccnz"(ne)
+        :
+        : "ax", "memory"
+    );
+    return ne;
+}
+
+__attribute((always_inline))
+static inline int bcmp_small(unsigned char *a, unsigned char *b, size_t len)
+{
+    if (len >= 8) {
+        unsigned long long x = *(u64u *)a ^ *(u64u *)b;
+        unsigned long long y = *(u64u *)(a + len - 8) ^ *(u64u *)(b + len - 8);
+        return !!(x | y);
+    } else if (len >= 4) {
+        unsigned x = *(u32u *)a ^ *(u32u *)b;
+        unsigned y = *(u32u *)(a + len - 4) ^ *(u32u *)(b + len - 4);
+        return !!(x | y);
+    }
+    int r = 0;
+    for (size_t i = 0; i < len; i++) {
+        r |= a[i] ^ b[i];
+    }
+    return !!r;
+}
+
+__attribute((target("sse2")))
+static int bcmp_sse2(void *s1, void *s2, size_t len)
+{
+    unsigned char *a = s1, *b = s2;
+    if (len < 16) {
+        return bcmp_small(a, b, len);
+    }
+    // Overlapping tail, then whole blocks from the start
+    v16 ne = *(v16 *)(a + len - 16) ^ *(v16 *)(b + len - 16);
+    for (size_t i = 0; i < len-16; i += 16) {
+        ne |= *(v16 *)(a + i) ^ *(v16 *)(b + i);
+        if (__builtin_ia32_pmovmskb128((v16)(ne != 0))) {
+            return 1;
+        }
+    }
+    return !!__builtin_ia32_pmovmskb128((v16)(ne != 0));
+}
+
+__attribute((target("avx2")))
+static int bcmp_avx2(void *s1, void *s2, size_t len)
+{
+    unsigned char *a = s1, *b = s2;
+    if (len < 16) {
+        return bcmp_small(a, b, len);
+    } else if (len <= 32) {
+        v16 ne = *(v16 *)a ^ *(v16 *)b;
+        ne |= *(v16 *)(a + len - 16) ^ *(v16 *)(b + len - 16);
+        return !!__builtin_ia32_pmovmskb128((v16)(ne != 0));
+    }
+    v32 ne = *(v32 *)(a + len - 32) ^ *(v32 *)(b + len - 32);
+    for (size_t i = 0; i < len-32; i += 32) {
+        ne |= *(v32 *)(a + i) ^ *(v32 *)(b + i);
+        if (__builtin_ia32_pmovmskb256((v32)(ne != 0))) {
+            return 1;
+        }
+    }
+    return !!__builtin_ia32_pmovmskb256((v32)(ne != 0));
+}
+
+static int bcmp_init(void *, void *, size_t);
+static int (*bcmp_impl)(void *, void *, size_t) = bcmp_init;
+
+static int bcmp_init(void *s1, void *s2, size_t len)
+{
+    int features = cpuinit();
+    int (*f)(void *, void *, size_t) = bcmp_rep;
+    f = features&CPU_SSE2 ? bcmp_sse2 : f;
+    f = features&CPU_AVX2 ? bcmp_avx2 : f;
+    __atomic_store_n(&bcmp_impl, f, __ATOMIC_RELEASE);
+    return f(s1, s2, len);
+}
+
+int bcmp(void *s1, void *s2, size_t len)
+{
+    return __atomic_load_n(&bcmp_impl, __ATOMIC_ACQUIRE)(s1, s2, len);
+}
 #endif
 
 #ifdef TEST
-// $ sh libmemory.c
-// $ cc -nostdlib -fno-builtin -DTEST -g3 -O -o test libmemory.c libmemory.a
+// $ cc -nostdlib -fno-builtin -DTEST -g3 -O -o test libmemory.c
 // $ gdb -ex r -ex q ./test
 
 #define assert(c) while (!(c)) __builtin_trap()
+#define countof(a) (int)(sizeof(a) / sizeof(*(a)))
 void   *memset(void *, int, size_t);
 int     memcmp(void *, void *, size_t);
 void   *memcpy(void *restrict, void *restrict, size_t);
 void   *memmove(void *, void *, size_t);
 size_t  strlen(char *);
+void   *memchr(void *, int, size_t);
+void   *memrchr(void *, int, size_t);
+char   *strchr(char *, int);
+int     strcmp(char *, char *);
+size_t  strnlen(char *, size_t);
+int     bcmp(void *, void *, size_t);
 
 #if defined(__linux) && defined(__amd64)
 asm ("        .global _start\n"
@@ -128,8 +1162,366 @@ asm ("        .global _start\n"
      "        int  $0x80\n");
 #endif
 
+// Sweep every size through the tiers, at every alignment, checking that
+// the bytes around the destination are untouched.
+enum {
+    SWEEP_SMALL = 320,    // all sizes through the copy tiers
+    SWEEP_SCAN  = 160,    // all lengths for the quadratic search sweeps
+    SWEEP_ALIGN = 32,
+    SWEEP_LARGE = 1<<13,
+};
+static size_t sweeplarge[] = {1023, 2047, 2048, 2049, 4096+17, SWEEP_LARGE};
+static unsigned char sweepsrc[SWEEP_LARGE + 8*SWEEP_ALIGN];
+static unsigned char sweepdst[SWEEP_LARGE + 8*SWEEP_ALIGN];
+
+typedef void *memsetfn(void *, int, size_t);
+typedef void *memcpyfn(void *, void *, size_t);
+
+static void checkset(memsetfn *f, size_t align, size_t len)
+{
+    size_t end = align + len + SWEEP_ALIGN;
+    for (size_t i = 0; i < end; i++) {
+        sweepdst[i] = 0xee;
+    }
+    int c = (int)(len*31 + align) - 128;
+    assert(f(sweepdst+align, c, len) == sweepdst+align);
+    for (size_t i = 0; i < end; i++) {
+        int inside = i>=align && i-align<len;
+        assert(sweepdst[i] == (inside ? (unsigned char)c : 0xee));
+    }
+}
+
+static void checkcpy(memcpyfn *f, size_t dalign, size_t salign, size_t len)
+{
+    size_t end = dalign + len + SWEEP_ALIGN;
+    for (size_t i = 0; i < end; i++) {
+        sweepdst[i] = 0xee;
+    }
+    assert(f(sweepdst+dalign, sweepsrc+salign, len) == sweepdst+dalign);
+    for (size_t i = 0; i < end; i++) {
+        int inside = i>=dalign && i-dalign<len;
+        assert(sweepdst[i] == (inside ? sweepsrc[salign+i-dalign] : 0xee));
+    }
+}
+
+static void sweepset(memsetfn *f)
+{
+    for (size_t align = 0; align < SWEEP_ALIGN; align++) {
+        for (size_t len = 0; len <= SWEEP_SMALL; len++) {
+            checkset(f, align, len);
+        }
+        for (int i = 0; i < countof(sweeplarge); i++) {
+            checkset(f, align, sweeplarge[i]);
+        }
+    }
+}
+
+static void sweepcpy(memcpyfn *f)
+{
+    for (size_t d = 0; d < SWEEP_ALIGN; d++) {
+        for (size_t s = 0; s < SWEEP_ALIGN; s++) {
+            for (size_t len = 0; len <= SWEEP_SMALL; len++) {
+                checkcpy(f, d, s, len);
+            }
+        }
+        for (int i = 0; i < countof(sweeplarge); i++) {
+            checkcpy(f, d, (d*7)%SWEEP_ALIGN, sweeplarge[i]);
+        }
+    }
+}
+
+// Move within one buffer, src at a distance either side of dst.
+static void checkmove(memcpyfn *f, size_t dalign, int dist, size_t len)
+{
+    size_t d = 3*SWEEP_ALIGN + dalign;
+    size_t s = d + dist;
+    size_t end = d + len + 3*SWEEP_ALIGN;
+    for (size_t i = 0; i < end; i++) {
+        sweepdst[i] = sweepsrc[i];
+    }
+    assert(f(sweepdst+d, sweepdst+s, len) == sweepdst+d);
+    for (size_t i = 0; i < end; i++) {
+        int inside = i>=d && i-d<len;
+        assert(sweepdst[i] == sweepsrc[inside ? s+i-d : i]);
+    }
+}
+
+static void sweepmove(memcpyfn *f)
+{
+    static int edges[] = {
+        -96, -65, -64, -33, -32, -17, -16, -1,
+        +1, +16, +17, +32, +33, +64, +65, +96,
+    };
+    for (size_t align = 0; align < SWEEP_ALIGN; align++) {
+        for (size_t len = 0; len <= SWEEP_SMALL; len++) {
+            if (len <= SWEEP_SCAN) {
+                for (int dist = -33; dist <= 33; dist++) {
+                    checkmove(f, align, dist, len);
+                }
+            }
+            for (int i = 0; i < countof(edges); i++) {
+                checkmove(f, align, edges[i], len);
+            }
+        }
+        for (int i = 0; i < countof(sweeplarge); i++) {
+            for (int dist = -66; dist <= 66; dist += 11) {
+                checkmove(f, align, dist, sweeplarge[i]);
+            }
+        }
+    }
+}
+
+typedef int memcmpfn(void *, void *, size_t);
+typedef size_t strlenfn(char *);
+
+// Plant a difference at each position, including just past the end.
+static void sweepcmp(memcmpfn *f)
+{
+    for (size_t align = 0; align < SWEEP_ALIGN; align++) {
+        unsigned char *a = sweepsrc + align;
+        unsigned char *b = sweepdst + (align*7 + 3)%SWEEP_ALIGN;
+        for (size_t len = 0; len <= SWEEP_SMALL; len++) {
+            for (size_t i = 0; i <= len; i++) {
+                b[i] = a[i];
+            }
+            assert(!f(a, b, len));
+            for (size_t i = 0; i <= len; i++) {
+                unsigned char save = b[i];
+                b[i] = a[i] + (unsigned char)(i%255 + 1);
+                int want = i==len ? 0 : a[i]<b[i] ? -1 : 1;
+                int got  = f(a, b, len);
+                assert((got>0) - (got<0) == want);
+                b[i] = save;
+            }
+        }
+    }
+}
+
+// Zeros before the string must not count.
+static void sweeplen(strlenfn *f)
+{
+    for (size_t align = 0; align < SWEEP_ALIGN; align++) {
+        for (size_t i = 0; i < align; i++) {
+            sweepdst[i] = 0;
+        }
+        char *s = (char *)sweepdst + align;
+        for (size_t len = 0; len <= SWEEP_SMALL; len++) {
+            for (size_t i = 0; i < len; i++) {
+                s[i] = (char)(i%255 + 1);
+            }
+            s[len] = 0;
+            assert(f(s) == len);
+        }
+    }
+}
+
+typedef void  *memchrfn(void *, int, size_t);
+typedef char  *strchrfn(char *, int);
+typedef int    strcmpfn(char *, char *);
+typedef size_t strnlenfn(char *, size_t);
+
+// Plant c at each position along with decoys just outside the buffer.
+// A second c after (memchr) or before (memrchr) the first must lose.
+static void sweepchr(memchrfn *f, int reverse)
+{
+    unsigned char c = 0xc5;
+    for (size_t align = 0; align < SWEEP_ALIGN; align++) {
+        unsigned char *s = sweepdst + SWEEP_ALIGN + align;
+        for (size_t len = 0; len <= SWEEP_SCAN; len++) {
+            for (size_t i = 0; i < SWEEP_ALIGN+len+SWEEP_ALIGN; i++) {
+                sweepdst[i] = c;
+            }
+            for (size_t i = 0; i < len; i++) {
+                s[i] = (unsigned char)(i%c);
+            }
+            assert(!f(s, c, len));
+            for (size_t i = 0; i < len; i++) {
+                size_t other = reverse ? i-17 : i+17;
+                if (other < len) {
+                    s[other] = c;
+                }
+                s[i] = c;
+                assert(f(s, c, len) == s+i);
+                s[i] = (unsigned char)(i%c);
+                if (other < len) {
+                    s[other] = (unsigned char)(other%c);
+                }
+            }
+        }
+    }
+}
+
+// Also plants c before the string and after its terminator.
+static void sweepstrchr(strchrfn *f)
+{
+    char c = 'x';
+    for (size_t align = 0; align < SWEEP_ALIGN; align++) {
+        char *s = (char *)sweepdst + SWEEP_ALIGN + align;
+        for (size_t len = 0; len <= SWEEP_SCAN; len++) {
+            for (size_t i = 0; i < SWEEP_ALIGN+len+SWEEP_ALIGN; i++) {
+                sweepdst[i] = c;
+            }
+            for (size_t i = 0; i < len; i++) {
+                s[i] = (char)(i%('x'-1) + 1);
+            }
+            s[len] = 0;
+            assert(!f(s, c));
+            assert(f(s, 0) == s+len);
+            for (size_t i = 0; i < len; i++) {
+                char save = s[i];
+                s[i] = c;
+                assert(f(s, c) == s+i);
+                s[i] = save;
+            }
+        }
+    }
+}
+
+static void sweepstrnlen(strnlenfn *f)
+{
+    for (size_t align = 0; align < SWEEP_ALIGN; align++) {
+        for (size_t i = 0; i < align; i++) {
+            sweepdst[i] = 0;
+        }
+        char *s = (char *)sweepdst + align;
+        for (size_t len = 0; len <= SWEEP_SCAN; len++) {
+            for (size_t i = 0; i < len; i++) {
+                s[i] = (char)(i%255 + 1);
+            }
+            s[len] = 0;
+            assert(f(s, len/2) == len/2);
+            assert(f(s, len) == len);
+            assert(f(s, len+1) == len);
+            assert(f(s, -1) == len);
+        }
+    }
+}
+
+// Strings straddle a page boundary so that the bytewise steps run.
+static void sweepstrcmp(strcmpfn *f)
+{
+    uintptr_t pa = (uintptr_t)(sweepsrc + PAGE - 1) & -PAGE;
+    uintptr_t pb = (uintptr_t)(sweepdst + PAGE - 1) & -PAGE;
+    for (size_t align = 0; align < SWEEP_ALIGN; align++) {
+        unsigned char *a = (unsigned char *)pa - 3*SWEEP_ALIGN + align;
+        unsigned char *b = (unsigned char *)pb - 2*SWEEP_ALIGN +
+                           (align*7 + 3)%SWEEP_ALIGN;
+        for (size_t len = 0; len <= SWEEP_SCAN; len++) {
+            for (size_t i = 0; i < len; i++) {
+                a[i] = b[i] = (unsigned char)(i%255 + 1);
+            }
+            a[len] = b[len] = 0;
+            b[len+1] = 0;
+            assert(!f((char *)a, (char *)b));
+            for (size_t i = 0; i <= len; i++) {
+                unsigned char save = b[i];
+                b[i] = a[i] + (unsigned char)(i%254 + 1);
+                b[i] += !b[i];
+                int want = a[i]<b[i] ? -1 : 1;
+                int got  = f((char *)a, (char *)b);
+                assert((got>0) - (got<0) == want);
+                got = f((char *)b, (char *)a);
+                assert((got>0) - (got<0) == -want);
+                b[i] = save;
+            }
+        }
+    }
+}
+
+static void sweepbcmp(memcmpfn *f)
+{
+    for (size_t align = 0; align < SWEEP_ALIGN; align++) {
+        unsigned char *a = sweepsrc + align;
+        unsigned char *b = sweepdst + (align*7 + 3)%SWEEP_ALIGN;
+        for (size_t len = 0; len <= SWEEP_SCAN; len++) {
+            for (size_t i = 0; i <= len; i++) {
+                b[i] = a[i];
+            }
+            assert(!f(a, b, len));
+            for (size_t i = 0; i <= len; i++) {
+                b[i] ^= 1 << i%8;
+                assert(!f(a, b, len) == (i == len));
+                b[i] = a[i];
+            }
+        }
+    }
+}
+
 int mainCRTStartup(void)
 {
+    for (size_t i = 0; i < sizeof(sweepsrc); i++) {
+        sweepsrc[i] = (unsigned char)(i*167 + i/251 + 1);
+    }
+
+    // Each variant the CPU supports: first streaming from 4 KiB without
+    // ERMS, then with ERMS (if present) and without streaming
+    int features = cpuinit();
+    size_t detected = ntmin;
+    sweepset(memset_rep);
+    sweepcpy(memcpy_rep);
+    sweepmove(memmove_rep);
+    for (int pass = 0; pass < 2; pass++) {
+        cpu   = pass ? features : features&~CPU_ERMS;
+        ntmin = pass ? (size_t)-1 : 1<<12;
+        if (features & CPU_SSE2) {
+            sweepset(memset_sse2);
+            sweepcpy(memcpy_sse2);
+            sweepmove(memmove_sse2);
+        }
+        if (features & CPU_AVX2) {
+            sweepset(memset_avx2);
+            sweepcpy(memcpy_avx2);
+            sweepmove(memmove_avx2);
+        }
+    }
+    cpu = features;
+    ntmin = detected;
+    sweepset(memset);
+    sweepcpy(memcpy);
+    sweepmove(memmove);
+
+    sweepcmp(memcmp_rep);
+    sweeplen(strlen_rep);
+    if (features & CPU_SSE2) {
+        sweepcmp(memcmp_sse2);
+        sweeplen(strlen_sse2);
+    }
+    if (features & CPU_AVX2) {
+        sweepcmp(memcmp_avx2);
+        sweeplen(strlen_avx2);
+    }
+    sweepcmp(memcmp);
+    sweeplen(strlen);
+
+    sweepchr(memchr_rep, 0);
+    sweepchr(memrchr_rep, 1);
+    sweepstrchr(strchr_byte);
+    sweepstrcmp(strcmp_byte);
+    sweepstrnlen(strnlen_rep);
+    sweepbcmp(bcmp_rep);
+    if (features & CPU_SSE2) {
+        sweepchr(memchr_sse2, 0);
+        sweepchr(memrchr_sse2, 1);
+        sweepstrchr(strchr_sse2);
+        sweepstrcmp(strcmp_sse2);
+        sweepstrnlen(strnlen_sse2);
+        sweepbcmp(bcmp_sse2);
+    }
+    if (features & CPU_AVX2) {
+        sweepchr(memchr_avx2, 0);
+        sweepchr(memrchr_avx2, 1);
+        sweepstrchr(strchr_avx2);
+        sweepstrcmp(strcmp_avx2);
+        sweepstrnlen(strnlen_avx2);
+        sweepbcmp(bcmp_avx2);
+    }
+    sweepchr(memchr, 0);
+    sweepchr(memrchr, 1);
+    sweepstrchr(strchr);
+    sweepstrcmp(strcmp);
+    sweepstrnlen(strnlen);
+    sweepbcmp(bcmp);
+
     {
         char buf[12] = "............";
         memset(buf+4, 'x', 4);
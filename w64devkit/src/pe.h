@@ -0,0 +1,910 @@
+// pe.h: safe, zero-allocation PE image reader (header-only)
+//
+// Parses the headers, section table, data directories, export table,
+// and import table of an EXE or DLL already in memory. It never writes
+// to the image and allocates only from a caller-supplied arena. Errors
+// are reported by longjmp-ing to the arena's escape, so callers set up
+// a catch() before parsing:
+//
+//   escape esc = {0};
+//   scratch.esc = &esc;
+//   if (catch(&esc)) {
+//       // esc.err describes the problem
+//   }
+//   peimage pe = peload(file, &scratch);
+//   for (exportiter it = newexportiter(&pe, &scratch); nextexport(&it);) {
+//       // it.name, it.ordinal, it.forward
+//   }
+//
+// The section table is parsed once, so appended data (overlay) past the
+// last section is located without scanning the file: pe.overlay.
+//
+// Requires GCC or Clang. The includer gets the basic vocabulary (u8,
+// s8, arena, escape, new, etc.) along with the parser.
+//
+// This is free and unencumbered software released into the public domain.
+#ifndef PE_H
+#define PE_H
+
+#define assert(c)       while (!(c)) __builtin_unreachable()
+#define countof(a)      (iz)(sizeof(a) / sizeof(*(a)))
+#define new(a, n, t)    (t *)alloc(a, n, sizeof(t), _Alignof(t))
+#define s8(s)           (s8){(u8 *)s, countof(s)-1}
+#define catch(e)        __builtin_setjmp((e)->jmp)
+
+typedef unsigned char       u8;
+typedef unsigned short      u16;
+typedef   signed int        b32;
+typedef   signed int        i32;
+typedef unsigned int        u32;
+typedef   signed long long  i64;
+typedef unsigned long long  u64;
+typedef unsigned short      char16_t;
+typedef          char16_t   c16;
+typedef __PTRDIFF_TYPE__    iz;
+typedef __SIZE_TYPE__       uz;
+typedef          char       byte;
+
+typedef struct {
+    u8 *data;
+    iz  len;
+} s8;
+
+typedef struct {
+    void *jmp[5];
+    s8    err;
+} escape;
+
+__attribute((noreturn))
+static void throw(escape *e, s8 reason)
+{
+    e->err = reason;
+    __builtin_longjmp(e->jmp, 1);
+}
+
+typedef struct {
+    byte   *beg;
+    byte   *end;
+    escape *esc;
+} arena;
+
+static byte *alloc(arena *a, iz count, iz size, iz align)
+{
+    assert(count >= 0);
+    iz pad = -(uz)a->beg & (align - 1);
+    if (count >= (a->end - a->beg - pad)/size) {
+        throw(a->esc, s8("out of memory"));
+    }
+    byte *r = a->beg + pad;
+    a->beg += pad + count*size;
+    return __builtin_memset(r, 0, count*size);
+}
+
+static s8 span(u8 *beg, u8 *end)
+{
+    assert(beg <= end);
+    s8 r = {0};
+    r.data = beg;
+    r.len = end - beg;
+    return r;
+}
+
+static b32 equals(s8 a, s8 b)
+{
+    if (a.len != b.len) {
+        return 0;
+    }
+    for (iz i = 0; i < a.len; i++) {
+        if (a.data[i] != b.data[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static u64 hash64(s8 s)
+{
+    u64 h = 0x100;
+    for (iz i = 0; i < s.len; i++) {
+        h ^= s.data[i];
+        h *= 1111111111111111111u;
+    }
+    return h;
+}
+
+static s8 slice3(s8 s, iz beg, iz end, escape *e)
+{
+    if (beg<0 || beg>end || end>s.len) {
+        throw(e, s8("unexpected end of input (slice)"));
+    }
+    s.data += beg;
+    s.len = end - beg;
+    return s;
+}
+
+static s8 slice2(s8 s, iz beg, escape *e)
+{
+    return slice3(s, beg, s.len, e);
+}
+
+static u16 readu16(s8 s, iz off, escape *e)
+{
+    if (off > s.len-2) {
+        throw(e, s8("unexpected end of input (uint16)"));
+    }
+    u8 *p = s.data + off;
+    return (u16)((u16)p[1]<<8 | p[0]);
+}
+
+static u32 readu32(s8 s, iz off, escape *e)
+{
+    if (off > s.len-4) {
+        throw(e, s8("unexpected end of input (uint32)"));
+    }
+    u8 *p = s.data + off;
+    return (u32)p[3]<<24 | (u32)p[2]<<16 | (u32)p[1]<<8 | p[0];
+}
+
+static s8 nullterm(s8 s)
+{
+    if (!s.data) return s;
+    iz len = 0;
+    for (; len<s.len && s.data[len]; len++) {}
+    s.len = len;
+    return s;
+}
+
+typedef struct {
+    u32 beg;
+    u32 end;
+    s8  mem;
+} region;
+
+typedef struct {
+    region *regions;
+    i32     len;
+} vm;
+
+// Parsing a PE means simulating a loader. A virtual memory (vm) object
+// represents sections mapped into a virtual address space, and this
+// function reads regions out of that address space.
+static s8 loadrva(vm m, u32 vaddr, escape *e)
+{
+    s8 r = {0};
+    for (i32 i = 0; i < m.len; i++) {
+        region s = m.regions[i];
+        if (vaddr>=s.beg && vaddr<s.end) {
+            r = slice3(s.mem, vaddr-s.beg, s.mem.len, e);
+            break;
+        }
+    }
+    return r;
+}
+
+// Throw an error if the result overflows. It would be better not to do
+// arithmetic on unsigned operands, but PE requires it.
+static u32 checkadd(u32 a, u32 b, escape *e)
+{
+    if (a > 0xffffffff-b) {
+        throw(e, s8("overflow computing 32-bit offset"));
+    }
+    return a + b;
+}
+
+enum { PE32, PE64 };
+
+enum {
+    PEDIR_EXPORT,
+    PEDIR_IMPORT,
+    PEDIR_RESOURCE,
+    PEDIR_EXCEPTION,
+    PEDIR_SECURITY,     // NOTE: file offset, not an RVA
+    PEDIR_BASERELOC,
+    PEDIR_DEBUG,
+    PEDIR_ARCHITECTURE,
+    PEDIR_GLOBALPTR,
+    PEDIR_TLS,
+    PEDIR_LOADCONFIG,
+    PEDIR_BOUNDIMPORT,
+    PEDIR_IAT,
+    PEDIR_DELAYIMPORT,
+    PEDIR_CLR,
+    PEDIR_RESERVED,
+    PEDIR_MAX
+};
+
+typedef struct {
+    u32 rva;
+    u32 len;
+} pedir;
+
+typedef struct {
+    s8  name;   // up to 8 bytes, not null terminated
+    u32 vaddr;
+    u32 vsize;
+    u32 raddr;
+    u32 rsize;
+    u32 flags;
+} pesection;
+
+typedef struct {
+    s8         file;
+    i32        type;         // PE32 or PE64
+    u16        machine;
+    u16        characteristics;
+    pesection *sections;     // at most the first 96 entries
+    i32        nsections;
+    pedir      dirs[PEDIR_MAX];
+    i32        ndirs;        // populated entries of dirs
+    vm         map;          // loadable sections, for loadrva()
+    iz         overlay;      // file offset of appended data
+} peimage;
+
+// Parse headers and the section table. Allocates only the section
+// table and the section map. Like the Windows loader, only the first 96
+// sections are considered. The overlay offset is the end of the
+// furthest section raw data, or of the headers, whichever is later. It
+// equals file.len when there is no appended data, and is never larger,
+// though truncated inputs may put it at the end of the input.
+static peimage peload(s8 file, arena *a)
+{
+    escape *esc = a->esc;
+    peimage r = {0};
+    r.file = file;
+
+    u32 peoff = readu32(file, 0x3c, esc);
+    s8  pe    = slice2(file, peoff, esc);
+    s8  pehdr = slice3(pe, 0, 4, esc);
+    if (!equals(s8("PE\0\0"), pehdr)) {
+        throw(esc, s8("not a PE file"));
+    }
+
+    r.machine         = readu16(pe, 4+ 0, esc);
+    u16 nsections     = readu16(pe, 4+ 2, esc);
+    u16 hdrsize       = readu16(pe, 4+16, esc);
+    r.characteristics = readu16(pe, 4+18, esc);
+
+    u16 magic = readu16(pe, 4+20, esc);
+    switch (magic) {
+    default:     throw(esc, s8("unknown PE magic"));
+    case 0x010b: r.type = PE32; break;
+    case 0x020b: r.type = PE64; break;
+    }
+
+    s8  opt     = slice2(pe, 4+20, esc);
+    u32 ndirs   = readu32(opt, r.type==PE32 ?  92 : 108, esc);
+    iz  dirsoff = r.type==PE32 ? 96 : 112;
+    r.ndirs = ndirs>PEDIR_MAX ? PEDIR_MAX : (i32)ndirs;
+    for (i32 i = 0; i < r.ndirs; i++) {
+        r.dirs[i].rva = readu32(opt, dirsoff + 8*i + 0, esc);
+        r.dirs[i].len = readu32(opt, dirsoff + 8*i + 4, esc);
+    }
+
+    u32 headers = readu32(opt, 60, esc);
+    r.overlay   = headers<(uz)file.len ? (iz)headers : file.len;
+
+    i32 loadlen  = nsections>96 ? 96 : nsections;
+    r.map.regions = new(a, loadlen, region);
+    r.sections    = new(a, loadlen, pesection);
+    r.nsections   = loadlen;
+    s8  sections  = slice2(pe, 4+20+hdrsize, esc);
+    for (i32 i = 0; i < loadlen; i++) {
+        pesection *s = r.sections + i;
+        s->name  = nullterm(slice3(sections, 40*i, 40*i+8, esc));
+        s->vsize = readu32(sections, 40*i+ 8, esc);
+        s->vaddr = readu32(sections, 40*i+12, esc);
+        s->rsize = readu32(sections, 40*i+16, esc);
+        s->raddr = readu32(sections, 40*i+20, esc);
+        s->flags = readu32(sections, 40*i+36, esc);
+
+        u32 rend = checkadd(s->raddr, s->rsize, esc);
+        if (s->rsize && rend>(uz)r.overlay) {
+            r.overlay = rend<(uz)file.len ? (iz)rend : file.len;
+        }
+
+        i32 m = r.map.len++;
+        r.map.regions[m].beg = s->vaddr;
+        r.map.regions[m].end = checkadd(s->vaddr, s->vsize, esc);
+        if (m) {
+            region prev = r.map.regions[m-1];
+            if (prev.beg>=s->vaddr || prev.end>s->vaddr) {
+                throw(esc, s8("invalid section order"));
+            }
+        }
+
+        r.map.regions[m].mem = slice3(file, s->raddr, rend, esc);
+        if (s->vsize > s->rsize) {
+            // Padded sections (e.g. .bss) unlikely interesting: discard
+            r.map.len--;
+        } else if (s->vsize < s->rsize) {
+            // Truncated sections *are* usually interesting. Go figure.
+            r.map.regions[m].mem.len = s->vsize;
+        }
+    }
+    return r;
+}
+
+// Return the data directory entry, or a zero entry if absent.
+static pedir pedirectory(peimage *pe, i32 which)
+{
+    pedir null = {0};
+    return which<pe->ndirs ? pe->dirs[which] : null;
+}
+
+
+// Iterate over the export table: named exports in name table order,
+// then exports without names in ordinal order. Forwarders have a
+// non-null forward field naming the target ("module.symbol"), and
+// exports without names have a null name.
+typedef struct {
+    s8       module;    // name in the export directory, if any
+
+    // Current export
+    s8       name;
+    s8       forward;
+    u32      ordinal;   // includes ordinal base
+    u32      rva;
+
+    // Iterator state
+    escape  *esc;
+    vm       map;
+    u8      *seen;
+    s8       addrs;
+    s8       names;
+    s8       ordinals;
+    u32      ordbase;
+    u32      edataoff;
+    u32      edataend;
+    i32      naddrs;
+    i32      nnames;
+    i32      index;
+} exportiter;
+
+static exportiter newexportiter(peimage *pe, arena *a)
+{
+    escape *esc = a->esc;
+    exportiter r = {0};
+    r.esc = esc;
+    r.map = pe->map;
+
+    pedir dir = pedirectory(pe, PEDIR_EXPORT);
+    if (!dir.len) {
+        return r;  // empty iterator
+    }
+    r.edataoff = dir.rva;
+    r.edataend = checkadd(dir.rva, dir.len, esc);
+    s8 edata   = loadrva(pe->map, dir.rva, esc);
+
+    r.module  = nullterm(loadrva(pe->map, readu32(edata, 3*4, esc), esc));
+    r.ordbase = readu32(edata, 4*4, esc);
+    r.naddrs  = readu32(edata, 5*4, esc);
+    r.nnames  = readu32(edata, 6*4, esc);
+    if (r.naddrs<0 || r.nnames<0) {
+        throw(esc, s8("invalid export count"));
+    }
+
+    // If naddrs is huge, this will fail here with OOM
+    r.seen = new(a, r.naddrs, u8);
+
+    r.addrs    = loadrva(pe->map, readu32(edata, 7*4, esc), esc);
+    r.names    = loadrva(pe->map, readu32(edata, 8*4, esc), esc);
+    r.ordinals = loadrva(pe->map, readu32(edata, 9*4, esc), esc);
+    return r;
+}
+
+static b32 nextexport(exportiter *it)
+{
+    escape *esc = it->esc;
+    s8 null = {0};
+    it->name = it->forward = null;
+
+    // If nnames is huge, the loop will EOF before overflow
+    if (it->index < it->nnames) {
+        i32 i = it->index++;
+        u16 ordinal = readu16(it->ordinals, i*2, esc);
+        if (ordinal >= it->naddrs) {
+            throw(esc, s8("invalid export ordinal"));
+        }
+        it->seen[ordinal] = 1;
+
+        // If RVA points in .edata it's a forwarder name
+        it->rva = readu32(it->addrs, ordinal*4, esc);
+        if (it->rva>=it->edataoff && it->rva<it->edataend) {
+            it->forward = nullterm(loadrva(it->map, it->rva, esc));
+        }
+        it->ordinal = checkadd(ordinal, it->ordbase, esc);
+
+        u32 off  = readu32(it->names, i*4, esc);
+        it->name = nullterm(loadrva(it->map, off, esc));
+        if (!it->name.data) {
+            it->name = s8("");  // unmapped name reads as empty
+        }
+        return 1;
+    }
+
+    for (; it->index-it->nnames < it->naddrs; it->index++) {
+        i32 i = it->index - it->nnames;
+        if (!it->seen[i]) {
+            it->index++;
+            it->ordinal = checkadd(i, it->ordbase, esc);
+            it->rva = readu32(it->addrs, i*4, esc);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Iterate over the import directory, one module at a time, and then
+// over each module's symbols with nextimport().
+//
+// The PE specification says the last import directory table entry is
+// all zeros, indicating the directory end. However, MSVC link.exe is
+// buggy and does not reliably produce this null entry. Instead the
+// directory runs into import lookup tables and string table, causing
+// the directory to read as garbage. We have two workarounds:
+//
+// 1. Track the earliest import lookup table RVA, and stop reading if
+//    the directory would overlap it.
+// 2. Don't treat garbage RVA fields as errors, just stop reading the
+//    table (Binutils strategy).
+//
+// This issue was crashing objdump back in 2005. See Binutils commit
+// a50b216054a4.
+typedef struct {
+    // Current module
+    s8       module;
+
+    // Current symbol
+    s8       name;      // null when imported by ordinal
+    u32      hint;      // ordinal when name is null, otherwise hint
+
+    // Iterator state
+    escape  *esc;
+    vm       map;
+    s8       idata;
+    s8       table;
+    i32      type;
+    u32      idataoff;
+    u32      firsttable;
+    i32      index;
+    i32      entry;
+    b32      done;
+} importiter;
+
+static importiter newimportiter(peimage *pe, arena *a)
+{
+    importiter r = {0};
+    r.esc  = a->esc;
+    r.map  = pe->map;
+    r.type = pe->type;
+    r.firsttable = -1;
+
+    pedir dir = pedirectory(pe, PEDIR_IMPORT);
+    r.done     = !dir.len;
+    r.idataoff = dir.rva;
+    r.idata    = loadrva(pe->map, dir.rva, a->esc);
+    return r;
+}
+
+// Advance to the next imported module. Modules with an unreadable
+// symbol table are still produced, but end iteration.
+static b32 nextmodule(importiter *it)
+{
+    escape *esc = it->esc;
+    if (it->done) {
+        return 0;
+    }
+
+    i32 i = it->index++;
+    if (it->idataoff + i*20 == it->firsttable) {
+        // Probably the link.exe bug. We're now overlapping an import
+        // lookup table, so stop reading the import directory. The
+        // left-side sum might overflow, but that's fine. This is just
+        // a heuristic.
+        it->done = 1;
+        return 0;
+    }
+
+    u32 tableoff = readu32(it->idata, i*20+ 0, esc);
+    u32 nameoff  = readu32(it->idata, i*20+12, esc);
+    if (!tableoff || !nameoff) {
+        it->done = 1;
+        return 0;
+    }
+
+    it->module = nullterm(loadrva(it->map, nameoff, esc));
+    if (!it->module.data) {
+        it->done = 1;  // ignore link.exe bug
+        return 0;
+    }
+
+    it->entry = 0;
+    it->table = loadrva(it->map, tableoff, esc);
+    if (!it->table.data) {
+        it->done = 1;  // ignore link.exe bug
+    } else {
+        it->firsttable = it->firsttable<tableoff ? it->firsttable : tableoff;
+    }
+    return 1;
+}
+
+// Advance to the next symbol imported from the current module.
+static b32 nextimport(importiter *it)
+{
+    escape *esc = it->esc;
+    if (!it->table.data) {
+        return 0;
+    }
+
+    i32 j = it->entry++;
+    u32 addr = 0;
+    switch (it->type) {
+    case PE32:
+        addr  = readu32(it->table, j*4, esc);
+        break;
+    case PE64:
+        addr  = readu32(it->table, j*8+4, esc);
+        addr |= readu32(it->table, j*8+0, esc);
+        break;
+    }
+    if (!addr) {
+        it->table.data = 0;
+        return 0;
+    }
+
+    s8 null = {0};
+    it->name = null;
+    if (addr>>31) {
+        it->hint = addr & 0x7fffffff;
+    } else {
+        s8 entry = loadrva(it->map, addr, esc);
+        it->hint = readu16(entry, 0, esc);
+        it->name = nullterm(slice2(entry, 2, esc));
+    }
+    return 1;
+}
+
+// Import libraries are ar archives whose members each describe one
+// imported symbol. MSVC and LLVM write "short import" members, a small
+// header followed by symbol and DLL names. Binutils dlltool writes tiny
+// COFF objects instead: each symbol object holds the hint/name entry in
+// .idata$6 (or an ordinal in .idata$4), and its .idata$7 relocation
+// names a "head" object whose import descriptor, .idata$2, relocates to
+// a symbol in a "tail" object holding the DLL name. Members are found
+// through the archive symbol table by their "__imp_" symbols, and the
+// head and tail by name, so nothing is extracted or scanned in bulk.
+enum { IMPORT_CODE, IMPORT_DATA, IMPORT_CONST };
+
+static b32 isarchive(s8 file)
+{
+    s8 magic = s8("!<arch>\n");
+    return file.len>=magic.len && equals(span(file.data, file.data+magic.len), magic);
+}
+
+static u32 readbe32(s8 s, iz off, escape *e)
+{
+    if (off > s.len-4) {
+        throw(e, s8("unexpected end of input (uint32)"));
+    }
+    u8 *p = s.data + off;
+    return (u32)p[0]<<24 | (u32)p[1]<<16 | (u32)p[2]<<8 | p[3];
+}
+
+// Return the contents of the archive member whose header is at off.
+static s8 armember(s8 file, u32 off, escape *e)
+{
+    if (file.len<68 || off<8 || off>(uz)(file.len-60)) {
+        throw(e, s8("invalid archive member offset"));
+    }
+    u8 *hdr = file.data + off;
+    if (hdr[58]!='`' || hdr[59]!='\n') {
+        throw(e, s8("invalid archive member header"));
+    }
+    u64 size = 0;
+    for (i32 i = 48; i<58 && hdr[i]!=' '; i++) {
+        u8 d = hdr[i] - '0';
+        if (d > 9) {
+            throw(e, s8("invalid archive member size"));
+        }
+        size = size*10 + d;
+    }
+    if (size > (u64)(file.len-off-60)) {
+        throw(e, s8("unexpected end of input (archive member)"));
+    }
+    return span(hdr+60, hdr+60+size);
+}
+
+typedef struct {
+    s8  file;
+    s8  sections;
+    s8  symbols;
+    s8  strings;
+    i32 nsections;
+    u32 nsymbols;
+} coffobj;
+
+static coffobj coffload(s8 file, escape *e)
+{
+    coffobj r = {0};
+    r.file      = file;
+    r.nsections = readu16(file,  2, e);
+    u32 symoff  = readu32(file,  8, e);
+    r.nsymbols  = readu32(file, 12, e);
+    u16 optsize = readu16(file, 16, e);
+    r.sections  = slice3(file, 20+optsize, 20+optsize+40*r.nsections, e);
+    if (r.nsymbols > (uz)file.len/18) {
+        throw(e, s8("invalid COFF symbol count"));
+    }
+    r.symbols = slice3(file, symoff, symoff+(iz)r.nsymbols*18, e);
+    r.strings = slice2(file, symoff+(iz)r.nsymbols*18, e);
+    return r;
+}
+
+static s8 coffsymbol(coffobj *c, u32 i, escape *e)
+{
+    if (i >= c->nsymbols) {
+        throw(e, s8("invalid COFF symbol index"));
+    }
+    s8 sym = slice3(c->symbols, 18*i, 18*i+8, e);
+    if (readu32(sym, 0, e)) {
+        return nullterm(sym);  // short name, up to 8 bytes
+    }
+    return nullterm(slice2(c->strings, readu32(sym, 4, e), e));
+}
+
+// Find a section by name, returning its 1-based number, or zero.
+static i32 coffsection(coffobj *c, s8 name, escape *e)
+{
+    for (i32 i = 0; i < c->nsections; i++) {
+        if (equals(nullterm(slice3(c->sections, 40*i, 40*i+8, e)), name)) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static s8 coffdata(coffobj *c, i32 sec, escape *e)
+{
+    iz  hdr  = 40*(sec - 1);
+    u32 size = readu32(c->sections, hdr+16, e);
+    u32 off  = readu32(c->sections, hdr+20, e);
+    return slice3(c->file, off, checkadd(off, size, e), e);
+}
+
+// Return the symbol index of the section's relocation at vaddr.
+static u32 coffreloc(coffobj *c, i32 sec, u32 vaddr, escape *e)
+{
+    iz  hdr     = 40*(sec - 1);
+    u32 off     = readu32(c->sections, hdr+24, e);
+    u16 nrelocs = readu16(c->sections, hdr+32, e);
+    s8  relocs  = slice3(c->file, off, off+10*nrelocs, e);
+    for (i32 i = 0; i < nrelocs; i++) {
+        if (readu32(relocs, 10*i, e) == vaddr) {
+            return readu32(relocs, 10*i+4, e);
+        }
+    }
+    throw(e, s8("missing COFF relocation"));
+}
+
+// Return the data at the named symbol defined in the object.
+static s8 coffdefinition(coffobj *c, s8 name, escape *e)
+{
+    for (u32 i = 0; i < c->nsymbols; i++) {
+        s8 sym = slice3(c->symbols, 18*i, 18*i+18, e);
+        i32 sec = (short)readu16(sym, 12, e);
+        if (sec>0 && sec<=c->nsections && equals(coffsymbol(c, i, e), name)) {
+            return slice2(coffdata(c, sec, e), readu32(sym, 8, e), e);
+        }
+        i += sym.data[17];  // skip auxiliary records
+    }
+    throw(e, s8("undefined COFF symbol"));
+}
+
+typedef struct arsymbol arsymbol;
+struct arsymbol {
+    arsymbol *child[4];
+    s8        name;
+    u32       member;
+    s8        dll;      // for dlltool heads, once resolved
+};
+
+// Iterate over the imports of an import library in archive symbol table
+// order. Members that are not imports, such as the regular objects in
+// a mixed static/import library, are skipped.
+typedef struct {
+    // Current import
+    s8        dll;
+    s8        name;     // null when imported by ordinal
+    u32       hint;     // ordinal when name is null, otherwise hint
+    i32       type;     // IMPORT_CODE, IMPORT_DATA, or IMPORT_CONST
+
+    // Iterator state
+    escape   *esc;
+    s8        file;
+    s8        offsets;
+    s8        strings;  // all symbol names
+    s8        names;    // names not yet visited
+    u32       nsymbols;
+    u32       index;
+    arsymbol *symbols;  // by name, built on first use
+} libiter;
+
+static libiter newlibiter(s8 file, arena *a)
+{
+    escape *esc = a->esc;
+    libiter r = {0};
+    r.esc  = esc;
+    r.file = file;
+    if (!isarchive(file)) {
+        throw(esc, s8("not an archive"));
+    } else if (file.len == 8) {
+        return r;  // empty archive
+    }
+
+    // The first linker member: big endian count, offsets, then names
+    s8 first = armember(file, 8, esc);
+    if (file.data[8]!='/' || file.data[9]!=' ') {
+        throw(esc, s8("archive has no symbol table"));
+    }
+    r.nsymbols = readbe32(first, 0, esc);
+    if (r.nsymbols > (uz)first.len/4) {
+        throw(esc, s8("invalid archive symbol count"));
+    }
+    r.offsets = slice3(first, 4, 4+4*(iz)r.nsymbols, esc);
+    r.strings = slice2(first, 4+4*(iz)r.nsymbols, esc);
+    r.names   = r.strings;
+    return r;
+}
+
+static arsymbol *arlookup(libiter *it, s8 name, arena *a)
+{
+    if (!it->symbols) {
+        s8 names = it->strings;
+        for (u32 i = 0; i < it->nsymbols && names.len; i++) {
+            s8 sym = nullterm(names);
+            names = slice2(names, sym.len+(sym.len<names.len), it->esc);
+            arsymbol **m = &it->symbols;
+            for (u64 h = hash64(sym); *m; h <<= 2) {
+                m = &(*m)->child[h>>62];
+            }
+            *m = new(a, 1, arsymbol);
+            (*m)->name   = sym;
+            (*m)->member = readbe32(it->offsets, 4*i, it->esc);
+        }
+    }
+
+    arsymbol *m = it->symbols;
+    for (u64 h = hash64(name); m; h <<= 2) {
+        if (equals(m->name, name)) {
+            return m;
+        }
+        m = m->child[h>>62];
+    }
+    throw(it->esc, s8("unresolved import library symbol"));
+}
+
+// Follow a dlltool head symbol to its DLL name.
+static s8 arheaddll(libiter *it, s8 head, arena *a)
+{
+    escape   *esc = it->esc;
+    arsymbol *h   = arlookup(it, head, a);
+    if (!h->dll.data) {
+        coffobj hobj = coffload(armember(it->file, h->member, esc), esc);
+        i32 idata2 = coffsection(&hobj, s8(".idata$2"), esc);
+        if (!idata2) {
+            throw(esc, s8("import head has no descriptor"));
+        }
+        s8 iname = coffsymbol(&hobj, coffreloc(&hobj, idata2, 12, esc), esc);
+
+        arsymbol *t = arlookup(it, iname, a);
+        coffobj tobj = coffload(armember(it->file, t->member, esc), esc);
+        h->dll = nullterm(coffdefinition(&tobj, iname, esc));
+    }
+    return h->dll;
+}
+
+// Strip the leading ?, @, or _ from a public symbol name.
+static s8 noprefix(s8 name)
+{
+    if (name.len && (*name.data=='?' || *name.data=='@' || *name.data=='_')) {
+        name.data++;
+        name.len--;
+    }
+    return name;
+}
+
+static b32 decodeshort(libiter *it, s8 m)
+{
+    escape *esc = it->esc;
+    u16 hint  = readu16(m, 16, esc);
+    u16 flags = readu16(m, 18, esc);
+    s8  rest  = slice2(m, 20, esc);
+    s8  sym   = nullterm(rest);
+    rest      = slice2(rest, sym.len+1, esc);
+    it->dll   = nullterm(rest);
+    it->hint  = hint;
+    it->type  = flags & 3;
+    if (it->type > IMPORT_CONST) {
+        throw(esc, s8("unknown import type"));
+    }
+
+    s8 null = {0};
+    switch (flags>>2 & 7) {
+    case 0:  // IMPORT_OBJECT_ORDINAL
+        it->name = null;
+        break;
+    case 1:  // IMPORT_OBJECT_NAME
+        it->name = sym;
+        break;
+    case 2:  // IMPORT_OBJECT_NAME_NO_PREFIX
+        it->name = noprefix(sym);
+        break;
+    case 3:  // IMPORT_OBJECT_NAME_UNDECORATE
+        it->name = noprefix(sym);
+        for (iz i = 0; i < it->name.len; i++) {
+            if (it->name.data[i] == '@') {
+                it->name.len = i;
+                break;
+            }
+        }
+        break;
+    case 4:  // IMPORT_OBJECT_NAME_EXPORTAS
+        it->name = nullterm(slice2(rest, it->dll.len+1, esc));
+        break;
+    default:
+        throw(esc, s8("unknown import name type"));
+    }
+    return 1;
+}
+
+static b32 decodedlltool(libiter *it, s8 m, arena *a)
+{
+    escape *esc = it->esc;
+    coffobj obj = coffload(m, esc);
+    i32 idata4  = coffsection(&obj, s8(".idata$4"), esc);
+    i32 idata6  = coffsection(&obj, s8(".idata$6"), esc);
+    i32 idata7  = coffsection(&obj, s8(".idata$7"), esc);
+    i32 text    = coffsection(&obj, s8(".text"), esc);
+    if (!idata4 || !idata7) {
+        return 0;  // not an import object
+    }
+
+    s8 head = coffsymbol(&obj, coffreloc(&obj, idata7, 0, esc), esc);
+    it->dll = arheaddll(it, head, a);
+
+    s8 null = {0};
+    if (idata6) {
+        s8 hintname = coffdata(&obj, idata6, esc);
+        it->hint = readu16(hintname, 0, esc);
+        it->name = nullterm(slice2(hintname, 2, esc));
+    } else {
+        it->hint = readu16(coffdata(&obj, idata4, esc), 0, esc);
+        it->name = null;
+    }
+    it->type = text && coffdata(&obj, text, esc).len ? IMPORT_CODE : IMPORT_DATA;
+    return 1;
+}
+
+static b32 nextlibimport(libiter *it, arena *a)
+{
+    escape *esc = it->esc;
+    s8 prefix = s8("__imp_");
+    while (it->index<it->nsymbols && it->names.len) {
+        u32 i   = it->index++;
+        s8  sym = nullterm(it->names);
+        it->names = slice2(it->names, sym.len+(sym.len<it->names.len), esc);
+        if (sym.len<=prefix.len || !equals(span(sym.data, sym.data+prefix.len), prefix)) {
+            continue;
+        }
+
+        s8 m = armember(it->file, readbe32(it->offsets, 4*i, esc), esc);
+        if (readu16(m, 0, esc)==0 && readu16(m, 2, esc)==0xffff) {
+            return decodeshort(it, m);
+        } else if (decodedlltool(it, m, a)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif
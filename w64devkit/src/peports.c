@@ -3,11 +3,21 @@
 //   $ peports c:/windows/system32/kernel32.dll
 //   $ peports -i main.exe    >imports.txt
 //   $ peports -e library.dll >exports.txt
+//   $ peports -d library.dll >library.def
+//   $ peports -m -L c:/windows/system32 main.exe
+//   $ peports -m -L c:/windows/system32 libuser32.a
+//   $ peports -j8 -i deploy/ >audit.txt
+//   $ peports -x exports.idx c:/windows/system32
+//   $ peports -w exports.idx CreateFileW GetProcAddress
+//   $ peports -C -e libstdc++-6.dll
+//   $ peports -c old/library.dll new/library.dll
 //
 // Compilation requires GCC or Clang. Behaves like "dumpbin /exports"
 // and "dumpbin /imports" from MSVC, but open source, standalone, and
-// much faster. For C++ symbols, consider piping output through c++filt
-// or vc++filt.
+// much faster. With -C, C++ symbols are demangled in-process, both MSVC
+// and Itanium (GCC, Clang), using demangle.h. Import libraries (.a,
+// .lib), whether short import format or dlltool objects, are read in
+// place and listed like an import table.
 //
 // Dynamic linking only permits ASCII for module and symbol names, and
 // both the MSVC and GNU toolchains sometimes choke on non-ASCII names.
@@ -24,143 +34,85 @@
 // from Windows' parsing of the same input. This is first and foremost a
 // debugging tool.
 //
-// Porting note: The platform layer implements osload and oswrite. To
-// run the application, it calls peports with command line arguments and
-// a scratch arena. The application calls osload and oswrite as needed
-// for reading file and writing output.
-//
-// Roadmap:
-// * Alternate format options? (e.g. DEF, a better gendef)
-// * A recursive option, to behave like a dependency walker?
-// * An option to automatically demangle C++ symbols?
+// Porting note: The platform layer implements the os* functions declared
+// below. To run the application, it calls peports with command line
+// arguments and a scratch arena. The application calls osload and
+// oswrite as needed for reading file and writing output. Input files are
+// mapped, or read into memory of their own when they cannot be, so the
+// arena only holds parse state. PE parsing itself lives in pe.h, a
+// header-only library usable by other tools.
 //
 // This is free and unencumbered software released into the public domain.
 
-#define assert(c)       while (!(c)) __builtin_unreachable()
-#define countof(a)      (iz)(sizeof(a) / sizeof(*(a)))
-#define new(a, n, t)    (t *)alloc(a, n, sizeof(t), _Alignof(t))
-#define s8(s)           (s8){(u8 *)s, countof(s)-1}
-#define catch(e)        __builtin_setjmp((e)->jmp)
-
-typedef unsigned char       u8;
-typedef unsigned short      u16;
-typedef   signed int        b32;
-typedef   signed int        i32;
-typedef unsigned int        u32;
-typedef unsigned short      char16_t;
-typedef          char16_t   c16;
-typedef __PTRDIFF_TYPE__    iz;
-typedef __SIZE_TYPE__       uz;
-typedef          char       byte;
-
-typedef struct {
-    u8 *data;
-    iz  len;
-} s8;
-
-typedef struct {
-    void *jmp[5];
-    s8    err;
-} escape;
-
-__attribute((noreturn))
-static void throw(escape *e, s8 reason)
-{
-    e->err = reason;
-    __builtin_longjmp(e->jmp, 1);
-}
+#include "pe.h"
+#include "demangle.h"
 
-typedef struct {
-    byte   *beg;
-    byte   *end;
-    escape *esc;
-} arena;
-
-// Read an entire file into memory. Returns a null string on error. The
-// information we care about is probably at the very beginning of the
-// file, so this function does not fill the whole arena but truncates as
-// necessary to leave an 8th or so of the remaining space for parsing.
-// Truncation is not an error. The special path "-" is standard input.
+// Map an entire file read-only into memory. Returns a null string on
+// error. The arena is only used for temporaries. The special path "-"
+// is standard input. Files that cannot be mapped, such as pipes, are
+// read into a buffer of their own that grows as needed.
 static s8 osload(arena *, s8);
 
+// Release a file loaded by osload, whether mapped or read.
+static void osunload(s8);
+
 // Write some bytes to standard output (1) or standard error (2).
 static b32 oswrite(i32, u8 *, i32);
 
-static byte *alloc(arena *a, iz count, iz size, iz align)
-{
-    assert(count >= 0);
-    iz pad = -(uz)a->beg & (align - 1);
-    if (count >= (a->end - a->beg - pad)/size) {
-        throw(a->esc, s8("out of memory"));
-    }
-    byte *r = a->beg + pad;
-    a->beg += pad + count*size;
-    return __builtin_memset(r, 0, count*size);
-}
-
-static s8 span(u8 *beg, u8 *end)
-{
-    assert(beg <= end);
-    s8 r = {0};
-    r.data = beg;
-    r.len = end - beg;
-    return r;
-}
-
-static b32 equals(s8 a, s8 b)
-{
-    if (a.len != b.len) {
-        return 0;
-    }
-    for (iz i = 0; i < a.len; i++) {
-        if (a.data[i] != b.data[i]) {
-            return 0;
-        }
-    }
-    return 1;
-}
+typedef struct direntry direntry;
+struct direntry {
+    direntry *next;
+    s8        name;
+    b32       isdir;
+};
 
-static s8 slice3(s8 s, iz beg, iz end, escape *e)
-{
-    if (beg<0 || beg>end || end>s.len) {
-        throw(e, s8("unexpected end of input (slice)"));
-    }
-    s.data += beg;
-    s.len = end - beg;
-    return s;
-}
+// List the entries of a directory, excluding "." and "..", in no
+// particular order. Returns false if the path cannot be listed as a
+// directory. The path must be null terminated. Symbolic links to
+// directories are not reported as directories.
+static b32 oslistdir(arena *, s8 path, direntry **);
 
-static s8 slice2(s8 s, iz beg, escape *e)
-{
-    return slice3(s, beg, s.len, e);
-}
+// Call fn once per argument, each on its own thread, returning after
+// all calls have returned.
+static void osparallel(void (*fn)(void *), void **args, i32 n);
 
-static u16 readu16(s8 s, iz off, escape *e)
-{
-    if (off > s.len-2) {
-        throw(e, s8("unexpected end of input (uint16)"));
-    }
-    u8 *p = s.data + off;
-    return (u16)((u16)p[1]<<8 | p[0]);
-}
+// Give up the rest of the time slice while waiting on another thread.
+static void osyield(void);
 
-static u32 readu32(s8 s, iz off, escape *e)
-{
-    if (off > s.len-4) {
-        throw(e, s8("unexpected end of input (uint32)"));
-    }
-    u8 *p = s.data + off;
-    return (u32)p[3]<<24 | (u32)p[2]<<16 | (u32)p[1]<<8 | p[0];
-}
+typedef struct {
+    u64 size;
+    u64 mtime;  // opaque, only compared for equality
+    b32 ok;
+} fileinfo;
+
+// Get the size and modification time of a file. The path must be null
+// terminated. The arena is only used for temporaries.
+static fileinfo osstat(arena *, s8 path);
+
+// Create or replace a file with the given contents. The path must be
+// null terminated. The arena is only used for temporaries.
+static b32 ossave(arena *, s8 path, s8 data);
+
+typedef struct demangled demangled;
+struct demangled {
+    demangled *child[4];
+    s8         name;
+    s8         text;  // null if not a mangled name
+};
+
+// Caches demangler results. C++ DLLs export many overloads and
+// instantiations, and a batch imports the same names over and over, so
+// most lookups are repeats, and a hash trie lookup is much cheaper than
+// demangling. The cache has its own arena and quietly stops growing
+// when that fills, so it never runs a file out of memory.
+typedef struct {
+    demangled *seen;
+    arena      perm;
+    u8        *mem;  // demangler working memory
+    iz         cap;
+} namecache;
 
-static s8 nullterm(s8 s)
-{
-    if (!s.data) return s;
-    iz len = 0;
-    for (; len<s.len && s.data[len]; len++) {}
-    s.len = len;
-    return s;
-}
+enum {DEMANGLE_MEM = 1<<18};
 
 typedef struct {
     u8 *buf;
@@ -168,12 +120,15 @@ typedef struct {
     i32 cap;
     i32 fd;
     b32 err;
+    i32 seq;    // output position in a batch
+    i32 *turn;  // if non-null, wait until *turn == seq to write
+    namecache *names;  // if non-null, demangle symbol names
 } u8buf;
 
-static u8buf newu8buf(arena *a, i32 fd)
+static u8buf newu8buf(arena *a, i32 fd, i32 cap)
 {
     u8buf b = {0};
-    b.cap = 1<<12;
+    b.cap = cap;
     b.buf = new(a, b.cap, u8);
     b.fd  = fd;
     return b;
@@ -182,6 +137,9 @@ static u8buf newu8buf(arena *a, i32 fd)
 static void flush(u8buf *b)
 {
     if (!b->err && b->len) {
+        while (b->turn && __atomic_load_n(b->turn, __ATOMIC_ACQUIRE)!=b->seq) {
+            osyield();
+        }
         b->err |= !oswrite(b->fd, b->buf, b->len);
         b->len = 0;
     }
@@ -232,64 +190,135 @@ static void printname(u8buf *b, s8 s)
     }
 }
 
-typedef struct {
-    u32 beg;
-    u32 end;
-    s8  mem;
-} region;
+static namecache *newnamecache(arena *a, iz cap)
+{
+    namecache *c = new(a, 1, namecache);
+    c->cap = DEMANGLE_MEM;
+    c->mem = new(a, c->cap, u8);
+    c->perm.beg = new(a, cap, byte);
+    c->perm.end = c->perm.beg + cap;
+    return c;
+}
 
-typedef struct {
-    region *regions;
-    i32     len;
-} vm;
+static s8 copy(arena *a, s8 s)
+{
+    s8 r = s;
+    r.data = new(a, s.len, u8);
+    if (s.len) __builtin_memcpy(r.data, s.data, s.len);
+    return r;
+}
 
-// Parsing a PE means simulating a loader. A virtual memory (vm) object
-// represents sections mapped into a virtual address space, and this
-// function reads regions out of that address space.
-static s8 loadrva(vm m, u32 vaddr, escape *e)
+// Returns the demangled name, or a null string if the name is not
+// mangled. The result is valid until the next call.
+static s8 demanglename(namecache *c, s8 name)
 {
     s8 r = {0};
-    for (i32 i = 0; i < m.len; i++) {
-        region s = m.regions[i];
-        if (vaddr>=s.beg && vaddr<s.end) {
-            r = slice3(s.mem, vaddr-s.beg, s.mem.len, e);
-            break;
+    b32 msvc    = name.len>1 && name.data[0]=='?';
+    b32 itanium = name.len>2 && name.data[0]=='_' && name.data[1]=='Z';
+    if (!msvc && !itanium) {
+        return r;
+    }
+
+    demangled **m = &c->seen;
+    for (u64 h = hash64(name); *m; h <<= 2) {
+        if (equals((*m)->name, name)) {
+            return (*m)->text;
         }
+        m = &(*m)->child[h>>62];
+    }
+
+    i32 flags = DEMANGLE_NOACCESS | DEMANGLE_UNDNAME;  // like vc++filt
+    dmname d = demangle(name.data, name.len, flags, c->mem, c->cap);
+    r.data = d.data;
+    r.len  = d.len;
+
+    iz need = (iz)sizeof(demangled) + name.len + r.len + 16;
+    if (need < c->perm.end - c->perm.beg) {
+        *m = new(&c->perm, 1, demangled);
+        (*m)->name = copy(&c->perm, name);
+        (*m)->text = r.data ? copy(&c->perm, r) : r;
     }
     return r;
 }
 
-// Throw an error if the result overflows. It would be better not to do
-// arithmetic on unsigned operands, but PE requires it.
-static u32 checkadd(u32 a, u32 b, escape *e)
+// Print a symbol name, demangled if the buffer has a name cache. The
+// brackets of demangled names print as-is.
+static void printsym(u8buf *b, s8 s)
 {
-    if (a > 0xffffffff-b) {
-        throw(e, s8("overflow computing 32-bit offset"));
+    s8 text = b->names ? demanglename(b->names, s) : (s8){0};
+    if (!text.data) {
+        return printname(b, s);
+    }
+    for (iz i = 0; i < text.len; i++) {
+        u8 c = text.data[i];
+        if (c<0x20 || c>0x7e) {
+            u8 encode[4] = "\\x..";
+            encode[2] = "0123456789abcdef"[c>>4];
+            encode[3] = "0123456789abcdef"[c&15];
+            print(b, span(encode, encode+countof(encode)));
+        } else {
+            print(b, span(&c, &c+1));
+        }
     }
-    return a + b;
 }
 
 static void usage(u8buf *b)
 {
     print(b, s8(
-        "usage: peports [-ehi] [files...]\n"
+        "usage: peports [-Cdehimr] [-f list] [-j N] [-L dir] [-x index] [files...]\n"
+        "       peports -c [-C] [-f list] [-j N] old new [old new...]\n"
+        "       peports -w index symbols...\n"
+        "  -C    demangle C++ symbol names (MSVC and Itanium)\n"
+        "  -c    compare exports and imports of each pair of files\n"
+        "  -d    print the exports as a module-definition (DEF) file\n"
         "  -e    print the export table\n"
+        "  -f    also read paths from a file, one per line (- for stdin)\n"
         "  -h    print this message\n"
         "  -i    print the import table\n"
-        "Prints export and import tables of EXEs and DLLs.\n"
+        "  -j    process files on N threads [1]\n"
+        "  -L    append a directory to the DLL search path (-m, -r)\n"
+        "  -m    list imports missing from the dependency closure\n"
+        "  -r    print the recursive dependency tree\n"
+        "  -w    print the indexed modules exporting each symbol\n"
+        "  -x    write an index of the inputs' exports, updating in place\n"
+        "Prints export and import tables of EXEs and DLLs, and the imports\n"
+        "provided by import libraries (.a, .lib) as an import table.\n"
         "Given no arguments, reads data from standard input.\n"
+        "Directories are searched recursively for EXEs, DLLs, and\n"
+        "libraries. Output is in input order regardless of thread count,\n"
+        "each file's headed by its path when there are several.\n"
+        "Dependencies are searched for in the root file's directory, as\n"
+        "the loader searches the application's, then in -L directories\n"
+        "in order. API sets are assumed present.\n"
+        "An index records paths as given, and updating it only parses\n"
+        "files whose size or modification time changed.\n"
+        "A comparison prints removed (-), renumbered (!), and added (+)\n"
+        "exports and imports, and exits with failure if any pair differs.\n"
     ));
 }
 
 typedef struct {
     u8buf *out;
     u8buf *err;
+    s8    *dirs;
+    i32    ndirs;
+    s8    *lists;
+    i32    nlists;
+    s8     index;
+    b32    query;
+    i32    nthreads;
     i32    optind;
+    b32    compare;
+    b32    def;
+    b32    demangle;
     b32    exports;
     b32    imports;
+    b32    missing;
+    b32    recursive;
 } config;
 
 enum {OPT_OK, OPT_EXIT, OPT_ERR};
+enum {MAX_THREADS = 64};
 
 static i32 parseopts(config *c, i32 argc, s8 *argv)
 {
@@ -298,7 +327,34 @@ static i32 parseopts(config *c, i32 argc, s8 *argv)
         if (!arg.len || arg.data[0]!='-') break;
         for (iz i = 1; i < arg.len; i++) {
             u8 x = arg.data[i];
+
+            s8 value = {0};
+            if (x=='f' || x=='j' || x=='L' || x=='w' || x=='x') {
+                if (i+1 < arg.len) {
+                    value = span(arg.data+i+1, arg.data+arg.len);
+                } else if (c->optind+1 < argc) {
+                    value = argv[++c->optind];
+                } else {
+                    print(c->err, s8("peports: missing argument: -"));
+                    print(c->err, span(&x, &x+1));
+                    print(c->err, s8("\n"));
+                    usage(c->err);
+                    flush(c->err);
+                    return OPT_ERR;
+                }
+                i = arg.len;  // consumed the rest of the argument
+            }
+
             switch (x) {
+            case 'C':
+                c->demangle = 1;
+                break;
+            case 'c':
+                c->compare = 1;
+                break;
+            case 'd':
+                c->def = 1;
+                break;
             case 'e':
                 c->exports = 1;
                 break;
@@ -309,6 +365,40 @@ static i32 parseopts(config *c, i32 argc, s8 *argv)
             case 'i':
                 c->imports = 1;
                 break;
+            case 'f':
+                c->lists[c->nlists++] = value;
+                break;
+            case 'j':
+                c->nthreads = 0;
+                for (iz d = 0; d < value.len; d++) {
+                    u8 v = value.data[d] - '0';
+                    c->nthreads = v>9 ? 0 : c->nthreads*10 + v;
+                    if (!c->nthreads || c->nthreads>MAX_THREADS) {
+                        print(c->err, s8("peports: invalid thread count: "));
+                        print(c->err, value);
+                        print(c->err, s8("\n"));
+                        flush(c->err);
+                        return OPT_ERR;
+                    }
+                }
+                break;
+            case 'L':
+                c->dirs[c->ndirs++] = value;
+                break;
+            case 'm':
+                c->missing = 1;
+                break;
+            case 'r':
+                c->recursive = 1;
+                break;
+            case 'w':
+                c->index = value;
+                c->query = 1;
+                break;
+            case 'x':
+                c->index = value;
+                c->query = 0;
+                break;
             default:
                 print(c->err, s8("peports: unknown option: -"));
                 print(c->err, span(&x, &x+1));
@@ -320,355 +410,1971 @@ static i32 parseopts(config *c, i32 argc, s8 *argv)
         }
     }
 
-    if (!c->imports && !c->exports) {
+    if (!c->imports && !c->exports && !c->missing && !c->recursive && !c->def) {
         c->imports = c->exports = 1;
     }
     return OPT_OK;
 }
 
-static void processpe(s8 dll, config conf, arena scratch)
+// Print an import library's records like an import table, one module
+// heading per run of imports from the same DLL.
+static void processlib(s8 lib, config conf, arena scratch)
 {
-    u8buf  *out = conf.out;
-    escape *esc = scratch.esc;
-
-    u32 peoff = readu32(dll, 0x3c, esc);
-    s8  pe    = slice2(dll, peoff, esc);
-    s8  pehdr = slice3(pe, 0, 4, esc);
-    if (!equals(s8("PE\0\0"), pehdr)) {
-        throw(esc, s8("not a PE file"));
-    }
-
-    u16 nsections = readu16(pe, 4+ 2, esc);
-    u16 hdrsize   = readu16(pe, 4+16, esc);
-
-    enum { PE32, PE64 };
-    u16 magic = readu16(pe, 4+20, esc);
-    i32 type = -1;
-    switch (magic) {
-    default:     throw(esc, s8("unknown PE magic"));
-    case 0x010b: type = PE32; break;
-    case 0x020b: type = PE64; break;
-    }
-
-    vm map       = {0};
-    i32 loadlen  = nsections>96 ? 96 : nsections;
-    map.regions  = new(&scratch, loadlen, region);
-    s8  sections = slice2(pe, 4+20+hdrsize, esc);
-    for (i32 i = 0; i < loadlen; i++) {
-        u32 vsize = readu32(sections, 40*i+ 8, esc);
-        u32 vaddr = readu32(sections, 40*i+12, esc);
-        u32 rsize = readu32(sections, 40*i+16, esc);
-        u32 raddr = readu32(sections, 40*i+20, esc);
-
-        i32 r = map.len++;
-        map.regions[r].beg = vaddr;
-        map.regions[r].end = checkadd(vaddr, vsize, esc);
-        if (r) {
-            region prev = map.regions[r-1];
-            if (prev.beg>=vaddr || prev.end>vaddr) {
-                throw(esc, s8("invalid section order"));
-            }
+    u8buf *out = conf.out;
+    s8     dll = {0};
+    for (libiter it = newlibiter(lib, &scratch); nextlibimport(&it, &scratch);) {
+        if (!dll.data || !equals(dll, it.dll)) {
+            dll = it.dll;
+            printname(out, dll);
+            print(out, s8("\n"));
         }
-
-        u32 rend = checkadd(raddr, rsize, esc);
-        map.regions[r].mem = slice3(dll, raddr, rend, esc);
-        if (vsize > rsize) {
-            // Padded sections (e.g. .bss) unlikely interesting: discard
-            map.len--;
-        } else if (vsize < rsize) {
-            // Truncated sections *are* usually interesting. Go figure.
-            map.regions[r].mem.len = vsize;
+        print(out, s8("\t"));
+        printu32(out, it.hint);
+        if (!it.name.data) {
+            print(out, s8("\t<NONAME>"));
+        } else {
+            print(out, s8("\t"));
+            printsym(out, it.name);
+        }
+        switch (it.type) {
+        case IMPORT_CODE:  break;
+        case IMPORT_DATA:  print(out, s8(" <DATA>"));  break;
+        case IMPORT_CONST: print(out, s8(" <CONST>")); break;
         }
+        print(out, s8("\n"));
     }
+}
 
-    u32 edataoff = readu32(pe, 24+(type==PE32 ?  96 : 112), esc);
-    u32 edatalen = readu32(pe, 24+(type==PE32 ? 100 : 116), esc);
-    u32 edataend = checkadd(edataoff, edatalen, esc);
-    s8  edata    = loadrva(map, edataoff, esc);
-
-    if (conf.exports && edatalen) {
-        print(out, s8("EXPORTS\n"));
-
-        u32 ordbase = readu32(edata, 4*4, esc);
-        i32 naddrs  = readu32(edata, 5*4, esc);
-        i32 nnames  = readu32(edata, 6*4, esc);
-        if (naddrs<0 || nnames<0) {
-            throw(esc, s8("invalid export count"));
+static void processpe(s8 dll, config conf, arena scratch)
+{
+    if (isarchive(dll)) {
+        if (conf.imports) {
+            processlib(dll, conf, scratch);
         }
+        return;
+    }
 
-        // If naddrs is huge, this will fail here with OOM
-        u8 *seen = new(&scratch, naddrs, u8);
-
-        u32 addrsoff = readu32(edata, 7*4, esc);
-        s8  addrs    = loadrva(map, addrsoff, esc);
-        u32 namesoff = readu32(edata, 8*4, esc);
-        s8  names    = loadrva(map, namesoff, esc);
-        u32 ordsoff  = readu32(edata, 9*4, esc);
-        s8  ordinals = loadrva(map, ordsoff, esc);
-
-        // If nnames is huge, the loop will EOF before overflow
-        for (i32 i = 0; i < nnames; i++) {
-            u16 ordinal = readu16(ordinals, i*2, esc);
-            if (ordinal >= naddrs) {
-                throw(esc, s8("invalid export ordinal"));
-            }
-            seen[ordinal] = 1;
-
-            // If RVA points in .edata it's a forwarder name
-            s8 module = {0};
-            u32 addr = readu32(addrs, ordinal*4, esc);
-            if (addr>=edataoff && addr<edataend) {
-                module = nullterm(loadrva(map, addr, esc));
-            }
+    u8buf  *out = conf.out;
+    peimage pe  = peload(dll, &scratch);
 
+    if (conf.exports && pedirectory(&pe, PEDIR_EXPORT).len) {
+        exportiter exports = newexportiter(&pe, &scratch);
+        print(out, s8("EXPORTS\n"));
+        while (nextexport(&exports)) {
             print(out, s8("\t"));
-            u32 ordend = checkadd(ordinal, ordbase, esc);
-            printu32(out, ordend);
+            printu32(out, exports.ordinal);
+            if (!exports.name.data) {
+                print(out, s8("\t<NONAME>\n"));
+                continue;
+            }
             print(out, s8("\t"));
-
-            u32 off = readu32(names, i*4, esc);
-            s8 name = nullterm(loadrva(map, off, esc));
-            printname(out, name);
-            if (module.data) {
+            printsym(out, exports.name);
+            if (exports.forward.data) {
                 print(out, s8(" <"));
-                printname(out, module);
+                printname(out, exports.forward);
                 print(out, s8(">"));
             }
             print(out, s8("\n"));
         }
+    }
 
-        for (i32 i = 0; i < naddrs; i++) {
-            if (!seen[i]) {
+    importiter imports = newimportiter(&pe, &scratch);
+    while (conf.imports && nextmodule(&imports)) {
+        printname(out, imports.module);
+        print(out, s8("\n"));
+        while (nextimport(&imports)) {
+            print(out, s8("\t"));
+            printu32(out, imports.hint);
+            if (!imports.name.data) {
+                print(out, s8("\t<NONAME>"));
+            } else {
                 print(out, s8("\t"));
-                printu32(out, checkadd(i, ordbase, esc));
-                print(out, s8("\t<NONAME>\n"));
+                printsym(out, imports.name);
             }
+            print(out, s8("\n"));
         }
     }
+}
 
-    u32 idataoff = readu32(pe, 24+(type==PE32 ? 104 : 120), esc);
-    u32 idatalen = readu32(pe, 24+(type==PE32 ? 108 : 124), esc);
-    s8  idata    = loadrva(map, idataoff, esc);
-
-    if (conf.imports && idatalen) {
-        // The PE specification says the last import directory table
-        // entry is all zeros, indicating the directory end. However,
-        // MSVC link.exe is buggy and does not reliably produce this
-        // null entry. Instead the directory runs into import lookup
-        // tables and string table, causing the directory to read as
-        // garbage. We have two workarounds:
-        //
-        // 1. Track the earliest import lookup table RVA, and stop
-        //    reading if the directory would overlap it.
-        // 2. Don't treat garbage RVA fields as errors, just stop
-        //    reading the table (Binutils strategy).
-        //
-        // This issue was crashing objdump back in 2005. See Binutils
-        // commit a50b216054a4.
-        u32 firsttable = -1;
-
-        for (i32 i = 0;; i++) {
-            if (idataoff + i*20 == firsttable) {
-                // Probably the link.exe bug. We're now overlapping an
-                // import lookup table, so stop reading the import
-                // directory. The left-side sum might overflow, but
-                // that's fine. This is just a heuristic.
-                break;
-            }
-
-            u32 tableoff = readu32(idata, i*20+ 0, esc);
-            u32 nameoff  = readu32(idata, i*20+12, esc);
-            if (!tableoff || !nameoff) break;
+static s8 concat(arena *a, s8 head, s8 tail)
+{
+    s8 r = {0};
+    r.data = new(a, head.len+tail.len, u8);
+    if (head.len) __builtin_memcpy(r.data, head.data, head.len);
+    if (tail.len) __builtin_memcpy(r.data+head.len, tail.data, tail.len);
+    r.len = head.len + tail.len;
+    return r;
+}
 
-            s8 name = nullterm(loadrva(map, nameoff, esc));
-            if (!name.data) break;  // ignore link.exe bug
+// Module names are case-insensitive, and only ASCII is permitted.
+static s8 lowercase(arena *a, s8 s)
+{
+    s8 r = concat(a, s, (s8){0});
+    for (iz i = 0; i < r.len; i++) {
+        u8 c = r.data[i];
+        r.data[i] = c>='A' && c<='Z' ? c+'a'-'A' : c;
+    }
+    return r;
+}
 
-            printname(out, name);
-            print(out, s8("\n"));
+static s8 dirname(s8 path)
+{
+    iz len = path.len;
+    while (len>0 && path.data[len-1]!='/' && path.data[len-1]!='\\') {
+        len--;
+    }
+    path.len = len ? len-1 : 0;
+    if (!len) path = s8(".");
+    return path;
+}
 
-            s8 table = loadrva(map, tableoff, esc);
-            if (!table.data) break;  // ignore link.exe bug
-            firsttable = firsttable<tableoff ? firsttable : tableoff;
-
-            for (i32 j = 0;; j++) {
-                u32 addr = 0;
-                switch (type) {
-                case PE32:
-                    addr  = readu32(table, j*4, esc);
-                    break;
-                case PE64:
-                    addr  = readu32(table, j*8+4, esc);
-                    addr |= readu32(table, j*8+0, esc);
-                    break;
-                }
-                if (!addr) break;
+static s8 basename(s8 path)
+{
+    iz len = path.len;
+    while (len>0 && path.data[len-1]!='/' && path.data[len-1]!='\\') {
+        len--;
+    }
+    return span(path.data+len, path.data+path.len);
+}
 
-                print(out, s8("\t"));
-                if (addr>>31) {
-                    printu32(out, addr&0x7fffffff);
-                    print(out, s8("\t<NONAME>"));
-                } else {
-                    s8 entry = loadrva(map, addr, esc);
-                    u16 hint = readu16(entry, 0, esc);
-                    printu32(out, hint);
-                    print(out, s8("\t"));
-                    s8  name = nullterm(slice2(entry, 2, esc));
-                    printname(out, name);
-                }
-                print(out, s8("\n"));
-            }
+// Exports outside executable sections are data.
+static b32 isdata(peimage *pe, u32 rva)
+{
+    enum { SCN_CNT_CODE = 0x20, SCN_MEM_EXECUTE = 0x20000000 };
+    for (i32 i = 0; i < pe->nsections; i++) {
+        pesection *s = pe->sections + i;
+        u32 size = s->vsize ? s->vsize : s->rsize;
+        if (rva>=s->vaddr && rva-s->vaddr<size) {
+            return !(s->flags & (SCN_CNT_CODE|SCN_MEM_EXECUTE));
         }
     }
+    return 0;
 }
 
-static void processpath(s8 path, config conf, arena scratch)
+// A DEF file has no escapes, so names are written verbatim. One that
+// would not read back as the same token is an error, not a different
+// symbol. Quoted names may contain spaces.
+static void printdefname(u8buf *out, s8 name, b32 quoted, escape *esc)
 {
-    s8 dll = osload(&scratch, path);
-    if (!dll.data) {
-        throw(scratch.esc, s8("could not load file"));
+    b32 ok = name.len > 0;
+    for (iz i = 0; i < name.len; i++) {
+        u8 c = name.data[i];
+        ok &= c>=' ' && c!=0x7f && c!='"';
+        ok &= quoted || (c!=' ' && c!=',' && c!=';' && c!='=');
+    }
+    if (!ok) {
+        throw(esc, s8("name not representable in a DEF file"));
     }
-    processpe(dll, conf, scratch);
+    print(out, name);
 }
 
-static b32 peports(i32 argc, s8 *argv, arena scratch)
+static void printdef(u8buf *out, s8 name, s8 forward, u32 ordinal,
+                     b32 byordinal, b32 data, escape *esc)
 {
-    b32   ok     = 1;
-    u8buf out[1] = {newu8buf(&scratch, 1)};
-    u8buf err[1] = {newu8buf(&scratch, 2)};
-
-    config conf = {0};
-    conf.out = out;
-    conf.err = err;
-    switch (parseopts(&conf, argc, argv)) {
-    case OPT_OK:   break;
-    case OPT_EXIT: return 1;
-    case OPT_ERR:  return 0;
+    if (name.data) {
+        printdefname(out, name, 0, esc);
+    } else {
+        print(out, s8("ord_"));  // placeholder, as dlltool names them
+        printu32(out, ordinal);
     }
-
-    if (conf.optind == argc) {
-        static s8 fakeargv[] = {s8("peports"), s8("-")};
-        argc = countof(fakeargv);
-        argv = fakeargv;
-        conf.optind = 1;
+    if (forward.data) {
+        print(out, s8(" = "));
+        printdefname(out, forward, 0, esc);
     }
-
-    escape esc = {0};
-    scratch.esc = &esc;
-    for (i32 i = conf.optind; i < argc; i++) {
-        if (catch(&esc)) {
-            flush(out);
-            print(err, s8("peports: "));
-            print(err, esc.err);
-            print(err, s8(": "));
-            print(err, argv[i]);  // NOTE: UTF-8
-            print(err, s8("\n"));
-            flush(err);
-            ok &= 1;
-            continue;
+    if (byordinal) {
+        print(out, s8(" @"));
+        printu32(out, ordinal);
+        if (!name.data) {
+            print(out, s8(" NONAME"));
         }
-        processpath(argv[i], conf, scratch);
     }
+    if (data) {
+        print(out, s8(" DATA"));
+    }
+    print(out, s8("\n"));
+}
 
-    flush(out);
-    ok &= !out->err;
-    return ok;
+static void printlibrary(u8buf *out, s8 name, escape *esc)
+{
+    print(out, s8("LIBRARY \""));
+    printdefname(out, name, 1, esc);
+    print(out, s8("\"\nEXPORTS\n"));
 }
 
+// Print the exports as a module-definition file, suitable for building
+// an import library with dlltool or lib. Unlike gendef, which guesses
+// from the code, exports are DATA when outside executable sections. An
+// import library converts back to a DEF file for each DLL it names.
+static void processdef(s8 file, s8 path, config conf, arena scratch)
+{
+    u8buf *out = conf.out;
+    s8     null = {0};
+
+    if (isarchive(file)) {
+        s8 dll = {0};
+        for (libiter it = newlibiter(file, &scratch); nextlibimport(&it, &scratch);) {
+            if (!dll.data || !equals(dll, it.dll)) {
+                dll = it.dll;
+                printlibrary(out, dll, scratch.esc);
+            }
+            b32 data = it.type != IMPORT_CODE;
+            printdef(out, it.name, null, it.hint, !it.name.data, data, scratch.esc);
+        }
+        return;
+    }
 
-#if _WIN32
-// $ gcc -nostartfiles -o peports.exe peports.c
-// $ clang-cl peports.c /link /subsystem:console
-//            kernel32.lib shell32.lib libvcruntime.lib
+    peimage    pe = peload(file, &scratch);
+    exportiter it = newexportiter(&pe, &scratch);
+    printlibrary(out, it.module.len ? it.module : basename(path), scratch.esc);
+    while (nextexport(&it)) {
+        if (it.rva) {  // zero marks an unused ordinal
+            b32 data = !it.forward.data && isdata(&pe, it.rva);
+            printdef(out, it.name, it.forward, it.ordinal, 1, data, scratch.esc);
+        }
+    }
+}
 
-#define W32(r) __declspec(dllimport) r __stdcall
-W32(b32)    CloseHandle(uz);
-W32(c16 **) CommandLineToArgvW(c16 *, i32 *);
-W32(b32)    CreateFileW(c16 *, i32, i32, uz, i32, i32, uz);
-W32(void)   ExitProcess(i32) __attribute((noreturn));
-W32(c16 *)  GetCommandLineW(void);
-W32(uz)     GetStdHandle(i32);
-W32(i32)    MultiByteToWideChar(i32, i32, u8 *, i32, c16 *, i32);
-W32(b32)    ReadFile(uz, u8 *, i32, i32 *, uz);
-W32(i32)    WideCharToMultiByte(i32, i32, c16 *, i32, u8 *, i32, uz, uz);
-W32(b32)    WriteFile(uz, u8 *, i32, i32 *, uz);
+typedef struct symbol symbol;
+struct symbol {
+    symbol *child[4];
+    s8      name;
+};
 
-static i32 truncsize(iz len, i32 max)
+// Insert the name into the set, returning true if it was already present.
+// Given no arena, only tests for membership.
+static b32 upsertsym(symbol **m, s8 name, arena *a)
 {
-    return max<len ? max : (i32)len;
+    for (u64 h = hash64(name); *m; h <<= 2) {
+        if (equals((*m)->name, name)) {
+            return 1;
+        }
+        m = &(*m)->child[h>>62];
+    }
+    if (a) {
+        *m = new(a, 1, symbol);
+        (*m)->name = name;
+    }
+    return 0;
 }
 
-static s8 osload(arena *a, s8 path)
+typedef struct import import;
+struct import {
+    import *next;
+    s8      name;  // null for ordinal imports
+    u32     hint;
+};
+
+typedef struct module module;
+
+typedef struct dep dep;
+struct dep {
+    dep    *next;
+    s8      name;
+    import *symbols;
+    module *module;  // resolved by the walker
+};
+
+enum { MOD_OK, MOD_NOTFOUND, MOD_APISET, MOD_BAD };
+
+struct module {
+    module *child[4];
+    module *next;      // load order, for releasing files
+    s8      file;
+    s8      key;       // lowercase name
+    s8      name;      // as first referenced
+    s8      path;
+    s8      err;       // reason for MOD_BAD
+    dep    *deps;
+    symbol *exports;
+    u8     *live;      // per ordinal, nonzero if its RVA is
+    u32     ordbase;
+    u32     naddrs;
+    i32     status;
+    b32     printed;
+    b32     checked;
+};
+
+// Memoizes the import closure: every module is found, loaded, and
+// parsed at most once no matter how many times it's imported.
+typedef struct {
+    module *modules;
+    module *loaded;
+    s8     *dirs;
+    i32     ndirs;
+    b32     wantexports;
+} walker;
+
+static b32 apiset(s8 key)
 {
-    enum {
-        FILE_ATTRIBUTE_NORMAL   = 0x80,
-        FILE_SHARE_ALL          = 7,
-        GENERIC_READ            = 0x80000000,
-        OPEN_EXISTING           = 3,
-    };
-    s8 r       = {0};
-    b32 close  = 0;
-    uz  handle = -1;
+    s8 api = s8("api-ms-");
+    s8 ext = s8("ext-ms-");
+    return key.len>api.len && (equals(span(key.data, key.data+api.len), api) ||
+                               equals(span(key.data, key.data+ext.len), ext));
+}
 
-    if (equals(path, s8("-"))) {
-        handle = GetStdHandle(-10);
+// Load and parse a module, recording its imports and exports. Errors
+// are confined to the module, recorded as MOD_BAD.
+static void loadmodule(walker *w, module *m, s8 path, s8 file, arena *perm)
+{
+    escape esc  = {0};
+    arena  temp = *perm;
+    temp.esc = &esc;
+    if (catch(&esc)) {
+        m->status = MOD_BAD;
+        m->err = esc.err;
+        return;
+    }
 
-    } else {
-        arena scratch = *a;
+    m->path = path;
+    if (isarchive(file)) {
+        // An import library is the root of a closure of link inputs
+        for (libiter it = newlibiter(file, &temp); nextlibimport(&it, &temp);) {
+            dep **d = &m->deps;
+            for (; *d && !equals((*d)->name, it.dll); d = &(*d)->next) {}
+            if (!*d) {
+                *d = new(&temp, 1, dep);
+                (*d)->name = it.dll;
+            }
+            import *i = new(&temp, 1, import);
+            i->name = it.name;
+            i->hint = it.hint;
+            i->next = (*d)->symbols;
+            (*d)->symbols = i;
+        }
+        for (dep *d = m->deps; d; d = d->next) {
+            import *list = 0;  // restore archive order
+            while (d->symbols) {
+                import *i = d->symbols;
+                d->symbols = i->next;
+                i->next = list;
+                list = i;
+            }
+            d->symbols = list;
+        }
+        m->status = MOD_OK;
+        perm->beg = temp.beg;  // commit
+        return;
+    }
 
-        assert((i32)path.len == path.len);
-        i32  len   = (i32)path.len;
-        i32  wlen  = MultiByteToWideChar(65001, 0, path.data, len, 0, 0);
-        c16 *wpath = new(&scratch, wlen+1, c16);
-        MultiByteToWideChar(65001, 0, path.data, len, wpath, wlen);
+    peimage pe = peload(file, &temp);
 
-        handle = CreateFileW(
-            wpath,
-            GENERIC_READ,
-            FILE_SHARE_ALL,
-            0,
-            OPEN_EXISTING,
-            FILE_ATTRIBUTE_NORMAL,
-            0
-        );
-        if (handle == (uz)-1) {
-            return r;
+    exportiter exports = newexportiter(&pe, &temp);
+    m->ordbase = exports.ordbase;
+    m->naddrs  = exports.naddrs;
+    m->live    = new(&temp, w->wantexports ? exports.naddrs : 0, u8);
+    while (w->wantexports && nextexport(&exports)) {
+        m->live[exports.ordinal - exports.ordbase] = !!exports.rva;
+        if (exports.name.data) {
+            upsertsym(&m->exports, exports.name, &temp);
         }
-        close = 1;
     }
 
-    r.data = (u8 *)a->beg;
-    iz avail = a->end - a->beg;
-    avail -= avail / 8;  // don't fill the arena to the brim
-    for (;;) {
-        i32 max = 1<<21;
-        i32 len;
-        ReadFile(handle, r.data+r.len, truncsize(avail-r.len, max), &len, 0);
-        if (len < 1) break;
-        r.len += len;
+    dep **tail = &m->deps;
+    importiter imports = newimportiter(&pe, &temp);
+    while (nextmodule(&imports)) {
+        dep *d = new(&temp, 1, dep);
+        d->name = imports.module;
+        *tail = d;
+        tail = &d->next;
+        import **last = &d->symbols;
+        while (nextimport(&imports)) {
+            import *i = new(&temp, 1, import);
+            i->name = imports.name;
+            i->hint = imports.hint;
+            *last = i;
+            last = &i->next;
+        }
     }
-    a->beg += r.len;
 
-    if (close) CloseHandle(handle);
-    return r;
+    m->status = MOD_OK;
+    perm->beg = temp.beg;  // commit
 }
 
-static b32 oswrite(i32 fd, u8 *buf, i32 len)
+// Find the module by name, loading it from the first search directory
+// containing it. Like the loader, the application's directory, that of
+// the root of the closure, is searched first.
+static module *resolve(walker *w, s8 name, s8 appdir, arena *perm)
 {
-    uz h = GetStdHandle(-10 - fd);
-    return WriteFile(h, buf, len, &len, 0);
+    arena   scratch = *perm;
+    s8      key     = lowercase(&scratch, name);
+    module **m      = &w->modules;
+    for (u64 h = hash64(key); *m; h <<= 2) {
+        if (equals((*m)->key, key)) {
+            return *m;
+        }
+        m = &(*m)->child[h>>62];
+    }
+
+    *perm = scratch;  // keep the key
+    *m = new(perm, 1, module);
+    (*m)->key = key;
+    (*m)->name = name;
+    (*m)->status = MOD_NOTFOUND;
+    if (apiset(key)) {
+        (*m)->status = MOD_APISET;
+        return *m;
+    }
+
+    for (i32 i = -1; i < w->ndirs; i++) {
+        s8 dir = i<0 ? appdir : w->dirs[i];
+        for (i32 lower = 0; lower < 2; lower++) {
+            if (lower && equals(name, key)) {
+                break;
+            }
+            scratch = *perm;
+            s8 path = concat(&scratch, dir, s8("/"));
+            path = concat(&scratch, path, lower ? key : name);
+            path = concat(&scratch, path, s8("\0"));
+            path.len--;
+            s8 file = osload(&scratch, path);
+            if (file.data) {
+                *perm = scratch;
+                (*m)->file = file;
+                (*m)->next = w->loaded;
+                w->loaded = *m;
+                loadmodule(w, *m, path, file, perm);
+                return *m;
+            }
+        }
+    }
+    return *m;
 }
 
-__attribute((force_align_arg_pointer))
-void mainCRTStartup(void)
+static void printindent(u8buf *out, i32 depth)
 {
-    static byte mem[sizeof(uz)<<26];  // 256/512 MiB
-    arena scratch = {0};
-    scratch.beg = mem;
-    asm ("" : "+r"(scratch.beg));  // launder the pointer
-    scratch.end = scratch.beg + countof(mem);
+    for (i32 i = 0; i < depth; i++) {
+        print(out, s8("\t"));
+    }
+}
 
-    c16  *cmd   = GetCommandLineW();
-    i32   argc  = 0;
+// Print each module's dependencies, expanding each module only at its
+// first appearance in the tree.
+static void printtree(walker *w, module *m, s8 appdir, i32 depth,
+                      u8buf *out, arena *perm)
+{
+    m->printed = 1;
+    for (dep *d = m->deps; d; d = d->next) {
+        d->module = resolve(w, d->name, appdir, perm);
+        printindent(out, depth);
+        printname(out, d->name);
+        switch (d->module->status) {
+        case MOD_OK:
+            print(out, s8(" <"));
+            print(out, d->module->path);  // NOTE: UTF-8
+            print(out, s8(">\n"));
+            if (!d->module->printed) {
+                printtree(w, d->module, appdir, depth+1, out, perm);
+            }
+            break;
+        case MOD_NOTFOUND:
+            print(out, s8(" <NOTFOUND>\n"));
+            break;
+        case MOD_APISET:
+            print(out, s8(" <APISET>\n"));
+            break;
+        case MOD_BAD:
+            print(out, s8(" <ERROR: "));
+            print(out, d->module->err);
+            print(out, s8(">\n"));
+            break;
+        }
+    }
+}
+
+// An ordinal import needs an export slot in use, as a zero RVA marks
+// an unused ordinal.
+static b32 resolved(module *m, import *i)
+{
+    if (!i->name.data) {
+        u32 slot = i->hint - m->ordbase;
+        return i->hint>=m->ordbase && slot<m->naddrs && m->live[slot];
+    }
+    return upsertsym(&m->exports, i->name, 0);
+}
+
+// List every import in the closure that cannot be satisfied, one per
+// line: importer, module, then hint and symbol like the import table.
+// Returns false if anything is missing.
+static b32 printmissing(walker *w, module *m, s8 appdir, u8buf *out,
+                        arena *perm)
+{
+    b32 ok = 1;
+    m->checked = 1;
+    for (dep *d = m->deps; d; d = d->next) {
+        module *target = d->module = resolve(w, d->name, appdir, perm);
+        switch (target->status) {
+        case MOD_APISET:
+            continue;
+        case MOD_NOTFOUND:
+            ok = 0;
+            printname(out, m->name);
+            print(out, s8("\t"));
+            printname(out, d->name);
+            print(out, s8("\t<NOTFOUND>\n"));
+            continue;
+        case MOD_BAD:
+            ok = 0;
+            printname(out, m->name);
+            print(out, s8("\t"));
+            printname(out, d->name);
+            print(out, s8("\t<ERROR: "));
+            print(out, target->err);
+            print(out, s8(">\n"));
+            continue;
+        case MOD_OK:
+            break;
+        }
+
+        for (import *i = d->symbols; i; i = i->next) {
+            if (!resolved(target, i)) {
+                ok = 0;
+                printname(out, m->name);
+                print(out, s8("\t"));
+                printname(out, d->name);
+                print(out, s8("\t"));
+                printu32(out, i->hint);
+                print(out, s8("\t"));
+                if (i->name.data) {
+                    printsym(out, i->name);
+                } else {
+                    print(out, s8("<NONAME>"));
+                }
+                print(out, s8("\n"));
+            }
+        }
+        if (!target->checked) {
+            ok &= printmissing(w, target, appdir, out, perm);
+        }
+    }
+    return ok;
+}
+
+static void unloadall(walker *w)
+{
+    for (module *m = w->loaded; m; m = m->next) {
+        osunload(m->file);
+    }
+    w->loaded = 0;
+}
+
+// Walk the import closure of the file, reporting as configured.
+static b32 processclosure(s8 path, s8 file, config conf, arena scratch)
+{
+    b32 ok = 1;
+    walker w = {0};
+    w.dirs  = conf.dirs;
+    w.ndirs = conf.ndirs;
+    w.wantexports = conf.missing;
+
+    escape *outer = scratch.esc;
+    escape  esc   = {0};
+    scratch.esc = &esc;
+    if (catch(&esc)) {
+        unloadall(&w);
+        throw(outer, esc.err);
+    }
+
+    module *root = new(&scratch, 1, module);
+    root->name = basename(path);
+    root->key  = lowercase(&scratch, root->name);
+    loadmodule(&w, root, path, file, &scratch);
+    if (root->status == MOD_BAD) {
+        throw(scratch.esc, root->err);
+    }
+
+    s8 appdir = dirname(root->path);
+    if (conf.recursive) {
+        printname(conf.out, root->name);
+        print(conf.out, s8("\n"));
+        printtree(&w, root, appdir, 1, conf.out, &scratch);
+    }
+    if (conf.missing) {
+        ok &= printmissing(&w, root, appdir, conf.out, &scratch);
+    }
+    unloadall(&w);
+    return ok;
+}
+
+static b32 processpath(s8 path, config conf, arena scratch)
+{
+    b32 ok = 1;
+    s8 dll = osload(&scratch, path);
+    if (!dll.data) {
+        throw(scratch.esc, s8("could not load file"));
+    }
+
+    escape *outer = scratch.esc;
+    escape  esc   = {0};
+    scratch.esc = &esc;
+    if (catch(&esc)) {
+        osunload(dll);
+        throw(outer, esc.err);
+    }
+
+    if (conf.def) {
+        processdef(dll, path, conf, scratch);
+    }
+    if (conf.exports || conf.imports) {
+        processpe(dll, conf, scratch);
+    }
+    if (conf.recursive || conf.missing) {
+        ok = processclosure(path, dll, conf, scratch);
+    }
+    osunload(dll);
+    return ok;
+}
+
+// ABI diff: export and import records of the old image are hashed by
+// identity, then each table is walked once per side in table order, so
+// a comparison is linear with no sorting. Named exports are identified
+// by name and nameless exports by ordinal. Imports are identified by
+// case-folded module plus name, or ordinal when imported by ordinal.
+typedef struct abientry abientry;
+struct abientry {
+    abientry *child[4];
+    s8        key;
+    u32       ordinal;
+    b32       matched;
+};
+
+static abientry *upsertabi(abientry **m, s8 key, arena *a)
+{
+    for (u64 h = hash64(key); *m; h <<= 2) {
+        if (equals((*m)->key, key)) {
+            return *m;
+        }
+        m = &(*m)->child[h>>62];
+    }
+    if (!a) {
+        return 0;
+    }
+    *m = new(a, 1, abientry);
+    (*m)->key = key;
+    return *m;
+}
+
+// Key for a nameless record. Names cannot contain a null byte.
+static s8 ordinalkey(arena *a, s8 prefix, u32 ordinal)
+{
+    s8 r = concat(a, prefix, s8("\0...."));
+    for (i32 i = 0; i < 4; i++) {
+        r.data[r.len-4+i] = (u8)(ordinal >> (8*i));
+    }
+    return r;
+}
+
+static s8 exportkey(arena *a, exportiter *it)
+{
+    return it->name.data ? it->name : ordinalkey(a, (s8){0}, it->ordinal);
+}
+
+static s8 importkey(arena *a, importiter *it)
+{
+    s8 module = concat(a, lowercase(a, it->module), s8("\0"));
+    return it->name.data ? concat(a, module, it->name) : ordinalkey(a, module, it->hint);
+}
+
+typedef struct {
+    u8buf *out;
+    s8     oldpath;
+    s8     newpath;
+    b32    same;
+} abidiff;
+
+static void diffline(abidiff *d, u8 sign, s8 kind)
+{
+    if (d->same) {
+        d->same = 0;
+        print(d->out, s8("--- "));
+        print(d->out, d->oldpath);  // NOTE: UTF-8
+        print(d->out, s8("\n+++ "));
+        print(d->out, d->newpath);
+        print(d->out, s8("\n"));
+    }
+    print(d->out, span(&sign, &sign+1));
+    print(d->out, s8("\t"));
+    print(d->out, kind);
+    print(d->out, s8("\t"));
+}
+
+static void diffexport(abidiff *d, u8 sign, exportiter *it)
+{
+    diffline(d, sign, s8("export"));
+    printu32(d->out, it->ordinal);
+    print(d->out, s8("\t"));
+    if (it->name.data) {
+        printsym(d->out, it->name);
+    } else {
+        print(d->out, s8("<NONAME>"));
+    }
+    print(d->out, s8("\n"));
+}
+
+static void diffimport(abidiff *d, u8 sign, importiter *it)
+{
+    diffline(d, sign, s8("import"));
+    printname(d->out, it->module);
+    print(d->out, s8("\t"));
+    printu32(d->out, it->hint);
+    print(d->out, s8("\t"));
+    if (it->name.data) {
+        printsym(d->out, it->name);
+    } else {
+        print(d->out, s8("<NONAME>"));
+    }
+    print(d->out, s8("\n"));
+}
+
+// Print removed (-), changed (!), and added (+) exports and imports
+// between two images. Changed exports print the old ordinal, then the
+// new. Returns false if the images differ.
+static b32 diffpe(abidiff *d, s8 olddll, s8 newdll, arena scratch)
+{
+    peimage oldpe = peload(olddll, &scratch);
+    peimage newpe = peload(newdll, &scratch);
+
+    abientry *exports = 0;
+    for (exportiter it = newexportiter(&newpe, &scratch); nextexport(&it);) {
+        upsertabi(&exports, exportkey(&scratch, &it), &scratch)->ordinal = it.ordinal;
+    }
+    for (exportiter it = newexportiter(&oldpe, &scratch); nextexport(&it);) {
+        abientry *e = upsertabi(&exports, exportkey(&scratch, &it), 0);
+        if (!e) {
+            diffexport(d, '-', &it);
+        } else if (!e->matched) {
+            e->matched = 1;
+            if (e->ordinal != it.ordinal) {
+                diffline(d, '!', s8("export"));
+                printu32(d->out, it.ordinal);
+                print(d->out, s8("\t"));
+                printu32(d->out, e->ordinal);
+                print(d->out, s8("\t"));
+                printsym(d->out, it.name);
+                print(d->out, s8("\n"));
+            }
+        }
+    }
+    for (exportiter it = newexportiter(&newpe, &scratch); nextexport(&it);) {
+        abientry *e = upsertabi(&exports, exportkey(&scratch, &it), 0);
+        if (!e->matched) {
+            e->matched = 1;  // report duplicates once
+            diffexport(d, '+', &it);
+        }
+    }
+
+    abientry *imports = 0;
+    for (importiter it = newimportiter(&newpe, &scratch); nextmodule(&it);) {
+        while (nextimport(&it)) {
+            upsertabi(&imports, importkey(&scratch, &it), &scratch);
+        }
+    }
+    for (importiter it = newimportiter(&oldpe, &scratch); nextmodule(&it);) {
+        while (nextimport(&it)) {
+            abientry *e = upsertabi(&imports, importkey(&scratch, &it), 0);
+            if (!e) {
+                diffimport(d, '-', &it);
+            } else {
+                e->matched = 1;
+            }
+        }
+    }
+    for (importiter it = newimportiter(&newpe, &scratch); nextmodule(&it);) {
+        while (nextimport(&it)) {
+            abientry *e = upsertabi(&imports, importkey(&scratch, &it), 0);
+            if (!e->matched) {
+                e->matched = 1;
+                diffimport(d, '+', &it);
+            }
+        }
+    }
+    return d->same;
+}
+
+static b32 processpair(s8 oldpath, s8 newpath, config conf, arena scratch)
+{
+    s8 olddll = osload(&scratch, oldpath);
+    if (!olddll.data) {
+        throw(scratch.esc, s8("could not load file"));
+    }
+
+    escape *outer = scratch.esc;
+    escape  esc   = {0};
+    scratch.esc = &esc;
+    if (catch(&esc)) {
+        osunload(olddll);
+        throw(outer, esc.err);
+    }
+
+    s8 newdll = osload(&scratch, newpath);
+    if (!newdll.data) {
+        osunload(olddll);
+        throw(outer, s8("could not load file"));
+    }
+
+    escape inner = {0};
+    scratch.esc = &inner;
+    if (catch(&inner)) {
+        osunload(newdll);
+        osunload(olddll);
+        throw(outer, inner.err);
+    }
+
+    abidiff d = {0};
+    d.out     = conf.out;
+    d.oldpath = oldpath;
+    d.newpath = newpath;
+    d.same    = 1;
+    b32 ok = diffpe(&d, olddll, newdll, scratch);
+    osunload(newdll);
+    osunload(olddll);
+    return ok;
+}
+
+typedef struct pathnode pathnode;
+struct pathnode {
+    pathnode *next;
+    s8        path;
+};
+
+typedef struct {
+    pathnode  *head;
+    pathnode **tail;
+    i32        len;
+    b32        libs;  // directory walks include (import) libraries
+} pathlist;
+
+static void pushpath(pathlist *l, s8 path, arena *a)
+{
+    pathnode *n = new(a, 1, pathnode);
+    n->path = path;
+    *l->tail = n;
+    l->tail = &n->next;
+    l->len++;
+}
+
+static b32 less(s8 a, s8 b)
+{
+    iz len = a.len<b.len ? a.len : b.len;
+    for (iz i = 0; i < len; i++) {
+        if (a.data[i] != b.data[i]) {
+            return a.data[i] < b.data[i];
+        }
+    }
+    return a.len < b.len;
+}
+
+// Merge sort a directory listing by name so that output order does not
+// depend on the file system.
+static direntry *sortentries(direntry *head)
+{
+    if (!head || !head->next) {
+        return head;
+    }
+
+    direntry *slow = head;
+    for (direntry *fast = head->next; fast && fast->next;) {
+        slow = slow->next;
+        fast = fast->next->next;
+    }
+    direntry *right = slow->next;
+    slow->next = 0;
+
+    direntry *a = sortentries(head);
+    direntry *b = sortentries(right);
+    direntry  *r    = 0;
+    direntry **tail = &r;
+    while (a && b) {
+        direntry **min = less(b->name, a->name) ? &b : &a;
+        *tail = *min;
+        tail = &(*min)->next;
+        *min = (*min)->next;
+    }
+    *tail = a ? a : b;
+    return r;
+}
+
+// PE images, and (import) libraries if requested.
+static b32 pefilename(s8 name, b32 libs)
+{
+    static s8 exts[] = {
+        s8(".a"),   s8(".lib"),  // libraries first
+        s8(".cpl"), s8(".dll"), s8(".drv"), s8(".efi"),
+        s8(".exe"), s8(".ocx"), s8(".sys"),
+    };
+    for (i32 i = libs ? 0 : 2; i < countof(exts); i++) {
+        iz len = exts[i].len;
+        if (name.len > len) {
+            b32 match = 1;
+            u8 *tail  = name.data + name.len - len;
+            for (iz j = 0; j < len; j++) {
+                u8 c = tail[j];
+                match &= (c>='A' && c<='Z' ? c+'a'-'A' : c) == exts[i].data[j];
+            }
+            if (match) return 1;
+        }
+    }
+    return 0;
+}
+
+// Append the path to the input list, or if it's a directory, every PE
+// file beneath it in sorted order.
+static void addinput(pathlist *l, s8 path, arena *a)
+{
+    direntry *entries = 0;
+    if (equals(path, s8("-")) || !oslistdir(a, path, &entries)) {
+        pushpath(l, path, a);
+        return;
+    }
+
+    s8 dir = path;
+    while (dir.len>1 && (dir.data[dir.len-1]=='/' || dir.data[dir.len-1]=='\\')) {
+        dir.len--;
+    }
+    for (direntry *e = sortentries(entries); e; e = e->next) {
+        if (!e->isdir && !pefilename(e->name, l->libs)) {
+            continue;
+        }
+        s8 child = concat(a, dir, s8("/"));
+        child = concat(a, child, e->name);
+        child = concat(a, child, s8("\0"));
+        child.len--;
+        if (e->isdir) {
+            addinput(l, child, a);
+        } else {
+            pushpath(l, child, a);
+        }
+    }
+}
+
+// Append each line of a list file as an input, expanding directories
+// unless the inputs are compared in pairs.
+static void addlist(pathlist *l, s8 listpath, b32 expand, arena *a)
+{
+    s8 list = osload(a, listpath);
+    if (!list.data) {
+        throw(a->esc, s8("could not load list"));
+    }
+    for (iz beg = 0, end = 0; beg < list.len; beg = end + 1) {
+        for (end = beg; end<list.len && list.data[end]!='\n'; end++) {}
+        s8 line = span(list.data+beg, list.data+end);
+        if (line.len && line.data[line.len-1]=='\r') {
+            line.len--;
+        }
+        if (line.len) {
+            s8 path = concat(a, line, s8("\0"));
+            path.len--;
+            if (expand) {
+                addinput(l, path, a);
+            } else {
+                pushpath(l, path, a);
+            }
+        }
+    }
+    osunload(list);
+}
+
+// Label a file's output when there are several inputs, separated by a
+// blank line, and as a comment so that DEF output remains valid.
+static void printheader(u8buf *out, s8 path, i32 index, b32 def)
+{
+    if (index) {
+        print(out, s8("\n"));
+    }
+    if (def) {
+        print(out, s8("; "));
+    }
+    print(out, path);  // NOTE: UTF-8
+    print(out, s8(":\n"));
+}
+
+// Files are claimed in order from a shared counter and each worker has
+// its own scratch arena and buffers. Output is written in input order
+// by passing a turn counter: a worker writes a file's output only when
+// it's that file's turn, blocking if necessary, so a worker that gets
+// ahead waits rather than buffering without bound.
+typedef struct {
+    config conf;
+    arena  scratch;
+    s8    *paths;
+    i32    njobs;   // files, or pairs of files when comparing
+    i32   *next;
+    i32   *turn;
+    b32    ok;
+} worker;
+
+static void work(void *arg)
+{
+    worker *w   = arg;
+    u8buf  *out = w->conf.out;
+    u8buf  *err = w->conf.err;
+
+    for (;;) {
+        i32 i = __atomic_fetch_add(w->next, 1, __ATOMIC_RELAXED);
+        if (i >= w->njobs) {
+            break;
+        }
+        out->seq = err->seq = i;
+        s8 *job = w->paths + i*(w->conf.compare ? 2 : 1);
+
+        escape esc = {0};
+        arena scratch = w->scratch;
+        scratch.esc = &esc;
+        if (catch(&esc)) {
+            flush(out);
+            print(err, s8("peports: "));
+            print(err, esc.err);
+            print(err, s8(": "));
+            print(err, job[0]);  // NOTE: UTF-8
+            if (w->conf.compare) {
+                print(err, s8(" "));
+                print(err, job[1]);
+            }
+            print(err, s8("\n"));
+            w->ok &= !w->conf.compare;  // an unreadable pair fails a gate
+        } else if (w->conf.compare) {
+            w->ok &= processpair(job[0], job[1], w->conf, scratch);
+        } else {
+            if (w->njobs > 1) {
+                printheader(out, job[0], i, w->conf.def);
+            }
+            w->ok &= processpath(job[0], w->conf, scratch);
+        }
+
+        flush(out);
+        flush(err);
+        // Pass the turn only once it's ours, even with nothing written
+        while (__atomic_load_n(w->turn, __ATOMIC_ACQUIRE) != i) {
+            osyield();
+        }
+        __atomic_store_n(w->turn, i+1, __ATOMIC_RELEASE);
+    }
+}
+
+// Export index: a memory-mappable file mapping each exported symbol
+// name to the modules exporting it. All fields are little endian u32
+// unless noted, and tables follow the header in this order:
+//
+//   header   "PEPORTS1", nmodules, nsymbols, nslots, nrefs, nstrings, 0
+//   modules  pathoff, pathlen, firstexport, nexports, size:u64, mtime:u64
+//   symbols  nameoff, namelen, firstref, nrefs
+//   slots    symbol+1, or 0 if empty (open addressing, linear probing)
+//   refs     module, for each symbol
+//   exports  symbol, for each module
+//   strings  paths and names, not terminated
+//
+// A lookup is a hash, a probe or two, and a walk over the references,
+// touching only the pages it needs. The per-module export lists allow
+// an update to carry forward unchanged modules without parsing them.
+enum {
+    IDX_HEADER = 32,
+    IDX_MODULE = 32,
+    IDX_SYMBOL = 16,
+};
+
+typedef struct {
+    s8  modules;
+    s8  symbols;
+    s8  slots;
+    s8  refs;
+    s8  exports;
+    s8  strings;
+    u32 nmodules;
+    u32 nsymbols;
+    u32 nslots;
+} idxfile;
+
+static void putu32(u8 *p, u32 x)
+{
+    p[0] = (u8)(x >>  0);
+    p[1] = (u8)(x >>  8);
+    p[2] = (u8)(x >> 16);
+    p[3] = (u8)(x >> 24);
+}
+
+static void putu64(u8 *p, u64 x)
+{
+    putu32(p+0, (u32)(x >>  0));
+    putu32(p+4, (u32)(x >> 32));
+}
+
+static u32 idxslot(s8 name, u32 nslots)
+{
+    return (u32)(hash64(name) >> 32) & (nslots - 1);
+}
+
+// Read a field of the i-th record of a table.
+static u32 idxget(s8 table, i32 width, u32 i, i32 field, escape *e)
+{
+    if (i >= (uz)(table.len/width)) {
+        throw(e, s8("invalid index (record)"));
+    }
+    return readu32(table, (iz)i*width + field*4, e);
+}
+
+static s8 idxstring(idxfile *idx, u32 off, u32 len, escape *e)
+{
+    if (off>(uz)idx->strings.len || len>(uz)idx->strings.len-off) {
+        throw(e, s8("invalid index (string)"));
+    }
+    return span(idx->strings.data+off, idx->strings.data+off+len);
+}
+
+static s8 idxname(idxfile *idx, u32 symbol, escape *e)
+{
+    u32 off = idxget(idx->symbols, IDX_SYMBOL, symbol, 0, e);
+    u32 len = idxget(idx->symbols, IDX_SYMBOL, symbol, 1, e);
+    return idxstring(idx, off, len, e);
+}
+
+static s8 idxpath(idxfile *idx, u32 module, escape *e)
+{
+    u32 off = idxget(idx->modules, IDX_MODULE, module, 0, e);
+    u32 len = idxget(idx->modules, IDX_MODULE, module, 1, e);
+    return idxstring(idx, off, len, e);
+}
+
+// Locate the tables within an index file. Only the header is examined,
+// so opening is constant time, and accessors check every read.
+static idxfile openindex(s8 data, escape *e)
+{
+    idxfile r = {0};
+    if (data.len<IDX_HEADER || !equals(s8("PEPORTS1"), span(data.data, data.data+8))) {
+        throw(e, s8("not a peports index"));
+    }
+    r.nmodules   = readu32(data,  8, e);
+    r.nsymbols   = readu32(data, 12, e);
+    r.nslots     = readu32(data, 16, e);
+    u32 nrefs    = readu32(data, 20, e);
+    u32 nstrings = readu32(data, 24, e);
+    if (!r.nslots || r.nslots&(r.nslots-1)) {
+        throw(e, s8("invalid index (slots)"));
+    }
+
+    i64 sizes[] = {
+        (i64)r.nmodules * IDX_MODULE,
+        (i64)r.nsymbols * IDX_SYMBOL,
+        (i64)r.nslots * 4,
+        (i64)nrefs * 4,
+        (i64)nrefs * 4,
+        (i64)nstrings,
+    };
+    s8 *tables[] = {
+        &r.modules, &r.symbols, &r.slots, &r.refs, &r.exports, &r.strings,
+    };
+    i64 off = IDX_HEADER;
+    for (i32 i = 0; i < countof(tables); i++) {
+        if (sizes[i] > data.len-off) {
+            throw(e, s8("invalid index (truncated)"));
+        }
+        *tables[i] = span(data.data+off, data.data+off+sizes[i]);
+        off += sizes[i];
+    }
+    return r;
+}
+
+// Returns the symbol index plus one, or zero if not present.
+static u32 idxlookup(idxfile *idx, s8 name, escape *e)
+{
+    u32 mask = idx->nslots - 1;
+    u32 slot = idxslot(name, idx->nslots);
+    for (u32 n = 0; n < idx->nslots; n++, slot = (slot+1)&mask) {
+        u32 s = idxget(idx->slots, 4, slot, 0, e);
+        if (!s || equals(idxname(idx, s-1, e), name)) {
+            return s;
+        }
+    }
+    return 0;
+}
+
+static b32 queryindex(config conf, s8 *names, i32 nnames, arena scratch)
+{
+    b32 ok  = 1;
+    s8 data = osload(&scratch, conf.index);
+    if (!data.data) {
+        throw(scratch.esc, s8("could not load index"));
+    }
+
+    escape *outer = scratch.esc;
+    escape  esc   = {0};
+    if (catch(&esc)) {
+        osunload(data);
+        throw(outer, esc.err);
+    }
+
+    idxfile idx = openindex(data, &esc);
+    for (i32 i = 0; i < nnames; i++) {
+        u32 s = idxlookup(&idx, names[i], &esc);
+        if (!s) {
+            ok = 0;
+            printname(conf.out, names[i]);
+            print(conf.out, s8("\t<NOTFOUND>\n"));
+            continue;
+        }
+        u32 first = idxget(idx.symbols, IDX_SYMBOL, s-1, 2, &esc);
+        u32 nrefs = idxget(idx.symbols, IDX_SYMBOL, s-1, 3, &esc);
+        for (u32 j = 0; j < nrefs; j++) {
+            u32 m = idxget(idx.refs, 4, checkadd(first, j, &esc), 0, &esc);
+            printname(conf.out, names[i]);
+            print(conf.out, s8("\t"));
+            print(conf.out, idxpath(&idx, m, &esc));  // NOTE: UTF-8
+            print(conf.out, s8("\n"));
+        }
+    }
+
+    osunload(data);
+    flush(conf.out);
+    return ok && !conf.out->err;
+}
+
+typedef struct idxmodule idxmodule;
+struct idxmodule {
+    idxmodule *next;
+    s8         path;
+    fileinfo   info;
+    u32        id;        // index plus one, or zero if discarded
+    u32        nexports;
+};
+
+typedef struct ref ref;
+struct ref {
+    ref       *next;
+    idxmodule *module;
+};
+
+typedef struct entry entry;
+struct entry {
+    entry *child[4];
+    entry *next;       // insertion order
+    s8     name;
+    ref   *refs;       // most recent first
+    u32    id;         // index plus one, or zero if unreferenced
+    u32    nrefs;
+};
+
+typedef struct {
+    entry      *table;
+    entry      *head;
+    entry     **tail;
+    idxmodule  *modules;
+    idxmodule **mtail;
+} indexer;
+
+// Record that the module exports the name, copying the name.
+static void addexport(indexer *ix, idxmodule *m, s8 name, arena *perm)
+{
+    entry **e = &ix->table;
+    for (u64 h = hash64(name); *e; h <<= 2) {
+        if (equals((*e)->name, name)) {
+            break;
+        }
+        e = &(*e)->child[h>>62];
+    }
+    if (!*e) {
+        *e = new(perm, 1, entry);
+        (*e)->name = concat(perm, name, (s8){0});
+        *ix->tail = *e;
+        ix->tail = &(*e)->next;
+    }
+    if (!(*e)->refs || (*e)->refs->module!=m) {
+        ref *r = new(perm, 1, ref);
+        r->module = m;
+        r->next = (*e)->refs;
+        (*e)->refs = r;
+    }
+}
+
+typedef struct oldmodule oldmodule;
+struct oldmodule {
+    oldmodule *child[4];
+    s8         path;
+    u32        index;
+};
+
+// Open the previous index and map its paths to modules. The whole file
+// is validated here so that carrying modules forward cannot fail. An
+// unusable index is ignored, and everything is parsed again.
+static b32 openprev(idxfile *idx, oldmodule **olds, s8 data, arena *perm)
+{
+    escape esc  = {0};
+    arena  temp = *perm;
+    temp.esc = &esc;
+    if (catch(&esc)) {
+        *olds = 0;
+        return 0;
+    }
+
+    *idx = openindex(data, &esc);
+    for (u32 i = 0; i < idx->nsymbols; i++) {
+        idxname(idx, i, &esc);
+    }
+    for (u32 i = 0; i < idx->nmodules; i++) {
+        u32 first    = idxget(idx->modules, IDX_MODULE, i, 2, &esc);
+        u32 nexports = idxget(idx->modules, IDX_MODULE, i, 3, &esc);
+        for (u32 j = 0; j < nexports; j++) {
+            u32 s = idxget(idx->exports, 4, checkadd(first, j, &esc), 0, &esc);
+            if (s >= idx->nsymbols) {
+                throw(&esc, s8("invalid index (symbol)"));
+            }
+        }
+
+        s8 path = idxpath(idx, i, &esc);
+        oldmodule **m = olds;
+        for (u64 h = hash64(path); *m; h <<= 2) {
+            m = &(*m)->child[h>>62];
+        }
+        *m = new(&temp, 1, oldmodule);
+        (*m)->path  = path;
+        (*m)->index = i;
+    }
+
+    perm->beg = temp.beg;  // commit
+    return 1;
+}
+
+// Add the file's exports to the index, carrying them forward from the
+// previous index if the file is unchanged. Returns an error, or a null
+// string on success. A failed file is left out of the index.
+static s8 indexfile(indexer *ix, s8 path, idxfile *prev, oldmodule *olds, arena *perm)
+{
+    idxmodule *m = new(perm, 1, idxmodule);
+    m->path = path;
+    m->info = osstat(perm, path);
+    if (!m->info.ok) {
+        return s8("could not load file");
+    }
+
+    for (u64 h = hash64(path); olds; h <<= 2) {
+        if (equals(olds->path, path)) {
+            break;
+        }
+        olds = olds->child[h>>62];
+    }
+    if (olds) {
+        // Validated by openprev, so these reads cannot fail
+        escape *esc = perm->esc;
+        u32 i  = olds->index;
+        u64 lo = idxget(prev->modules, IDX_MODULE, i, 4, esc);
+        u64 hi = idxget(prev->modules, IDX_MODULE, i, 5, esc);
+        u64 ml = idxget(prev->modules, IDX_MODULE, i, 6, esc);
+        u64 mh = idxget(prev->modules, IDX_MODULE, i, 7, esc);
+        if (m->info.size==(hi<<32|lo) && m->info.mtime==(mh<<32|ml)) {
+            u32 first    = idxget(prev->modules, IDX_MODULE, i, 2, esc);
+            u32 nexports = idxget(prev->modules, IDX_MODULE, i, 3, esc);
+            for (u32 j = 0; j < nexports; j++) {
+                u32 s = idxget(prev->exports, 4, first+j, 0, esc);
+                addexport(ix, m, idxname(prev, s, esc), perm);
+            }
+            *ix->mtail = m;
+            ix->mtail = &m->next;
+            return (s8){0};
+        }
+    }
+
+    s8 file = osload(perm, path);
+    if (!file.data) {
+        return s8("could not load file");
+    }
+
+    // Exports added before an error remain in the table, but reference
+    // a module that is never linked in, and so are dropped on output.
+    escape *outer = perm->esc;
+    escape  esc   = {0};
+    perm->esc = &esc;
+    if (catch(&esc)) {
+        perm->esc = outer;
+        osunload(file);
+        return esc.err;
+    }
+
+    if (isarchive(file)) {
+        for (libiter it = newlibiter(file, perm); nextlibimport(&it, perm);) {
+            if (it.name.data) {
+                addexport(ix, m, it.name, perm);
+            }
+        }
+    } else {
+        peimage pe = peload(file, perm);
+        for (exportiter it = newexportiter(&pe, perm); nextexport(&it);) {
+            if (it.name.data) {
+                addexport(ix, m, it.name, perm);
+            }
+        }
+    }
+
+    perm->esc = outer;
+    osunload(file);
+    *ix->mtail = m;
+    ix->mtail = &m->next;
+    return (s8){0};
+}
+
+static s8 serialize(indexer *ix, arena *a)
+{
+    // Number the linked modules and the symbols they reference
+    u32 nmodules = 0;
+    i64 nstrings = 0;
+    for (idxmodule *m = ix->modules; m; m = m->next) {
+        m->id = ++nmodules;
+        nstrings += m->path.len;
+    }
+    u32 nsymbols = 0;
+    i64 nrefs    = 0;
+    for (entry *e = ix->head; e; e = e->next) {
+        for (ref *r = e->refs; r; r = r->next) {
+            if (r->module->id) {
+                e->nrefs++;
+                r->module->nexports++;
+            }
+        }
+        if (e->nrefs) {
+            e->id = ++nsymbols;
+            nrefs += e->nrefs;
+            nstrings += e->name.len;
+        }
+    }
+
+    u32 nslots = 1;
+    while (nslots/2 < nsymbols) {
+        nslots *= 2;
+    }
+
+    i64 modoff  = IDX_HEADER;
+    i64 symoff  = modoff  + (i64)nmodules*IDX_MODULE;
+    i64 slotoff = symoff  + (i64)nsymbols*IDX_SYMBOL;
+    i64 refoff  = slotoff + (i64)nslots*4;
+    i64 expoff  = refoff  + nrefs*4;
+    i64 stroff  = expoff  + nrefs*4;
+    i64 total   = stroff  + nstrings;
+    if (nrefs>0xffffffff || nstrings>0xffffffff || (iz)total!=total) {
+        throw(a->esc, s8("index too large"));
+    }
+
+    s8 r = {0};
+    r.len  = total;
+    r.data = new(a, r.len, u8);
+    __builtin_memcpy(r.data, "PEPORTS1", 8);
+    putu32(r.data+ 8, nmodules);
+    putu32(r.data+12, nsymbols);
+    putu32(r.data+16, nslots);
+    putu32(r.data+20, (u32)nrefs);
+    putu32(r.data+24, (u32)nstrings);
+
+    u32  str    = 0;
+    u32  first  = 0;
+    u32 *cursor = new(a, nmodules, u32);
+    for (idxmodule *m = ix->modules; m; m = m->next) {
+        u8 *p = r.data + modoff + (m->id-1)*IDX_MODULE;
+        putu32(p+ 0, str);
+        putu32(p+ 4, (u32)m->path.len);
+        putu32(p+ 8, first);
+        putu32(p+12, m->nexports);
+        putu64(p+16, m->info.size);
+        putu64(p+24, m->info.mtime);
+        __builtin_memcpy(r.data+stroff+str, m->path.data, m->path.len);
+        str += (u32)m->path.len;
+        cursor[m->id-1] = first;
+        first += m->nexports;
+    }
+
+    u32 firstref = 0;
+    u32 mask     = nslots - 1;
+    for (entry *e = ix->head; e; e = e->next) {
+        if (!e->id) {
+            continue;
+        }
+        u32 s = e->id - 1;
+        u8 *p = r.data + symoff + s*IDX_SYMBOL;
+        putu32(p+ 0, str);
+        putu32(p+ 4, (u32)e->name.len);
+        putu32(p+ 8, firstref);
+        putu32(p+12, e->nrefs);
+        if (e->name.len) {
+            __builtin_memcpy(r.data+stroff+str, e->name.data, e->name.len);
+        }
+        str += (u32)e->name.len;
+
+        // References are listed most recent first, so fill backwards
+        u32 j = firstref + e->nrefs;
+        for (ref *f = e->refs; f; f = f->next) {
+            u32 id = f->module->id;
+            if (id) {
+                putu32(r.data + refoff + --j*4, id-1);
+                putu32(r.data + expoff + cursor[id-1]++*4, s);
+            }
+        }
+        firstref += e->nrefs;
+
+        u32 slot = idxslot(e->name, nslots);
+        for (;; slot = (slot+1)&mask) {
+            u8 *q = r.data + slotoff + slot*4;
+            if (!(q[0] | q[1] | q[2] | q[3])) {
+                putu32(q, e->id);
+                break;
+            }
+        }
+    }
+    return r;
+}
+
+static b32 buildindex(config conf, s8 *paths, i32 npaths, arena scratch)
+{
+    b32 ok = 1;
+    indexer ix = {0};
+    ix.tail  = &ix.head;
+    ix.mtail = &ix.modules;
+
+    idxfile    prev = {0};
+    oldmodule *olds = 0;
+    s8 old = osload(&scratch, conf.index);
+    if (old.data) {
+        openprev(&prev, &olds, old, &scratch);
+    }
+
+    for (i32 i = 0; i < npaths; i++) {
+        s8 err = indexfile(&ix, paths[i], &prev, olds, &scratch);
+        if (err.data) {
+            ok = 0;
+            print(conf.err, s8("peports: "));
+            print(conf.err, err);
+            print(conf.err, s8(": "));
+            print(conf.err, paths[i]);  // NOTE: UTF-8
+            print(conf.err, s8("\n"));
+        }
+    }
+    flush(conf.err);
+
+    s8 data = serialize(&ix, &scratch);
+    osunload(old);  // cannot replace a mapped file on Windows
+    if (!ossave(&scratch, conf.index, data)) {
+        throw(scratch.esc, s8("could not write index"));
+    }
+    return ok;
+}
+
+static b32 peports(i32 argc, s8 *argv, arena scratch)
+{
+    b32   ok     = 1;
+    u8buf out[1] = {newu8buf(&scratch, 1, 1<<12)};
+    u8buf err[1] = {newu8buf(&scratch, 2, 1<<12)};
+
+    config conf = {0};
+    conf.out      = out;
+    conf.err      = err;
+    conf.dirs     = new(&scratch, argc, s8);
+    conf.lists    = new(&scratch, argc, s8);
+    conf.nthreads = 1;
+    switch (parseopts(&conf, argc, argv)) {
+    case OPT_OK:   break;
+    case OPT_EXIT: return 1;
+    case OPT_ERR:  return 0;
+    }
+
+    escape esc = {0};
+    scratch.esc = &esc;
+    if (catch(&esc)) {
+        print(err, s8("peports: "));
+        print(err, esc.err);
+        print(err, s8("\n"));
+        flush(err);
+        return 0;
+    }
+
+    if (conf.index.data && conf.query) {
+        return queryindex(conf, argv+conf.optind, argc-conf.optind, scratch);
+    }
+
+    pathlist inputs = {0};
+    inputs.tail = &inputs.head;
+    inputs.libs = conf.imports || conf.index.data;  // only libraries' imports
+    for (i32 i = 0; i < conf.nlists; i++) {
+        addlist(&inputs, conf.lists[i], !conf.compare, &scratch);
+    }
+    for (i32 i = conf.optind; i < argc; i++) {
+        if (conf.compare) {
+            pushpath(&inputs, argv[i], &scratch);
+        } else {
+            addinput(&inputs, argv[i], &scratch);
+        }
+    }
+    if (conf.compare && (!inputs.len || inputs.len%2)) {
+        print(err, s8("peports: -c requires pairs of files\n"));
+        usage(err);
+        flush(err);
+        return 0;
+    }
+    if (conf.optind==argc && !conf.nlists && !conf.compare) {
+        pushpath(&inputs, s8("-"), &scratch);
+    }
+
+    s8 *paths = new(&scratch, inputs.len, s8);
+    i32 npaths = 0;
+    for (pathnode *n = inputs.head; n; n = n->next) {
+        paths[npaths++] = n->path;
+    }
+
+    if (conf.index.data) {
+        return buildindex(conf, paths, npaths, scratch);
+    }
+
+    i32 njobs    = conf.compare ? npaths/2 : npaths;
+    i32 nthreads = conf.nthreads<njobs ? conf.nthreads : njobs;
+    nthreads = nthreads ? nthreads : 1;
+    worker *workers = new(&scratch, nthreads, worker);
+    void  **args    = new(&scratch, nthreads, void *);
+    i32     next    = 0;
+    i32     turn    = 0;
+    iz      share   = (scratch.end - scratch.beg) / nthreads;
+    i32     bufcap  = share/16<1<<20 ? (i32)(share/16) : 1<<20;
+    for (i32 i = 0; i < nthreads; i++) {
+        worker *w = workers + i;
+        w->scratch.beg = scratch.beg + i*share;
+        w->scratch.end = w->scratch.beg + share;
+        w->scratch.esc = &esc;
+        w->conf     = conf;
+        w->conf.out = new(&w->scratch, 1, u8buf);
+        w->conf.err = new(&w->scratch, 1, u8buf);
+        *w->conf.out = newu8buf(&w->scratch, 1, bufcap);
+        *w->conf.err = newu8buf(&w->scratch, 2, 1<<12);
+        if (conf.demangle) {
+            // A quarter of the share caches names across the batch
+            w->conf.out->names = newnamecache(&w->scratch, share/4);
+        }
+        w->conf.out->turn = w->conf.err->turn = &turn;
+        w->paths  = paths;
+        w->njobs  = njobs;
+        w->next   = &next;
+        w->turn   = &turn;
+        w->ok     = 1;
+        args[i]   = w;
+    }
+
+    if (nthreads == 1) {
+        work(workers);
+    } else {
+        osparallel(work, args, nthreads);
+    }
+
+    for (i32 i = 0; i < nthreads; i++) {
+        ok &= workers[i].ok;
+        ok &= !workers[i].conf.out->err;
+    }
+    return ok;
+}
+
+
+#if _WIN32
+// $ gcc -nostartfiles -o peports.exe peports.c
+// $ clang-cl peports.c /link /subsystem:console
+//            kernel32.lib shell32.lib libvcruntime.lib
+
+#define W32(r) __declspec(dllimport) r __stdcall
+W32(b32)    CloseHandle(uz);
+W32(c16 **) CommandLineToArgvW(c16 *, i32 *);
+W32(uz)     CreateFileMappingW(uz, uz, i32, i32, i32, c16 *);
+W32(uz)     CreateFileW(c16 *, i32, i32, uz, i32, i32, uz);
+W32(uz)     CreateThread(uz, uz, u32 (__stdcall *)(void *), void *, i32, u32 *);
+W32(void)   ExitProcess(i32) __attribute((noreturn));
+W32(b32)    FindClose(uz);
+W32(uz)     FindFirstFileW(c16 *, void *);
+W32(b32)    FindNextFileW(uz, void *);
+W32(c16 *)  GetCommandLineW(void);
+W32(b32)    GetFileAttributesExW(c16 *, i32, void *);
+W32(b32)    GetFileSizeEx(uz, i64 *);
+W32(uz)     GetStdHandle(i32);
+W32(void *) MapViewOfFile(uz, i32, i32, i32, uz);
+W32(i32)    MultiByteToWideChar(i32, i32, u8 *, i32, c16 *, i32);
+W32(b32)    ReadFile(uz, u8 *, i32, i32 *, uz);
+W32(b32)    SwitchToThread(void);
+W32(b32)    UnmapViewOfFile(void *);
+W32(void *) VirtualAlloc(uz, uz, i32, i32);
+W32(b32)    VirtualFree(void *, uz, i32);
+W32(i32)    WaitForSingleObject(uz, i32);
+W32(i32)    WideCharToMultiByte(i32, i32, c16 *, i32, u8 *, i32, uz, uz);
+W32(b32)    WriteFile(uz, u8 *, i32, i32 *, uz);
+
+static byte mem[1<<26];  // 64 MiB, parse state only
+
+static i32 truncsize(iz len, i32 max)
+{
+    return max<len ? max : (i32)len;
+}
+
+enum {
+    MEM_COMMIT     = 0x1000,
+    MEM_RESERVE    = 0x2000,
+    MEM_RELEASE    = 0x8000,
+    PAGE_READWRITE = 4,
+};
+
+// Read a pipe or console to its end into a buffer of its own, doubling
+// it as needed. Data follows a 16-byte header, so unlike a mapped view
+// it's never page-aligned, which is how osunload tells them apart.
+static s8 readall(uz handle)
+{
+    s8 r   = {0};
+    iz cap = 0;
+    for (;;) {
+        if (r.len == cap) {
+            i32   type = MEM_COMMIT | MEM_RESERVE;
+            iz    grow = cap ? cap : 1<<21;
+            byte *p    = 0;
+            if (cap < (iz)((uz)-1>>2)) {
+                p = VirtualAlloc(0, 16+cap+grow, type, PAGE_READWRITE);
+            }
+            if (p && r.len) {
+                __builtin_memcpy(p+16, r.data, r.len);
+            }
+            if (cap) {
+                VirtualFree(r.data-16, 0, MEM_RELEASE);
+            }
+            if (!p) {
+                return (s8){0};  // too large
+            }
+            r.data = (u8 *)p + 16;
+            cap += grow;
+        }
+        i32 len;
+        ReadFile(handle, r.data+r.len, truncsize(cap-r.len, 1<<21), &len, 0);
+        if (len < 1) break;
+        r.len += len;
+    }
+    if (!r.len) {
+        VirtualFree(r.data-16, 0, MEM_RELEASE);
+        r.data = (u8 *)"";
+    }
+    return r;
+}
+
+static c16 *widepath(arena *a, s8 path)
+{
+    assert((i32)path.len == path.len);
+    i32  len   = (i32)path.len;
+    i32  wlen  = MultiByteToWideChar(65001, 0, path.data, len, 0, 0);
+    c16 *wpath = new(a, wlen+1, c16);
+    MultiByteToWideChar(65001, 0, path.data, len, wpath, wlen);
+    return wpath;
+}
+
+static s8 osload(arena *a, s8 path)
+{
+    enum {
+        FILE_ATTRIBUTE_NORMAL   = 0x80,
+        FILE_MAP_READ           = 4,
+        FILE_SHARE_ALL          = 7,
+        GENERIC_READ            = 0x80000000,
+        OPEN_EXISTING           = 3,
+        PAGE_READONLY           = 2,
+    };
+    s8 r       = {0};
+    b32 close  = 0;
+    uz  handle = -1;
+
+    if (equals(path, s8("-"))) {
+        handle = GetStdHandle(-10);
+
+    } else {
+        arena scratch = *a;
+        c16  *wpath   = widepath(&scratch, path);
+        handle = CreateFileW(
+            wpath,
+            GENERIC_READ,
+            FILE_SHARE_ALL,
+            0,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            0
+        );
+        if (handle == (uz)-1) {
+            return r;
+        }
+        close = 1;
+    }
+
+    i64 size = 0;
+    if (GetFileSizeEx(handle, &size) && (iz)size==size) {
+        if (!size) {
+            r.data = (u8 *)"";  // cannot map an empty file
+        } else {
+            uz map = CreateFileMappingW(handle, 0, PAGE_READONLY, 0, 0, 0);
+            if (map) {
+                r.data = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+                r.len  = r.data ? (iz)size : 0;
+                CloseHandle(map);
+            }
+        }
+    }
+
+    if (!r.data) {
+        r = readall(handle);  // not a regular file (pipe, console)
+    }
+
+    if (close) CloseHandle(handle);
+    return r;
+}
+
+static void osunload(s8 file)
+{
+    if (!file.len) {
+        return;  // nothing was allocated
+    } else if ((uz)file.data & 4095) {  // see readall
+        VirtualFree(file.data-16, 0, MEM_RELEASE);
+    } else {
+        UnmapViewOfFile(file.data);
+    }
+}
+
+static b32 oswrite(i32 fd, u8 *buf, i32 len)
+{
+    uz h = GetStdHandle(-10 - fd);
+    return WriteFile(h, buf, len, &len, 0);
+}
+
+typedef struct {
+    u32 attr;
+    u32 ctime[2];
+    u32 atime[2];
+    u32 mtime[2];
+    u32 sizehi;
+    u32 sizelo;
+    u32 reserved[2];
+    c16 name[260];
+    c16 altname[14];
+} finddata;
+
+static b32 oslistdir(arena *a, s8 path, direntry **list)
+{
+    enum {
+        FILE_ATTRIBUTE_DIRECTORY     = 0x010,
+        FILE_ATTRIBUTE_REPARSE_POINT = 0x400,
+    };
+
+    byte *save = a->beg;
+    assert((i32)path.len == path.len);
+    i32  len   = (i32)path.len;
+    i32  wlen  = MultiByteToWideChar(65001, 0, path.data, len, 0, 0);
+    c16 *wpath = new(a, wlen+3, c16);
+    MultiByteToWideChar(65001, 0, path.data, len, wpath, wlen);
+    wpath[wlen+0] = '\\';
+    wpath[wlen+1] = '*';
+
+    finddata fd;
+    uz handle = FindFirstFileW(wpath, &fd);
+    if (handle == (uz)-1) {
+        a->beg = save;
+        return 0;
+    }
+
+    do {
+        c16 *name = fd.name;
+        if (name[0]=='.' && (!name[1] || (name[1]=='.' && !name[2]))) {
+            continue;
+        }
+        i32 nlen = WideCharToMultiByte(65001, 0, name, -1, 0, 0, 0, 0);
+        direntry *e = new(a, 1, direntry);
+        e->name.data = new(a, nlen, u8);
+        e->name.len  = nlen ? nlen-1 : nlen;
+        WideCharToMultiByte(65001, 0, name, -1, e->name.data, nlen, 0, 0);
+        e->isdir = (fd.attr & FILE_ATTRIBUTE_DIRECTORY) &&
+                  !(fd.attr & FILE_ATTRIBUTE_REPARSE_POINT);
+        e->next = *list;
+        *list = e;
+    } while (FindNextFileW(handle, &fd));
+    FindClose(handle);
+    return 1;
+}
+
+static fileinfo osstat(arena *a, s8 path)
+{
+    fileinfo r = {0};
+    arena scratch = *a;
+    finddata fd;  // begins with WIN32_FILE_ATTRIBUTE_DATA
+    if (GetFileAttributesExW(widepath(&scratch, path), 0, &fd)) {
+        r.size  = (u64)fd.sizehi<<32 | fd.sizelo;
+        r.mtime = (u64)fd.mtime[1]<<32 | fd.mtime[0];
+        r.ok    = 1;
+    }
+    return r;
+}
+
+static b32 ossave(arena *a, s8 path, s8 data)
+{
+    enum {
+        CREATE_ALWAYS           = 2,
+        FILE_ATTRIBUTE_NORMAL   = 0x80,
+        GENERIC_WRITE           = 0x40000000,
+    };
+    arena scratch = *a;
+    uz handle = CreateFileW(
+        widepath(&scratch, path),
+        GENERIC_WRITE,
+        0,
+        0,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL,
+        0
+    );
+    if (handle == (uz)-1) {
+        return 0;
+    }
+
+    b32 ok = 1;
+    for (iz off = 0; ok && off<data.len;) {
+        i32 len = 0;
+        ok = WriteFile(handle, data.data+off, truncsize(data.len-off, 1<<30), &len, 0);
+        off += len;
+    }
+    return CloseHandle(handle) && ok;
+}
+
+typedef struct {
+    void (*fn)(void *);
+    void  *arg;
+} threadstart;
+
+__attribute((force_align_arg_pointer))
+static u32 __stdcall threadentry(void *arg)
+{
+    threadstart *t = arg;
+    t->fn(t->arg);
+    return 0;
+}
+
+static void osparallel(void (*fn)(void *), void **args, i32 n)
+{
+    assert(n <= MAX_THREADS);
+    threadstart starts[MAX_THREADS];
+    uz          threads[MAX_THREADS];
+    for (i32 i = 0; i < n; i++) {
+        starts[i].fn  = fn;
+        starts[i].arg = args[i];
+        threads[i] = CreateThread(0, 0, threadentry, starts+i, 0, 0);
+        if (!threads[i]) {
+            fn(args[i]);  // run it here instead
+        }
+    }
+    for (i32 i = 0; i < n; i++) {
+        if (threads[i]) {
+            WaitForSingleObject(threads[i], -1);
+            CloseHandle(threads[i]);
+        }
+    }
+}
+
+static void osyield(void)
+{
+    SwitchToThread();
+}
+
+__attribute((force_align_arg_pointer))
+void mainCRTStartup(void)
+{
+    arena scratch = {0};
+    scratch.beg = mem;
+    asm ("" : "+r"(scratch.beg));  // launder the pointer
+    scratch.end = scratch.beg + countof(mem);
+
+    c16  *cmd   = GetCommandLineW();
+    i32   argc  = 0;
     c16 **argvw = CommandLineToArgvW(cmd, &argc);
     s8   *argv  = new(&scratch, argc, s8);
     for (i32 i = 0; i < argc; i++) {
@@ -693,8 +2399,20 @@ void mainCRTStartup(void)
 
 __AFL_FUZZ_INIT();
 
-static b32 oswrite(i32, u8 *, i32) { return 1; }
-static s8  osload(arena *, s8)     { __builtin_trap(); }
+static b32  oswrite(i32, u8 *, i32) { return 1; }
+static s8   osload(arena *, s8)     { __builtin_trap(); }
+static void osunload(s8)            {}
+static b32  oslistdir(arena *, s8, direntry **) { return 0; }
+static void osyield(void)           {}
+static fileinfo osstat(arena *, s8) { return (fileinfo){0}; }
+static b32  ossave(arena *, s8, s8) { return 0; }
+
+static void osparallel(void (*fn)(void *), void **args, i32 n)
+{
+    for (i32 i = 0; i < n; i++) {
+        fn(args[i]);
+    }
+}
 
 int main(void)
 {
@@ -709,9 +2427,9 @@ int main(void)
     c.exports = 1;
     c.imports = 1;
      c.out    = new(&a, 1, u8buf);
-    *c.out    = newu8buf(&a, 1);
+    *c.out    = newu8buf(&a, 1, 1<<12);
      c.err    = new(&a, 1, u8buf);
-    *c.err    = newu8buf(&a, 2);
+    *c.err    = newu8buf(&a, 2, 1<<12);
 
     s8 dll   = {0};
     dll.data = __AFL_FUZZ_TESTCASE_BUF;
@@ -726,12 +2444,60 @@ int main(void)
 
 
 #else  // POSIX-ish?
-// $ cc -o peports peports.c
+// $ cc -pthread -o peports peports.c
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static byte mem[1<<26];  // 64 MiB, parse state only
+
+// Read a pipe or terminal to its end into a mapping of its own, doubling
+// it as needed. Data follows a 16-byte header holding the mapping size,
+// so unlike a mapped file it's never page-aligned, which is how osunload
+// tells them apart.
+static s8 readall(int fd)
+{
+    s8 r   = {0};
+    iz cap = 0;
+    for (;;) {
+        if (r.len == cap) {
+            iz    grow = cap ? cap : 1<<21;
+            byte *p    = MAP_FAILED;
+            if (cap < (iz)((uz)-1>>2)) {
+                int prot  = PROT_READ | PROT_WRITE;
+                int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+                p = mmap(0, 16+cap+grow, prot, flags, -1, 0);
+            }
+            if (p!=MAP_FAILED && r.len) {
+                __builtin_memcpy(p+16, r.data, r.len);
+            }
+            if (cap) {
+                munmap(r.data-16, 16+cap);
+            }
+            if (p == MAP_FAILED) {
+                return (s8){0};  // too large
+            }
+            cap += grow;
+            *(iz *)p = 16 + cap;
+            r.data = (u8 *)p + 16;
+        }
+        iz len = read(fd, r.data+r.len, cap-r.len);
+        if (len < 1) break;
+        r.len += len;
+    }
+    if (!r.len) {
+        munmap(r.data-16, 16+cap);
+        r.data = (u8 *)"";
+    }
+    return r;
+}
 
-static s8 osload(arena *a, s8 path)
+static s8 osload(arena *, s8 path)
 {
     s8  r       = {0};
     int fd      = 0;
@@ -740,27 +2506,45 @@ static s8 osload(arena *a, s8 path)
     if (equals(path, s8("-"))) {
         closeit = 0;
     } else {
-        // NOTE: Assume the path is null-terminated because it came
-        // straight from argv. This program does not construct paths.
+        // NOTE: Assume the path is null-terminated. It either came
+        // straight from argv, or was constructed with a terminator.
         char *cpath = (char *)path.data;
         fd = open(cpath, O_RDONLY);
         if (fd == -1) return r;
     }
 
-    r.data = (u8 *)a->beg;
-    iz avail = a->end - a->beg;
-    avail -= avail / 8;  // don't fill the arena to the brim
-    while (r.len < avail) {
-        iz len = read(fd, r.data+r.len, avail-r.len);
-        if (len < 1) break;
-        r.len += len;
+    struct stat sb;
+    if (!fstat(fd, &sb) && S_ISREG(sb.st_mode) && (iz)sb.st_size==sb.st_size) {
+        if (!sb.st_size) {
+            r.data = (u8 *)"";  // cannot map an empty file
+        } else {
+            void *p = mmap(0, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                r.data = p;
+                r.len  = sb.st_size;
+            }
+        }
+    }
+
+    if (!r.data) {
+        r = readall(fd);  // not a regular file (pipe, terminal)
     }
-    a->beg += r.len;
 
     if (closeit) close(fd);
     return r;
 }
 
+static void osunload(s8 file)
+{
+    if (!file.len) {
+        return;  // nothing was mapped
+    } else if ((uz)file.data & 4095) {  // see readall
+        munmap(file.data-16, *(iz *)(file.data-16));
+    } else {
+        munmap(file.data, file.len);
+    }
+}
+
 static b32 oswrite(i32 fd, u8 *buf, i32 len)
 {
     for (i32 off = 0; off < len;) {
@@ -771,9 +2555,444 @@ static b32 oswrite(i32 fd, u8 *buf, i32 len)
     return 1;
 }
 
+static b32 oslistdir(arena *a, s8 path, direntry **list)
+{
+    DIR *dir = opendir((char *)path.data);
+    if (!dir) {
+        return 0;
+    }
+
+    for (struct dirent *d; (d = readdir(dir));) {
+        if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..")) {
+            continue;
+        }
+        b32 isdir = d->d_type == DT_DIR;
+        if (d->d_type == DT_UNKNOWN) {
+            struct stat sb;
+            int flags = AT_SYMLINK_NOFOLLOW;
+            isdir = !fstatat(dirfd(dir), d->d_name, &sb, flags) &&
+                    S_ISDIR(sb.st_mode);
+        }
+        iz len = strlen(d->d_name);
+        direntry *e = new(a, 1, direntry);
+        e->name.data = new(a, len, u8);
+        e->name.len  = len;
+        memcpy(e->name.data, d->d_name, len);
+        e->isdir = isdir;
+        e->next = *list;
+        *list = e;
+    }
+    closedir(dir);
+    return 1;
+}
+
+typedef struct {
+    void (*fn)(void *);
+    void  *arg;
+} threadstart;
+
+static void *threadentry(void *arg)
+{
+    threadstart *t = arg;
+    t->fn(t->arg);
+    return 0;
+}
+
+static void osparallel(void (*fn)(void *), void **args, i32 n)
+{
+    assert(n <= MAX_THREADS);
+    threadstart starts[MAX_THREADS];
+    pthread_t   threads[MAX_THREADS];
+    b32         started[MAX_THREADS];
+    for (i32 i = 0; i < n; i++) {
+        starts[i].fn  = fn;
+        starts[i].arg = args[i];
+        started[i] = !pthread_create(threads+i, 0, threadentry, starts+i);
+        if (!started[i]) {
+            fn(args[i]);  // run it here instead
+        }
+    }
+    for (i32 i = 0; i < n; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], 0);
+        }
+    }
+}
+
+static void osyield(void)
+{
+    sched_yield();
+}
+
+static fileinfo osstat(arena *a, s8 path)
+{
+    (void)a;
+    fileinfo r = {0};
+    struct stat sb;
+    if (!stat((char *)path.data, &sb)) {
+        r.size  = sb.st_size;
+        r.mtime = (u64)sb.st_mtim.tv_sec*1000000000 + sb.st_mtim.tv_nsec;
+        r.ok    = 1;
+    }
+    return r;
+}
+
+static b32 ossave(arena *a, s8 path, s8 data)
+{
+    (void)a;
+    int fd = open((char *)path.data, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd == -1) {
+        return 0;
+    }
+    b32 ok = 1;
+    for (iz off = 0; ok && off<data.len;) {
+        iz len = write(fd, data.data+off, data.len-off);
+        ok  = len > 0;
+        off += ok ? len : 0;
+    }
+    return !close(fd) && ok;
+}
+
+#if BENCH
+// Benchmark harness for the parser and listing, on this platform layer:
+// $ cc -DBENCH -O2 -pthread -o bench peports.c
+// $ ./bench             # synthetic PE32 and PE64 images
+// $ ./bench *.dll       # a corpus of real images
+// Each image is listed several times with output to /dev/null, so the
+// formatting cost counts, and the best run is divided over its exports
+// (-e) and its imports (-i). The arena column is the scratch high-water
+// mark of a full listing, measured by poisoning the arena beforehand.
+// A corpus is then run through the whole program, loading included,
+// once on one thread and once on every core.
+#include <stdio.h>
+#include <time.h>
+
+enum {BENCH_RUNS = 7, BENCH_SCRATCH = 1<<24};
+
+typedef struct {
+    b32 pe64;
+    i32 nexports;
+    i32 nmodules;   // import descriptors
+    i32 nimports;   // per descriptor
+    i32 nsections;  // 2 to 96, since only the first 96 are read
+} synthspec;
+
+static void putu16(u8 *p, u16 x)
+{
+    p[0] = (u8)(x >> 0);
+    p[1] = (u8)(x >> 8);
+}
+
+static void putdigits(u8 *p, u32 x, i32 width)
+{
+    for (i32 i = width-1; i >= 0; i--, x /= 10) {
+        p[i] = (u8)(x%10) + '0';
+    }
+}
+
+// Build a well-formed image: small filler sections followed by one data
+// section holding the export and import tables, so that every table
+// access walks the whole section map.
+static s8 synthpe(arena *a, synthspec spec)
+{
+    u32 ptrsize = spec.pe64 ? 8 : 4;
+    u32 optsize = spec.pe64 ? 240 : 224;
+    u32 nsec    = spec.nsections;
+    u32 hdrsize = (0x40 + 4 + 20 + optsize + 40*nsec + 0x1ff) & ~0x1ffu;
+    u32 n       = spec.nexports;
+    u32 nnames  = n<0x10000 ? n : 0x10000;  // beyond, by ordinal only
+    u32 m       = spec.nmodules;
+    u32 k       = spec.nimports;
+
+    // Data section layout, as offsets from its start
+    u32 off   = 0;
+    u32 edir  = off;  off += 40;
+    u32 eat   = off;  off += 4*n;
+    u32 npt   = off;  off += 4*nnames;
+    u32 ot    = off;  off += 2*nnames;
+    off = (off + 3) & ~3u;
+    u32 names = off;  off += 24*nnames;  // "SyntheticExport0000000"
+    u32 emod  = off;  off += 16;
+    u32 idir  = off;  off += 20*(m + 1);
+    off = (off + 7) & ~7u;
+    u32 ilts  = off;  off += m*(k + 1)*ptrsize;
+    u32 iats  = off;  off += m*(k + 1)*ptrsize;
+    u32 hints = off;  off += m*k*26;  // hint, "SyntheticImport0000000"
+    u32 dlls  = off;  off += m*16;    // "lib00000.dll"
+    u32 dsize = (off + 0x1ff) & ~0x1ffu;
+    u32 draw  = hdrsize + 0x200*(nsec - 1);
+    u32 drva  = 0x1000*nsec;
+
+    s8 r = {0};
+    r.len  = draw + dsize;
+    r.data = new(a, r.len, u8);
+    u8 *pe = r.data + 0x40;
+    u8 *opt = pe + 24;
+    u8 *d  = r.data + draw;
+
+    r.data[0] = 'M';
+    r.data[1] = 'Z';
+    putu32(r.data+0x3c, 0x40);
+    memcpy(pe, "PE\0\0", 4);
+    putu16(pe+ 4, spec.pe64 ? 0x8664 : 0x014c);
+    putu16(pe+ 6, (u16)nsec);
+    putu16(pe+20, (u16)optsize);
+    putu16(pe+22, spec.pe64 ? 0x2022 : 0x2102);
+    putu16(opt+0, spec.pe64 ? 0x020b : 0x010b);
+    putu32(opt+32, 0x1000);
+    putu32(opt+36, 0x200);
+    putu32(opt+56, drva + ((dsize + 0xfff) & ~0xfffu));
+    putu32(opt+60, hdrsize);
+    putu16(opt+68, 3);
+    u8 *dirs = opt + (spec.pe64 ? 112 : 96);
+    putu32(opt + (spec.pe64 ? 108 : 92), 16);
+    putu32(dirs+ 0, drva+edir);
+    putu32(dirs+ 4, 40);
+    putu32(dirs+ 8, drva+idir);
+    putu32(dirs+12, 20*(m + 1));
+
+    u8 *sec = opt + optsize;
+    for (u32 i = 0; i < nsec; i++, sec += 40) {
+        b32 last = i == nsec-1;
+        memcpy(sec, last ? ".rdata" : ".text", last ? 6 : 5);
+        putu32(sec+ 8, last ? dsize : 0x200);
+        putu32(sec+12, 0x1000*(i + 1));
+        putu32(sec+16, last ? dsize : 0x200);
+        putu32(sec+20, hdrsize + 0x200*i);
+        putu32(sec+36, last ? 0x40000040 : 0x60000020);
+    }
+
+    putu32(d+edir+12, drva+emod);
+    putu32(d+edir+16, 1);
+    putu32(d+edir+20, n);
+    putu32(d+edir+24, nnames);
+    putu32(d+edir+28, drva+eat);
+    putu32(d+edir+32, drva+npt);
+    putu32(d+edir+36, drva+ot);
+    memcpy(d+emod, "synthetic.dll", 13);
+    for (u32 i = 0; i < n; i++) {
+        putu32(d+eat+4*i, 0x1000);  // code in the first section
+    }
+    for (u32 i = 0; i < nnames; i++) {
+        u8 *name = d + names + 24*i;
+        memcpy(name, "SyntheticExport", 15);
+        putdigits(name+15, i, 7);
+        putu32(d+npt+4*i, drva + names + 24*i);
+        putu16(d+ot+2*i, (u16)i);
+    }
+
+    for (u32 j = 0; j < m; j++) {
+        u8 *desc = d + idir + 20*j;
+        u32 ilt  = ilts + j*(k + 1)*ptrsize;
+        u32 iat  = iats + j*(k + 1)*ptrsize;
+        u8 *dll  = d + dlls + 16*j;
+        memcpy(dll, "lib", 3);
+        putdigits(dll+3, j, 5);
+        memcpy(dll+8, ".dll", 4);
+        putu32(desc+ 0, drva+ilt);
+        putu32(desc+12, drva+dlls+16*j);
+        putu32(desc+16, drva+iat);
+        for (u32 i = 0; i < k; i++) {
+            u32 hint = hints + 26*(j*k + i);
+            putu16(d+hint, (u16)i);
+            memcpy(d+hint+2, "SyntheticImport", 15);
+            putdigits(d+hint+17, j*k + i, 7);
+            if (spec.pe64) {
+                putu64(d+ilt+8*i, drva+hint);
+                putu64(d+iat+8*i, drva+hint);
+            } else {
+                putu32(d+ilt+4*i, drva+hint);
+                putu32(d+iat+4*i, drva+hint);
+            }
+        }
+    }
+    return r;
+}
+
+static i64 now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (i64)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// Best time of several listings, or -1 if the image does not parse.
+static i64 timepe(s8 dll, config c, arena scratch)
+{
+    i64 best = -1;
+    for (i32 i = 0; i < BENCH_RUNS; i++) {
+        escape esc = {0};
+        scratch.esc = &esc;
+        if (catch(&esc)) {
+            return -1;
+        }
+        i64 beg = now();
+        processpe(dll, c, scratch);
+        flush(c.out);
+        i64 t = now() - beg;
+        best = best<0 || t<best ? t : best;
+    }
+    return best;
+}
+
+static iz highwater(s8 dll, config c, arena scratch)
+{
+    u8 poison = 0xa5;
+    memset(scratch.beg, poison, scratch.end-scratch.beg);
+    escape esc = {0};
+    scratch.esc = &esc;
+    if (!catch(&esc)) {
+        processpe(dll, c, scratch);
+        flush(c.out);
+    }
+    byte *p = scratch.end;
+    for (; p>scratch.beg && (u8)p[-1]==poison; p--) {}
+    return p - scratch.beg;
+}
+
+static void bench(char *label, s8 dll, config c, arena scratch)
+{
+    i64 nexports = 0;
+    i64 nimports = 0;
+    escape esc = {0};
+    scratch.esc = &esc;
+    if (catch(&esc)) {
+        printf("%-32s %.*s\n", label, (int)esc.err.len, esc.err.data);
+        return;
+    }
+    peimage pe = peload(dll, &scratch);
+    for (exportiter it = newexportiter(&pe, &scratch); nextexport(&it);) {
+        nexports++;
+    }
+    for (importiter it = newimportiter(&pe, &scratch); nextmodule(&it);) {
+        while (nextimport(&it)) {
+            nimports++;
+        }
+    }
+
+    c.exports = 1;
+    c.imports = 0;
+    i64 texports = timepe(dll, c, scratch);
+    c.exports = 0;
+    c.imports = 1;
+    i64 timports = timepe(dll, c, scratch);
+    c.exports = 1;
+    iz high = highwater(dll, c, scratch);
+
+    printf(
+        "%-32s %10lld %8lld %8lld %10.1f %10.1f %10lld\n",
+        label, (long long)dll.len, (long long)nexports, (long long)nimports,
+        nexports ? (double)texports/(double)nexports : 0.0,
+        nimports ? (double)timports/(double)nimports : 0.0,
+        (long long)high
+    );
+}
+
+// Best time of several whole-program runs over a corpus, with standard
+// output discarded.
+static i64 timeall(int argc, char **argv, i32 nthreads, arena perm)
+{
+    char jobs[16];
+    snprintf(jobs, sizeof(jobs), "-j%d", (int)nthreads);
+    s8 *args = new(&perm, argc+1, s8);
+    args[0] = s8("peports");
+    args[1] = (s8){(u8 *)jobs, (iz)strlen(jobs)};
+    for (int i = 1; i < argc; i++) {
+        args[i+1] = (s8){(u8 *)argv[i], (iz)strlen(argv[i])};
+    }
+
+    fflush(stdout);
+    int saved = dup(1);
+    int null  = open("/dev/null", O_WRONLY);
+    dup2(null, 1);
+    close(null);
+    i64 best = -1;
+    for (i32 i = 0; i < BENCH_RUNS; i++) {
+        i64 beg = now();
+        b32 ok  = peports(argc+1, args, perm);
+        i64 t   = now() - beg;
+        best = !ok ? -1 : best<0 || t<best ? t : best;
+    }
+    dup2(saved, 1);
+    close(saved);
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    arena perm = {0};
+    perm.beg = mem;
+    asm ("" : "+r"(perm.beg));  // launder the pointer
+    perm.end = perm.beg + countof(mem);
+    escape esc = {0};
+    perm.esc = &esc;
+    if (catch(&esc)) {
+        fprintf(stderr, "bench: %.*s\n", (int)esc.err.len, esc.err.data);
+        return 1;
+    }
+
+    config c = {0};
+    c.out  = new(&perm, 1, u8buf);
+    *c.out = newu8buf(&perm, open("/dev/null", O_WRONLY), 1<<16);
+    c.err  = c.out;
+
+    arena scratch = {0};
+    scratch.beg = new(&perm, BENCH_SCRATCH, byte);
+    scratch.end = scratch.beg + BENCH_SCRATCH;
+
+    printf(
+        "%-32s %10s %8s %8s %10s %10s %10s\n",
+        "image", "bytes", "exports", "imports", "ns/export", "ns/import",
+        "arena"
+    );
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            s8 path = {(u8 *)argv[i], (iz)strlen(argv[i])};
+            s8 dll  = osload(&perm, path);
+            if (!dll.data) {
+                printf("%-32s could not load file\n", argv[i]);
+                continue;
+            }
+            bench(argv[i], dll, c, scratch);
+            osunload(dll);
+        }
+
+        i32 ncores = (i32)sysconf(_SC_NPROCESSORS_ONLN);
+        ncores = ncores<1 ? 1 : ncores>MAX_THREADS ? MAX_THREADS : ncores;
+        for (i32 n = 1;; n = ncores) {
+            i64 t = timeall(argc, argv, n, perm);
+            printf("all, -j%-25d %10.3f ms\n", (int)n, (double)t/1e6);
+            if (n == ncores) break;
+        }
+        return 0;
+    }
+
+    static const synthspec specs[] = {
+        {0,    1000,   10, 16,  4},
+        {1,    1000,   10, 16,  4},
+        {0,   10000,  100, 16, 16},
+        {1,   10000,  100, 16, 16},
+        {0,  100000, 1000, 16, 96},
+        {1,  100000, 1000, 16, 96},
+    };
+    for (i32 i = 0; i < countof(specs); i++) {
+        synthspec s = specs[i];
+        char label[64];
+        snprintf(
+            label, sizeof(label), "PE%d e%d i%dx%d s%d", s.pe64 ? 64 : 32,
+            s.nexports, s.nmodules, s.nimports, s.nsections
+        );
+        arena temp = perm;
+        s8 dll = synthpe(&temp, s);
+        bench(label, dll, c, scratch);
+    }
+    return 0;
+}
+
+#else
 int main(int argc, char **argv)
 {
-    static byte mem[sizeof(uz)<<26];  // 256/512 MiB
     arena scratch = {0};
     scratch.beg = mem;
     asm ("" : "+r"(scratch.beg));  // launder the pointer
@@ -787,4 +3006,5 @@ int main(int argc, char **argv)
     b32 ok = peports(argc, args, scratch);
     return !ok;
 }
+#endif  // BENCH
 #endif
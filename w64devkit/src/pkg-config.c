@@ -1,6 +1,7 @@
 // u-config: a small, simple, portable pkg-config clone
 // https://github.com/skeeto/u-config
-//   $ cc -nostartfiles -o pkg-config.exe pkg-config.c
+//   $ cc -nostartfiles -o pkg-config.exe pkg-config.c   # Windows
+//   $ cc -o pkg-config pkg-config.c                     # POSIX
 // This is free and unencumbered software released into the public domain.
 #define VERSION "0.33.1"
 
@@ -8,6 +9,8 @@ typedef unsigned char    u8;
 typedef   signed int     b32;
 typedef   signed int     i32;
 typedef unsigned int     u32;
+typedef   signed long long i64;
+typedef unsigned long long u64;
 typedef __PTRDIFF_TYPE__ size;
 typedef          char    byte;
 
@@ -38,7 +41,9 @@ typedef struct {
     s8    sys_libpath;   // $PKG_CONFIG_SYSTEM_LIBRARY_PATH or default
     s8    print_sysinc;  // $PKG_CONFIG_ALLOW_SYSTEM_CFLAGS or empty
     s8    print_syslib;  // $PKG_CONFIG_ALLOW_SYSTEM_LIBS or empty
+    s8    cachepath;     // $PKG_CONFIG_CACHE or empty
     b32   define_prefix;
+    b32   foldcase;      // file names are case-insensitive
     u8    delim;
 } config;
 
@@ -61,6 +66,22 @@ typedef struct {
 // a null terminator since it may be passed directly to the OS interface.
 static filemap os_mapfile(arena *, s8 path);
 
+typedef struct {
+    i64 mtime;  // platform-defined units
+    i64 size;
+    b32 ok;
+} filestamp;
+
+// Query modification time and size. Works on directories, whose time
+// changes as entries are added and removed. Null terminated like
+// os_mapfile().
+static filestamp os_stamp(arena *, s8 path);
+
+// Atomically replace the file's contents, returning false on failure.
+// Concurrent readers see either the old or new contents. Null
+// terminated like os_mapfile().
+static b32 os_savefile(arena *, s8 path, s8 data);
+
 // Write buffer to stdout (1) or stderr (2). The platform must detect
 // write errors and arrange for an eventual non-zero exit status.
 static void os_write(i32 fd, s8);
@@ -68,13 +89,51 @@ static void os_write(i32 fd, s8);
 // Immediately exit the program with a non-zero status.
 static void os_fail(void) __attribute((noreturn));
 
+// Push any output buffered by the platform for a handle.
+static void os_flush(i32 fd);
+
+// Read from stdin (0) or a connection, returning the byte count, or zero
+// at end of input or on error.
+static i32 os_read(i32 fd, u8 *, i32 len);
+
+// Listen on a local socket (POSIX) or named pipe (Windows) for batch
+// clients, returning a handle or -1. Null terminated like os_mapfile().
+static i32 os_listen(arena *, s8 path);
+
+// Wait for the next client, returning a connection usable with os_read()
+// and os_write(), or -1 on failure.
+static i32 os_accept(i32 listener);
+
+// Flush and close a client connection.
+static void os_close(i32 fd);
+
+// List the non-directory entries of a directory, each name followed by
+// a null byte, using the arena. Null terminated like os_mapfile().
+static filemap os_listdir(arena *, s8 path);
+
+// Allocate an arena apart from the configured one, for state that must
+// outlive the queries using it. Empty if out of memory.
+static arena os_newarena(size cap);
+
 
 // Application
 
+// When set, failures unwind to a batch query instead of exiting.
+static void **failjmp;
+
+__attribute((noreturn))
+static void fail(void)
+{
+    if (failjmp) {
+        __builtin_longjmp(failjmp, 1);
+    }
+    os_fail();
+}
+
 static void oom(void)
 {
     os_write(2, S("pkg-config: out of memory\n"));
-    os_fail();
+    fail();
 }
 
 static b32 digit(u8 c)
@@ -205,6 +264,13 @@ static b32 startswith(s8 s, s8 prefix)
     return s.len>=prefix.len && s8equals(takehead(s, prefix.len), prefix);
 }
 
+static i32 s8compare(s8 a, s8 b)
+{
+    size len = a.len<b.len ? a.len : b.len;
+    i32 r = u8compare(a.s, b.s, len);
+    return r ? r : (a.len>b.len) - (a.len<b.len);
+}
+
 static u32 s8hash(s8 s)
 {
     u32 h = 0x811c9dc5;
@@ -489,6 +555,7 @@ struct pkg {
     s8   realname;
     s8   contents;
     env *env;
+    env *memo;  // expanded variables
     i32  flags;
 
     #define PKG_NFIELDS 10
@@ -723,7 +790,7 @@ static void missing(u8buf *err, s8 option)
     prints8(err, option);
     prints8(err, S("\n"));
     flush(err);
-    os_fail();
+    fail();
 }
 
 typedef struct {
@@ -798,13 +865,16 @@ static void usage(u8buf *b)
     "u-config " VERSION " https://github.com/skeeto/u-config\n"
     "free and unencumbered software released into the public domain\n"
     "usage: pkg-config [OPTIONS...] [PACKAGES...]\n"
+    "  --batch, --serve=PATH\n"
     "  --cflags, --cflags-only-I, --cflags-only-other\n"
     "  --define-prefix, --dont-define-prefix\n"
     "  --define-variable=NAME=VALUE, --variable=NAME\n"
+    "  --depfile=FILE, --depfile-target=TARGET\n"
     "  --exists, --validate, --{atleast,exact,max}-version=VERSION\n"
     "  --errors-to-stdout\n"
     "  --keep-system-cflags, --keep-system-libs\n"
     "  --libs, --libs-only-L, --libs-only-l, --libs-only-other\n"
+    "  --list-all\n"
     "  --maximum-traverse-depth=N\n"
     "  --modversion\n"
     "  --msvc-syntax\n"
@@ -820,7 +890,8 @@ static void usage(u8buf *b)
     "  PKG_CONFIG_SYSTEM_INCLUDE_PATH\n"
     "  PKG_CONFIG_SYSTEM_LIBRARY_PATH\n"
     "  PKG_CONFIG_ALLOW_SYSTEM_CFLAGS\n"
-    "  PKG_CONFIG_ALLOW_SYSTEM_LIBS\n";
+    "  PKG_CONFIG_ALLOW_SYSTEM_LIBS\n"
+    "  PKG_CONFIG_CACHE\n";
     prints8(b, S(usage));
 }
 
@@ -848,6 +919,7 @@ static void append(s8list *list, s8 str, arena *perm)
 
 typedef struct {
     s8list list;
+    b32    foldcase;
     u8     delim;
 } search;
 
@@ -929,7 +1001,7 @@ static s8 readpackage(u8buf *err, s8 path, s8 realname, arena *perm)
         prints8(err, path);
         prints8(err, S("'\n"));
         flush(err);
-        os_fail();
+        fail();
 
     case filemap_OK:
         return m.data;
@@ -937,65 +1009,106 @@ static s8 readpackage(u8buf *err, s8 path, s8 realname, arena *perm)
     assert(0);
 }
 
-static void expand(u8buf *out, u8buf *err, env *global, pkg *p, s8 str)
-{
-    i32 top = 0;
-    s8 stack[128];
+static s8 expandvar(u8buf *, env *, pkg *, s8 name, i32 depth, arena *);
 
-    stack[top] = str;
-    while (top >= 0) {
-        s8 s = stack[top--];
-        for (size i = 0; i < s.len-1; i++) {
-            if (s.s[i]=='$' && s.s[i+1]=='{') {
-                if (top >= countof(stack)-2) {
-                    prints8(err, S("pkg-config: "));
-                    prints8(err, S("exceeded max recursion depth in '"));
-                    prints8(err, p->path);
-                    prints8(err, S("'\n"));
-                    flush(err);
-                    os_fail();
-                }
+// Parse a reference at the beginning of s, "${name}" or "$$", returning
+// its length, or zero if s does not begin with a reference.
+static size reference(s8 s, s8 *name)
+{
+    if (s.len<2 || s.s[0]!='$') {
+        return 0;
+    } else if (s.s[1] == '$') {
+        name->s = 0;
+        return 2;
+    } else if (s.s[1] != '{') {
+        return 0;
+    }
+    size end = 2;
+    for (; end<s.len && s.s[end]!='}'; end++) {}
+    *name = s8span(s.s+2, s.s+end);
+    return end + (end < s.len);
+}
 
-                prints8(out, takehead(s, i));
-
-                size beg = i + 2;
-                size end = beg;
-                for (; end<s.len && s.s[end]!='}'; end++) {}
-                s8 name = s8span(s.s+beg, s.s+end);
-                end += end < s.len;
-
-                // If the tail is empty, this stack push could be elided
-                // as a kind of tail call optimization. However, there
-                // would need to be another mechanism in place to detect
-                // infinite recursion.
-                s8 tail = cuthead(s, end);
-                stack[++top] = tail;
-
-                s8 value = lookup(global, p->env, name);
-                if (!value.s) {
-                    prints8(err, S("pkg-config: "));
-                    prints8(err, S("undefined variable '"));
-                    prints8(err, name);
-                    prints8(err, S("' in '"));
-                    prints8(err, p->path);
-                    prints8(err, S("'\n"));
-                    flush(err);
-                    os_fail();
-                }
-                stack[++top] = value;
-                s.len = 0;
-                break;
+static s8 expandn(u8buf *err, env *g, pkg *p, s8 str, i32 depth, arena *perm)
+{
+    // Resolve all references before allocating the result
+    size len = 0;
+    b32 plain = 1;
+    for (size i = 0; i < str.len;) {
+        s8 name = {0};
+        size r = reference(cuthead(str, i), &name);
+        if (!r) {
+            len++;
+            i++;
+        } else {
+            plain = 0;
+            len += name.s ? expandvar(err, g, p, name, depth, perm).len : 1;
+            i += r;
+        }
+    }
+    if (plain) {
+        return str;
+    }
 
-            } else if (s.s[i]=='$' && s.s[i+1]=='$') {
-                s8 head = takehead(s, i+1);
-                prints8(out, head);
-                stack[++top] = cuthead(s, i+2);
-                s.len = 0;
-                break;
-            }
+    s8 result = news8(perm, len);
+    s8 tail = result;
+    for (size i = 0; i < str.len;) {
+        s8 name = {0};
+        size r = reference(cuthead(str, i), &name);
+        if (!r) {
+            tail.s[0] = str.s[i++];
+            tail = cuthead(tail, 1);
+        } else if (!name.s) {
+            tail = s8copy(tail, S("$"));
+            i += r;
+        } else {
+            tail = s8copy(tail, *insert(&p->memo, name, 0));
+            i += r;
         }
-        prints8(out, s);
     }
+    return result;
+}
+
+// Fully expand a variable, memoized per package. Since globals take
+// precedence, memos are only valid for one global environment.
+static s8 expandvar(u8buf *err, env *g, pkg *p, s8 name, i32 depth, arena *perm)
+{
+    s8 *memo = insert(&p->memo, name, 0);
+    if (memo) {
+        return *memo;
+    }
+
+    if (depth >= 128) {
+        prints8(err, S("pkg-config: "));
+        prints8(err, S("exceeded max recursion depth in '"));
+        prints8(err, p->path);
+        prints8(err, S("'\n"));
+        flush(err);
+        fail();
+    }
+
+    s8 value = lookup(g, p->env, name);
+    if (!value.s) {
+        prints8(err, S("pkg-config: "));
+        prints8(err, S("undefined variable '"));
+        prints8(err, name);
+        prints8(err, S("' in '"));
+        prints8(err, p->path);
+        prints8(err, S("'\n"));
+        flush(err);
+        fail();
+    }
+
+    value = expandn(err, g, p, value, depth+1, perm);
+    *insert(&p->memo, name, perm) = value;
+    return value;
+}
+
+// Expand variable references, returning the result in the arena. The
+// arena must not be in use by a u8buf.
+static s8 expand(u8buf *err, env *global, pkg *p, s8 str, arena *perm)
+{
+    return expandn(err, global, p, str, 0, perm);
 }
 
 // Merge and expand data from "update" into "base".
@@ -1006,14 +1119,156 @@ static void expandmerge(u8buf *err, env *g, pkg *base, pkg *update, arena *perm)
     base->env = update->env;
     base->flags = update->flags;
     for (i32 i = 0; i < PKG_NFIELDS; i++) {
-        u8buf mem = newmembuf(perm);
         s8 src = *fieldbyid(update, i);
-        expand(&mem, err, g, update, src);
-        *fieldbyid(base, i) = finalize(&mem);
+        *fieldbyid(base, i) = expand(err, g, update, src, perm);
+    }
+    base->memo = update->memo;
+}
+
+// Search path index
+
+// Each search directory is listed once into a hash trie mapping package
+// names to the first directory providing them, so lookups need no file
+// system probes. Directories that exist but cannot be listed are probed
+// the old way, in order.
+typedef struct pcname pcname;
+struct pcname {
+    pcname *child[4];
+    pcname *next;   // listing order
+    s8      name;   // without .pc suffix
+    s8      dir;
+    i32     order;  // position in the search path
+};
+
+typedef struct {
+    pcname  *names;
+    pcname  *head;
+    pcname **tail;
+    pcname  *unlisted;
+    size     count;
+    b32      foldcase;
+} pcindex;
+
+static u8 foldbyte(u8 c, b32 fold)
+{
+    return fold && c>='A' && c<='Z' ? c+'a'-'A' : c;
+}
+
+// Compare names as the file system does.
+static b32 nameequals(s8 a, s8 b, b32 fold)
+{
+    if (a.len != b.len) {
+        return 0;
+    }
+    for (size i = 0; i < a.len; i++) {
+        if (foldbyte(a.s[i], fold) != foldbyte(b.s[i], fold)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static pcname **indexslot(pcindex *x, s8 name)
+{
+    u32 hash = 0x811c9dc5;
+    for (size i = 0; i < name.len; i++) {
+        hash ^= foldbyte(name.s[i], x->foldcase);
+        hash *= 0x01000193;
+    }
+
+    pcname **n = &x->names;
+    for (u32 h = hash; *n; h <<= 2) {
+        if (nameequals((*n)->name, name, x->foldcase)) {
+            break;
+        }
+        n = &(*n)->child[h>>30];
+    }
+    return n;
+}
+
+static pcindex *newindex(search *dirs, arena *perm)
+{
+    pcindex *x = new(perm, pcindex, 1);
+    x->tail = &x->head;
+    x->foldcase = dirs->foldcase;
+    pcname **unlisted = &x->unlisted;
+
+    i32 order = 0;
+    for (s8node *d = dirs->list.head; d; d = d->next, order++) {
+        s8 dir = d->str;
+        arena scratch = *perm;
+        s8 path = news8(&scratch, dir.len+1);
+        s8copy(path, dir).s[0] = 0;
+        filemap m = os_listdir(perm, path);
+
+        if (m.status == filemap_READERR) {
+            *unlisted = new(perm, pcname, 1);
+            (*unlisted)->dir = dir;
+            (*unlisted)->order = order;
+            unlisted = &(*unlisted)->next;
+            continue;
+        }
+
+        for (s8 list = m.data; list.len;) {
+            cut c = s8cut(list, 0);
+            list = c.tail;
+            s8 name = c.head;
+            if (!realnameispath(name)) {
+                continue;
+            }
+            name = cuttail(name, 3);
+            pcname **n = indexslot(x, name);
+            if (!*n) {
+                *n = new(perm, pcname, 1);
+                (*n)->name = name;
+                (*n)->dir = dir;
+                (*n)->order = order;
+                *x->tail = *n;
+                x->tail = &(*n)->next;
+                x->count++;
+            }
+        }
+    }
+    return x;
+}
+
+// Sort the first n names, returning the head, and storing the remaining
+// unsorted list in *rest.
+static pcname *sortnames(pcname *list, size n, pcname **rest)
+{
+    if (n == 1) {
+        *rest = list->next;
+        list->next = 0;
+        return list;
+    }
+    pcname *a = sortnames(list, n/2, &list);
+    pcname *b = sortnames(list, n-n/2, rest);
+    pcname *head = 0;
+    pcname **tail = &head;
+    while (a && b) {
+        pcname **min = s8compare(b->name, a->name)<0 ? &b : &a;
+        *tail = *min;
+        tail = &(*min)->next;
+        *min = (*min)->next;
+    }
+    *tail = a ? a : b;
+    return head;
+}
+
+static void sortindex(pcindex *x)
+{
+    if (x->count > 1) {
+        pcname *rest = 0;
+        x->head = sortnames(x->head, x->count, &rest);
+        x->tail = &x->head;
+        while (*x->tail) {
+            x->tail = &(*x->tail)->next;
+        }
     }
 }
 
-static pkg findpackage(search *dirs, u8buf *err, s8 realname, arena *perm)
+static pkg findpackage(search *dirs, pcindex *index, u8buf *err,
+                       s8 realname, arena *perm)
 {
     s8 path = {0};
     s8 contents = {0};
@@ -1028,6 +1283,29 @@ static pkg findpackage(search *dirs, u8buf *err, s8 realname, arena *perm)
         }
     }
 
+    // The index only lists names directly inside search directories, and
+    // lacks the built-in package. Anything it misses is probed as before.
+    b32 indexed = index && !s8equals(realname, S("pkg-config"));
+    for (size i = 0; indexed && i < realname.len; i++) {
+        indexed = !pathsep(realname.s[i]);
+    }
+    pcname *hit = indexed ? *indexslot(index, realname) : 0;
+    if (!contents.s && hit) {
+        for (pcname *u = index->unlisted; u && !contents.s; u = u->next) {
+            if (u->order > hit->order) {
+                break;
+            }
+            path = buildpath(u->dir, realname, perm);
+            contents = readpackage(err, path, realname, perm);
+            path = cuttail(path, 1);
+        }
+        if (!contents.s) {
+            path = buildpath(hit->dir, realname, perm);
+            contents = readpackage(err, path, realname, perm);
+            path = cuttail(path, 1);
+        }
+    }
+
     for (s8node *n = dirs->list.head; n && !contents.s; n = n->next) {
         path = buildpath(n->str, realname, perm);
         contents = readpackage(err, path, realname, perm);
@@ -1040,7 +1318,7 @@ static pkg findpackage(search *dirs, u8buf *err, s8 realname, arena *perm)
         prints8(err, realname);
         prints8(err, S("'\n"));
         flush(err);
-        os_fail();
+        fail();
     }
 
     parseresult r = parsepackage(contents, perm);
@@ -1053,7 +1331,7 @@ static pkg findpackage(search *dirs, u8buf *err, s8 realname, arena *perm)
         prints8(err, path);
         prints8(err, S("'\n"));
         flush(err);
-        os_fail();
+        fail();
 
     case parse_DUPFIELD:
         prints8(err, S("pkg-config: "));
@@ -1063,7 +1341,7 @@ static pkg findpackage(search *dirs, u8buf *err, s8 realname, arena *perm)
         prints8(err, path);
         prints8(err, S("'\n"));
         flush(err);
-        os_fail();
+        fail();
 
     case parse_OK:
         break;
@@ -1091,7 +1369,7 @@ static pkg findpackage(search *dirs, u8buf *err, s8 realname, arena *perm)
         flush(err);
         #ifndef FUZZTEST
         // Do not enforce during fuzzing
-        os_fail();
+        fail();
         #endif
     }
 
@@ -1288,954 +1566,2552 @@ static b32 validcompare(versop op, i32 result)
     assert(0);
 }
 
-typedef struct {
-    s8     arg;
-    pkg   *last;
-    i32    depth;
-    i32    flags;
-    versop op;
-} procstate;
+// Persistent package cache
+
+// The optional cache file memoizes findpackage() across runs. It is an
+// image used in place after loading: a header, an open-addressed table
+// of entry offsets, then entries interleaved with their strings. Numbers
+// are little endian. Strings are offset/length pairs, null terminated in
+// the image, and a zero offset is a null string.
+//
+// Entries are keyed by package name and a search stamp hashing every
+// search directory with its modification time, so adding or removing a
+// .pc file anywhere on the path misses. A hit is used only if its .pc
+// file still has the recorded modification time and size.
+//
+//   header: magic[16] nslots:u32 imagelen:u32
+//   table:  offset:u32[nslots]
+//   entry:  stamp:u64 mtime:u64 size:u64 nvars:u32 pad:u32
+//           realname path fields[PKG_NFIELDS] vars[nvars][2]
+
+#define CACHE_MAGIC "u-config cache 1"
+enum {
+    cache_HEADER     = 24,
+    cache_ENTRY      = 32 + 8*(2 + PKG_NFIELDS),
+    cache_MAXENTRIES = 1<<12,
+};
+
+typedef struct cacherecord cacherecord;
+struct cacherecord {
+    cacherecord *next;
+    u64          stamp;
+    filestamp    file;
+    s8           realname;
+    s8           path;
+    s8           fields[PKG_NFIELDS];
+    s8          *vars;  // name/value pairs
+    i32          nvars;
+};
 
 typedef struct {
-    u8buf    *err;
-    search    search;
-    env     **global;
-    pkgs     *pkgs;
-    pkg      *last;
-    i32       maxdepth;
-    versop    op;
-    b32       define_prefix;
-    b32       recursive;
-    b32       ignore_versions;
-    procstate stack[256];
-} processor;
+    s8           path;   // null terminated
+    s8           image;  // empty if missing or invalid
+    cacherecord *fresh;  // newly parsed, to be saved
+    b32          dirty;  // fresh records since the last save
+} pkgcache;
 
-static processor *newprocessor(config *c, u8buf *err, env **g, pkgs *pkgs)
+static u32 load32(u8 *p)
 {
-    arena *perm = &c->perm;
-    processor *proc = new(perm, processor, 1);
-    proc->err = err;
-    proc->search = newsearch(c->delim);
-    appendpath(&proc->search, c->envpath, perm);
-    appendpath(&proc->search, c->fixedpath, perm);
-    proc->global = g;
-    proc->pkgs = pkgs;
-    proc->maxdepth = (u32)-1 >> 1;
-    proc->define_prefix = 1;
-    proc->recursive = 1;
-    return proc;
+    return (u32)p[0] <<  0 | (u32)p[1] <<  8 |
+           (u32)p[2] << 16 | (u32)p[3] << 24;
 }
 
-static void procfail(u8buf *err, versop op, pkg *p)
+static u64 load64(u8 *p)
 {
-    prints8(err, S("pkg-config: "));
-    prints8(err, S("expected version following operator "));
-    prints8(err, opname(op));
-    if (p) {
-        prints8(err, S(" in package '"));
-        prints8(err, p->realname);
-        prints8(err, S("'"));
-    }
-    prints8(err, S("\n"));
-    flush(err);
-    os_fail();
+    return (u64)load32(p+4)<<32 | load32(p);
 }
 
-static void setprefix(pkg *p, arena *perm)
+static void store32(u8 *p, u32 v)
 {
-    s8 parent = dirname(p->path);
-    if (s8equals(S("pkgconfig"), basename(parent))) {
-        s8 prefix = dirname(dirname(parent));
-        prefix = s8pathencode(prefix, perm);
-        *insert(&p->env, S("prefix"), perm) = prefix;
+    p[0] = (u8)(v >>  0);
+    p[1] = (u8)(v >>  8);
+    p[2] = (u8)(v >> 16);
+    p[3] = (u8)(v >> 24);
+}
+
+static void store64(u8 *p, u64 v)
+{
+    store32(p+0, (u32)(v >>  0));
+    store32(p+4, (u32)(v >> 32));
+}
+
+static u64 hash64(u64 h, u8 *p, size len)
+{
+    for (size i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1111111111111111111u;
     }
+    return h;
 }
 
-static void failmaxrecurse(u8buf *err, s8 tok)
+// Return a copy with a null terminator, included in the length.
+static s8 tocstr(s8 s, arena *perm)
 {
-    prints8(err, S("pkg-config: "));
-    prints8(err, S("exceeded max recursion depth on '"));
-    prints8(err, tok);
-    prints8(err, S("'\n"));
-    flush(err);
-    os_fail();
+    s8 r = news8(perm, s.len+1);
+    s8copy(r, s).s[0] = 0;
+    return r;
 }
 
-static void failversion(u8buf *err, pkg *pkg, versop op, s8 want)
+static u64 searchstamp(search *dirs, arena scratch)
 {
-    prints8(err, S("pkg-config: "));
-    prints8(err, S("requested '"));
-    prints8(err, pkg->realname);
-    prints8(err, S("' "));
-    prints8(err, opname(op));
-    prints8(err, S(" '"));
-    prints8(err, want);
-    prints8(err, S("' but got '"));
-    prints8(err, pkg->version);
-    prints8(err, S("'\n"));
-    flush(err);
-    os_fail();
+    u64 h = 0x100;
+    for (s8node *n = dirs->list.head; n; n = n->next) {
+        filestamp t = os_stamp(&scratch, tocstr(n->str, &scratch));
+        u8 buf[17];
+        store64(buf+0, (u64)t.mtime);
+        store64(buf+8, (u64)t.ok);
+        buf[16] = 0;  // delimiter
+        h = hash64(h, n->str.s, n->str.len);
+        h = hash64(h, buf, countof(buf));
+    }
+    return h;
 }
 
-static void process(processor *proc, s8 arg, arena *perm)
+static u32 cacheslot(u64 stamp, s8 realname)
 {
-    u8buf *err = proc->err;
-    pkgs *pkgs = proc->pkgs;
-    env **global = proc->global;
-    search *search = &proc->search;
+    return (u32)((stamp ^ s8hash(realname)) * 1111111111111111111u >> 32);
+}
 
-    procstate *stack = proc->stack;
-    i32 cap = countof(proc->stack);
-    i32 top = 0;
-    stack[0].arg = arg;
-    stack[0].last = proc->last;
-    stack[0].depth = 0;
-    stack[0].flags = pkg_DIRECT | pkg_PUBLIC;
-    stack[0].op = proc->op;
+// Load an offset or length for comparison with the image length. It
+// wraps negative if it doesn't fit in a 32-bit size.
+static size loadsize(u8 *p)
+{
+    return (size)load32(p);
+}
 
-    while (top >= 0) {
-        procstate *s = stack + top;
-        s8pair pair = nexttoken(s->arg);
-        s8 tok = pair.head;
-        if (!tok.len) {
-            if (top>0 && s->op) {
-                procfail(err, s->op, s->last);
-            }
-            top--;
-            continue;
-        }
-        stack[top].arg = pair.tail;
+// True if a whole entry lies at the offset, after the header.
+static b32 entryfits(s8 image, size off)
+{
+    return image.len>=cache_ENTRY &&
+           off>=cache_HEADER && off<=image.len-cache_ENTRY;
+}
 
-        if (s->op) {
-            if (!proc->ignore_versions) {
-                i32 cmp = compareversions(s->last->version, tok);
-                if (!validcompare(s->op, cmp)) {
-                    failversion(err, s->last, s->op, tok);
-                }
-            }
-            s->last = 0;
-            s->op = versop_ERR;
-            continue;
+// Decode a string reference, failing if it lies outside the image.
+static b32 loadstr(s8 image, u8 *ref, s8 *dst)
+{
+    size off = loadsize(ref+0);
+    size len = loadsize(ref+4);
+    s8 r = {0};
+    if (off) {
+        if (off<0 || len<0 || off>=image.len || len>=image.len-off ||
+            image.s[off+len]) {
+            return 0;
         }
+        r.s = image.s + off;
+        r.len = len;
+    }
+    *dst = r;
+    return 1;
+}
 
-        s->op = parseop(tok);
-        if (s->op) {
-            if (!s->last) {
-                prints8(err, S("pkg-config: "));
-                prints8(err, S("unexpected operator '"));
-                prints8(err, tok);
-                prints8(err, S("'\n"));
-                flush(err);
-                os_fail();
-            }
-            continue;
-        }
-
-        i32 depth = s->depth + 1;
-        i32 flags = s->flags;
-        pkg *p = s->last = locate(pkgs, pathtorealname(tok), perm);
-        if (p->contents.s) {
-            if (flags&pkg_PUBLIC && !(p->flags & pkg_PUBLIC)) {
-                // We're on a public branch, but this package was
-                // previously loaded as private. Recursively traverse
-                // its public requires and mark all as public.
-                p->flags |= pkg_PUBLIC;
-                if (proc->recursive && depth<proc->maxdepth) {
-                    if (top >= cap-1) {
-                        failmaxrecurse(err, tok);
-                    }
-                    top++;
-                    stack[top].arg = p->requires;
-                    stack[top].last = 0;
-                    stack[top].depth = depth;
-                    stack[top].flags = flags & ~pkg_DIRECT;
-                    stack[top].op = versop_ERR;
-                }
-            }
-        } else {
-            // Package hasn't been loaded yet, so find and load it.
-            pkg newpkg = findpackage(search, err, tok, perm);
-            if (proc->define_prefix) {
-                setprefix(&newpkg, perm);
-            }
-            expandmerge(err, *global, p, &newpkg, perm);
-            if (proc->recursive && depth<proc->maxdepth) {
-                if (top >= cap-2) {
-                    failmaxrecurse(err, tok);
-                }
-                top++;
-                stack[top].arg = p->requiresprivate;
-                stack[top].last = 0;
-                stack[top].depth = depth;
-                stack[top].flags = 0;
-                stack[top].op = versop_ERR;
-                top++;
-                stack[top].arg = p->requires;
-                stack[top].last = 0;
-                stack[top].depth = depth;
-                stack[top].flags = flags & ~pkg_DIRECT;
-                stack[top].op = versop_ERR;
-            }
-        }
-        p->flags |= flags;
+// Decode the entry at an offset, returning false if malformed.
+static b32 loadrecord(s8 image, size off, cacherecord *r, arena *perm)
+{
+    if (!entryfits(image, off)) {
+        return 0;
+    }
+    u8 *p = image.s + off;
+    r->stamp      = load64(p+ 0);
+    r->file.mtime = (i64)load64(p+ 8);
+    r->file.size  = (i64)load64(p+16);
+    r->file.ok    = 1;
+    size nvars    = loadsize(p+24);
+    if (nvars<0 || nvars>(image.len - off - cache_ENTRY)/16) {
+        return 0;
     }
 
-    proc->last = stack[0].last;
-    proc->op = stack[0].op;
+    b32 ok = 1;
+    ok &= loadstr(image, p+32, &r->realname);
+    ok &= loadstr(image, p+40, &r->path);
+    for (i32 i = 0; i < PKG_NFIELDS; i++) {
+        ok &= loadstr(image, p+48+8*i, r->fields+i);
+    }
+    r->nvars = (i32)nvars;
+    r->vars = new(perm, s8, 2*r->nvars);
+    for (i32 i = 0; i < 2*r->nvars; i++) {
+        ok &= loadstr(image, p+cache_ENTRY+8*i, r->vars+i);
+    }
+    return ok && r->realname.s && r->path.s;
 }
 
-static void endprocessor(processor *proc, u8buf *err)
+static b32 validimage(s8 image)
 {
-    if (proc->op) {
-        procfail(err, proc->op, 0);
+    s8 magic = S(CACHE_MAGIC);
+    if (image.len<cache_HEADER || !startswith(image, magic)) {
+        return 0;
     }
+    size nslots = loadsize(image.s+16);
+    size len    = loadsize(image.s+20);
+    return len==image.len &&
+           nslots>0 && !(nslots & (nslots-1)) &&
+           nslots <= (image.len - cache_HEADER)/4;
 }
 
-typedef enum {
-    filter_ANY,
-    filter_I,
-    filter_L,
-    filter_l,
-    filter_OTHERC,
-    filter_OTHERL
-} filter;
-
-static b32 filterok(filter f, s8 arg)
+static pkgcache *opencache(s8 path, arena *perm)
 {
-    switch (f) {
-    case filter_ANY:
-        return 1;
-    case filter_I:
-        return startswith(arg, S("-I"));
-    case filter_L:
-        return startswith(arg, S("-L"));
-    case filter_l:
-        return startswith(arg, S("-l"));
-    case filter_OTHERC:
-        return !startswith(arg, S("-I"));
-    case filter_OTHERL:
-        return !startswith(arg, S("-L")) && !startswith(arg, S("-l"));
+    pkgcache *c = new(perm, pkgcache, 1);
+    c->path = tocstr(path, perm);
+    filemap m = os_mapfile(perm, c->path);
+    if (m.status==filemap_OK && validimage(m.data)) {
+        c->image = m.data;
     }
-    assert(0);
+    return c;
 }
 
-static void msvcize(u8buf *out, s8 arg)
+// Build a package from a record, with a fresh environment.
+static pkg recordpkg(cacherecord *r, arena *perm)
 {
-    if (startswith(arg, S("-L"))) {
-        prints8(out, S("/libpath:"));
-        prints8(out, cuthead(arg, 2));
-    } else if (startswith(arg, S("-I"))) {
-        prints8(out, S("/I"));
-        prints8(out, cuthead(arg, 2));
-    } else if (startswith(arg, S("-l"))) {
-        prints8(out, cuthead(arg, 2));
-        prints8(out, S(".lib"));
-    } else if (startswith(arg, S("-D"))) {
-        prints8(out, S("/D"));
-        prints8(out, cuthead(arg, 2));
-    } else if (s8equals(arg, S("-mwindows"))) {
-        prints8(out, S("/subsystem:windows"));
-    } else if (s8equals(arg, S("-mconsole"))) {
-        prints8(out, S("/subsystem:console"));
-    } else {
-        prints8(out, arg);
+    pkg p = {0};
+    p.path = r->path;
+    p.realname = r->realname;
+    p.contents = r->path;  // non-null: loaded
+    for (i32 i = 0; i < PKG_NFIELDS; i++) {
+        *fieldbyid(&p, i) = r->fields[i];
+    }
+    for (i32 i = 0; i < r->nvars; i++) {
+        *insert(&p.env, r->vars[2*i], perm) = r->vars[2*i+1];
     }
+    return p;
 }
 
-typedef struct argpos argpos;
-struct argpos {
-    argpos *child[4];
-    argpos *next;
-    s8      arg;
-    size    position;
-};
-
-typedef struct {
-    s8list  list;
-    argpos *positions;
-    size    count;
-} args;
-
-static argpos *findargpos(argpos **m, s8 arg, arena *perm)
+// True if the record's .pc file is unchanged since it was parsed.
+static b32 recordfresh(cacherecord *r, arena scratch)
 {
-    for (u32 h = s8hash(arg); *m; h <<= 2) {
-        if (s8equals((*m)->arg, arg)) {
-            return *m;
-        }
-        m = &(*m)->child[h>>30];
-    }
-    if (perm) {
-        *m = new(perm, argpos, 1);
-        (*m)->arg = arg;
-    }
-    return *m;
+    s8 path = r->path;
+    path.len++;  // include terminator
+    filestamp now = os_stamp(&scratch, path);
+    return now.ok && now.mtime==r->file.mtime && now.size==r->file.size;
 }
 
-static b32 dedupable(s8 arg)
+// Populate a package from a valid, unchanged cache entry.
+static b32 cachelookup(pkgcache *c, u64 stamp, s8 realname, pkg *dst, arena *perm)
 {
-    // Do not count "-I" or "-L" with detached argument
-    if (arg.len<3 || arg.s[0]!='-') {
+    s8 image = c->image;
+    if (!image.len) {
         return 0;
-    } else if (s8equals(arg, S("-pthread"))) {
-        return 1;
     }
-    s8 flags = S("DILflm");
-    for (size i = 0; i < flags.len; i++) {
-        if (arg.s[1] == flags.s[i]) {
-            return 1;
+
+    u32 nslots = load32(image.s+16);
+    u32 i = cacheslot(stamp, realname);
+    for (u32 n = 0; n < nslots; n++, i++) {
+        u8 *slot = image.s + cache_HEADER + 4*(i & (nslots-1));
+        size off = loadsize(slot);
+        if (!off) {
+            return 0;
+        }
+        if (!entryfits(image, off)) {
+            return 0;
+        }
+
+        s8 name = {0};
+        u8 *e = image.s + off;
+        if (load64(e)!=stamp ||
+            !loadstr(image, e+32, &name) ||
+            !s8equals(name, realname)) {
+            continue;
+        }
+
+        arena rollback = *perm;
+        cacherecord r = {0};
+        if (!loadrecord(image, off, &r, perm) || !recordfresh(&r, *perm)) {
+            *perm = rollback;
+            return 0;
         }
+        *dst = recordpkg(&r, perm);
+        return 1;
     }
     return 0;
 }
 
-static void appendarg(args *args, s8 arg, arena *perm)
+static i32 countvars(env *e)
 {
-    append(&args->list, arg, perm);
-    size position = args->count++;
-    if (dedupable(arg)) {
-        argpos *n = findargpos(&args->positions, arg, perm);
-        if (!n->position || startswith(arg, S("-l"))) {
-            // Zero position reserved for null, so bias it by 1
-            n->position = 1 + position;
+    i32 n = 0;
+    if (e) {
+        n++;
+        for (i32 i = 0; i < countof(e->child); i++) {
+            n += countvars(e->child[i]);
         }
     }
+    return n;
 }
 
-static void excludearg(args *args, s8 arg, arena *perm)
+static s8 *flattenvars(env *e, s8 *dst)
 {
-    argpos *n = findargpos(&args->positions, arg, perm);
-    n->position = -1;  // i.e. position before first argument
+    if (e) {
+        *dst++ = e->name;
+        *dst++ = e->value;
+        for (i32 i = 0; i < countof(e->child); i++) {
+            dst = flattenvars(e->child[i], dst);
+        }
+    }
+    return dst;
 }
 
-// Is this the correct position for the given argument?
-static b32 inposition(args *args, s8 arg, size position)
+// Flatten a freshly parsed package into a record, or return null if
+// its file cannot be stamped. The name and path are copied, since they
+// may point into the query, the path with a terminator.
+static cacherecord *newrecord(pkg *p, u64 stamp, arena *perm)
 {
-    argpos *n = findargpos(&args->positions, arg, 0);
-    return !n || n->position==position+1;
+    s8 path = tocstr(p->path, perm);
+    s8 realname = news8(perm, p->realname.len);
+    s8copy(realname, p->realname);
+    cacherecord *r = new(perm, cacherecord, 1);
+    r->file = os_stamp(perm, path);
+    if (!r->file.ok) {
+        return 0;
+    }
+    r->stamp = stamp;
+    r->realname = realname;
+    r->path = cuttail(path, 1);
+    for (i32 i = 0; i < PKG_NFIELDS; i++) {
+        r->fields[i] = *fieldbyid(p, i);
+    }
+    r->nvars = countvars(p->env);
+    r->vars = new(perm, s8, 2*r->nvars);
+    flattenvars(p->env, r->vars);
+    return r;
 }
 
-typedef struct {
-    arena *perm;
-    size  *argcount;
-    args   args;
-    filter filter;
-    b32    msvc;
-    u8     delim;
-} fieldwriter;
-
-static fieldwriter newfieldwriter(filter f, size *argcount, arena *perm)
+// Queue a record for the next cachesave().
+static void cacheinsert(pkgcache *c, cacherecord *r)
 {
-    fieldwriter w = {0};
-    w.perm = perm;
-    w.filter = f;
-    w.argcount = argcount;
-    return w;
+    r->next = c->fresh;
+    c->fresh = r;
+    c->dirty = 1;
 }
 
-static void insertsyspath(fieldwriter *w, s8 path, u8 delim, u8 flag)
+// Insert into the save table unless the key is already present.
+static b32 cacheclaim(cacherecord **table, u32 nslots, cacherecord *r)
 {
-    arena *perm = w->perm;
+    for (u32 i = cacheslot(r->stamp, r->realname);; i++) {
+        cacherecord **slot = table + (i & (nslots-1));
+        if (!*slot) {
+            *slot = r;
+            return 1;
+        }
+        cacherecord *e = *slot;
+        if (e->stamp==r->stamp && s8equals(e->realname, r->realname)) {
+            return 0;
+        }
+    }
+}
 
-    u8 flagbuf[3] = {0};
-    flagbuf[0] = '-';
-    flagbuf[1] = flag;
-    s8 prefix = S(flagbuf);
+static u8 *storestr(u8 *ref, u8 *image, u8 *top, s8 s)
+{
+    store32(ref+0, s.s ? (u32)(top - image) : 0);
+    store32(ref+4, (u32)s.len);
+    if (s.s) {
+        u8copy(top, s.s, s.len);
+        top += s.len;
+        *top++ = 0;
+    }
+    return top;
+}
 
-    while (path.len) {
-        cut c = s8cut(path, delim);
-        s8 dir = c.head;
-        path = c.tail;
-        if (!dir.len) {
-            continue;
+// Write fresh records plus surviving old entries to the cache file.
+// Failure is silent since the cache is only an optimization.
+static void cachesave(pkgcache *c, arena scratch)
+{
+    if (!c->dirty) {
+        return;
+    }
+    c->dirty = 0;
+
+    // Fresh records take precedence over old entries with the same key,
+    // which were either stale or never consulted.
+    i32 count = 0;
+    u32 nkeys = 2*cache_MAXENTRIES;
+    cacherecord **keys = new(&scratch, cacherecord *, nkeys);
+    cacherecord *head = 0;
+    cacherecord **tail = &head;
+    for (cacherecord *r = c->fresh; r && count<cache_MAXENTRIES; r = r->next) {
+        if (cacheclaim(keys, nkeys, r)) {
+            *tail = r;
+            tail = &r->next;
+            count++;
         }
+    }
+    *tail = 0;
+    u32 nold = c->image.len ? load32(c->image.s+16) : 0;
+    for (u32 i = 0; i<nold && count<cache_MAXENTRIES; i++) {
+        size off = loadsize(c->image.s + cache_HEADER + 4*i);
+        cacherecord *r = new(&scratch, cacherecord, 1);
+        if (off && loadrecord(c->image, off, r, &scratch) &&
+            cacheclaim(keys, nkeys, r)) {
+            *tail = r;
+            tail = &r->next;
+            count++;
+        }
+    }
+    *tail = 0;
+
+    u32 nslots = 16;
+    for (; nslots < 2*(u32)count; nslots *= 2) {}
+    size len = cache_HEADER + 4*(size)nslots;
+    for (cacherecord *r = head; r; r = r->next) {
+        len += cache_ENTRY + 16*(size)r->nvars;
+        len += r->realname.len + 1 + r->path.len + 1;
+        for (i32 i = 0; i < PKG_NFIELDS; i++) {
+            len += r->fields[i].s ? r->fields[i].len+1 : 0;
+        }
+        for (i32 i = 0; i < 2*r->nvars; i++) {
+            len += r->vars[i].s ? r->vars[i].len+1 : 0;
+        }
+    }
+    if (len > 0x7fffffff || len > scratch.end-scratch.beg) {
+        return;
+    }
 
-        // Prepend option flag
-        dir = s8pathencode(dir, perm);
-        s8 syspath = news8(perm, prefix.len+dir.len);
-        s8copy(s8copy(syspath, prefix), dir);
-
-        // Process as an argument, as though being printed
-        dequoted dr = dequote(syspath, perm);
-        syspath = dr.arg;
+    s8 image = news8(&scratch, len);  // zeroed: empty table
+    u8 *top = image.s + cache_HEADER + 4*(size)nslots;
+    s8copy(image, S(CACHE_MAGIC));
+    store32(image.s+16, nslots);
+    store32(image.s+20, (u32)len);
+    for (cacherecord *r = head; r; r = r->next) {
+        u32 i = cacheslot(r->stamp, r->realname);
+        u8 *slot = image.s + cache_HEADER + 4*(i & (nslots-1));
+        while (load32(slot)) {
+            slot = image.s + cache_HEADER + 4*(++i & (nslots-1));
+        }
 
-        // NOTE(NRK): Technically, the path doesn't need to follow the flag
-        // immediately e.g `-I /usr/include` (notice the space between -I and
-        // the include dir!).
-        //
-        // But I have not seen a single pc file that does this and so we're not
-        // handling this edge-case. As a proof that this should be fine in
-        // practice, `pkgconf` which is used by many distros, also doesn't
-        // handle it.
-        if (dr.ok && !dr.tail.len) {
-            excludearg(&w->args, syspath, perm);
+        u8 *p = top;
+        store32(slot, (u32)(p - image.s));
+        store64(p+ 0, r->stamp);
+        store64(p+ 8, (u64)r->file.mtime);
+        store64(p+16, (u64)r->file.size);
+        store32(p+24, (u32)r->nvars);
+        top = p + cache_ENTRY + 16*(size)r->nvars;
+        top = storestr(p+32, image.s, top, r->realname);
+        top = storestr(p+40, image.s, top, r->path);
+        for (i32 i = 0; i < PKG_NFIELDS; i++) {
+            top = storestr(p+48+8*i, image.s, top, r->fields[i]);
+        }
+        for (i32 i = 0; i < 2*r->nvars; i++) {
+            top = storestr(p+cache_ENTRY+8*i, image.s, top, r->vars[i]);
         }
     }
+    assert(top == image.s+len);
+
+    os_savefile(&scratch, c->path, image);
 }
 
-static void appendfield(u8buf *err, fieldwriter *w, pkg *p, s8 field)
+// Parsed packages are memoized across batch queries, keyed like cache
+// entries. Entries are records rather than packages so that each query
+// gets its own environment to modify.
+typedef struct pkgmemo pkgmemo;
+struct pkgmemo {
+    pkgmemo     *child[4];
+    cacherecord *record;
+};
+
+static cacherecord **memoize(pkgmemo **m, u64 stamp, s8 realname, arena *perm)
 {
-    arena *perm = w->perm;
-    filter f = w->filter;
-    while (field.len) {
-        dequoted r = dequote(field, perm);
-        if (!r.ok) {
-            prints8(err, S("pkg-config: "));
-            prints8(err, S("unmatched quote in '"));
-            prints8(err, p->realname);
-            prints8(err, S("'\n"));
-            flush(err);
-            os_fail();
+    for (u32 h = cacheslot(stamp, realname); *m; h <<= 2) {
+        cacherecord *r = (*m)->record;
+        if (r->stamp==stamp && s8equals(r->realname, realname)) {
+            return &(*m)->record;
         }
-        if (filterok(f, r.arg)) {
-            appendarg(&w->args, r.arg, perm);
-        }
-        field = r.tail;
+        m = &(*m)->child[h>>30];
+    }
+    if (!perm) {
+        return 0;
     }
+    *m = new(perm, pkgmemo, 1);
+    return &(*m)->record;
 }
 
-static void writeargs(u8buf *out, fieldwriter *w)
+// State that outlives a query. Batch mode gives it a separate arena,
+// emptied for each generation of memos, one per search stamp.
+typedef struct {
+    arena    *keep;   // null outside batch mode
+    arena     empty;  // keep at the start of every generation
+    pkgcache *cache;  // null if disabled
+    pkgmemo  *memo;
+    u64       stamp;  // search stamp for the current query
+    u64       keepstamp;
+    pcindex  *index;  // built for keepstamp
+} session;
+
+typedef struct {
+    s8     arg;
+    pkg   *last;
+    i32    depth;
+    i32    flags;
+    versop op;
+} procstate;
+
+typedef struct {
+    u8buf    *err;
+    search    search;
+    env     **global;
+    pkgs     *pkgs;
+    pkg      *last;
+    session  *session;
+    pcindex  *index;
+    s8list    deps;      // .pc files loaded
+    b32       searched;  // consulted the search path
+    i32       maxdepth;
+    versop    op;
+    b32       define_prefix;
+    b32       recursive;
+    b32       ignore_versions;
+    procstate stack[256];
+} processor;
+
+static processor *newprocessor(config *c, u8buf *err, env **g, pkgs *pkgs)
 {
-    size position = 0;
-    u8 delim = w->delim ? w->delim : ' ';
-    for (s8node *n = w->args.list.head; n; n = n->next) {
-        s8 arg = n->str;
-        if (inposition(&w->args, arg, position++)) {
-            if ((*w->argcount)++) {
-                printu8(out, delim);
-            }
-            if (w->msvc) {
-                msvcize(out, arg);
-            } else {
-                prints8(out, arg);
-            }
-        }
-    }
+    arena *perm = &c->perm;
+    processor *proc = new(perm, processor, 1);
+    proc->err = err;
+    proc->search = newsearch(c->delim);
+    proc->search.foldcase = c->foldcase;
+    appendpath(&proc->search, c->envpath, perm);
+    appendpath(&proc->search, c->fixedpath, perm);
+    proc->global = g;
+    proc->pkgs = pkgs;
+    proc->maxdepth = (u32)-1 >> 1;
+    proc->define_prefix = 1;
+    proc->recursive = 1;
+    return proc;
 }
 
-static i32 parseuint(s8 s, i32 hi)
+static void procfail(u8buf *err, versop op, pkg *p)
 {
-    i32 v = 0;
-    for (size i = 0; i < s.len; i++) {
-        u8 c = s.s[i];
-        if (digit(c)) {
-            v = v*10 + c - '0';
-            if (v >= hi) {
-                return hi;
-            }
-        }
+    prints8(err, S("pkg-config: "));
+    prints8(err, S("expected version following operator "));
+    prints8(err, opname(op));
+    if (p) {
+        prints8(err, S(" in package '"));
+        prints8(err, p->realname);
+        prints8(err, S("'"));
     }
-    return v;
+    prints8(err, S("\n"));
+    flush(err);
+    fail();
 }
 
-static void uconfig(config *conf)
+static void setprefix(pkg *p, arena *perm)
 {
-    arena *perm = &conf->perm;
-
-    env *global = 0;
-    filter filterc = filter_ANY;
-    filter filterl = filter_ANY;
-    pkgs *pkgs = newpkgs(perm);
-    u8buf *out = newfdbuf(perm, 1, 1<<12);
-    u8buf *err = newfdbuf(perm, 2, 1<<7);
-    processor *proc = newprocessor(conf, err, &global, pkgs);
-    size argcount = 0;
-
-    b32 msvc = 0;
-    b32 libs = 0;
-    b32 cflags = 0;
-    b32 err_to_stdout = 0;
-    b32 silent = 0;
-    b32 static_ = 0;
-    u8 argdelim = ' ';
-    b32 modversion = 0;
-    versop override_op = versop_ERR;
-    s8 override_version = {0};
-    b32 print_sysinc = !!conf->print_sysinc.s;
-    b32 print_syslib = !!conf->print_syslib.s;
-    s8 variable = {0};
-
-    proc->define_prefix = conf->define_prefix;
-    s8 top_builddir = conf->top_builddir;
-    if (top_builddir.s) {
-        top_builddir = s8pathencode(top_builddir, perm);
-    } else {
-        top_builddir = S("$(top_builddir)");
+    s8 parent = dirname(p->path);
+    if (s8equals(S("pkgconfig"), basename(parent))) {
+        s8 prefix = dirname(dirname(parent));
+        prefix = s8pathencode(prefix, perm);
+        *insert(&p->env, S("prefix"), perm) = prefix;
+        p->memo = 0;  // invalidate expansions
     }
+}
 
-    *insert(&global, S("pc_path"), perm) = conf->fixedpath;
-    *insert(&global, S("pc_system_includedirs"), perm) = conf->sys_incpath;
-    *insert(&global, S("pc_system_libdirs"), perm) = conf->sys_libpath;
-    *insert(&global, S("pc_sysrootdir"), perm) = S("/");
-    *insert(&global, S("pc_top_builddir"), perm) = top_builddir;
+static void failmaxrecurse(u8buf *err, s8 tok)
+{
+    prints8(err, S("pkg-config: "));
+    prints8(err, S("exceeded max recursion depth on '"));
+    prints8(err, tok);
+    prints8(err, S("'\n"));
+    flush(err);
+    fail();
+}
 
-    s8 *args = new(perm, s8, conf->nargs);
-    size nargs = 0;
+static void failversion(u8buf *err, pkg *pkg, versop op, s8 want)
+{
+    prints8(err, S("pkg-config: "));
+    prints8(err, S("requested '"));
+    prints8(err, pkg->realname);
+    prints8(err, S("' "));
+    prints8(err, opname(op));
+    prints8(err, S(" '"));
+    prints8(err, want);
+    prints8(err, S("' but got '"));
+    prints8(err, pkg->version);
+    prints8(err, S("'\n"));
+    flush(err);
+    fail();
+}
 
-    for (options opts = newoptions(conf->args, conf->nargs);;) {
-        optresult r = nextoption(&opts);
-        if (!r.ok) {
-            break;
+// Index the search path on first use. Batch mode keeps the index for
+// the rest of the generation.
+static pcindex *searchindex(processor *proc, arena *perm)
+{
+    session *s = proc->session;
+    if (!s->keep) {
+        if (!proc->index) {
+            proc->index = newindex(&proc->search, perm);
         }
+        return proc->index;
+    }
+    if (!s->index) {
+        s->index = newindex(&proc->search, s->keep);
+    }
+    return s->index;
+}
 
-        if (!r.isoption) {
-            args[nargs++] = r.arg;
+// Begin a new generation when the search stamp changes, since nothing
+// kept for another stamp can be used again, or when keep runs low. The
+// cache lives in keep, too, so it's saved and reloaded.
+static void newgeneration(session *s, s8 cachepath, arena scratch)
+{
+    size cap  = s->empty.end - s->empty.beg;
+    size left = s->keep->end - s->keep->beg;
+    if (s->stamp==s->keepstamp && left>=cap/4) {
+        return;
+    }
 
-        } else if (s8equals(r.arg, S("h")) || s8equals(r.arg, S("-help"))) {
-            usage(out);
-            flush(out);
-            return;
+    if (s->cache) {
+        cachesave(s->cache, scratch);
+    }
+    *s->keep = s->empty;
+    s->memo = 0;
+    s->index = 0;
+    s->keepstamp = s->stamp;
+    if (s->cache) {
+        s->cache = opencache(cachepath, s->keep);
+    }
+}
 
-        } else if (s8equals(r.arg, S("-version"))) {
-            prints8(out, S(VERSION));
-            printu8(out, '\n');
-            flush(out);
-            return;
+// Find and parse a package, consulting the memo and cache when enabled.
+// Explicit .pc paths are relative to the working directory and never
+// cached.
+static pkg loadpackage(processor *proc, s8 realname, arena *perm)
+{
+    session *s = proc->session;
+    pkgcache *cache = s->cache;
+    search *dirs = &proc->search;
+    if (realnameispath(realname)) {
+        return findpackage(dirs, 0, proc->err, realname, perm);
+    } else if (!cache && !s->keep) {
+        pcindex *index = searchindex(proc, perm);
+        return findpackage(dirs, index, proc->err, realname, perm);
+    }
 
-        } else if (s8equals(r.arg, S("-modversion"))) {
-            modversion = 1;
+    pkg p = {0};
+    u64 stamp = s->stamp;
+    if (s->keep) {
+        cacherecord **r = memoize(&s->memo, stamp, realname, 0);
+        if (r && recordfresh(*r, *perm)) {
+            return recordpkg(*r, perm);
+        }
+    }
 
-        } else if (s8equals(r.arg, S("-define-prefix"))) {
-            proc->define_prefix = 1;
+    // Packages are built in a copy of the arena, committed on success
+    // so that a failed batch query cannot leave a partial allocation.
+    pcindex *index = s->keep ? searchindex(proc, perm) : 0;
+    arena *mem = s->keep ? s->keep : perm;
+    arena tmp = *mem;
+    b32 parsed = 0;
+    if (!cache || !cachelookup(cache, stamp, realname, &p, &tmp)) {
+        index = index ? index : searchindex(proc, &tmp);
+        p = findpackage(dirs, index, proc->err, realname, &tmp);
+        parsed = 1;
+    }
 
-        } else if (s8equals(r.arg, S("-dont-define-prefix"))) {
-            proc->define_prefix = 0;
+    cacherecord *r = 0;
+    if ((cache && parsed) || s->keep) {
+        r = newrecord(&p, stamp, &tmp);
+    }
+    if (r && cache && parsed) {
+        cacheinsert(cache, r);
+    }
+    if (r && s->keep) {
+        *memoize(&s->memo, stamp, realname, &tmp) = r;
+        p = recordpkg(r, perm);
+    }
+    *mem = tmp;
+    return p;
+}
 
-        } else if (s8equals(r.arg, S("-cflags"))) {
-            cflags = 1;
-            filterc = filter_ANY;
+static void process(processor *proc, s8 arg, arena *perm)
+{
+    u8buf *err = proc->err;
+    pkgs *pkgs = proc->pkgs;
+    env **global = proc->global;
 
-        } else if (s8equals(r.arg, S("-libs"))) {
-            libs = 1;
-            filterl = filter_ANY;
+    procstate *stack = proc->stack;
+    i32 cap = countof(proc->stack);
+    i32 top = 0;
+    stack[0].arg = arg;
+    stack[0].last = proc->last;
+    stack[0].depth = 0;
+    stack[0].flags = pkg_DIRECT | pkg_PUBLIC;
+    stack[0].op = proc->op;
 
-        } else if (s8equals(r.arg, S("-variable"))) {
-            if (!r.value.s) {
-                r.value = getargopt(err, &opts, r.arg);
+    while (top >= 0) {
+        procstate *s = stack + top;
+        s8pair pair = nexttoken(s->arg);
+        s8 tok = pair.head;
+        if (!tok.len) {
+            if (top>0 && s->op) {
+                procfail(err, s->op, s->last);
             }
-            variable = r.value;
-
-        } else if (s8equals(r.arg, S("-static"))) {
-            static_ = 1;
+            top--;
+            continue;
+        }
+        stack[top].arg = pair.tail;
 
-        } else if (s8equals(r.arg, S("-libs-only-L"))) {
-            libs = 1;
-            filterl = filter_L;
+        if (s->op) {
+            if (!proc->ignore_versions) {
+                i32 cmp = compareversions(s->last->version, tok);
+                if (!validcompare(s->op, cmp)) {
+                    failversion(err, s->last, s->op, tok);
+                }
+            }
+            s->last = 0;
+            s->op = versop_ERR;
+            continue;
+        }
 
-        } else if (s8equals(r.arg, S("-libs-only-l"))) {
-            libs = 1;
-            filterl = filter_l;
+        s->op = parseop(tok);
+        if (s->op) {
+            if (!s->last) {
+                prints8(err, S("pkg-config: "));
+                prints8(err, S("unexpected operator '"));
+                prints8(err, tok);
+                prints8(err, S("'\n"));
+                flush(err);
+                fail();
+            }
+            continue;
+        }
 
-        } else if (s8equals(r.arg, S("-libs-only-other"))) {
+        i32 depth = s->depth + 1;
+        i32 flags = s->flags;
+        pkg *p = s->last = locate(pkgs, pathtorealname(tok), perm);
+        if (p->contents.s) {
+            if (flags&pkg_PUBLIC && !(p->flags & pkg_PUBLIC)) {
+                // We're on a public branch, but this package was
+                // previously loaded as private. Recursively traverse
+                // its public requires and mark all as public.
+                p->flags |= pkg_PUBLIC;
+                if (proc->recursive && depth<proc->maxdepth) {
+                    if (top >= cap-1) {
+                        failmaxrecurse(err, tok);
+                    }
+                    top++;
+                    stack[top].arg = p->requires;
+                    stack[top].last = 0;
+                    stack[top].depth = depth;
+                    stack[top].flags = flags & ~pkg_DIRECT;
+                    stack[top].op = versop_ERR;
+                }
+            }
+        } else {
+            // Package hasn't been loaded yet, so find and load it.
+            pkg newpkg = loadpackage(proc, tok, perm);
+            if (!s8equals(newpkg.realname, S("pkg-config"))) {
+                append(&proc->deps, newpkg.path, perm);  // not built-in
+            }
+            proc->searched |= !realnameispath(tok);
+            if (proc->define_prefix) {
+                setprefix(&newpkg, perm);
+            }
+            expandmerge(err, *global, p, &newpkg, perm);
+            if (proc->recursive && depth<proc->maxdepth) {
+                if (top >= cap-2) {
+                    failmaxrecurse(err, tok);
+                }
+                top++;
+                stack[top].arg = p->requiresprivate;
+                stack[top].last = 0;
+                stack[top].depth = depth;
+                stack[top].flags = 0;
+                stack[top].op = versop_ERR;
+                top++;
+                stack[top].arg = p->requires;
+                stack[top].last = 0;
+                stack[top].depth = depth;
+                stack[top].flags = flags & ~pkg_DIRECT;
+                stack[top].op = versop_ERR;
+            }
+        }
+        p->flags |= flags;
+    }
+
+    proc->last = stack[0].last;
+    proc->op = stack[0].op;
+}
+
+static void endprocessor(processor *proc, u8buf *err)
+{
+    if (proc->op) {
+        procfail(err, proc->op, 0);
+    }
+}
+
+typedef enum {
+    filter_ANY,
+    filter_I,
+    filter_L,
+    filter_l,
+    filter_OTHERC,
+    filter_OTHERL
+} filter;
+
+static b32 filterok(filter f, s8 arg)
+{
+    switch (f) {
+    case filter_ANY:
+        return 1;
+    case filter_I:
+        return startswith(arg, S("-I"));
+    case filter_L:
+        return startswith(arg, S("-L"));
+    case filter_l:
+        return startswith(arg, S("-l"));
+    case filter_OTHERC:
+        return !startswith(arg, S("-I"));
+    case filter_OTHERL:
+        return !startswith(arg, S("-L")) && !startswith(arg, S("-l"));
+    }
+    assert(0);
+}
+
+static void msvcize(u8buf *out, s8 arg)
+{
+    if (startswith(arg, S("-L"))) {
+        prints8(out, S("/libpath:"));
+        prints8(out, cuthead(arg, 2));
+    } else if (startswith(arg, S("-I"))) {
+        prints8(out, S("/I"));
+        prints8(out, cuthead(arg, 2));
+    } else if (startswith(arg, S("-l"))) {
+        prints8(out, cuthead(arg, 2));
+        prints8(out, S(".lib"));
+    } else if (startswith(arg, S("-D"))) {
+        prints8(out, S("/D"));
+        prints8(out, cuthead(arg, 2));
+    } else if (s8equals(arg, S("-mwindows"))) {
+        prints8(out, S("/subsystem:windows"));
+    } else if (s8equals(arg, S("-mconsole"))) {
+        prints8(out, S("/subsystem:console"));
+    } else {
+        prints8(out, arg);
+    }
+}
+
+typedef struct argpos argpos;
+struct argpos {
+    argpos *child[4];
+    argpos *next;
+    s8      arg;
+    size    position;
+};
+
+typedef struct {
+    s8list  list;
+    argpos *positions;
+    size    count;
+} args;
+
+static argpos *findargpos(argpos **m, s8 arg, arena *perm)
+{
+    for (u32 h = s8hash(arg); *m; h <<= 2) {
+        if (s8equals((*m)->arg, arg)) {
+            return *m;
+        }
+        m = &(*m)->child[h>>30];
+    }
+    if (perm) {
+        *m = new(perm, argpos, 1);
+        (*m)->arg = arg;
+    }
+    return *m;
+}
+
+static b32 dedupable(s8 arg)
+{
+    // Do not count "-I" or "-L" with detached argument
+    if (arg.len<3 || arg.s[0]!='-') {
+        return 0;
+    } else if (s8equals(arg, S("-pthread"))) {
+        return 1;
+    }
+    s8 flags = S("DILflm");
+    for (size i = 0; i < flags.len; i++) {
+        if (arg.s[1] == flags.s[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void appendarg(args *args, s8 arg, arena *perm)
+{
+    append(&args->list, arg, perm);
+    size position = args->count++;
+    if (dedupable(arg)) {
+        argpos *n = findargpos(&args->positions, arg, perm);
+        if (!n->position || startswith(arg, S("-l"))) {
+            // Zero position reserved for null, so bias it by 1
+            n->position = 1 + position;
+        }
+    }
+}
+
+static void excludearg(args *args, s8 arg, arena *perm)
+{
+    argpos *n = findargpos(&args->positions, arg, perm);
+    n->position = -1;  // i.e. position before first argument
+}
+
+// Is this the correct position for the given argument?
+static b32 inposition(args *args, s8 arg, size position)
+{
+    argpos *n = findargpos(&args->positions, arg, 0);
+    return !n || n->position==position+1;
+}
+
+typedef struct {
+    arena *perm;
+    size  *argcount;
+    args   args;
+    filter filter;
+    b32    msvc;
+    u8     delim;
+} fieldwriter;
+
+static fieldwriter newfieldwriter(filter f, size *argcount, arena *perm)
+{
+    fieldwriter w = {0};
+    w.perm = perm;
+    w.filter = f;
+    w.argcount = argcount;
+    return w;
+}
+
+static void insertsyspath(fieldwriter *w, s8 path, u8 delim, u8 flag)
+{
+    arena *perm = w->perm;
+
+    u8 flagbuf[3] = {0};
+    flagbuf[0] = '-';
+    flagbuf[1] = flag;
+    s8 prefix = S(flagbuf);
+
+    while (path.len) {
+        cut c = s8cut(path, delim);
+        s8 dir = c.head;
+        path = c.tail;
+        if (!dir.len) {
+            continue;
+        }
+
+        // Prepend option flag
+        dir = s8pathencode(dir, perm);
+        s8 syspath = news8(perm, prefix.len+dir.len);
+        s8copy(s8copy(syspath, prefix), dir);
+
+        // Process as an argument, as though being printed
+        dequoted dr = dequote(syspath, perm);
+        syspath = dr.arg;
+
+        // NOTE(NRK): Technically, the path doesn't need to follow the flag
+        // immediately e.g `-I /usr/include` (notice the space between -I and
+        // the include dir!).
+        //
+        // But I have not seen a single pc file that does this and so we're not
+        // handling this edge-case. As a proof that this should be fine in
+        // practice, `pkgconf` which is used by many distros, also doesn't
+        // handle it.
+        if (dr.ok && !dr.tail.len) {
+            excludearg(&w->args, syspath, perm);
+        }
+    }
+}
+
+static void appendfield(u8buf *err, fieldwriter *w, pkg *p, s8 field)
+{
+    arena *perm = w->perm;
+    filter f = w->filter;
+    while (field.len) {
+        dequoted r = dequote(field, perm);
+        if (!r.ok) {
+            prints8(err, S("pkg-config: "));
+            prints8(err, S("unmatched quote in '"));
+            prints8(err, p->realname);
+            prints8(err, S("'\n"));
+            flush(err);
+            fail();
+        }
+        if (filterok(f, r.arg)) {
+            appendarg(&w->args, r.arg, perm);
+        }
+        field = r.tail;
+    }
+}
+
+static void writeargs(u8buf *out, fieldwriter *w)
+{
+    size position = 0;
+    u8 delim = w->delim ? w->delim : ' ';
+    for (s8node *n = w->args.list.head; n; n = n->next) {
+        s8 arg = n->str;
+        if (inposition(&w->args, arg, position++)) {
+            if ((*w->argcount)++) {
+                printu8(out, delim);
+            }
+            if (w->msvc) {
+                msvcize(out, arg);
+            } else {
+                prints8(out, arg);
+            }
+        }
+    }
+}
+
+static i32 parseuint(s8 s, i32 hi)
+{
+    i32 v = 0;
+    for (size i = 0; i < s.len; i++) {
+        u8 c = s.s[i];
+        if (digit(c)) {
+            v = v*10 + c - '0';
+            if (v >= hi) {
+                return hi;
+            }
+        }
+    }
+    return v;
+}
+
+// Write a path escaped for Make and Ninja.
+static void printdep(u8buf *b, s8 path)
+{
+    for (size i = 0; i < path.len; i++) {
+        u8 c = path.s[i];
+        switch (c) {
+        case ' ':
+        case '#': printu8(b, '\\');
+                  break;
+        case '$': printu8(b, '$');
+                  break;
+        }
+        printu8(b, c);
+    }
+}
+
+// Write a depfile naming every .pc file loaded, plus the search path
+// directories if consulted, since adding a .pc file to one changes
+// resolution. Each dependency also gets an empty rule, like "gcc -MP",
+// so that deleting it does not break the build. Nonexistent directories
+// cannot be listed.
+static void writedepfile(processor *proc, s8 path, s8 target, arena scratch)
+{
+    s8list deps = proc->deps;
+    s8node *dir = proc->searched ? proc->search.list.head : 0;
+    for (; dir; dir = dir->next) {
+        arena temp = scratch;
+        if (os_stamp(&temp, tocstr(dir->str, &temp)).ok) {
+            append(&deps, dir->str, &scratch);
+        }
+    }
+    path = tocstr(path, &scratch);
+
+    u8buf mem = newmembuf(&scratch);
+    printdep(&mem, target);
+    printu8(&mem, ':');
+    for (s8node *n = deps.head; n; n = n->next) {
+        prints8(&mem, S(" \\\n  "));
+        printdep(&mem, n->str);
+    }
+    printu8(&mem, '\n');
+    for (s8node *n = deps.head; n; n = n->next) {
+        printu8(&mem, '\n');
+        printdep(&mem, n->str);
+        prints8(&mem, S(":\n"));
+    }
+    s8 data = finalize(&mem);
+
+    if (!os_savefile(&scratch, path, data)) {
+        u8buf *err = proc->err;
+        prints8(err, S("pkg-config: "));
+        prints8(err, S("could not write depfile '"));
+        prints8(err, cuttail(path, 1));
+        prints8(err, S("'\n"));
+        flush(err);
+        fail();
+    }
+}
+
+// Print every package on the search path sorted by name, skipping any
+// that fail to load.
+static void listall(processor *proc, u8buf *out, env *global, arena *perm)
+{
+    pcindex *index = searchindex(proc, perm);
+    sortindex(index);
+
+    size width = 0;
+    for (pcname *n = index->head; n; n = n->next) {
+        width = width>n->name.len ? width : n->name.len;
+    }
+
+    u8buf *null = newnullout(perm);
+    u8buf *err = proc->err;
+    proc->err = null;
+    void **save = failjmp;
+    for (pcname *n = index->head; n; n = n->next) {
+        arena scratch = *perm;
+        void *jmp[5];
+        if (!__builtin_setjmp(jmp)) {
+            failjmp = jmp;
+            pkg p = loadpackage(proc, n->name, &scratch);
+            if (proc->define_prefix) {
+                setprefix(&p, &scratch);
+            }
+            s8 name = expand(null, global, &p, p.name, &scratch);
+            s8 desc = expand(null, global, &p, p.description, &scratch);
+            u8buf mem = newmembuf(&scratch);
+            prints8(&mem, n->name);
+            for (size i = n->name.len; i <= width; i++) {
+                printu8(&mem, ' ');
+            }
+            prints8(&mem, name);
+            prints8(&mem, S(" - "));
+            prints8(&mem, desc);
+            printu8(&mem, '\n');
+            prints8(out, finalize(&mem));
+        }
+        failjmp = save;
+    }
+    proc->err = err;
+}
+
+// Run one pkg-config invocation. Returning indicates success.
+static void query(config *conf, session *sess, s8 *argv, size argc,
+                  i32 outfd, i32 errfd)
+{
+    arena *perm = &conf->perm;
+
+    env *global = 0;
+    filter filterc = filter_ANY;
+    filter filterl = filter_ANY;
+    pkgs *pkgs = newpkgs(perm);
+    u8buf *out = newfdbuf(perm, outfd, 1<<12);
+    u8buf *err = newfdbuf(perm, errfd, 1<<7);
+    processor *proc = newprocessor(conf, err, &global, pkgs);
+    proc->session = sess;
+    size argcount = 0;
+
+    b32 msvc = 0;
+    b32 libs = 0;
+    b32 cflags = 0;
+    b32 err_to_stdout = 0;
+    b32 silent = 0;
+    b32 static_ = 0;
+    u8 argdelim = ' ';
+    b32 modversion = 0;
+    versop override_op = versop_ERR;
+    s8 override_version = {0};
+    b32 print_sysinc = !!conf->print_sysinc.s;
+    b32 print_syslib = !!conf->print_syslib.s;
+    s8 variable = {0};
+    b32 list = 0;
+    s8 depfile = {0};
+    s8 deptarget = {0};
+
+    proc->define_prefix = conf->define_prefix;
+    s8 top_builddir = conf->top_builddir;
+    if (top_builddir.s) {
+        top_builddir = s8pathencode(top_builddir, perm);
+    } else {
+        top_builddir = S("$(top_builddir)");
+    }
+
+    *insert(&global, S("pc_path"), perm) = conf->fixedpath;
+    *insert(&global, S("pc_system_includedirs"), perm) = conf->sys_incpath;
+    *insert(&global, S("pc_system_libdirs"), perm) = conf->sys_libpath;
+    *insert(&global, S("pc_sysrootdir"), perm) = S("/");
+    *insert(&global, S("pc_top_builddir"), perm) = top_builddir;
+
+    s8 *args = new(perm, s8, argc);
+    size nargs = 0;
+
+    for (options opts = newoptions(argv, argc);;) {
+        optresult r = nextoption(&opts);
+        if (!r.ok) {
+            break;
+        }
+
+        if (!r.isoption) {
+            args[nargs++] = r.arg;
+
+        } else if (s8equals(r.arg, S("h")) || s8equals(r.arg, S("-help"))) {
+            usage(out);
+            flush(out);
+            return;
+
+        } else if (s8equals(r.arg, S("-version"))) {
+            prints8(out, S(VERSION));
+            printu8(out, '\n');
+            flush(out);
+            return;
+
+        } else if (s8equals(r.arg, S("-modversion"))) {
+            modversion = 1;
+
+        } else if (s8equals(r.arg, S("-list-all"))) {
+            list = 1;
+
+        } else if (s8equals(r.arg, S("-depfile"))) {
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            depfile = r.value;
+
+        } else if (s8equals(r.arg, S("-depfile-target"))) {
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            deptarget = r.value;
+
+        } else if (s8equals(r.arg, S("-define-prefix"))) {
+            proc->define_prefix = 1;
+
+        } else if (s8equals(r.arg, S("-dont-define-prefix"))) {
+            proc->define_prefix = 0;
+
+        } else if (s8equals(r.arg, S("-cflags"))) {
+            cflags = 1;
+            filterc = filter_ANY;
+
+        } else if (s8equals(r.arg, S("-libs"))) {
+            libs = 1;
+            filterl = filter_ANY;
+
+        } else if (s8equals(r.arg, S("-variable"))) {
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            variable = r.value;
+
+        } else if (s8equals(r.arg, S("-static"))) {
+            static_ = 1;
+
+        } else if (s8equals(r.arg, S("-libs-only-L"))) {
+            libs = 1;
+            filterl = filter_L;
+
+        } else if (s8equals(r.arg, S("-libs-only-l"))) {
+            libs = 1;
+            filterl = filter_l;
+
+        } else if (s8equals(r.arg, S("-libs-only-other"))) {
             libs = 1;
             filterl = filter_OTHERL;
 
-        } else if (s8equals(r.arg, S("-cflags-only-I"))) {
-            cflags = 1;
-            filterc = filter_I;
+        } else if (s8equals(r.arg, S("-cflags-only-I"))) {
+            cflags = 1;
+            filterc = filter_I;
+
+        } else if (s8equals(r.arg, S("-cflags-only-other"))) {
+            cflags = 1;
+            filterc = filter_OTHERC;
+
+        } else if (s8equals(r.arg, S("-with-path"))) {
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            prependpath(&proc->search, r.value, perm);
+
+        } else if (s8equals(r.arg, S("-maximum-traverse-depth"))) {
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            proc->maxdepth = parseuint(r.value, 1000);
+
+        } else if (s8equals(r.arg, S("-msvc-syntax"))) {
+            msvc = 1;
+
+        } else if (s8equals(r.arg, S("-define-variable"))) {
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            cut c = s8cut(r.value, '=');
+            if (!c.ok) {
+                prints8(err, S("pkg-config: "));
+                prints8(err, S("value missing in --define-variable for '"));
+                prints8(err, r.value);
+                prints8(err, S("'\n"));
+                flush(err);
+                fail();
+            }
+            *insert(&global, c.head, perm) = c.tail;
+
+        } else if (s8equals(r.arg, S("-newlines"))) {
+            argdelim = '\n';
+
+        } else if (s8equals(r.arg, S("-exists"))) {
+            // The check already happens, just disable the messages
+            silent = 1;
+
+        } else if (s8equals(r.arg, S("-atleast-pkgconfig-version"))) {
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            return;  // always succeeds
+
+        } else if (s8equals(r.arg, S("-atleast-version"))) {
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            override_op = versop_GTE;
+            override_version = r.value;
+            silent = 1;
+            proc->recursive = 0;
+            proc->ignore_versions = 1;
+
+        } else if (s8equals(r.arg, S("-exact-version"))) {
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            override_op = versop_EQ;
+            override_version = r.value;
+            silent = 1;
+            proc->recursive = 0;
+            proc->ignore_versions = 1;
+
+        } else if (s8equals(r.arg, S("-max-version"))) {
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            override_op = versop_LTE;
+            override_version = r.value;
+            silent = 1;
+            proc->recursive = 0;
+            proc->ignore_versions = 1;
+
+        } else if (s8equals(r.arg, S("-silence-errors"))) {
+            silent = 1;
+
+        } else if (s8equals(r.arg, S("-errors-to-stdout"))) {
+            err_to_stdout = 1;
+
+        } else if (s8equals(r.arg, S("-print-errors"))) {
+            // Ignore
+
+        } else if (s8equals(r.arg, S("-short-errors"))) {
+            // Ignore
+
+        } else if (s8equals(r.arg, S("-uninstalled"))) {
+            // Ignore
+
+        } else if (s8equals(r.arg, S("-keep-system-cflags"))) {
+            print_sysinc = 1;
+
+        } else if (s8equals(r.arg, S("-keep-system-libs"))) {
+            print_syslib = 1;
+
+        } else if (s8equals(r.arg, S("-validate"))) {
+            silent = 1;
+            proc->recursive = 0;
+
+        } else {
+            prints8(err, S("pkg-config: "));
+            prints8(err, S("unknown option -"));
+            prints8(err, r.arg);
+            prints8(err, S("\n"));
+            flush(err);
+            fail();
+        }
+    }
+
+    if (err_to_stdout) {
+        err = out;
+    }
+
+    if (silent) {
+        err = newnullout(perm);
+    }
+
+    if (sess->cache || sess->keep) {
+        sess->stamp = searchstamp(&proc->search, *perm);
+    }
+    if (sess->keep) {
+        newgeneration(sess, conf->cachepath, *perm);
+    }
+
+    if (list) {
+        listall(proc, out, global, perm);
+        flush(out);
+        return;
+    }
+
+    for (size i = 0; i < nargs; i++) {
+        process(proc, args[i], perm);
+    }
+    endprocessor(proc, err);
+
+    if (sess->cache) {
+        cachesave(sess->cache, *perm);
+    }
+
+    if (!pkgs->count) {
+        prints8(err, S("pkg-config: "));
+        prints8(err, S("requires at least one package name\n"));
+        flush(err);
+        fail();
+    }
+
+    if (depfile.s) {
+        proc->err = err;
+        writedepfile(proc, depfile, deptarget.s ? deptarget : depfile, *perm);
+    }
+
+    // --{atleast,exact,max}-version
+    if (override_op) {
+        for (pkg *p = pkgs->head; p; p = p->list) {
+            i32 cmp = compareversions(p->version, override_version);
+            if (!validcompare(override_op, cmp)) {
+                failversion(err, p, override_op, override_version);
+            }
+        }
+    }
+
+    if (modversion) {
+        for (pkg *p = pkgs->head; p; p = p->list) {
+            if (p->flags & pkg_DIRECT) {
+                prints8(out, p->version);
+                prints8(out, S("\n"));
+            }
+        }
+    }
+
+    if (variable.s) {
+        for (pkg *p = pkgs->head; p; p = p->list) {
+            if (p->flags & pkg_DIRECT) {
+                s8 value = lookup(global, p->env, variable);
+                if (value.s) {
+                    prints8(out, expand(err, global, p, value, perm));
+                    prints8(out, S("\n"));
+                }
+            }
+        }
+    }
+
+    if (cflags) {
+        arena scratch = *perm;
+        fieldwriter fw = newfieldwriter(filterc, &argcount, &scratch);
+        fw.delim = argdelim;
+        fw.msvc = msvc;
+        if (!print_sysinc) {
+            insertsyspath(&fw, conf->sys_incpath, conf->delim, 'I');
+        }
+        for (pkg *p = pkgs->head; p; p = p->list) {
+            appendfield(err, &fw, p, p->cflags);
+        }
+        writeargs(out, &fw);
+    }
+
+    if (libs) {
+        arena scratch = *perm;
+        fieldwriter fw = newfieldwriter(filterl, &argcount, &scratch);
+        fw.delim = argdelim;
+        fw.msvc = msvc;
+        if (!print_syslib) {
+            insertsyspath(&fw, conf->sys_libpath, conf->delim, 'L');
+        }
+        for (pkg *p = pkgs->head; p; p = p->list) {
+            if (static_) {
+                appendfield(err, &fw, p, p->libs);
+                appendfield(err, &fw, p, p->libsprivate);
+            } else if (p->flags & pkg_PUBLIC) {
+                appendfield(err, &fw, p, p->libs);
+            }
+        }
+        writeargs(out, &fw);
+    }
+
+    if (cflags || libs) {
+        prints8(out, S("\n"));
+    }
+
+    flush(out);
+}
+
+typedef struct {
+    u8  *buf;
+    i32  cap;
+    i32  len;
+    i32  off;
+    i32  fd;
+} u8input;
+
+static u8input *newinput(arena *perm, i32 fd, i32 cap)
+{
+    u8input *in = new(perm, u8input, 1);
+    in->buf = new(perm, u8, cap);
+    in->cap = cap;
+    in->fd  = fd;
+    return in;
+}
+
+// Read the next line into the arena, without its line ending. Returns a
+// null string at end of input.
+static s8 readline(u8input *in, arena *perm)
+{
+    b32 eof = 1;
+    u8buf mem = newmembuf(perm);
+    for (;;) {
+        if (in->off == in->len) {
+            in->off = 0;
+            in->len = os_read(in->fd, in->buf, in->cap);
+            if (!in->len) {
+                break;
+            }
+        }
+        eof = 0;
+        u8 c = in->buf[in->off++];
+        if (c == '\n') {
+            break;
+        }
+        printu8(&mem, c);
+    }
+    s8 line = finalize(&mem);
+    if (line.len && line.s[line.len-1]=='\r') {
+        line.len--;
+    }
+    if (eof) {
+        line.s = 0;
+    }
+    return line;
+}
+
+// Answer one query per input line, arguments separated by whitespace,
+// until end of input. Each query begins with the prefix arguments. A
+// response is the query's output, then a null byte, the exit status,
+// and a newline.
+static void batch(config *conf, session *sess, s8 *prefix, size nprefix,
+                  i32 infd, i32 outfd, i32 errfd)
+{
+    arena *perm = &conf->perm;
+    u8input *in = newinput(perm, infd, 1<<12);
+
+    for (;;) {
+        arena reset = *perm;
+        s8 line = readline(in, perm);
+        if (!line.s) {
+            break;
+        }
+
+        size argc = nprefix;
+        for (size i = 0; i < line.len; i++) {
+            b32 beg = !whitespace(line.s[i]);
+            argc += beg && (!i || whitespace(line.s[i-1]));
+        }
+        s8 *argv = new(perm, s8, argc);
+        argc = 0;
+        for (; argc < nprefix; argc++) {
+            argv[argc] = prefix[argc];
+        }
+        for (size i = 0; i < line.len;) {
+            for (; i<line.len && whitespace(line.s[i]); i++) {}
+            size beg = i;
+            for (; i<line.len && !whitespace(line.s[i]); i++) {}
+            if (i > beg) {
+                argv[argc++] = s8span(line.s+beg, line.s+i);
+            }
+        }
+
+        void *jmp[5];
+        s8 status = S("\0" "0\n");
+        if (__builtin_setjmp(jmp)) {
+            status = S("\0" "1\n");
+        } else {
+            failjmp = jmp;
+            query(conf, sess, argv, argc, outfd, errfd);
+        }
+        failjmp = 0;
+
+        os_write(outfd, status);
+        os_flush(outfd);
+        *perm = reset;
+    }
+}
+
+static void uconfig(config *conf)
+{
+    arena *perm = &conf->perm;
+    session *sess = new(perm, session, 1);
+    u8buf *err = newfdbuf(perm, 2, 1<<7);
+
+    // Pull out batch options, keeping the rest verbatim as a prefix
+    b32 batchmode = 0;
+    s8 serve = {0};
+    s8 *prefix = new(perm, s8, conf->nargs);
+    size nprefix = 0;
+    for (options opts = newoptions(conf->args, conf->nargs);;) {
+        size beg = opts.index;
+        optresult r = nextoption(&opts);
+        if (!r.ok) {
+            break;
+        } else if (r.isoption && s8equals(r.arg, S("-batch"))) {
+            batchmode = 1;
+        } else if (r.isoption && s8equals(r.arg, S("-serve"))) {
+            if (!r.value.s) {
+                r.value = getargopt(err, &opts, r.arg);
+            }
+            serve = r.value;
+        } else {
+            for (size i = beg; i < opts.index; i++) {
+                prefix[nprefix++] = conf->args[i];
+            }
+        }
+    }
+
+    if (!batchmode && !serve.s) {
+        if (conf->cachepath.len) {
+            sess->cache = opencache(conf->cachepath, perm);
+        }
+        query(conf, sess, conf->args, conf->nargs, 1, 2);
+        return;
+    }
+
+    // Packages persisting across queries get an arena of their own, so
+    // each query still has the whole of perm
+    sess->keep = new(perm, arena, 1);
+    *sess->keep = os_newarena(perm->end - perm->beg);
+    if (sess->keep->beg == sess->keep->end) {
+        oom();
+    }
+    sess->empty = *sess->keep;
+    if (conf->cachepath.len) {
+        sess->cache = opencache(conf->cachepath, sess->keep);
+    }
+
+    if (!serve.s) {
+        batch(conf, sess, prefix, nprefix, 0, 1, 2);
+        return;
+    }
+
+    i32 listener = os_listen(perm, tocstr(serve, perm));
+    if (listener < 0) {
+        prints8(err, S("pkg-config: "));
+        prints8(err, S("could not listen on '"));
+        prints8(err, serve);
+        prints8(err, S("'\n"));
+        flush(err);
+        fail();
+    }
+    for (;;) {
+        i32 fd = os_accept(listener);
+        if (fd < 0) {
+            prints8(err, S("pkg-config: "));
+            prints8(err, S("failed to accept a connection\n"));
+            flush(err);
+            fail();
+        }
+        // Clients see errors in their responses
+        batch(conf, sess, prefix, nprefix, fd, fd, fd);
+        os_close(fd);
+    }
+}
+
+#if _WIN32
+// Win32 types, constants, and declarations (replaces windows.h)
+// This is free and unencumbered software released into the public domain.
+
+typedef __SIZE_TYPE__  uptr;
+typedef unsigned short char16_t;
+typedef char16_t       c16;
+
+enum {
+    FILE_ATTRIBUTE_NORMAL = 0x80,
+
+    FILE_SHARE_ALL = 7,
+
+    GENERIC_READ  = 0x80000000,
+    GENERIC_WRITE = 0x40000000,
+
+    GetFileExInfoStandard = 0,
+
+    INVALID_HANDLE_VALUE = -1,
+
+    MEM_COMMIT  = 0x1000,
+    MEM_RESERVE = 0x2000,
+
+    CREATE_ALWAYS = 2,
+    OPEN_EXISTING = 3,
+
+    MOVEFILE_REPLACE_EXISTING = 1,
+
+    PAGE_READWRITE = 4,
+
+    STD_INPUT_HANDLE  = -10,
+    STD_OUTPUT_HANDLE = -11,
+    STD_ERROR_HANDLE  = -12,
+
+    PIPE_ACCESS_DUPLEX   = 3,
+    ERROR_PIPE_CONNECTED = 535,
+
+    ERROR_FILE_NOT_FOUND = 2,
+    ERROR_PATH_NOT_FOUND = 3,
+
+    FILE_ATTRIBUTE_DIRECTORY = 0x10,
+};
+
+#define W32(r) __declspec(dllimport) r __stdcall
+W32(b32)    CloseHandle(uptr);
+W32(b32)    ConnectNamedPipe(uptr, uptr);
+W32(i32)    CreateFileW(c16 *, i32, i32, uptr, i32, i32, i32);
+W32(i32)    CreateNamedPipeW(c16 *, i32, i32, i32, i32, i32, i32, uptr);
+W32(b32)    DeleteFileW(c16 *);
+W32(b32)    DisconnectNamedPipe(uptr);
+W32(b32)    FindClose(uptr);
+W32(i32)    FindFirstFileW(c16 *, void *);
+W32(b32)    FindNextFileW(uptr, void *);
+W32(void)   ExitProcess(i32);
+W32(c16 *)  GetCommandLineW(void);
+W32(b32)    GetConsoleMode(uptr, i32 *);
+W32(i32)    GetCurrentProcessId(void);
+W32(i32)    GetEnvironmentVariableW(c16 *, c16 *, i32);
+W32(b32)    GetFileAttributesExW(c16 *, i32, void *);
+W32(i32)    GetLastError(void);
+W32(i32)    GetModuleFileNameW(uptr, c16 *, i32);
+W32(b32)    FlushFileBuffers(uptr);
+W32(i32)    GetStdHandle(i32);
+W32(b32)    MoveFileExW(c16 *, c16 *, i32);
+W32(b32)    ReadFile(uptr, u8 *, i32, i32 *, uptr);
+W32(byte *) VirtualAlloc(uptr, size, i32, i32);
+W32(b32)    WriteConsoleW(uptr, c16 *, i32, i32 *, uptr);
+W32(b32)    WriteFile(uptr, u8 *, i32, i32 *, uptr);
+
+#define CMDLINE_CMD_MAX  32767  // max command line length on Windows
+#define CMDLINE_ARGV_MAX (16384+(98298+(i32)sizeof(u8 *))/(i32)sizeof(u8 *))
+
+// Convert an ill-formed-UTF-16 command line to a WTF-8 argv following
+// field splitting semantics identical to CommandLineToArgvW, including
+// undocumented behavior. Populates argv with pointers into itself and
+// returns argc, which is always positive.
+//
+// Expects that cmd has no more than 32,767 (CMDLINE_CMD_MAX) elements
+// including the null terminator, and argv has at least CMDLINE_ARGV_MAX
+// elements. This covers the worst possible cases for a Windows command
+// string, so no further allocation is ever necessary.
+//
+// Unlike CommandLineToArgvW, when the command line string is zero
+// length this function does not invent an artificial argv[0] based on
+// the calling module file name. To implement this behavior yourself,
+// test if cmd[0] is zero and then act accordingly.
+//
+// If the input is UTF-16, then the output is UTF-8.
+static i32 cmdline_to_argv8(c16 *cmd, u8 **argv)
+{
+    i32 argc  = 1;  // worst case: argv[0] is an empty string
+    i32 state = 6;  // special argv[0] state
+    i32 slash = 0;
+    // Use second half as byte buffer
+    u8 *buf = (u8 *)(argv + 16384);
+
+    argv[0] = buf;
+    while (*cmd) {
+        i32 c = *cmd++;
+        if (c>>10 == 0x36 && *cmd>>10 == 0x37) {  // surrogates?
+            c = 0x10000 + ((c - 0xd800)<<10) + (*cmd++ - 0xdc00);
+        }
+
+        switch (state) {
+        case 0: switch (c) {  // outside token
+                case 0x09:
+                case 0x20: continue;
+                case 0x22: argv[argc++] = buf;
+                           state = 2;
+                           continue;
+                case 0x5c: argv[argc++] = buf;
+                           slash = 1;
+                           state = 3;
+                           break;
+                default  : argv[argc++] = buf;
+                           state = 1;
+                } break;
+        case 1: switch (c) {  // inside unquoted token
+                case 0x09:
+                case 0x20: *buf++ = 0;
+                           state = 0;
+                           continue;
+                case 0x22: state = 2;
+                           continue;
+                case 0x5c: slash = 1;
+                           state = 3;
+                           break;
+                } break;
+        case 2: switch (c) {  // inside quoted token
+                case 0x22: state = 5;
+                           continue;
+                case 0x5c: slash = 1;
+                           state = 4;
+                           break;
+                } break;
+        case 3:
+        case 4: switch (c) {  // backslash sequence
+                case 0x22: buf -= (1 + slash) >> 1;
+                           if (slash & 1) {
+                               state -= 2;
+                               break;
+                           } // fallthrough
+                default  : cmd -= 1 + (c >= 0x10000);
+                           state -= 2;
+                           continue;
+                case 0x5c: slash++;
+                } break;
+        case 5: switch (c) {  // quoted token exit
+                default  : cmd -= 1 + (c >= 0x10000);
+                           state = 1;
+                           continue;
+                case 0x22: state = 1;
+                } break;
+        case 6: switch (c) {  // begin argv[0]
+                case 0x09:
+                case 0x20: *buf++ = 0;
+                           state = 0;
+                           continue;
+                case 0x22: state = 8;
+                           continue;
+                default  : state = 7;
+                } break;
+        case 7: switch (c) {  // unquoted argv[0]
+                case 0x09:
+                case 0x20: *buf++ = 0;
+                           state = 0;
+                           continue;
+                } break;
+        case 8: switch (c) {  // quoted argv[0]
+                case 0x22: *buf++ = 0;
+                           state = 0;
+                           continue;
+                } break;
+        }
+
+        // WTF-8/UTF-8 encoding
+        switch ((c >= 0x80) + (c >= 0x800) + (c >= 0x10000)) {
+        case 0: *buf++ = (u8)(0x00 | ((c >>  0)     )); break;
+        case 1: *buf++ = (u8)(0xc0 | ((c >>  6)     ));
+                *buf++ = (u8)(0x80 | ((c >>  0) & 63)); break;
+        case 2: *buf++ = (u8)(0xe0 | ((c >> 12)     ));
+                *buf++ = (u8)(0x80 | ((c >>  6) & 63));
+                *buf++ = (u8)(0x80 | ((c >>  0) & 63)); break;
+        case 3: *buf++ = (u8)(0xf0 | ((c >> 18)     ));
+                *buf++ = (u8)(0x80 | ((c >> 12) & 63));
+                *buf++ = (u8)(0x80 | ((c >>  6) & 63));
+                *buf++ = (u8)(0x80 | ((c >>  0) & 63)); break;
+        }
+    }
+
+    *buf = 0;
+    argv[argc] = 0;
+    return argc;
+}
 
-        } else if (s8equals(r.arg, S("-cflags-only-other"))) {
-            cflags = 1;
-            filterc = filter_OTHERC;
+// Mingw-w64 Win32 platform layer for u-config
+// $ cc -nostartfiles -o pkg-config win32_main.c
+// This is free and unencumbered software released into the public domain.
 
-        } else if (s8equals(r.arg, S("-with-path"))) {
-            if (!r.value.s) {
-                r.value = getargopt(err, &opts, r.arg);
-            }
-            prependpath(&proc->search, r.value, perm);
+#ifndef PKG_CONFIG_PREFIX
+#  define PKG_CONFIG_PREFIX
+#endif
 
-        } else if (s8equals(r.arg, S("-maximum-traverse-depth"))) {
-            if (!r.value.s) {
-                r.value = getargopt(err, &opts, r.arg);
-            }
-            proc->maxdepth = parseuint(r.value, 1000);
+// For communication with os_write(). Slot 3 is the batch server pipe.
+static struct {
+    i32 handle;
+    b32 isconsole;
+    b32 err;
+} handles[4];
 
-        } else if (s8equals(r.arg, S("-msvc-syntax"))) {
-            msvc = 1;
+typedef struct {
+    c16 *s;
+    size len;
+} s16;
 
-        } else if (s8equals(r.arg, S("-define-variable"))) {
-            if (!r.value.s) {
-                r.value = getargopt(err, &opts, r.arg);
-            }
-            cut c = s8cut(r.value, '=');
-            if (!c.ok) {
-                prints8(err, S("pkg-config: "));
-                prints8(err, S("value missing in --define-variable for '"));
-                prints8(err, r.value);
-                prints8(err, S("'\n"));
-                flush(err);
-                os_fail();
-            }
-            *insert(&global, c.head, perm) = c.tail;
+static s16 s16cuthead_(s16 s, size off)
+{
+    assert(off >= 0);
+    assert(off <= s.len);
+    s.s += off;
+    s.len -= off;
+    return s;
+}
 
-        } else if (s8equals(r.arg, S("-newlines"))) {
-            argdelim = '\n';
+static arena newarena_(size cap)
+{
+    arena arena = {0};
+    arena.beg = VirtualAlloc(0, cap, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE);
+    if (!arena.beg) {
+        arena.beg = (byte *)16;  // aligned, non-null, zero-size arena
+        cap = 0;
+    }
+    arena.end = arena.beg + cap;
+    return arena;
+}
 
-        } else if (s8equals(r.arg, S("-exists"))) {
-            // The check already happens, just disable the messages
-            silent = 1;
+static arena os_newarena(size cap)
+{
+    return newarena_(cap);
+}
 
-        } else if (s8equals(r.arg, S("-atleast-pkgconfig-version"))) {
-            if (!r.value.s) {
-                r.value = getargopt(err, &opts, r.arg);
-            }
-            return;  // always succeeds
+typedef i32 char32_t;
+typedef char32_t c32;
 
-        } else if (s8equals(r.arg, S("-atleast-version"))) {
-            if (!r.value.s) {
-                r.value = getargopt(err, &opts, r.arg);
-            }
-            override_op = versop_GTE;
-            override_version = r.value;
-            silent = 1;
-            proc->recursive = 0;
-            proc->ignore_versions = 1;
+enum {
+    REPLACEMENT_CHARACTER = 0xfffd
+};
 
-        } else if (s8equals(r.arg, S("-exact-version"))) {
-            if (!r.value.s) {
-                r.value = getargopt(err, &opts, r.arg);
-            }
-            override_op = versop_EQ;
-            override_version = r.value;
-            silent = 1;
-            proc->recursive = 0;
-            proc->ignore_versions = 1;
+typedef struct {
+    s8  tail;
+    c32 rune;
+} utf8;
 
-        } else if (s8equals(r.arg, S("-max-version"))) {
-            if (!r.value.s) {
-                r.value = getargopt(err, &opts, r.arg);
-            }
-            override_op = versop_LTE;
-            override_version = r.value;
-            silent = 1;
-            proc->recursive = 0;
-            proc->ignore_versions = 1;
+static utf8 utf8decode_(s8 s)
+{
+    assert(s.len);
+    utf8 r = {0};
+    switch (s.s[0]&0xf0) {
+    default  : r.rune = s.s[0];
+               if (r.rune > 0x7f) break;
+               r.tail = cuthead(s, 1);
+               return r;
+    case 0xc0:
+    case 0xd0: if (s.len < 2) break;
+               if ((s.s[1]&0xc0) != 0x80) break;
+               r.rune = (i32)(s.s[0]&0x1f) << 6 |
+                        (i32)(s.s[1]&0x3f) << 0;
+               if (r.rune < 0x80) break;
+               r.tail = cuthead(s, 2);
+               return r;
+    case 0xe0: if (s.len < 3) break;
+               if ((s.s[1]&0xc0) != 0x80) break;
+               if ((s.s[2]&0xc0) != 0x80) break;
+               r.rune = (i32)(s.s[0]&0x0f) << 12 |
+                        (i32)(s.s[1]&0x3f) <<  6 |
+                        (i32)(s.s[2]&0x3f) <<  0;
+               if (r.rune < 0x800) break;
+               if (r.rune>=0xd800 && r.rune<=0xdfff) break;
+               r.tail = cuthead(s, 3);
+               return r;
+    case 0xf0: if (s.len < 4) break;
+               if ((s.s[1]&0xc0) != 0x80) break;
+               if ((s.s[2]&0xc0) != 0x80) break;
+               if ((s.s[3]&0xc0) != 0x80) break;
+               r.rune = (i32)(s.s[0]&0x0f) << 18 |
+                        (i32)(s.s[1]&0x3f) << 12 |
+                        (i32)(s.s[2]&0x3f) <<  6 |
+                        (i32)(s.s[3]&0x3f) <<  0;
+               if (r.rune < 0x10000) break;
+               if (r.rune > 0x10ffff) break;
+               r.tail = cuthead(s, 4);
+               return r;
+    }
+    r.rune = REPLACEMENT_CHARACTER;
+    r.tail = cuthead(s, 1);
+    return r;
+}
+
+// Encode code point returning the output length (1-4).
+static i32 utf8encode_(u8 *s, c32 rune)
+{
+    if (rune<0 || (rune>=0xd800 && rune<=0xdfff) || rune>0x10ffff) {
+        rune = REPLACEMENT_CHARACTER;
+    }
+    switch ((rune >= 0x80) + (rune >= 0x800) + (rune >= 0x10000)) {
+    case 0: s[0] = (u8)(0x00 | ((rune >>  0)     )); return 1;
+    case 1: s[0] = (u8)(0xc0 | ((rune >>  6)     ));
+            s[1] = (u8)(0x80 | ((rune >>  0) & 63)); return 2;
+    case 2: s[0] = (u8)(0xe0 | ((rune >> 12)     ));
+            s[1] = (u8)(0x80 | ((rune >>  6) & 63));
+            s[2] = (u8)(0x80 | ((rune >>  0) & 63)); return 3;
+    case 3: s[0] = (u8)(0xf0 | ((rune >> 18)     ));
+            s[1] = (u8)(0x80 | ((rune >> 12) & 63));
+            s[2] = (u8)(0x80 | ((rune >>  6) & 63));
+            s[3] = (u8)(0x80 | ((rune >>  0) & 63)); return 4;
+    }
+    assert(0);
+}
+
+typedef struct {
+    s16 tail;
+    c32 rune;
+} utf16;
+
+static utf16 utf16decode_(s16 s)
+{
+    assert(s.len);
+    utf16 r = {0};
+    r.rune = s.s[0];
+    if (r.rune>=0xdc00 && r.rune<=0xdfff) {
+        goto reject;  // unpaired low surrogate
+    } else if (r.rune>=0xd800 && r.rune<=0xdbff) {
+        if (s.len < 2) {
+            goto reject;  // missing low surrogate
+        }
+        i32 hi = r.rune;
+        i32 lo = s.s[1];
+        if (lo<0xdc00 || lo>0xdfff) {
+            goto reject;  // expected low surrogate
+        }
+        r.rune = 0x10000 + ((hi - 0xd800)<<10) + (lo - 0xdc00);
+        r.tail = s16cuthead_(s, 2);
+        return r;
+    }
+    r.tail = s16cuthead_(s, 1);
+    return r;
+
+    reject:
+    r.rune = REPLACEMENT_CHARACTER;
+    r.tail = s16cuthead_(s, 1);
+    return r;
+}
+
+// Encode code point returning the output length (1-2).
+static i32 utf16encode_(c16 *dst, c32 rune)
+{
+    if (rune<0 || (rune>=0xd800 && rune<=0xdfff) || rune>0x10ffff) {
+        rune = REPLACEMENT_CHARACTER;
+    }
+    if (rune >= 0x10000) {
+        rune -= 0x10000;
+        dst[0] = (c16)((rune >> 10) + 0xd800);
+        dst[1] = (c16)((rune&0x3ff) + 0xdc00);
+        return 2;
+    }
+    dst[0] = (c16)rune;
+    return 1;
+}
+
+static s16 towide_(arena *perm, s8 s)
+{
+    size len = 0;
+    utf8 state = {0};
+    state.tail = s;
+    while (state.tail.len) {
+        state = utf8decode_(state.tail);
+        c16 tmp[2];
+        len += utf16encode_(tmp, state.rune);
+    }
+
+    s16 w = {0};
+    w.s = new(perm, c16, len);
+    state.tail = s;
+    while (state.tail.len) {
+        state = utf8decode_(state.tail);
+        w.len += utf16encode_(w.s+w.len, state.rune);
+    }
+    return w;
+}
 
-        } else if (s8equals(r.arg, S("-silence-errors"))) {
-            silent = 1;
+static s8 fromwide_(arena *perm, s16 w)
+{
+    size len = 0;
+    utf16 state = {0};
+    state.tail = w;
+    while (state.tail.len) {
+        state = utf16decode_(state.tail);
+        u8 tmp[4];
+        len += utf8encode_(tmp, state.rune);
+    }
 
-        } else if (s8equals(r.arg, S("-errors-to-stdout"))) {
-            err_to_stdout = 1;
+    s8 s = {0};
+    s.s = new(perm, u8, len);
+    state.tail = w;
+    while (state.tail.len) {
+        state = utf16decode_(state.tail);
+        s.len += utf8encode_(s.s+s.len, state.rune);
+    }
+    return s;
+}
 
-        } else if (s8equals(r.arg, S("-print-errors"))) {
-            // Ignore
+static s8 fromenv_(arena *perm, c16 *name)
+{
+    // Given no buffer, unset variables report as size 0, while empty
+    // variables report as size 1 for the null terminator.
+    i32 wlen = GetEnvironmentVariableW(name, 0, 0);
+    if (!wlen) {
+        s8 r = {0};
+        return r;
+    }
 
-        } else if (s8equals(r.arg, S("-short-errors"))) {
-            // Ignore
+    // Store temporarily at the beginning of the arena.
+    size cap = (perm->end - perm->beg) / (size)sizeof(c16);
+    if (wlen > cap) {
+        oom();
+    }
+    s16 wvar = {0};
+    wvar.s   = (c16 *)perm->beg;
+    wvar.len = wlen - 1;
+    GetEnvironmentVariableW(name, wvar.s, wlen);
 
-        } else if (s8equals(r.arg, S("-uninstalled"))) {
-            // Ignore
+    byte *save = perm->beg;
+    perm->beg = (byte *)(wvar.s + wvar.len);
+    s8 var = fromwide_(perm, wvar);
+    perm->beg = save;
 
-        } else if (s8equals(r.arg, S("-keep-system-cflags"))) {
-            print_sysinc = 1;
+    return var;
+}
 
-        } else if (s8equals(r.arg, S("-keep-system-libs"))) {
-            print_syslib = 1;
+static i32 truncsize(size len)
+{
+    i32 max = 0x7fffffff;
+    return len>max ? max : (i32)len;
+}
 
-        } else if (s8equals(r.arg, S("-validate"))) {
-            silent = 1;
-            proc->recursive = 0;
+static s8 installdir_(arena *perm)
+{
+    byte *save = perm->beg;
 
-        } else {
-            prints8(err, S("pkg-config: "));
-            prints8(err, S("unknown option -"));
-            prints8(err, r.arg);
-            prints8(err, S("\n"));
-            flush(err);
-            os_fail();
+    // GetModuleFileNameW does not communicate length. It only indicates
+    // success (buffer large enough) or failure (result truncated). To
+    // make matters worse, long paths have no fixed upper limit, though
+    // 64KiB is given as an approximate. To deal with this, offer the
+    // entire free region of the arena, far exceeding any path length.
+    //
+    // Computing sizes outside of the allocator isn't great, but the
+    // situation is constrained by this crummy API.
+    s16 exe   = {0};
+    exe.s     = (c16 *)perm->beg;
+    i32 cap   = truncsize(perm->end - perm->beg) / (i32)sizeof(c16);
+    exe.len   = GetModuleFileNameW(0, exe.s, cap);
+    perm->beg = (byte *)(exe.s + exe.len);
+
+    // Normalize by converting backslashes to slashes
+    for (size i = 0; i < exe.len; i++) {
+        if (exe.s[i] == '\\') {
+            exe.s[i] = '/';
         }
     }
 
-    if (err_to_stdout) {
-        err = out;
-    }
+    s8 path = fromwide_(perm, exe);
+    perm->beg = save;  // free the wide path
+    return dirname(dirname(path));
+}
 
-    if (silent) {
-        err = newnullout(perm);
-    }
+static s8 append2_(arena *perm, s8 pre, s8 suf)
+{
+    s8 s = news8(perm, pre.len+suf.len);
+    s8copy(s8copy(s, pre), suf);
+    return s;
+}
 
-    for (size i = 0; i < nargs; i++) {
-        process(proc, args[i], perm);
-    }
-    endprocessor(proc, err);
+static s8 makepath_(arena *perm, s8 base, s8 lib, s8 share)
+{
+    s8 delim = S(";");
+    size len = base.len + lib.len + delim.len + base.len + share.len;
+    s8 s = news8(perm, len);
+    s8 r = s8copy(s, base);
+       r = s8copy(r, lib);
+       r = s8copy(r, delim);
+       r = s8copy(r, base);
+           s8copy(r, share);
+    return s;
+}
 
-    if (!pkgs->count) {
-        prints8(err, S("pkg-config: "));
-        prints8(err, S("requires at least one package name\n"));
-        flush(err);
-        os_fail();
+static s8 fromcstr_(u8 *z)
+{
+    s8 s = {0};
+    s.s = z;
+    if (s.s) {
+        for (; s.s[s.len]; s.len++) {}
     }
+    return s;
+}
 
-    // --{atleast,exact,max}-version
-    if (override_op) {
-        for (pkg *p = pkgs->head; p; p = p->list) {
-            i32 cmp = compareversions(p->version, override_version);
-            if (!validcompare(override_op, cmp)) {
-                failversion(err, p, override_op, override_version);
-            }
-        }
-    }
+static config *newconfig_()
+{
+    arena perm = newarena_(1<<22);
+    config *conf = new(&perm, config, 1);
+    conf->perm = perm;
+    return conf;
+}
 
-    if (modversion) {
-        for (pkg *p = pkgs->head; p; p = p->list) {
-            if (p->flags & pkg_DIRECT) {
-                prints8(out, p->version);
-                prints8(out, S("\n"));
-            }
-        }
+__attribute((force_align_arg_pointer))
+void mainCRTStartup(void)
+{
+    config *conf = newconfig_();
+    conf->delim = ';';
+    conf->foldcase = 1;
+    conf->define_prefix = 1;
+    arena *perm = &conf->perm;
+
+    i32 dummy;
+    handles[0].handle = GetStdHandle(STD_INPUT_HANDLE);
+    handles[1].handle = GetStdHandle(STD_OUTPUT_HANDLE);
+    handles[1].isconsole = GetConsoleMode(handles[1].handle, &dummy);
+    handles[2].handle = GetStdHandle(STD_ERROR_HANDLE);
+    handles[2].isconsole = GetConsoleMode(handles[2].handle, &dummy);
+
+    u8 **argv = new(perm, u8 *, CMDLINE_ARGV_MAX);
+    c16 *cmdline = GetCommandLineW();
+    conf->nargs = cmdline_to_argv8(cmdline, argv) - 1;
+    conf->args = new(perm, s8, conf->nargs);
+    for (size i = 0; i < conf->nargs; i++) {
+        conf->args[i] = fromcstr_(argv[i+1]);
     }
 
-    if (variable.s) {
-        for (pkg *p = pkgs->head; p; p = p->list) {
-            if (p->flags & pkg_DIRECT) {
-                s8 value = lookup(global, p->env, variable);
-                if (value.s) {
-                    expand(out, err, global, p, value);
-                    prints8(out, S("\n"));
-                }
-            }
-        }
+    s8 base = installdir_(perm);
+    conf->envpath = fromenv_(perm, L"PKG_CONFIG_PATH");
+    conf->fixedpath = fromenv_(perm, L"PKG_CONFIG_LIBDIR");
+    if (!conf->fixedpath.s) {
+        s8 lib   = S(PKG_CONFIG_PREFIX "/lib/pkgconfig");
+        s8 share = S(PKG_CONFIG_PREFIX "/share/pkgconfig");
+        conf->fixedpath = makepath_(perm, base, lib, share);
     }
+    conf->top_builddir = fromenv_(perm, L"PKG_CONFIG_TOP_BUILD_DIR");
+    conf->sys_incpath  = append2_(perm, base, S(PKG_CONFIG_PREFIX "/include"));
+    conf->sys_libpath  = append2_(perm, base, S(PKG_CONFIG_PREFIX "/lib"));
+    conf->print_sysinc = fromenv_(perm, L"PKG_CONFIG_ALLOW_SYSTEM_CFLAGS");
+    conf->print_syslib = fromenv_(perm, L"PKG_CONFIG_ALLOW_SYSTEM_LIBS");
+    conf->cachepath    = fromenv_(perm, L"PKG_CONFIG_CACHE");
 
-    if (cflags) {
+    uconfig(conf);
+    ExitProcess(handles[1].err || handles[2].err);
+    assert(0);
+}
+
+static filemap os_mapfile(arena *perm, s8 path)
+{
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
+
+    filemap r = {0};
+
+    i32 handle = 0;
+    {
         arena scratch = *perm;
-        fieldwriter fw = newfieldwriter(filterc, &argcount, &scratch);
-        fw.delim = argdelim;
-        fw.msvc = msvc;
-        if (!print_sysinc) {
-            insertsyspath(&fw, conf->sys_incpath, conf->delim, 'I');
-        }
-        for (pkg *p = pkgs->head; p; p = p->list) {
-            appendfield(err, &fw, p, p->cflags);
+        s16 wpath = towide_(&scratch, path);
+        handle = CreateFileW(
+            wpath.s,
+            GENERIC_READ,
+            FILE_SHARE_ALL,
+            0,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            0
+        );
+        if (handle == INVALID_HANDLE_VALUE) {
+            r.status = filemap_NOTFOUND;
+            return r;
         }
-        writeargs(out, &fw);
     }
 
-    if (libs) {
-        arena scratch = *perm;
-        fieldwriter fw = newfieldwriter(filterl, &argcount, &scratch);
-        fw.delim = argdelim;
-        fw.msvc = msvc;
-        if (!print_syslib) {
-            insertsyspath(&fw, conf->sys_libpath, conf->delim, 'L');
-        }
-        for (pkg *p = pkgs->head; p; p = p->list) {
-            if (static_) {
-                appendfield(err, &fw, p, p->libs);
-                appendfield(err, &fw, p, p->libsprivate);
-            } else if (p->flags & pkg_PUBLIC) {
-                appendfield(err, &fw, p, p->libs);
-            }
+    r.data.s = (u8 *)perm->beg;
+    size cap = perm->end - perm->beg;
+    while (r.data.len < cap) {
+        i32 len = truncsize(cap - r.data.len);
+        ReadFile(handle, r.data.s+r.data.len, len, &len, 0);
+        if (len < 1) {
+            break;
         }
-        writeargs(out, &fw);
+        r.data.len += len;
     }
+    CloseHandle(handle);
 
-    if (cflags || libs) {
-        prints8(out, S("\n"));
+    if (r.data.len == cap) {
+        // If it filled all available space, assume the file is too large.
+        r.status = filemap_READERR;
+        return r;
     }
 
-    flush(out);
+    perm->beg += r.data.len;
+    r.status = filemap_OK;
+    return r;
 }
 
-// Win32 types, constants, and declarations (replaces windows.h)
-// This is free and unencumbered software released into the public domain.
+static filestamp os_stamp(arena *perm, s8 path)
+{
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
 
-typedef __SIZE_TYPE__  uptr;
-typedef unsigned short char16_t;
-typedef char16_t       c16;
+    struct {
+        i32 attr;
+        u32 create[2], access[2], write[2];
+        u32 sizehi, sizelo;
+    } info;
+    filestamp r = {0};
+    arena scratch = *perm;
+    s16 wpath = towide_(&scratch, path);
+    if (GetFileAttributesExW(wpath.s, GetFileExInfoStandard, &info)) {
+        r.mtime = (i64)((u64)info.write[1]<<32 | info.write[0]);
+        r.size  = (i64)((u64)info.sizehi<<32 | info.sizelo);
+        r.ok    = 1;
+    }
+    return r;
+}
 
-enum {
-    FILE_ATTRIBUTE_NORMAL = 0x80,
+static b32 os_savefile(arena *perm, s8 path, s8 data)
+{
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
 
-    FILE_SHARE_ALL = 7,
+    // Write a process-unique sibling, then rename it over the target
+    arena scratch = *perm;
+    s8 tmp = news8(&scratch, path.len-1 + 10);
+    s8 t = s8copy(tmp, cuttail(path, 1));
+    t = s8copy(t, S("."));
+    u32 pid = (u32)GetCurrentProcessId();
+    for (i32 i = 0; i < 8; i++) {
+        t.s[i] = (u8)"0123456789abcdef"[pid>>(28 - 4*i) & 15];
+    }
+    t.s[8] = 0;
+    s16 wtmp  = towide_(&scratch, tmp);
+    s16 wpath = towide_(&scratch, path);
+
+    i32 handle = CreateFileW(
+        wtmp.s, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0
+    );
+    if (handle == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    b32 ok = 1;
+    for (size off = 0; ok && off < data.len;) {
+        i32 len = truncsize(data.len - off);
+        ok = WriteFile(handle, data.s+off, len, &len, 0);
+        off += len;
+    }
+    CloseHandle(handle);
 
-    GENERIC_READ = 0x80000000,
+    ok = ok && MoveFileExW(wtmp.s, wpath.s, MOVEFILE_REPLACE_EXISTING);
+    if (!ok) {
+        DeleteFileW(wtmp.s);
+    }
+    return ok;
+}
 
-    INVALID_HANDLE_VALUE = -1,
+static void os_fail(void)
+{
+    ExitProcess(1);
+    assert(0);
+}
 
-    MEM_COMMIT  = 0x1000,
-    MEM_RESERVE = 0x2000,
+typedef struct {
+    c16 buf[1<<8];
+    i32 len;
+    i32 handle;
+    b32 err;
+} u16buf;
 
-    OPEN_EXISTING = 3,
+static void flushconsole_(u16buf *b)
+{
+    if (!b->err && b->len) {
+        i32 dummy;
+        b->err = !WriteConsoleW(b->handle, b->buf, b->len, &dummy, 0);
+    }
+    b->len = 0;
+}
 
-    PAGE_READWRITE = 4,
+static void printc32_(u16buf *b, c32 rune)
+{
+    if (b->len > countof(b->buf)-2) {
+        flushconsole_(b);
+    }
+    b->len += utf16encode_(b->buf+b->len, rune);
+}
 
-    STD_OUTPUT_HANDLE = -11,
-    STD_ERROR_HANDLE  = -12,
-};
+static void os_write(i32 fd, s8 s)
+{
+    assert((i32)s.len == s.len);  // NOTE: assume it's not a huge buffer
+    assert(fd>=1 && fd<=3);
 
-#define W32(r) __declspec(dllimport) r __stdcall
-W32(b32)    CloseHandle(uptr);
-W32(i32)    CreateFileW(c16 *, i32, i32, uptr, i32, i32, i32);
-W32(void)   ExitProcess(i32);
-W32(c16 *)  GetCommandLineW(void);
-W32(b32)    GetConsoleMode(uptr, i32 *);
-W32(i32)    GetEnvironmentVariableW(c16 *, c16 *, i32);
-W32(i32)    GetModuleFileNameW(uptr, c16 *, i32);
-W32(i32)    GetStdHandle(i32);
-W32(b32)    ReadFile(uptr, u8 *, i32, i32 *, uptr);
-W32(byte *) VirtualAlloc(uptr, size, i32, i32);
-W32(b32)    WriteConsoleW(uptr, c16 *, i32, i32 *, uptr);
-W32(b32)    WriteFile(uptr, u8 *, i32, i32 *, uptr);
+    b32 *err = &handles[fd].err;
+    if (*err) {
+        return;
+    }
 
-#define CMDLINE_CMD_MAX  32767  // max command line length on Windows
-#define CMDLINE_ARGV_MAX (16384+(98298+(i32)sizeof(u8 *))/(i32)sizeof(u8 *))
+    i32 handle = handles[fd].handle;
+    if (handles[fd].isconsole) {
+        // NOTE: There is a small chance that a multi-byte code point
+        // spans flushes from the application. With no decoder state
+        // tracked between os_write calls, this will mistranslate for
+        // console outputs. The application could avoid such flushes,
+        // which would require a distinct "close" flush before exits.
+        //
+        // Alternatively, the platform layer could detect truncated
+        // encodings and buffer up to 3 bytes between calls. This buffer
+        // would need to be flushed on exit by the platform.
+        //
+        // The primary use case for u-config is non-console outputs into
+        // a build system, which will not experience this issue. Console
+        // output is mainly for human-friendly debugging, so the risk is
+        // acceptable.
+        u16buf b = {0};
+        b.handle = handle;
+        utf8 state = {0};
+        state.tail = s;
+        while (state.tail.len) {
+            state = utf8decode_(state.tail);
+            printc32_(&b, state.rune);
+        }
+        flushconsole_(&b);
+        *err = b.err;
+    } else {
+        i32 dummy;
+        *err = !WriteFile(handle, s.s, (i32)s.len, &dummy, 0);
+    }
+}
 
-// Convert an ill-formed-UTF-16 command line to a WTF-8 argv following
-// field splitting semantics identical to CommandLineToArgvW, including
-// undocumented behavior. Populates argv with pointers into itself and
-// returns argc, which is always positive.
-//
-// Expects that cmd has no more than 32,767 (CMDLINE_CMD_MAX) elements
-// including the null terminator, and argv has at least CMDLINE_ARGV_MAX
-// elements. This covers the worst possible cases for a Windows command
-// string, so no further allocation is ever necessary.
-//
-// Unlike CommandLineToArgvW, when the command line string is zero
-// length this function does not invent an artificial argv[0] based on
-// the calling module file name. To implement this behavior yourself,
-// test if cmd[0] is zero and then act accordingly.
-//
-// If the input is UTF-16, then the output is UTF-8.
-static i32 cmdline_to_argv8(c16 *cmd, u8 **argv)
+static void os_flush(i32 fd)
 {
-    i32 argc  = 1;  // worst case: argv[0] is an empty string
-    i32 state = 6;  // special argv[0] state
-    i32 slash = 0;
-    // Use second half as byte buffer
-    u8 *buf = (u8 *)(argv + 16384);
+    (void)fd;  // unbuffered
+}
 
-    argv[0] = buf;
-    while (*cmd) {
-        i32 c = *cmd++;
-        if (c>>10 == 0x36 && *cmd>>10 == 0x37) {  // surrogates?
-            c = 0x10000 + ((c - 0xd800)<<10) + (*cmd++ - 0xdc00);
-        }
+static filemap os_listdir(arena *perm, s8 path)
+{
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
 
-        switch (state) {
-        case 0: switch (c) {  // outside token
-                case 0x09:
-                case 0x20: continue;
-                case 0x22: argv[argc++] = buf;
-                           state = 2;
-                           continue;
-                case 0x5c: argv[argc++] = buf;
-                           slash = 1;
-                           state = 3;
-                           break;
-                default  : argv[argc++] = buf;
-                           state = 1;
-                } break;
-        case 1: switch (c) {  // inside unquoted token
-                case 0x09:
-                case 0x20: *buf++ = 0;
-                           state = 0;
-                           continue;
-                case 0x22: state = 2;
-                           continue;
-                case 0x5c: slash = 1;
-                           state = 3;
-                           break;
-                } break;
-        case 2: switch (c) {  // inside quoted token
-                case 0x22: state = 5;
-                           continue;
-                case 0x5c: slash = 1;
-                           state = 4;
-                           break;
-                } break;
-        case 3:
-        case 4: switch (c) {  // backslash sequence
-                case 0x22: buf -= (1 + slash) >> 1;
-                           if (slash & 1) {
-                               state -= 2;
-                               break;
-                           } // fallthrough
-                default  : cmd -= 1 + (c >= 0x10000);
-                           state -= 2;
-                           continue;
-                case 0x5c: slash++;
-                } break;
-        case 5: switch (c) {  // quoted token exit
-                default  : cmd -= 1 + (c >= 0x10000);
-                           state = 1;
-                           continue;
-                case 0x22: state = 1;
-                } break;
-        case 6: switch (c) {  // begin argv[0]
-                case 0x09:
-                case 0x20: *buf++ = 0;
-                           state = 0;
-                           continue;
-                case 0x22: state = 8;
-                           continue;
-                default  : state = 7;
-                } break;
-        case 7: switch (c) {  // unquoted argv[0]
-                case 0x09:
-                case 0x20: *buf++ = 0;
-                           state = 0;
-                           continue;
-                } break;
-        case 8: switch (c) {  // quoted argv[0]
-                case 0x22: *buf++ = 0;
-                           state = 0;
-                           continue;
-                } break;
+    struct {
+        i32 attr;
+        u32 times[6];
+        u32 sizehi, sizelo;
+        u32 reserved[2];
+        c16 name[260];
+        c16 altname[14];
+    } find;
+    filemap r = {0};
+
+    arena scratch = *perm;
+    s8 glob = news8(&scratch, path.len+2);
+    s8copy(s8copy(glob, cuttail(path, 1)), S("/*\0"));
+    s16 wglob = towide_(&scratch, glob);
+    i32 handle = FindFirstFileW(wglob.s, &find);
+    if (handle == INVALID_HANDLE_VALUE) {
+        i32 e = GetLastError();
+        r.status = e==ERROR_FILE_NOT_FOUND || e==ERROR_PATH_NOT_FOUND
+            ? filemap_NOTFOUND
+            : filemap_READERR;
+        return r;
+    }
+
+    u8buf mem = newmembuf(perm);
+    do {
+        if (find.attr & FILE_ATTRIBUTE_DIRECTORY) {
+            continue;
         }
+        utf16 state = {0};
+        state.tail.s = find.name;
+        for (i32 i = 0; i<countof(find.name) && find.name[i]; i++) {
+            state.tail.len++;
+        }
+        while (state.tail.len) {
+            u8 tmp[4];
+            state = utf16decode_(state.tail);
+            prints8(&mem, s8span(tmp, tmp+utf8encode_(tmp, state.rune)));
+        }
+        printu8(&mem, 0);
+    } while (FindNextFileW(handle, &find));
+    FindClose(handle);
+
+    r.data = finalize(&mem);
+    r.status = filemap_OK;
+    return r;
+}
+
+static i32 os_read(i32 fd, u8 *buf, i32 len)
+{
+    assert(fd==0 || fd==3);
+    return ReadFile(handles[fd].handle, buf, len, &len, 0) ? len : 0;
+}
+
+static i32 os_listen(arena *perm, s8 path)
+{
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
+
+    arena scratch = *perm;
+    s16 wpath = towide_(&scratch, path);
+    i32 pipe = CreateNamedPipeW(
+        wpath.s, PIPE_ACCESS_DUPLEX, 0, 1, 1<<12, 1<<12, 0, 0
+    );
+    if (pipe == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    handles[3].handle = pipe;
+    return 3;
+}
 
-        // WTF-8/UTF-8 encoding
-        switch ((c >= 0x80) + (c >= 0x800) + (c >= 0x10000)) {
-        case 0: *buf++ = (u8)(0x00 | ((c >>  0)     )); break;
-        case 1: *buf++ = (u8)(0xc0 | ((c >>  6)     ));
-                *buf++ = (u8)(0x80 | ((c >>  0) & 63)); break;
-        case 2: *buf++ = (u8)(0xe0 | ((c >> 12)     ));
-                *buf++ = (u8)(0x80 | ((c >>  6) & 63));
-                *buf++ = (u8)(0x80 | ((c >>  0) & 63)); break;
-        case 3: *buf++ = (u8)(0xf0 | ((c >> 18)     ));
-                *buf++ = (u8)(0x80 | ((c >> 12) & 63));
-                *buf++ = (u8)(0x80 | ((c >>  6) & 63));
-                *buf++ = (u8)(0x80 | ((c >>  0) & 63)); break;
-        }
+static i32 os_accept(i32 listener)
+{
+    assert(listener == 3);
+    i32 pipe = handles[3].handle;
+    if (!ConnectNamedPipe(pipe, 0) && GetLastError()!=ERROR_PIPE_CONNECTED) {
+        return -1;
     }
+    handles[3].err = 0;
+    return 3;
+}
 
-    *buf = 0;
-    argv[argc] = 0;
-    return argc;
+static void os_close(i32 fd)
+{
+    assert(fd == 3);
+    FlushFileBuffers(handles[3].handle);
+    DisconnectNamedPipe(handles[3].handle);
 }
 
-// Mingw-w64 Win32 platform layer for u-config
-// $ cc -nostartfiles -o pkg-config win32_main.c
+#else  // !_WIN32
+// POSIX platform layer for u-config
 // This is free and unencumbered software released into the public domain.
 
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
 #ifndef PKG_CONFIG_PREFIX
-#  define PKG_CONFIG_PREFIX
+#  define PKG_CONFIG_PREFIX "/usr"
+#endif
+
+#ifndef PKG_CONFIG_LIBDIR
+#  define PKG_CONFIG_LIBDIR \
+     PKG_CONFIG_PREFIX "/local/lib/pkgconfig:" \
+     PKG_CONFIG_PREFIX "/local/share/pkgconfig:" \
+     PKG_CONFIG_PREFIX "/lib/pkgconfig:" \
+     PKG_CONFIG_PREFIX "/share/pkgconfig"
+#endif
+
+#ifndef PKG_CONFIG_SYSTEM_INCLUDE_PATH
+#  define PKG_CONFIG_SYSTEM_INCLUDE_PATH PKG_CONFIG_PREFIX "/include"
+#endif
+
+#ifndef PKG_CONFIG_SYSTEM_LIBRARY_PATH
+#  define PKG_CONFIG_SYSTEM_LIBRARY_PATH "/lib:" PKG_CONFIG_PREFIX "/lib"
 #endif
 
-// For communication with os_write()
+// Output is gathered into a large buffer and written with as few system
+// calls as possible. Standard error is unbuffered, but first drains any
+// pending standard output so that interleaving is preserved.
 static struct {
-    i32 handle;
-    b32 isconsole;
-    b32 err;
-} handles[3];
+    u8  buf[1<<16];
+    i32 len;
+    b32 err[3];
+} output_;
 
-typedef struct {
-    c16 *s;
-    size len;
-} s16;
+static b32 fullwrite_(i32 fd, u8 *s, size len)
+{
+    while (len) {
+        ssize_t r = write(fd, s, (size_t)len);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        s   += r;
+        len -= r;
+    }
+    return 1;
+}
 
-static s16 s16cuthead_(s16 s, size off)
+static void flushstdout_(void)
 {
-    assert(off >= 0);
-    assert(off <= s.len);
-    s.s += off;
-    s.len -= off;
-    return s;
+    if (!output_.err[1] && output_.len) {
+        output_.err[1] = !fullwrite_(1, output_.buf, output_.len);
+    }
+    output_.len = 0;
 }
 
 static arena newarena_(size cap)
 {
     arena arena = {0};
-    arena.beg = VirtualAlloc(0, cap, MEM_COMMIT|MEM_RESERVE, PAGE_READWRITE);
+    arena.beg = malloc((size_t)cap);
     if (!arena.beg) {
         arena.beg = (byte *)16;  // aligned, non-null, zero-size arena
         cap = 0;
@@ -2244,270 +4120,365 @@ static arena newarena_(size cap)
     return arena;
 }
 
-typedef i32 char32_t;
-typedef char32_t c32;
-
-enum {
-    REPLACEMENT_CHARACTER = 0xfffd
-};
-
-typedef struct {
-    s8  tail;
-    c32 rune;
-} utf8;
+static arena os_newarena(size cap)
+{
+    return newarena_(cap);
+}
 
-static utf8 utf8decode_(s8 s)
+static s8 fromcstr_(u8 *z)
 {
-    assert(s.len);
-    utf8 r = {0};
-    switch (s.s[0]&0xf0) {
-    default  : r.rune = s.s[0];
-               if (r.rune > 0x7f) break;
-               r.tail = cuthead(s, 1);
-               return r;
-    case 0xc0:
-    case 0xd0: if (s.len < 2) break;
-               if ((s.s[1]&0xc0) != 0x80) break;
-               r.rune = (i32)(s.s[0]&0x1f) << 6 |
-                        (i32)(s.s[1]&0x3f) << 0;
-               if (r.rune < 0x80) break;
-               r.tail = cuthead(s, 2);
-               return r;
-    case 0xe0: if (s.len < 3) break;
-               if ((s.s[1]&0xc0) != 0x80) break;
-               if ((s.s[2]&0xc0) != 0x80) break;
-               r.rune = (i32)(s.s[0]&0x0f) << 12 |
-                        (i32)(s.s[1]&0x3f) <<  6 |
-                        (i32)(s.s[2]&0x3f) <<  0;
-               if (r.rune < 0x800) break;
-               if (r.rune>=0xd800 && r.rune<=0xdfff) break;
-               r.tail = cuthead(s, 3);
-               return r;
-    case 0xf0: if (s.len < 4) break;
-               if ((s.s[1]&0xc0) != 0x80) break;
-               if ((s.s[2]&0xc0) != 0x80) break;
-               if ((s.s[3]&0xc0) != 0x80) break;
-               r.rune = (i32)(s.s[0]&0x0f) << 18 |
-                        (i32)(s.s[1]&0x3f) << 12 |
-                        (i32)(s.s[2]&0x3f) <<  6 |
-                        (i32)(s.s[3]&0x3f) <<  0;
-               if (r.rune < 0x10000) break;
-               if (r.rune > 0x10ffff) break;
-               r.tail = cuthead(s, 4);
-               return r;
+    s8 s = {0};
+    s.s = z;
+    if (s.s) {
+        for (; s.s[s.len]; s.len++) {}
     }
-    r.rune = REPLACEMENT_CHARACTER;
-    r.tail = cuthead(s, 1);
-    return r;
+    return s;
 }
 
-// Encode code point returning the output length (1-4).
-static i32 utf8encode_(u8 *s, c32 rune)
+static s8 fromenv_(char *name, s8 otherwise)
 {
-    if (rune<0 || (rune>=0xd800 && rune<=0xdfff) || rune>0x10ffff) {
-        rune = REPLACEMENT_CHARACTER;
-    }
-    switch ((rune >= 0x80) + (rune >= 0x800) + (rune >= 0x10000)) {
-    case 0: s[0] = (u8)(0x00 | ((rune >>  0)     )); return 1;
-    case 1: s[0] = (u8)(0xc0 | ((rune >>  6)     ));
-            s[1] = (u8)(0x80 | ((rune >>  0) & 63)); return 2;
-    case 2: s[0] = (u8)(0xe0 | ((rune >> 12)     ));
-            s[1] = (u8)(0x80 | ((rune >>  6) & 63));
-            s[2] = (u8)(0x80 | ((rune >>  0) & 63)); return 3;
-    case 3: s[0] = (u8)(0xf0 | ((rune >> 18)     ));
-            s[1] = (u8)(0x80 | ((rune >> 12) & 63));
-            s[2] = (u8)(0x80 | ((rune >>  6) & 63));
-            s[3] = (u8)(0x80 | ((rune >>  0) & 63)); return 4;
-    }
-    assert(0);
+    s8 var = fromcstr_((u8 *)getenv(name));
+    return var.s ? var : otherwise;
 }
 
-typedef struct {
-    s16 tail;
-    c32 rune;
-} utf16;
+#if BENCH
+// Benchmark harness for dependency resolution, on this platform layer:
+// $ cc -DBENCH -O2 -o bench pkg-config.c
+// $ ./bench             # synthetic package graphs
+// $ ./bench PKG...      # real packages from the usual search path
+// Synthetic graphs are written as .pc files into a temporary directory:
+// a root requiring every package in the first of several layers, where
+// each package requires some of the next layer. Wide graphs have one
+// layer, chains one package per layer, and diamonds require the whole
+// next layer. Every query is resolved from scratch several times with
+// output to /dev/null, and the best run is reported in milliseconds.
+// Each graph is first queried twice in batch mode, which must answer
+// for each package rather than from the previous query's memo.
+// The arena column is the high-water mark of --static --libs, measured
+// by poisoning the arena beforehand.
+#include <string.h>
+#include <time.h>
+
+enum {BENCH_RUNS = 5, BENCH_ARENA = 1<<28};
 
-static utf16 utf16decode_(s16 s)
+typedef struct {
+    char *label;
+    i32   width;   // packages per layer
+    i32   depth;   // layers below the root
+    i32   fanout;  // requires into the next layer
+    i32   nflags;  // extra -I, -L, and -l per package
+} benchspec;
+
+static i32 randint_(u64 *rng, i32 n)
 {
-    assert(s.len);
-    utf16 r = {0};
-    r.rune = s.s[0];
-    if (r.rune>=0xdc00 && r.rune<=0xdfff) {
-        goto reject;  // unpaired low surrogate
-    } else if (r.rune>=0xd800 && r.rune<=0xdbff) {
-        if (s.len < 2) {
-            goto reject;  // missing low surrogate
-        }
-        i32 hi = r.rune;
-        i32 lo = s.s[1];
-        if (lo<0xdc00 || lo>0xdfff) {
-            goto reject;  // expected low surrogate
-        }
-        r.rune = 0x10000 + ((hi - 0xd800)<<10) + (lo - 0xdc00);
-        r.tail = s16cuthead_(s, 2);
-        return r;
-    }
-    r.tail = s16cuthead_(s, 1);
-    return r;
-
-    reject:
-    r.rune = REPLACEMENT_CHARACTER;
-    r.tail = s16cuthead_(s, 1);
-    return r;
+    *rng = *rng*0x3243f6a8885a308d + 1;
+    return (i32)(((*rng >> 32) * (u64)n) >> 32);
 }
 
-// Encode code point returning the output length (1-2).
-static i32 utf16encode_(c16 *dst, c32 rune)
+static i32 npkgs_(benchspec s)
 {
-    if (rune<0 || (rune>=0xd800 && rune<=0xdfff) || rune>0x10ffff) {
-        rune = REPLACEMENT_CHARACTER;
-    }
-    if (rune >= 0x10000) {
-        rune -= 0x10000;
-        dst[0] = (c16)((rune >> 10) + 0xd800);
-        dst[1] = (c16)((rune&0x3ff) + 0xdc00);
-        return 2;
-    }
-    dst[0] = (c16)rune;
-    return 1;
+    return 1 + s.width*s.depth;
 }
 
-static s16 towide_(arena *perm, s8 s)
+static b32 generate_(char *dir, benchspec s, i32 *targets)
 {
-    size len = 0;
-    utf8 state = {0};
-    state.tail = s;
-    while (state.tail.len) {
-        state = utf8decode_(state.tail);
-        c16 tmp[2];
-        len += utf16encode_(tmp, state.rune);
-    }
+    u64 rng = 1;
+    for (i32 id = 0; id < npkgs_(s); id++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/p%05d.pc", dir, id);
+        FILE *f = fopen(path, "w");
+        if (!f) {
+            return 0;
+        }
 
-    s16 w = {0};
-    w.s = new(perm, c16, len);
-    state.tail = s;
-    while (state.tail.len) {
-        state = utf8decode_(state.tail);
-        w.len += utf16encode_(w.s+w.len, state.rune);
-    }
-    return w;
-}
+        fprintf(
+            f,
+            "prefix=/opt/p%05d\n"
+            "exec_prefix=${prefix}\n"
+            "libdir=${exec_prefix}/lib\n"
+            "includedir=${prefix}/include\n"
+            "\n"
+            "Name: p%05d\n"
+            "Description: synthetic package\n"
+            "Version: 1.%d\n",
+            id, id, id
+        );
 
-static s8 fromwide_(arena *perm, s16 w)
-{
-    size len = 0;
-    utf16 state = {0};
-    state.tail = w;
-    while (state.tail.len) {
-        state = utf16decode_(state.tail);
-        u8 tmp[4];
-        len += utf8encode_(tmp, state.rune);
-    }
+        // Packages require into the next layer, always including the
+        // package below them so that every package is reachable. The
+        // remainder alternate between public and private requires.
+        i32 layer = id ? (id-1)/s.width : -1;
+        i32 index = id ? (id-1)%s.width : 0;
+        i32 n = 0;
+        if (layer+1 < s.depth) {
+            n = !id || s.fanout>=s.width ? s.width : s.fanout;
+            for (i32 j = 0; j < n; j++) {
+                i32 k = n==s.width ? j : j ? randint_(&rng, s.width) : index;
+                targets[j] = 1 + (layer+1)*s.width + k;
+            }
+        }
+        fputs("Requires:", f);
+        for (i32 j = 0; j < n; j += 2) {
+            fprintf(f, " p%05d >= 1.0", targets[j]);
+        }
+        fputs("\nRequires.private:", f);
+        for (i32 j = 1; j < n; j += 2) {
+            fprintf(f, " p%05d", targets[j]);
+        }
 
-    s8 s = {0};
-    s.s = new(perm, u8, len);
-    state.tail = w;
-    while (state.tail.len) {
-        state = utf16decode_(state.tail);
-        s.len += utf8encode_(s.s+s.len, state.rune);
+        // Alternate unique and shared flags to exercise deduplication
+        fprintf(f, "\nCflags: -I${includedir} -DP%05d", id);
+        for (i32 j = 0; j < s.nflags; j++) {
+            if (j & 1) {
+                fprintf(f, " -I/opt/shared/include/%d", j);
+            } else {
+                fprintf(f, " -I${includedir}/%d", j);
+            }
+        }
+        fprintf(f, "\nLibs: -L${libdir} -lp%05d", id);
+        for (i32 j = 0; j < s.nflags; j++) {
+            if (j & 1) {
+                fprintf(f, " -L/opt/shared/lib/%d -lshared%d", j, j);
+            } else {
+                fprintf(f, " -L${libdir}/%d -lp%05d_%d", j, id, j);
+            }
+        }
+        fputs("\nLibs.private: -lm -lpthread\n", f);
+
+        if (fclose(f)) {
+            return 0;
+        }
     }
-    return s;
+    return 1;
 }
 
-static s8 fromenv_(arena *perm, c16 *name)
+static void cleanup_(char *dir, benchspec s)
 {
-    // Given no buffer, unset variables report as size 0, while empty
-    // variables report as size 1 for the null terminator.
-    i32 wlen = GetEnvironmentVariableW(name, 0, 0);
-    if (!wlen) {
-        s8 r = {0};
-        return r;
-    }
-
-    // Store temporarily at the beginning of the arena.
-    size cap = (perm->end - perm->beg) / (size)sizeof(c16);
-    if (wlen > cap) {
-        oom();
+    for (i32 id = 0; id < npkgs_(s); id++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/p%05d.pc", dir, id);
+        unlink(path);
     }
-    s16 wvar = {0};
-    wvar.s   = (c16 *)perm->beg;
-    wvar.len = wlen - 1;
-    GetEnvironmentVariableW(name, wvar.s, wlen);
-
-    byte *save = perm->beg;
-    perm->beg = (byte *)(wvar.s + wvar.len);
-    s8 var = fromwide_(perm, wvar);
-    perm->beg = save;
+    rmdir(dir);
+}
 
-    return var;
+static i64 now_(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (i64)ts.tv_sec*1000000000 + ts.tv_nsec;
 }
 
-static i32 truncsize(size len)
+// Run one query on a fresh session, returning false if it failed.
+static b32 runquery_(config c, s8 *args, size nargs, i32 nullfd)
 {
-    i32 max = 0x7fffffff;
-    return len>max ? max : (i32)len;
+    session sess = {0};
+    void *jmp[5];
+    if (__builtin_setjmp(jmp)) {
+        failjmp = 0;
+        return 0;
+    }
+    failjmp = jmp;
+    query(&c, &sess, args, nargs, nullfd, nullfd);
+    failjmp = 0;
+    return 1;
 }
 
-static s8 installdir_(arena *perm)
+// Two batch queries for different packages at the same argument offset
+// must each get their own answer, though the second line is read where
+// the first was, while the first's packages remain in keep.
+static b32 checkbatch_(config c, i32 a, i32 b, i32 nullfd)
 {
-    byte *save = perm->beg;
+    i32 in[2], out[2];
+    if (pipe(in)) {
+        return 0;
+    } else if (pipe(out)) {
+        close(in[0]);
+        close(in[1]);
+        return 0;
+    }
+    char line[64];
+    int len = snprintf(
+        line, sizeof(line), "--cflags p%05d\n--cflags p%05d\n", a, b
+    );
+    b32 ok = fullwrite_(in[1], (u8 *)line, len);
+    close(in[1]);
+
+    session sess = {0};
+    arena keep = {0};
+    size half = (c.perm.end - c.perm.beg) / 2;
+    keep.beg = new(&c.perm, byte, half);
+    keep.end = keep.beg + half;
+    sess.keep = &keep;
+    sess.empty = keep;
+    if (ok) {
+        batch(&c, &sess, 0, 0, in[0], out[1], nullfd);
+    }
+    close(in[0]);
+    close(out[1]);
 
-    // GetModuleFileNameW does not communicate length. It only indicates
-    // success (buffer large enough) or failure (result truncated). To
-    // make matters worse, long paths have no fixed upper limit, though
-    // 64KiB is given as an approximate. To deal with this, offer the
-    // entire free region of the arena, far exceeding any path length.
-    //
-    // Computing sizes outside of the allocator isn't great, but the
-    // situation is constrained by this crummy API.
-    s16 exe   = {0};
-    exe.s     = (c16 *)perm->beg;
-    i32 cap   = truncsize(perm->end - perm->beg) / (i32)sizeof(c16);
-    exe.len   = GetModuleFileNameW(0, exe.s, cap);
-    perm->beg = (byte *)(exe.s + exe.len);
+    static char buf[1<<16];
+    size buflen = 0;
+    for (;;) {
+        size avail = countof(buf) - 1 - buflen;
+        ssize_t r = avail ? read(out[0], buf+buflen, (size_t)avail) : 0;
+        if (r <= 0) {
+            break;
+        }
+        buflen += r;
+    }
+    close(out[0]);
+    buf[buflen] = 0;
+
+    // Each response is the output, a null byte, the status, and newline
+    char *resp = buf;
+    i32 ids[] = {a, b};
+    for (i32 i = 0; ok && i<countof(ids); i++) {
+        char want[16];
+        snprintf(want, sizeof(want), "-DP%05d", ids[i]);
+        char *end = resp + strlen(resp);
+        ok = end+2<buf+buflen && end[1]=='0' && end[2]=='\n';
+        ok = ok && strstr(resp, want);
+        resp = end + 3;
+    }
+    return ok;
+}
 
-    // Normalize by converting backslashes to slashes
-    for (size i = 0; i < exe.len; i++) {
-        if (exe.s[i] == '\\') {
-            exe.s[i] = '/';
+// Best time of several queries, or -1 if the query fails.
+static i64 timequery_(config c, s8 *args, size nargs, i32 nullfd)
+{
+    i64 best = -1;
+    for (i32 i = 0; i < BENCH_RUNS; i++) {
+        i64 beg = now_();
+        if (!runquery_(c, args, nargs, nullfd)) {
+            return -1;
         }
+        i64 t = now_() - beg;
+        best = best<0 || t<best ? t : best;
     }
+    return best;
+}
 
-    s8 path = fromwide_(perm, exe);
-    perm->beg = save;  // free the wide path
-    return dirname(dirname(path));
+// Membufs grow from the bottom of the arena and objects from the top,
+// where alignment padding may remain poisoned.
+static size highwater_(config c, s8 *args, size nargs, i32 nullfd)
+{
+    byte poison = (byte)0xa5;
+    fillbytes(c.perm.beg, poison, c.perm.end-c.perm.beg);
+    runquery_(c, args, nargs, nullfd);
+    byte *lo = c.perm.beg;
+    for (; lo<c.perm.end && *lo!=poison; lo++) {}
+    byte *hi = lo;
+    for (; hi<c.perm.end && *hi==poison; hi++) {}
+    return (lo - c.perm.beg) + (c.perm.end - hi);
 }
 
-static s8 append2_(arena *perm, s8 pre, s8 suf)
+static void printms_(i64 t)
 {
-    s8 s = news8(perm, pre.len+suf.len);
-    s8copy(s8copy(s, pre), suf);
-    return s;
+    if (t < 0) {
+        printf(" %10s", "failed");
+    } else {
+        printf(" %10.3f", (double)t/1e6);
+    }
 }
 
-static s8 makepath_(arena *perm, s8 base, s8 lib, s8 share)
+static void bench_(char *label, i32 npkgs, s8 root, config c, i32 nullfd)
 {
-    s8 delim = S(";");
-    size len = base.len + lib.len + delim.len + base.len + share.len;
-    s8 s = news8(perm, len);
-    s8 r = s8copy(s, base);
-       r = s8copy(r, lib);
-       r = s8copy(r, delim);
-       r = s8copy(r, base);
-           s8copy(r, share);
-    return s;
+    s8 cflags[] = {S("--cflags"), root};
+    s8 libs[] = {S("--libs"), root};
+    s8 static_[] = {S("--static"), S("--libs"), root};
+
+    printf("%-24s %6d", label, npkgs);
+    printms_(timequery_(c, cflags, countof(cflags), nullfd));
+    printms_(timequery_(c, libs, countof(libs), nullfd));
+    printms_(timequery_(c, static_, countof(static_), nullfd));
+    size high = highwater_(c, static_, countof(static_), nullfd);
+    printf(" %12lld\n", (long long)high);
+    fflush(stdout);
 }
 
-static s8 fromcstr_(u8 *z)
+int main(int argc, char **argv)
 {
-    s8 s = {0};
-    s.s = z;
-    if (s.s) {
-        for (; s.s[s.len]; s.len++) {}
+    (void)uconfig;  // queries are driven directly
+
+    config c = {0};
+    c.perm = newarena_(BENCH_ARENA);
+    if (c.perm.end == c.perm.beg) {
+        fprintf(stderr, "bench: out of memory\n");
+        return 1;
     }
-    return s;
+    c.delim = ':';
+
+    i32 nullfd = open("/dev/null", O_WRONLY);
+    if (nullfd < 0) {
+        fprintf(stderr, "bench: could not open /dev/null\n");
+        return 1;
+    }
+
+    printf(
+        "%-24s %6s %10s %10s %10s %12s\n",
+        "graph", "pkgs", "cflags ms", "libs ms", "static ms", "arena"
+    );
+
+    if (argc > 1) {
+        s8 null = {0};
+        c.envpath     = fromenv_("PKG_CONFIG_PATH", null);
+        c.fixedpath   = fromenv_("PKG_CONFIG_LIBDIR", S(PKG_CONFIG_LIBDIR));
+        c.sys_incpath = fromenv_(
+            "PKG_CONFIG_SYSTEM_INCLUDE_PATH", S(PKG_CONFIG_SYSTEM_INCLUDE_PATH)
+        );
+        c.sys_libpath = fromenv_(
+            "PKG_CONFIG_SYSTEM_LIBRARY_PATH", S(PKG_CONFIG_SYSTEM_LIBRARY_PATH)
+        );
+        for (int i = 1; i < argc; i++) {
+            bench_(argv[i], 1, fromcstr_((u8 *)argv[i]), c, nullfd);
+        }
+        return 0;
+    }
+
+    // The chain past the traversal stack must fail rather than crash
+    static const benchspec specs[] = {
+        {"wide 1k",            1000,   1,   0,  0},
+        {"wide 10k",          10000,   1,   0,  0},
+        {"chain 64",              1,  64,   1,  0},
+        {"chain 120",             1, 120,   1,  0},
+        {"chain 200",             1, 200,   1,  0},
+        {"diamond 16x16",        16,  16,  16,  0},
+        {"diamond 32x32",        32,  32,  32,  0},
+        {"random 100x100",      100, 100,   4,  0},
+        {"flags 1k x 16",      1000,   1,   0, 16},
+        {"flags 100x10 x 64",   100,  10,   4, 64},
+    };
+
+    c.fixedpath   = S("");
+    c.sys_incpath = S("/usr/include");
+    c.sys_libpath = S("/usr/lib");
+    i32 *targets = malloc(sizeof(i32) * 10000);
+    for (i32 i = 0; i < countof(specs); i++) {
+        benchspec s = specs[i];
+        char dir[] = "/tmp/u-config-bench-XXXXXX";
+        if (!targets || !mkdtemp(dir)) {
+            fprintf(stderr, "bench: could not create a temporary directory\n");
+            return 1;
+        }
+        if (!generate_(dir, s, targets)) {
+            fprintf(stderr, "bench: could not write %s\n", dir);
+            cleanup_(dir, s);
+            return 1;
+        }
+        c.envpath = fromcstr_((u8 *)dir);
+        if (!checkbatch_(c, npkgs_(s)-2, npkgs_(s)-1, nullfd)) {
+            fprintf(stderr, "bench: wrong batch answers for %s\n", s.label);
+            cleanup_(dir, s);
+            return 1;
+        }
+        bench_(s.label, npkgs_(s), S("p00000"), c, nullfd);
+        cleanup_(dir, s);
+    }
+    return 0;
 }
 
+#else
 static config *newconfig_()
 {
     arena perm = newarena_(1<<22);
@@ -2516,46 +4487,37 @@ static config *newconfig_()
     return conf;
 }
 
-__attribute((force_align_arg_pointer))
-void mainCRTStartup(void)
+int main(int argc, char **argv)
 {
     config *conf = newconfig_();
-    conf->delim = ';';
-    conf->define_prefix = 1;
+    conf->delim = ':';
     arena *perm = &conf->perm;
 
-    i32 dummy;
-    handles[1].handle = GetStdHandle(STD_OUTPUT_HANDLE);
-    handles[1].isconsole = GetConsoleMode(handles[1].handle, &dummy);
-    handles[2].handle = GetStdHandle(STD_ERROR_HANDLE);
-    handles[2].isconsole = GetConsoleMode(handles[2].handle, &dummy);
-
-    u8 **argv = new(perm, u8 *, CMDLINE_ARGV_MAX);
-    c16 *cmdline = GetCommandLineW();
-    conf->nargs = cmdline_to_argv8(cmdline, argv) - 1;
+    conf->nargs = argc - !!argc;
     conf->args = new(perm, s8, conf->nargs);
     for (size i = 0; i < conf->nargs; i++) {
-        conf->args[i] = fromcstr_(argv[i+1]);
+        conf->args[i] = fromcstr_((u8 *)argv[i+1]);
     }
 
-    s8 base = installdir_(perm);
-    conf->envpath = fromenv_(perm, L"PKG_CONFIG_PATH");
-    conf->fixedpath = fromenv_(perm, L"PKG_CONFIG_LIBDIR");
-    if (!conf->fixedpath.s) {
-        s8 lib   = S(PKG_CONFIG_PREFIX "/lib/pkgconfig");
-        s8 share = S(PKG_CONFIG_PREFIX "/share/pkgconfig");
-        conf->fixedpath = makepath_(perm, base, lib, share);
-    }
-    conf->top_builddir = fromenv_(perm, L"PKG_CONFIG_TOP_BUILD_DIR");
-    conf->sys_incpath  = append2_(perm, base, S(PKG_CONFIG_PREFIX "/include"));
-    conf->sys_libpath  = append2_(perm, base, S(PKG_CONFIG_PREFIX "/lib"));
-    conf->print_sysinc = fromenv_(perm, L"PKG_CONFIG_ALLOW_SYSTEM_CFLAGS");
-    conf->print_syslib = fromenv_(perm, L"PKG_CONFIG_ALLOW_SYSTEM_LIBS");
+    s8 null = {0};
+    conf->envpath      = fromenv_("PKG_CONFIG_PATH", null);
+    conf->fixedpath    = fromenv_("PKG_CONFIG_LIBDIR", S(PKG_CONFIG_LIBDIR));
+    conf->top_builddir = fromenv_("PKG_CONFIG_TOP_BUILD_DIR", null);
+    conf->sys_incpath  = fromenv_(
+        "PKG_CONFIG_SYSTEM_INCLUDE_PATH", S(PKG_CONFIG_SYSTEM_INCLUDE_PATH)
+    );
+    conf->sys_libpath  = fromenv_(
+        "PKG_CONFIG_SYSTEM_LIBRARY_PATH", S(PKG_CONFIG_SYSTEM_LIBRARY_PATH)
+    );
+    conf->print_sysinc = fromenv_("PKG_CONFIG_ALLOW_SYSTEM_CFLAGS", null);
+    conf->print_syslib = fromenv_("PKG_CONFIG_ALLOW_SYSTEM_LIBS", null);
+    conf->cachepath    = fromenv_("PKG_CONFIG_CACHE", null);
 
     uconfig(conf);
-    ExitProcess(handles[1].err || handles[2].err);
-    assert(0);
+    flushstdout_();
+    return output_.err[1] || output_.err[2];
 }
+#endif  // BENCH
 
 static filemap os_mapfile(arena *perm, s8 path)
 {
@@ -2564,36 +4526,51 @@ static filemap os_mapfile(arena *perm, s8 path)
 
     filemap r = {0};
 
-    i32 handle = 0;
-    {
-        arena scratch = *perm;
-        s16 wpath = towide_(&scratch, path);
-        handle = CreateFileW(
-            wpath.s,
-            GENERIC_READ,
-            FILE_SHARE_ALL,
-            0,
-            OPEN_EXISTING,
-            FILE_ATTRIBUTE_NORMAL,
-            0
-        );
-        if (handle == INVALID_HANDLE_VALUE) {
-            r.status = filemap_NOTFOUND;
+    i32 fd = open((char *)path.s, O_RDONLY);
+    if (fd < 0) {
+        r.status = filemap_NOTFOUND;
+        return r;
+    }
+
+    struct stat sb;
+    if (fstat(fd, &sb) || S_ISDIR(sb.st_mode)) {
+        close(fd);
+        r.status = filemap_NOTFOUND;
+        return r;
+    }
+
+    // Regular files are mapped directly and never unmapped: the parser
+    // slices into the contents, which must live as long as the arena.
+    // The application never writes into package contents.
+    if (S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        void *p = mmap(0, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            close(fd);
+            r.data.s   = p;
+            r.data.len = (size)sb.st_size;
+            r.status   = filemap_OK;
             return r;
         }
     }
 
+    // Pipes, character devices, and failed mappings fall back to reading
+    // into the arena.
     r.data.s = (u8 *)perm->beg;
     size cap = perm->end - perm->beg;
     while (r.data.len < cap) {
-        i32 len = truncsize(cap - r.data.len);
-        ReadFile(handle, r.data.s+r.data.len, len, &len, 0);
-        if (len < 1) {
+        ssize_t len = read(fd, r.data.s+r.data.len, (size_t)(cap-r.data.len));
+        if (len < 0 && errno == EINTR) {
+            continue;
+        } else if (len < 0) {
+            close(fd);
+            r.status = filemap_READERR;
+            return r;
+        } else if (!len) {
             break;
         }
         r.data.len += len;
     }
-    CloseHandle(handle);
+    close(fd);
 
     if (r.data.len == cap) {
         // If it filled all available space, assume the file is too large.
@@ -2606,74 +4583,174 @@ static filemap os_mapfile(arena *perm, s8 path)
     return r;
 }
 
+static filestamp os_stamp(arena *perm, s8 path)
+{
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
+    (void)perm;
+
+    struct stat sb;
+    filestamp r = {0};
+    if (!stat((char *)path.s, &sb)) {
+        r.mtime = (i64)sb.st_mtim.tv_sec*1000000000 + sb.st_mtim.tv_nsec;
+        r.size  = (i64)sb.st_size;
+        r.ok    = 1;
+    }
+    return r;
+}
+
+static b32 os_savefile(arena *perm, s8 path, s8 data)
+{
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
+
+    // Write a unique sibling, then rename it over the target
+    arena scratch = *perm;
+    s8 tmp = news8(&scratch, path.len-1 + 8);
+    s8copy(s8copy(tmp, cuttail(path, 1)), S(".XXXXXX\0"));
+    i32 fd = mkstemp((char *)tmp.s);
+    if (fd < 0) {
+        return 0;
+    }
+    b32 ok = fullwrite_(fd, data.s, data.len);
+    ok &= !fchmod(fd, 0644);
+    ok &= !close(fd);
+    ok = ok && !rename((char *)tmp.s, (char *)path.s);
+    if (!ok) {
+        unlink((char *)tmp.s);
+    }
+    return ok;
+}
+
 static void os_fail(void)
 {
-    ExitProcess(1);
-    assert(0);
+    flushstdout_();
+    _exit(1);
 }
 
-typedef struct {
-    c16 buf[1<<8];
-    i32 len;
-    i32 handle;
-    b32 err;
-} u16buf;
+static void os_write(i32 fd, s8 s)
+{
+    assert(fd > 0);
 
-static void flushconsole_(u16buf *b)
+    if (fd > 2) {
+        fullwrite_(fd, s.s, s.len);  // client errors are not ours
+        return;
+    } else if (fd == 2) {
+        flushstdout_();
+        if (!output_.err[2]) {
+            output_.err[2] = !fullwrite_(2, s.s, s.len);
+        }
+        return;
+    }
+
+    if (output_.err[1]) {
+        return;
+    }
+    size avail = countof(output_.buf) - output_.len;
+    if (s.len > avail) {
+        flushstdout_();
+        if (s.len >= countof(output_.buf)) {
+            output_.err[1] = !fullwrite_(1, s.s, s.len);
+            return;
+        }
+    }
+    for (size i = 0; i < s.len; i++) {
+        output_.buf[output_.len+i] = s.s[i];
+    }
+    output_.len += (i32)s.len;
+}
+
+static void os_flush(i32 fd)
 {
-    if (!b->err && b->len) {
-        i32 dummy;
-        b->err = !WriteConsoleW(b->handle, b->buf, b->len, &dummy, 0);
+    if (fd == 1) {
+        flushstdout_();
     }
-    b->len = 0;
 }
 
-static void printc32_(u16buf *b, c32 rune)
+static i32 os_read(i32 fd, u8 *buf, i32 len)
 {
-    if (b->len > countof(b->buf)-2) {
-        flushconsole_(b);
+    for (;;) {
+        ssize_t r = read(fd, buf, (size_t)len);
+        if (r<0 && errno==EINTR) {
+            continue;
+        }
+        return r<0 ? 0 : (i32)r;
     }
-    b->len += utf16encode_(b->buf+b->len, rune);
 }
 
-static void os_write(i32 fd, s8 s)
+static i32 os_listen(arena *perm, s8 path)
 {
-    assert((i32)s.len == s.len);  // NOTE: assume it's not a huge buffer
-    assert(fd==1 || fd==2);
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
+    (void)perm;
 
-    b32 *err = &handles[fd].err;
-    if (*err) {
-        return;
+    struct sockaddr_un addr = {0};
+    if (path.len > countof(addr.sun_path)) {
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    for (size i = 0; i < path.len; i++) {
+        addr.sun_path[i] = (char)path.s[i];
     }
 
-    i32 handle = handles[fd].handle;
-    if (handles[fd].isconsole) {
-        // NOTE: There is a small chance that a multi-byte code point
-        // spans flushes from the application. With no decoder state
-        // tracked between os_write calls, this will mistranslate for
-        // console outputs. The application could avoid such flushes,
-        // which would require a distinct "close" flush before exits.
-        //
-        // Alternatively, the platform layer could detect truncated
-        // encodings and buffer up to 3 bytes between calls. This buffer
-        // would need to be flushed on exit by the platform.
-        //
-        // The primary use case for u-config is non-console outputs into
-        // a build system, which will not experience this issue. Console
-        // output is mainly for human-friendly debugging, so the risk is
-        // acceptable.
-        u16buf b = {0};
-        b.handle = handle;
-        utf8 state = {0};
-        state.tail = s;
-        while (state.tail.len) {
-            state = utf8decode_(state.tail);
-            printc32_(&b, state.rune);
+    // Replace a stale socket from a previous server, but nothing else
+    struct stat sb;
+    if (!lstat(addr.sun_path, &sb) && S_ISSOCK(sb.st_mode)) {
+        unlink(addr.sun_path);
+    }
+
+    i32 fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 64)) {
+        close(fd);
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);  // departing clients must not kill us
+    return fd;
+}
+
+static i32 os_accept(i32 listener)
+{
+    for (;;) {
+        i32 fd = accept(listener, 0, 0);
+        if (fd<0 && (errno==EINTR || errno==ECONNABORTED)) {
+            continue;
+        }
+        return fd;
+    }
+}
+
+static void os_close(i32 fd)
+{
+    close(fd);
+}
+
+static filemap os_listdir(arena *perm, s8 path)
+{
+    assert(path.len > 0);
+    assert(!path.s[path.len-1]);
+
+    filemap r = {0};
+    DIR *dir = opendir((char *)path.s);
+    if (!dir) {
+        r.status = errno==ENOENT || errno==ENOTDIR
+            ? filemap_NOTFOUND
+            : filemap_READERR;
+        return r;
+    }
+
+    u8buf mem = newmembuf(perm);
+    for (struct dirent *e; (e = readdir(dir));) {
+        if (e->d_type != DT_DIR) {
+            prints8(&mem, fromcstr_((u8 *)e->d_name));
+            printu8(&mem, 0);
         }
-        flushconsole_(&b);
-        *err = b.err;
-    } else {
-        i32 dummy;
-        *err = !WriteFile(handle, s.s, (i32)s.len, &dummy, 0);
     }
+    closedir(dir);
+    r.data = finalize(&mem);
+    r.status = filemap_OK;
+    return r;
 }
+#endif  // _WIN32
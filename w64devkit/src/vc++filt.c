@@ -1,17 +1,25 @@
-// vc++filt: c++filt for Microsoft Visual C++, like undname
-// $ cc -nostartfiles -O -o vc++filt.exe vc++filt.c -ldbghelp
-// $ cl /O1 vc++filt.c /link /subsystem:console
-//      kernel32.lib shell32.lib dbghelp.lib libvcruntime.lib
+// vc++filt: c++filt for Microsoft Visual C++, like undname, and Itanium
+// $ cc -nostartfiles -O -o vc++filt.exe vc++filt.c   # Windows
+// $ cc -O -pthread -o vc++filt vc++filt.c            # Linux
+// $ cc -DTEST -g3 -o test vc++filt.c && ./test       # tests
 // * Full Unicode support, including UTF-8 and wide console output
 // * Tiny, slim, fast binary, low resource use, CRT-free
+// * Portable decoder (demangle.h) matching DbgHelp's UnDecorateSymbolName
 // This is free and unencumbered software released into the public domain.
 #include <stddef.h>
+#include "demangle.h"
 
 enum {
-    BUFFER_CAP  = 1<<14,
-    CONVERT_CAP = 1<<10,
-    SYMBOL_MAX  = 1<<16,
-    MEMORY_CAP  = 1<<24,
+    BUFFER_CAP   = 1<<14,
+    CONVERT_CAP  = 1<<10,
+    SYMBOL_MAX   = 1<<16,
+    DEMANGLE_CAP = 1<<18,
+    BATCH_CAP    = 1<<22,  // input read at once
+    PARALLEL_MIN = 1<<16,  // smallest input split across threads
+    MAX_THREADS  = 8,
+    MAX_JOBS     = 4*MAX_THREADS,
+    WORKER_CAP   = 1<<22,  // per-thread output and cache
+    MEMORY_CAP   = 1<<26,
 };
 
 #define countof(a)    (size)(sizeof(a) / sizeof(*(a)))
@@ -27,24 +35,42 @@ typedef          char      byte;
 typedef          size_t    uptr;
 typedef          ptrdiff_t size;
 
-#define W32(r) __declspec(dllimport) r __stdcall
-W32(u16 **) CommandLineToArgvW(u16 *, i32 *);
-W32(void)   ExitProcess(i32);
-W32(u16 *)  GetCommandLineW(void);
-W32(b32)    GetConsoleMode(uptr, i32 *);
-W32(i32)    GetStdHandle(i32);
-W32(b32)    ReadFile(uptr, u8 *, i32, i32 *, uptr);
-W32(i32)    UnDecorateSymbolName(u8 *, u8 *, i32, i32);  // dbghelp.dll
-W32(byte *) VirtualAlloc(byte *, size, i32, i32);
-W32(i32)    WideCharToMultiByte(i32, i32, u16 *, i32, u8 *, i32, uptr, uptr);
-W32(b32)    WriteConsoleW(uptr, u16 *, i32, i32 *, uptr);
-W32(b32)    WriteFile(uptr, u8 *, i32, i32 *, uptr);
-
 typedef struct {
     byte *beg;
     byte *end;
 } arena;
 
+typedef struct {
+    u8  *data;
+    size len;
+} s8;
+
+
+// Platform API
+
+// Application entry point, given UTF-8 arguments and a zeroed arena,
+// returning the exit status.
+static i32 run(i32 argc, s8 *argv, arena);
+
+// Read standard input, returning the byte count, or zero at the end of
+// input or on error.
+static i32 os_read(u8 *, i32 len);
+
+// Write to standard output (1) or standard error (2), converting for a
+// console if necessary. Returns false on error.
+static b32 os_write(i32 fd, u8 *, i32 len);
+
+// Number of hardware threads available, at least one.
+static i32 os_ncpu(void);
+
+// Call fn(arg, id) for each id in [0, n) concurrently, returning after
+// all calls return. The caller's thread handles id 0, and the platform
+// may fall back to calling others in sequence.
+static void os_parallel(void (*fn)(void *, i32 id), void *arg, i32 n);
+
+
+// Application
+
 // Allocate pointer-aligned, zero-initialized memory, or null on failure.
 static void *alloc(arena *a, size len)
 {
@@ -56,11 +82,6 @@ static void *alloc(arena *a, size len)
     return a->end -= len + alignment;  // NOTE: assume arena is zeroed
 }
 
-typedef struct {
-    u8  *data;
-    size len;
-} s8;
-
 static u64 s8hash(s8 s)
 {
     // NOTE: hash is fast enough; faster has no throughput impact
@@ -113,144 +134,35 @@ static s8 s8cuthead(s8 s, size len)
 }
 
 typedef struct {
-    s8  remain;
-    i32 rune;
-} utf8result;
-
-static utf8result utf8decode(s8 s)
-{
-    utf8result r = {0};
-    switch (s.data[0]&0xf0) {
-    default  : r.rune = s.data[0];
-               if (r.rune > 0x7f) break;
-               r.remain = s8cuthead(s, 1);
-               return r;
-    case 0xc0:
-    case 0xd0: if (s.len < 2) break;
-               if ((s.data[1]&0xc0) != 0x80) break;
-               r.rune = (i32)(s.data[0]&0x1f) << 6 |
-                        (i32)(s.data[1]&0x3f) << 0;
-               if (r.rune < 0x80) break;
-               r.remain = s8cuthead(s, 2);
-               return r;
-    case 0xe0: if (s.len < 3) break;
-               if ((s.data[1]&0xc0) != 0x80) break;
-               if ((s.data[2]&0xc0) != 0x80) break;
-               r.rune = (i32)(s.data[0]&0x0f) << 12 |
-                        (i32)(s.data[1]&0x3f) <<  6 |
-                        (i32)(s.data[2]&0x3f) <<  0;
-               if (r.rune < 0x800) break;
-               if (r.rune>=0xd800 && r.rune<=0xdfff) break;
-               r.remain = s8cuthead(s, 3);
-               return r;
-    case 0xf0: if (s.len < 4) break;
-               if ((s.data[1]&0xc0) != 0x80) break;
-               if ((s.data[2]&0xc0) != 0x80) break;
-               if ((s.data[3]&0xc0) != 0x80) break;
-               r.rune = (i32)(s.data[0]&0x0f) << 18 |
-                        (i32)(s.data[1]&0x3f) << 12 |
-                        (i32)(s.data[2]&0x3f) <<  6 |
-                        (i32)(s.data[3]&0x3f) <<  0;
-               if (r.rune < 0x10000) break;
-               if (r.rune > 0x10ffff) break;
-               r.remain = s8cuthead(s, 4);
-               return r;
-    }
-    r.rune = 0xfffd;  // Replacement Character
-    r.remain = s8cuthead(s, 1);
-    return r;
-}
-
-// Encode code point returning the output length (1-2).
-static i32 utf16encode(u16 *dst, i32 rune)
-{
-    if (rune >= 0x10000) {
-        rune -= 0x10000;
-        dst[0] = (u16)((rune >> 10) + 0xd800);
-        dst[1] = (u16)((rune&0x3ff) + 0xdc00);
-        return 2;
-    }
-    dst[0] = (u16)rune;
-    return 1;
-}
-
-typedef struct {
-    u8  buf[BUFFER_CAP];
-    i32 len;
-    i32 off;
-    i32 fd;
-    b32 eof;
-} bufin;
-
-static bufin *newbufin(arena *perm)
-{
-    bufin *b = new(perm, bufin, 1);
-    b->fd = GetStdHandle(-10);
-    return b;
-}
-
-static u8 readu8(bufin *b)
-{
-    if (b->eof) {
-        return 0;
-    } else if (b->off == b->len) {
-        ReadFile(b->fd, b->buf, BUFFER_CAP, &b->len, 0);
-        if (!b->len) {
-            b->eof = 1;
-            return 0;
-        }
-        b->off = 0;
-    }
-    return b->buf[b->off++];
-}
-
-typedef struct {
-    u8   buf[BUFFER_CAP];
-    i32  len;
-    i32  fd;
-    b32  err;
-    u16 *convert;  // scratch space for WriteConsoleW
+    u8     buf[BUFFER_CAP];
+    i32    len;
+    i32    fd;
+    b32    err;
+    arena *mem;  // if set, gather output at the bottom of this arena
 } bufout;
 
 static bufout *newbufout(arena *perm)
 {
     bufout *b = new(perm, bufout, 1);
-    b->fd = GetStdHandle(-11);
-    i32 dummy;
-    if (GetConsoleMode(b->fd, &dummy)) {
-        b->convert = new(perm, u16, CONVERT_CAP);
-    }
+    b->fd = 1;
     return b;
 }
 
-static void flushconsole(bufout *b)
-{
-    u16 *convert = b->convert;
-    utf8result r = {0};
-    r.remain.data = b->buf;
-    r.remain.len = b->len;
-    for (i32 len = 0; !b->err && r.remain.len;) {
-        r = utf8decode(r.remain);
-        len += utf16encode(convert+len, r.rune);
-        if (len>=CONVERT_CAP-1 || !r.remain.len) {
-            i32 dummy;
-            b->err = !WriteConsoleW(b->fd, convert, len, &dummy, 0);
-            len = 0;
-        }
-    }
-    b->len = 0;
-}
-
 static void flush(bufout *b)
 {
     if (!b->err && b->len) {
-        if (b->convert) {
-            flushconsole(b);
+        if (!b->mem) {
+            b->err = !os_write(b->fd, b->buf, b->len);
+        } else if (b->mem->end-b->mem->beg < b->len) {
+            b->err = 1;  // out of memory
         } else {
-            i32 dummy;
-            b->err = !WriteFile(b->fd, b->buf, b->len, &dummy, 0);
-            b->len = 0;
+            u8 *dst = (u8 *)b->mem->beg;
+            for (i32 i = 0; i < b->len; i++) {
+                dst[i] = b->buf[i];
+            }
+            b->mem->beg += b->len;
         }
+        b->len = 0;
     }
 }
 
@@ -289,6 +201,110 @@ static b32 ident(u8 c)
     return t[c>>5] & (u32)1<<(c&31);
 }
 
+static b32 itident(u8 c)
+{
+    // matches $.0-9A-Z_a-z, as c++filt
+    static const u32 t[] = {
+        0x00000000, 0x03ff4010, 0x87fffffe, 0x07fffffe,
+        0x00000000, 0x00000000, 0x00000000, 0x00000000,
+    };
+    return t[c>>5] & (u32)1<<(c&31);
+}
+
+#if __SSE2__
+typedef char v16 __attribute((vector_size(16), aligned(1)));
+
+static i32 movemask(v16 v)
+{
+    return __builtin_ia32_pmovmskb128(v);
+}
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+typedef u64 u64u __attribute((aligned(1), may_alias));
+
+// High bit set in each zero byte of x, exactly.
+static u64 zerobytes(u64 x)
+{
+    u64 low7 = 0x7f7f7f7f7f7f7f7f;
+    return ~(((x & low7) + low7) | x | low7);
+}
+
+// Index of the lowest flagged byte, in halves since __builtin_ctzll is a
+// libgcc call on 32-bit hosts.
+static i32 firstbyte(u64 mask)
+{
+    u32 lo = (u32)mask;
+    return lo ? __builtin_ctz(lo)/8 : 4 + __builtin_ctz((u32)(mask>>32))/8;
+}
+#endif
+
+// Index of the first c at or after i, or the length if none. Most input
+// is plain text, so this compares 16 bytes at a time where possible.
+static size findbyte(s8 s, size i, u8 c)
+{
+    #if __SSE2__
+    v16 pattern = {0};
+    pattern += (char)c;
+    for (; s.len-i >= 16; i += 16) {
+        v16 v = *(v16 *)(s.data + i);
+        i32 mask = movemask(v == pattern);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    #elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    u64 ones = 0x0101010101010101;
+    for (; s.len-i >= 8; i += 8) {
+        u64 mask = zerobytes(*(u64u *)(s.data + i) ^ ones*c);
+        if (mask) {
+            return i + firstbyte(mask);
+        }
+    }
+    #endif
+    for (; i<s.len && s.data[i]!=c; i++) {}
+    return i;
+}
+
+// Index of the next possible symbol, "?" (MSVC) or "_Z" (Itanium), at
+// or after i, or the length if none. A final "_" is possible, too.
+static size findsymbol(s8 s, size i)
+{
+    #if __SSE2__
+    v16 q = {0}, u = {0}, z = {0};
+    q += '?';
+    u += '_';
+    z += 'Z';
+    for (; s.len-i > 16; i += 16) {
+        v16 v = *(v16 *)(s.data + i);
+        v16 n = *(v16 *)(s.data + i + 1);
+        i32 mask = movemask((v == q) | ((v == u) & (n == z)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    #elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    u64 ones = 0x0101010101010101;
+    for (; s.len-i > 8; i += 8) {
+        u64 v = *(u64u *)(s.data + i);
+        u64 n = *(u64u *)(s.data + i + 1);
+        u64 mask = zerobytes(v ^ ones*'?') |
+                   (zerobytes(v ^ ones*'_') & zerobytes(n ^ ones*'Z'));
+        if (mask) {
+            return i + firstbyte(mask);
+        }
+    }
+    #endif
+    for (; i < s.len; i++) {
+        u8 c = s.data[i];
+        if (c=='?' || (c=='_' && (i+1==s.len || s.data[i+1]=='Z'))) {
+            break;
+        }
+    }
+    return i;
+}
+
+// The map is shared between threads. Racing insertions resolve with a
+// compare-and-swap, abandoning the losing node in its arena. Outputs are
+// published through the data pointer, after the length.
 typedef struct map map;
 struct map {
     map *child[4];
@@ -296,62 +312,274 @@ struct map {
     s8   output;
 };
 
+// Find the entry for an input, inserting it if perm is non-null.
 static map *upsert(map **m, s8 input, arena *perm)
 {
-    for (u64 h = s8hash(input); *m; h <<= 2) {
-        if (s8equals(input, (*m)->input)) {
-            return *m;
+    for (u64 h = s8hash(input);; h <<= 2) {
+        map *n = __atomic_load_n(m, __ATOMIC_ACQUIRE);
+        if (!n) {
+            n = perm ? new(perm, map, 1) : 0;
+            if (n) {
+                n->input = s8dup(input, perm);
+            }
+            if (!n || !n->input.data) {
+                return 0;  // out of memory
+            }
+            map *old = 0;
+            if (__atomic_compare_exchange_n(
+                    m, &old, n, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+                return n;
+            }
+            n = old;
         }
-        m = &(*m)->child[h>>62];
-    }
-    input = s8dup(input, perm);
-    *m = input.data ? new(perm, map, 1) : 0;
-    if (*m) {
-        (*m)->input = input;
+        if (s8equals(input, n->input)) {
+            return n;
+        }
+        m = &n->child[h>>62];
     }
-    return *m;
 }
 
-// Caches UnDecorateSymbolName calls. Typically ~90% of the symbols are
-// repeats. A hash map lookup is significantly faster than undecorating
-// through this API, so this measurably improves performance. The cache
-// operates correctly when out of memory, just with less caching.
+// Caches demangler results. Typically ~90% of the symbols are repeats,
+// and a hash map lookup is several times faster than decoding again, so
+// this measurably improves performance. Each thread has its own cache
+// over the shared map. The cache operates correctly when out of memory,
+// just with less caching.
 typedef struct {
-    map   *seen;
+    map  **seen;
     arena *perm;
-    u8    *temp;
-    i32    flags;
-    i32    hits;    // for debugging / tuning
-    i32    misses;  // "
+    size   reserve;  // arena kept free for other uses
+    u8    *mem;      // demangler working memory
+    i32    flags;    // DEMANGLE_*
+    i32    hits;     // for debugging / tuning
+    i32    misses;   // "
 } callcache;
 
-static callcache *newcache(i32 flags, arena *perm)
+static callcache *newcache(map **seen, i32 flags, arena *perm)
 {
     callcache *c = new(perm, callcache, 1);
+    c->seen = seen;
     c->perm = perm;
-    c->temp = new(perm, u8, SYMBOL_MAX);
+    c->mem = new(perm, u8, DEMANGLE_CAP);
     c->flags = flags;
     return c;
 }
 
+// Like UnDecorateSymbolName, names that do not decode print unchanged.
 static s8 undecorate(callcache *c, s8 sym)
 {
-    map *m = upsert(&c->seen, sym, c->perm);
-    if (m && m->output.data) {
+    arena *perm = c->perm->end-c->perm->beg > c->reserve ? c->perm : 0;
+    map *m = upsert(c->seen, sym, perm);
+    u8 *data = m ? __atomic_load_n(&m->output.data, __ATOMIC_ACQUIRE) : 0;
+    if (data) {
         c->hits++;
-        return m->output;
+        s8 r = {data, __atomic_load_n(&m->output.len, __ATOMIC_RELAXED)};
+        return r;
     }
 
     c->misses++;
-    s8 r = {0};
-    r.data = c->temp;
-    r.len = UnDecorateSymbolName(sym.data, c->temp, SYMBOL_MAX, c->flags);
-    if (m) {
-        m->output = s8dup(r, c->perm);
+    s8 r = sym;
+    dmname d = demangle(sym.data, sym.len, c->flags, c->mem, DEMANGLE_CAP);
+    if (d.data) {
+        r.data = d.data;
+        r.len  = d.len;
+    }
+    s8 save = {0};
+    if (m && perm) {
+        save = s8dup(r, perm);
+    }
+    if (save.data) {
+        __atomic_store_n(&m->output.len, save.len, __ATOMIC_RELAXED);
+        __atomic_store_n(&m->output.data, save.data, __ATOMIC_RELEASE);
     }
     return r;
 }
 
+typedef struct {
+    s8  sym;
+    b32 sym_at;       // current symbol contains '@'?
+    b32 sym_itanium;  // current symbol starts with '_'?
+    b32 sym_start;    // next byte starts an identifier?
+} scanner;
+
+static scanner *newscanner(arena *perm)
+{
+    scanner *s = new(perm, scanner, 1);
+    s->sym.data = new(perm, u8, SYMBOL_MAX);
+    s->sym_start = 1;
+    return s;
+}
+
+// Decode or pass through the current identifier, if any. An Itanium
+// symbol may run into an MSVC symbol, which then starts as though the
+// output had been filtered by c++filt first.
+static void endsymbol(scanner *s, callcache *cache, bufout *out)
+{
+    s8 text = s->sym;
+    if (s->sym_at || s->sym_itanium) {
+        // Itanium, or MSVC with at least one @? Try to decode it.
+        text = undecorate(cache, s->sym);
+    }
+    writes8(out, text);
+    s->sym_start = !text.len || !ident(text.data[text.len-1]);
+    s->sym.len = s->sym_at = s->sym_itanium = 0;
+}
+
+// Filter a span of input, continuing an identifier across calls.
+static void scan(scanner *s, s8 in, callcache *cache, bufout *out)
+{
+    for (size i = 0; i < in.len;) {
+        if (!s->sym.len) {
+            // Pass through plain text up to the next candidate
+            size next = findsymbol(in, i);
+            s8 plain = {in.data+i, next-i};
+            writes8(out, plain);
+            if (next > i) {
+                s->sym_start = !ident(in.data[next-1]);
+            }
+            if (next == in.len) {
+                break;
+            }
+            u8 c = in.data[next];
+            if (s->sym_start) {
+                // Start of a new identifier
+                s->sym = s8push(s->sym, c);
+                s->sym_itanium = c=='_';
+            } else {
+                writeu8(out, c);
+            }
+            s->sym_start = 0;
+            i = next + 1;
+
+        } else if (s->sym_itanium ? itident(in.data[i]) : ident(in.data[i])) {
+            // Continue the current identifier
+            u8 c = in.data[i++];
+            s->sym = s8push(s->sym, c);
+            s->sym_at |= c=='@';
+            if (s->sym.len == SYMBOL_MAX) {
+                // Too long, give up on this one
+                writes8(out, s->sym);
+                s->sym.len = s->sym_at = s->sym_itanium = 0;
+            }
+
+        } else {
+            // Terminated, and the terminator is handled as plain text
+            endsymbol(s, cache, out);
+        }
+    }
+}
+
+// Per-thread state for filtering lines in parallel. Output collects at
+// the bottom of the arena, and the cache grows down from the top.
+typedef struct {
+    arena      mem;
+    byte      *base;  // bottom of the output
+    callcache *cache;
+    scanner   *scanner;
+    bufout    *out;
+} worker;
+
+typedef struct {
+    s8  input;   // whole lines
+    s8  output;
+    b32 ok;
+} job;
+
+typedef struct {
+    worker workers[MAX_THREADS];
+    i32    nworkers;
+    job    jobs[MAX_JOBS];
+    i32    njobs;
+    i32    next;  // next job to claim
+} pool;
+
+static pool *newpool(i32 nworkers, map **seen, i32 flags, arena *perm)
+{
+    pool *p = new(perm, pool, 1);
+    if (!p) {
+        return 0;
+    }
+    p->nworkers = nworkers;
+    for (i32 i = 0; i < nworkers; i++) {
+        worker *w = p->workers + i;
+        w->mem.beg = new(perm, byte, WORKER_CAP);
+        if (!w->mem.beg) {
+            return 0;
+        }
+        w->mem.end = w->mem.beg + WORKER_CAP;
+        w->cache = newcache(seen, flags, &w->mem);
+        w->cache->reserve = WORKER_CAP / 2;
+        w->scanner = newscanner(&w->mem);
+        w->out = newbufout(&w->mem);
+        w->out->mem = &w->mem;
+        w->base = w->mem.beg;
+    }
+    return p;
+}
+
+static void work(void *arg, i32 id)
+{
+    pool *p = arg;
+    worker *w = p->workers + id;
+    for (;;) {
+        i32 i = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED);
+        if (i >= p->njobs) {
+            return;
+        }
+        job *j = p->jobs + i;
+        u8 *beg = (u8 *)w->mem.beg;
+        scan(w->scanner, j->input, w->cache, w->out);
+        flush(w->out);
+        j->ok = !w->out->err;
+        j->output.data = beg;
+        j->output.len  = (u8 *)w->mem.beg - beg;
+        w->out->err = 0;
+    }
+}
+
+// Filter whole lines, splitting large inputs between threads, with the
+// output in input order.
+static void filterlines(
+    pool *p, s8 lines, scanner *s, callcache *cache, bufout *out)
+{
+    if (!p || lines.len<PARALLEL_MIN) {
+        scan(s, lines, cache, out);
+        return;
+    }
+
+    p->njobs = 0;
+    p->next = 0;
+    for (size beg = 0; beg < lines.len; p->njobs++) {
+        size end = beg + lines.len/MAX_JOBS;
+        if (p->njobs==MAX_JOBS-1 || end>=lines.len) {
+            end = lines.len - 1;
+        }
+        end = findbyte(lines, end, '\n') + 1;
+        job *j = p->jobs + p->njobs;
+        j->input.data = lines.data + beg;
+        j->input.len  = end - beg;
+        beg = end;
+    }
+    os_parallel(work, p, p->nworkers);
+
+    for (i32 i = 0; i < p->njobs; i++) {
+        job *j = p->jobs + i;
+        if (j->ok) {
+            writes8(out, j->output);
+        } else {
+            scan(s, j->input, cache, out);  // out of memory, retry here
+        }
+    }
+
+    // Release the output, re-zeroing it for later cache allocations
+    for (i32 i = 0; i < p->nworkers; i++) {
+        worker *w = p->workers + i;
+        for (byte *b = w->base; b < w->mem.beg; b++) {
+            *b = 0;
+        }
+        w->mem.beg = w->base;
+    }
+}
+
 static b32 usage(i32 fd)
 {
     static const u8 usage[] =
@@ -361,9 +589,7 @@ static b32 usage(i32 fd)
     "  -h     print usage message\n"
     "  -n     64-bit mode\n"
     "  -p     do not print parameters\n";
-    uptr h = GetStdHandle(-10 - fd);
-    i32 dummy;
-    return WriteFile(h, (u8 *)usage, countof(usage)-1, &dummy, 0);
+    return os_write(fd, (u8 *)usage, countof(usage)-1);
 }
 
 typedef enum {
@@ -378,43 +604,37 @@ typedef struct {
     i32 status;
 } parsedargs;
 
-static parsedargs parseargs(i32 argc, u16 **argv)
+static parsedargs parseargs(i32 argc, s8 *argv)
 {
-    enum {
-        UNDNAME_NO_ACCESS_SPECIFIERS = 0x0080,
-        UNDNAME_32_BIT_DECODE        = 0x0800,
-        UNDNAME_NAME_ONLY            = 0x1000,
-    };
-
     parsedargs r = {0};
     // On Windows, c++filt -_/-n is, in practice, a 32-/64-bit toggle
-    r.flags |= sizeof(void *)==4 ? UNDNAME_32_BIT_DECODE : 0;
-    r.flags |= UNDNAME_NO_ACCESS_SPECIFIERS;
+    r.flags |= sizeof(void *)==4 ? DEMANGLE_NOPTR64 : 0;
+    r.flags |= DEMANGLE_NOACCESS | DEMANGLE_UNDNAME;
 
     for (r.index++; r.index < argc; r.index++) {
-        u16 *arg = argv[r.index];
-        if (arg[0] != '-') {
+        s8 arg = argv[r.index];
+        if (!arg.len || arg.data[0]!='-') {
             return r;   // positional argument
-        } else if (arg[1]=='-' && !arg[2]) {
+        } else if (arg.len==2 && arg.data[1]=='-') {
             r.index++;  // discard "--"
             return r;
         }
-        for (arg++; *arg; arg++) {
-            switch (*arg) {
+        for (size i = 1; i < arg.len; i++) {
+            switch (arg.data[i]) {
             case 'a':
-                r.flags &= ~UNDNAME_NO_ACCESS_SPECIFIERS;
+                r.flags &= ~DEMANGLE_NOACCESS;
                 break;
             case 'h':
                 r.status = usage(1) ? status_EXIT : status_FAIL;
                 return r;
             case '_':
-                r.flags |= UNDNAME_32_BIT_DECODE;
+                r.flags |= DEMANGLE_NOPTR64;
                 break;
             case 'n':
-                r.flags &= ~UNDNAME_32_BIT_DECODE;
+                r.flags &= ~DEMANGLE_NOPTR64;
                 break;
             case 'p':
-                r.flags |= UNDNAME_NAME_ONLY;
+                r.flags |= DEMANGLE_NAMEONLY;
                 break;
             default:
                 usage(2);
@@ -426,32 +646,21 @@ static parsedargs parseargs(i32 argc, u16 **argv)
     return r;
 }
 
-static i32 run(arena scratch)
+static i32 run(i32 argc, s8 *argv, arena scratch)
 {
     bufout *stdout = newbufout(&scratch);
 
-    s8 sym = {0};
-    sym.data = new(&scratch, u8, SYMBOL_MAX);
-    b32 sym_at = 0;     // current symbol contains '@'?
-    b32 sym_start = 1;  // current byte starts an identifier?
-
-    u16 *cmdline = GetCommandLineW();
-    i32 argc;
-    u16 **argv = CommandLineToArgvW(cmdline, &argc);
-
     parsedargs args = parseargs(argc, argv);
     switch (args.status) {
     case status_EXIT: return 0;
     case status_FAIL: return 1;
     }
 
-    callcache *cache = newcache(args.flags, &scratch);
+    map *seen = 0;
+    callcache *cache = newcache(&seen, args.flags, &scratch);
 
     for (i32 i = args.index; i < argc; i++) {
-        sym.len = WideCharToMultiByte(
-            65001, 0, argv[i], -1, sym.data, SYMBOL_MAX, 0, 0
-        );
-        s8 out = undecorate(cache, sym);
+        s8 out = undecorate(cache, argv[i]);
         writes8(stdout, out);
         writeu8(stdout, '\n');
     }
@@ -461,56 +670,445 @@ static i32 run(arena scratch)
         return stdout->err;
     }
 
-    bufin *stdin = newbufin(&scratch);
-    for (u8 c = readu8(stdin); !stdin->eof; c = readu8(stdin)) {
-        if (sym_start && c=='?') {
-            // Start of a new identifier?
-            sym = s8push(sym, c);
-
-        } else if (sym.len) {
-            if (ident(c)) {
-                // Continue the current identifier
-                sym = s8push(sym, c);
-                sym_at |= c=='@';
-                if (sym.len == SYMBOL_MAX) {
-                    // Too long, give up on this one
-                    writes8(stdout, sym);
-                    sym.len = sym_at = 0;
-                }
-
-            } else if (sym_at) {
-                // Contains at least one @? Try to decode it.
-                sym = s8push(sym, 0);
-                s8 out = undecorate(cache, sym);
-                writes8(stdout, out);
-                writeu8(stdout, c);
-                sym.len = sym_at = 0;
+    // Input is read in large batches and cut at line boundaries, so that
+    // lines may be split between threads without splitting identifiers.
+    scanner *scanner = newscanner(&scratch);
+    u8 *batch = new(&scratch, u8, BATCH_CAP);
+    i32 nthreads = os_ncpu();
+    nthreads = nthreads<MAX_THREADS ? nthreads : MAX_THREADS;
+    pool *pool = 0;
+    b32 eof = 0;
+    for (size len = 0; !eof;) {
+        while (!eof && len<BATCH_CAP) {
+            i32 r = os_read(batch+len, (i32)(BATCH_CAP-len));
+            eof = !r;
+            len += r;
+        }
+        if (!pool && nthreads>1 && len>=PARALLEL_MIN) {
+            pool = newpool(nthreads, &seen, args.flags, &scratch);
+        }
 
-            } else {
-                // Don't try to decode it, just pass it through
-                writes8(stdout, sym);
-                writeu8(stdout, c);
-                sym.len = sym_at = 0;
-            }
+        // Finish a line continued from the previous batch
+        s8 rest = {batch, len};
+        if (scanner->sym.len || !scanner->sym_start) {
+            s8 head = rest;
+            head.len = findbyte(rest, 0, '\n');
+            head.len += head.len < rest.len;
+            scan(scanner, head, cache, stdout);
+            rest = s8cuthead(rest, head.len);
+        }
+
+        s8 lines = rest;
+        for (; lines.len && lines.data[lines.len-1]!='\n'; lines.len--) {}
+        filterlines(pool, lines, scanner, cache, stdout);
+        rest = s8cuthead(rest, lines.len);
+
+        // Hold a partial line for the next batch unless it fills a batch
+        if (eof || rest.len==BATCH_CAP) {
+            scan(scanner, rest, cache, stdout);
+            rest.len = 0;
+        }
+        for (size i = 0; i < rest.len; i++) {
+            batch[i] = rest.data[i];
+        }
+        len = rest.len;
+    }
+    endsymbol(scanner, cache, stdout);
+
+    flush(stdout);
+    return stdout->err;
+}
+
+
+
+#if TEST
+// $ cc -DTEST -g3 -fsanitize=address,undefined -o test vc++filt.c
+// $ gdb -ex r -ex q ./test
+// The platform is simulated with an in-memory standard input and output.
+#include <stdlib.h>
+
+#define assert(c) while (!(c)) __builtin_trap()
+
+static struct {
+    s8  input;
+    u8  output[1<<24];
+    i32 len;
+    i32 ncpu;
+} test_;
+
+static i32 os_read(u8 *buf, i32 len)
+{
+    i32 count = test_.input.len<len ? (i32)test_.input.len : len;
+    for (i32 i = 0; i < count; i++) {
+        buf[i] = test_.input.data[i];
+    }
+    test_.input.data += count;
+    test_.input.len  -= count;
+    return count;
+}
+
+static b32 os_write(i32 fd, u8 *buf, i32 len)
+{
+    assert(fd==1 || fd==2);
+    assert(test_.len+len <= countof(test_.output));
+    for (i32 i = 0; i < len; i++) {
+        test_.output[test_.len++] = buf[i];
+    }
+    return 1;
+}
+
+static i32 os_ncpu(void)
+{
+    return test_.ncpu;
+}
+
+// Run in reverse so that ordering mistakes show up.
+static void os_parallel(void (*fn)(void *, i32), void *arg, i32 n)
+{
+    for (i32 i = n-1; i >= 0; i--) {
+        fn(arg, i);
+    }
+}
+
+static s8 fromcstr_(char *z)
+{
+    s8 s = {(u8 *)z, 0};
+    for (; z[s.len]; s.len++) {}
+    return s;
+}
+
+// Filter input through the program with up to three arguments, the
+// rest null, returning its output, or a null string on a non-zero exit.
+static s8 filter_(char **args, s8 input)
+{
+    s8 argv[4] = {0};
+    i32 argc = 0;
+    argv[argc++] = fromcstr_("vc++filt");
+    for (i32 i = 0; i<3 && args[i]; i++) {
+        argv[argc++] = fromcstr_(args[i]);
+    }
+
+    arena scratch = {0};
+    scratch.beg = calloc(MEMORY_CAP, 1);
+    assert(scratch.beg);
+    scratch.end = scratch.beg + MEMORY_CAP;
+    test_.input = input;
+    test_.len = 0;
+    i32 status = run(argc, argv, scratch);
+    free(scratch.beg);
+
+    s8 r = {0};
+    if (!status) {
+        r.data = test_.output;
+        r.len  = test_.len;
+    }
+    return r;
+}
+
+// Append a copy of s to dst, which has enough room.
+static s8 append_(s8 dst, s8 s)
+{
+    for (size i = 0; i < s.len; i++) {
+        dst.data[dst.len++] = s.data[i];
+    }
+    return dst;
+}
 
+int main(void)
+{
+    test_.ncpu = 1;
+
+    static const struct {
+        char *args[3];
+        char *input;
+        char *want;  // null means a non-zero exit
+    } tests[] = {
+        // Declarations and data
+        {{0}, "?f@@YAHH@Z\n", "int __cdecl f(int)\n"},
+        {{0}, "?x@@3HA", "int x"},
+        {{0}, "??_7A@@6B@\n", "const A::`vftable'\n"},
+        {{0}, "?v@@YAXP6AXH@Z@Z\n",
+              "void __cdecl v(void (__cdecl *)(int))\n"},
+        {{0}, "?k@@YAXHZZ\n", "void __cdecl k(int,...)\n"},
+
+        // DbgHelp spacing
+        {{0}, "?g@@YAPEAHPEBD@Z\n",
+              "int * __ptr64 __cdecl g(char const * __ptr64)\n"},
+        {{0}, "?p@@3QEAHEA\n", "int * const __ptr64 p\n"},
+        {{0}, "?f@@YAXV?$vector@V?$vector@H@std@@@std@@@Z\n",
+              "void __cdecl f(class std::vector<class std::vector<int> >)\n"},
+        {{0}, "??$max@H@std@@YAAEBHAEBH0@Z\n",
+              "int const & __ptr64 __cdecl std::max<int>"
+              "(int const & __ptr64,int const & __ptr64)\n"},
+
+        // Options: -a, -p, -_/-n
+        {{0}, "?f@A@@QEAAXXZ\n", "void __cdecl A::f(void) __ptr64\n"},
+        {{"-a"}, "?f@A@@QEAAXXZ\n",
+                 "public: void __cdecl A::f(void) __ptr64\n"},
+        {{"-_"}, "?f@A@@QEAAXXZ\n", "void __cdecl A::f(void)\n"},
+        {{"-_n"}, "?f@A@@QEAAXXZ\n", "void __cdecl A::f(void) __ptr64\n"},
+        {{"-_", "-a"}, "?h@A@@UAEHXZ\n",
+                       "public: virtual int __thiscall A::h(void)\n"},
+        {{"-p"}, "?f@A@@QEAAXXZ\n", "A::f\n"},
+        {{"-ap"}, "??0A@@QEAA@XZ ?s@A@@0HA\n", "A::A A::s\n"},
+        {{"-z"}, "", 0},
+
+        // Symbols embedded in text, and text that only looks like symbols
+        {{0}, "at ?f@@YAHH@Z+0x10 (?x@@3HA).\n",
+              "at int __cdecl f(int)+0x10 (int x).\n"},
+        {{0}, "a?b ?c ?? ?@\n", "a?b ?c ?? ?@\n"},
+        {{0}, "?f@@YAHH@Z?f@@YAHH@Z\n", "?f@@YAHH@Z?f@@YAHH@Z\n"},
+        {{0}, "?bad@@Q\n", "?bad@@Q\n"},
+        {{0}, "?x@@3HA ?x@@3HA ?x@@3HA\n", "int x int x int x\n"},
+
+        // Itanium symbols, mixed with MSVC as if through c++filt first
+        {{0}, "_ZN3foo3barEi\n", "foo::bar(int)\n"},
+        {{0}, "call _Z3fooi@plt, ?x@@3HA\n", "call foo(int)@plt, int x\n"},
+        {{0}, "_Z3fooi?x@@3HA _Z3fooi_Z3fooi\n",
+              "foo(int)int x _Z3fooi_Z3fooi\n"},
+        {{0}, "_Z3fooi.cold _Z3fooi. _Zbad __Z3fooi x_Z3fooi\n",
+              "foo(int) [clone .cold] _Z3fooi. _Zbad __Z3fooi x_Z3fooi\n"},
+        {{0}, "?f@@YA_ZXZ _ _\n", "?f@@YA_ZXZ _ _\n"},
+        {{0}, "std::_Z", "std::_Z"},
+        {{0}, "x _", "x _"},
+        {{0}, "_ZZ1fvENKUlOT_E_clIiEEDaS0_\n",
+              "auto f()::{lambda(auto:1&&)#1}::operator()<int>(int&&) const\n"},
+        {{0}, "_Z1fM1AKDoFvvES1_\n",
+              "f(void (A::*)() noexcept const, void (A::*)() noexcept const)\n"},
+        {{"-p"}, "_ZN3foo3barEi ?f@A@@QEAAXXZ\n", "foo::bar A::f\n"},
+        {{"_ZNKSt6vectorIiSaIiEE4sizeEv"}, "",
+         "std::vector<int, std::allocator<int> >::size() const\n"},
+        {{0}, "", ""},
+
+        // Positional arguments, which ignore standard input
+        {{"?x@@3HA", "?f@@YAHH@Z"}, "?x@@3HA\n",
+                                    "int x\nint __cdecl f(int)\n"},
+        {{"--", "-a"}, "", "-a\n"},
+        {{"-h"}, "?x@@3HA\n", "usage: vc++filt [-_ahnp] [symbols...] <input\n"
+                               "  -_     32-bit mode\n"
+                               "  -a     print access specifiers\n"
+                               "  -h     print usage message\n"
+                               "  -n     64-bit mode\n"
+                               "  -p     do not print parameters\n"},
+    };
+
+    for (i32 i = 0; i < countof(tests); i++) {
+        s8 got = filter_((char **)tests[i].args, fromcstr_(tests[i].input));
+        if (!tests[i].want) {
+            assert(!got.data);
         } else {
-            // Pass it through
-            writeu8(stdout, c);
+            assert(got.data && s8equals(got, fromcstr_(tests[i].want)));
         }
+    }
 
-        sym_start = !ident(c);
+    // Overlong identifiers pass through unchanged
+    {
+        static u8 buf[SYMBOL_MAX*2 + 1];
+        s8 in = {buf, countof(buf)};
+        buf[0] = '?';
+        for (size i = 1; i < in.len; i++) {
+            buf[i] = i%7 ? 'a' : '@';
+        }
+        char *a[] = {0};
+        s8 got = filter_(a, in);
+        assert(got.data && s8equals(got, in));
     }
 
-    if (sym_at) {
-        sym = s8push(sym, 0);
-        s8 out = undecorate(cache, sym);
-        writes8(stdout, out);
-    } else {
-        writes8(stdout, sym);
+    // Several batches of lines, with and without threads, where lines
+    // and identifiers straddle batch boundaries
+    {
+        static const struct { char *in, *out; } lines[] = {
+            {"at ?f@@YAHH@Z+0x10 in ?x@@3HA\n",
+             "at int __cdecl f(int)+0x10 in int x\n"},
+            {"?bad@@Q a?b ?c\n", "?bad@@Q a?b ?c\n"},
+            {"\n", "\n"},
+            {"plain text without any symbols at all\n",
+             "plain text without any symbols at all\n"},
+            {"?f@A@@QEAAXXZ", "void __cdecl A::f(void) __ptr64"},
+            {" _ZN3foo3barEi\n", " foo::bar(int)\n"},
+        };
+        size cap = 3*BATCH_CAP;
+        s8 in = {calloc(cap, 1), 0};
+        s8 want = {calloc(2*cap, 1), 0};
+        assert(in.data && want.data);
+        for (i32 i = 0; in.len < cap-64; i = (i+3) % countof(lines)) {
+            in   = append_(in, fromcstr_(lines[i].in));
+            want = append_(want, fromcstr_(lines[i].out));
+        }
+        char *a[] = {0};
+        for (test_.ncpu = 1; test_.ncpu <= 4; test_.ncpu += 3) {
+            s8 got = filter_(a, in);
+            assert(got.data && s8equals(got, want));
+        }
+
+        // One line longer than a batch
+        in.len = want.len = 0;
+        while (in.len < BATCH_CAP+1000) {
+            in   = append_(in, fromcstr_(" ?x@@3HA"));
+            want = append_(want, fromcstr_(" int x"));
+        }
+        in   = append_(in, fromcstr_("\n?x@@3HA\n"));
+        want = append_(want, fromcstr_("\nint x\n"));
+        s8 got = filter_(a, in);
+        assert(got.data && s8equals(got, want));
+        free(want.data);
+        free(in.data);
     }
+    return 0;
+}
 
-    flush(stdout);
-    return stdout->err;
+
+#elif _WIN32
+#define W32(r) __declspec(dllimport) r __stdcall
+W32(b32)    CloseHandle(uptr);
+W32(u16 **) CommandLineToArgvW(u16 *, i32 *);
+W32(uptr)   CreateThread(uptr, size, u32 (__stdcall *)(void *), void *,
+                         i32, u32 *);
+W32(void)   ExitProcess(i32);
+W32(u32)    GetActiveProcessorCount(u16);
+W32(u16 *)  GetCommandLineW(void);
+W32(b32)    GetConsoleMode(uptr, i32 *);
+W32(i32)    GetStdHandle(i32);
+W32(b32)    ReadFile(uptr, u8 *, i32, i32 *, uptr);
+W32(byte *) VirtualAlloc(byte *, size, i32, i32);
+W32(u32)    WaitForSingleObject(uptr, u32);
+W32(i32)    WideCharToMultiByte(i32, i32, u16 *, i32, u8 *, i32, uptr, uptr);
+W32(b32)    WriteConsoleW(uptr, u16 *, i32, i32 *, uptr);
+W32(b32)    WriteFile(uptr, u8 *, i32, i32 *, uptr);
+
+typedef struct {
+    s8  remain;
+    i32 rune;
+} utf8result;
+
+static utf8result utf8decode(s8 s)
+{
+    utf8result r = {0};
+    switch (s.data[0]&0xf0) {
+    default  : r.rune = s.data[0];
+               if (r.rune > 0x7f) break;
+               r.remain = s8cuthead(s, 1);
+               return r;
+    case 0xc0:
+    case 0xd0: if (s.len < 2) break;
+               if ((s.data[1]&0xc0) != 0x80) break;
+               r.rune = (i32)(s.data[0]&0x1f) << 6 |
+                        (i32)(s.data[1]&0x3f) << 0;
+               if (r.rune < 0x80) break;
+               r.remain = s8cuthead(s, 2);
+               return r;
+    case 0xe0: if (s.len < 3) break;
+               if ((s.data[1]&0xc0) != 0x80) break;
+               if ((s.data[2]&0xc0) != 0x80) break;
+               r.rune = (i32)(s.data[0]&0x0f) << 12 |
+                        (i32)(s.data[1]&0x3f) <<  6 |
+                        (i32)(s.data[2]&0x3f) <<  0;
+               if (r.rune < 0x800) break;
+               if (r.rune>=0xd800 && r.rune<=0xdfff) break;
+               r.remain = s8cuthead(s, 3);
+               return r;
+    case 0xf0: if (s.len < 4) break;
+               if ((s.data[1]&0xc0) != 0x80) break;
+               if ((s.data[2]&0xc0) != 0x80) break;
+               if ((s.data[3]&0xc0) != 0x80) break;
+               r.rune = (i32)(s.data[0]&0x0f) << 18 |
+                        (i32)(s.data[1]&0x3f) << 12 |
+                        (i32)(s.data[2]&0x3f) <<  6 |
+                        (i32)(s.data[3]&0x3f) <<  0;
+               if (r.rune < 0x10000) break;
+               if (r.rune > 0x10ffff) break;
+               r.remain = s8cuthead(s, 4);
+               return r;
+    }
+    r.rune = 0xfffd;  // Replacement Character
+    r.remain = s8cuthead(s, 1);
+    return r;
+}
+
+// Encode code point returning the output length (1-2).
+static i32 utf16encode(u16 *dst, i32 rune)
+{
+    if (rune >= 0x10000) {
+        rune -= 0x10000;
+        dst[0] = (u16)((rune >> 10) + 0xd800);
+        dst[1] = (u16)((rune&0x3ff) + 0xdc00);
+        return 2;
+    }
+    dst[0] = (u16)rune;
+    return 1;
+}
+
+static i32 os_read(u8 *buf, i32 len)
+{
+    i32 count = 0;
+    ReadFile(GetStdHandle(-10), buf, len, &count, 0);
+    return count;
+}
+
+static b32 os_write(i32 fd, u8 *buf, i32 len)
+{
+    uptr h = GetStdHandle(-10 - fd);
+    i32 dummy;
+    if (!GetConsoleMode(h, &dummy)) {
+        return WriteFile(h, buf, len, &dummy, 0);
+    }
+
+    static u16 convert[CONVERT_CAP];  // scratch space for WriteConsoleW
+    utf8result r = {0};
+    r.remain.data = buf;
+    r.remain.len = len;
+    for (i32 n = 0; r.remain.len;) {
+        r = utf8decode(r.remain);
+        n += utf16encode(convert+n, r.rune);
+        if (n>=CONVERT_CAP-1 || !r.remain.len) {
+            if (!WriteConsoleW(h, convert, n, &dummy, 0)) {
+                return 0;
+            }
+            n = 0;
+        }
+    }
+    return 1;
+}
+
+static i32 os_ncpu(void)
+{
+    i32 n = (i32)GetActiveProcessorCount(0xffff);  // all groups
+    return n>1 ? n : 1;
+}
+
+typedef struct {
+    void (*fn)(void *, i32);
+    void  *arg;
+    i32    id;
+} thread_;
+
+static u32 __stdcall threadentry_(void *arg)
+{
+    thread_ *t = arg;
+    t->fn(t->arg, t->id);
+    return 0;
+}
+
+static void os_parallel(void (*fn)(void *, i32), void *arg, i32 n)
+{
+    thread_ threads[MAX_THREADS];
+    uptr handles[MAX_THREADS] = {0};
+    for (i32 i = 1; i < n; i++) {
+        threads[i].fn = fn;
+        threads[i].arg = arg;
+        threads[i].id = i;
+        handles[i] = CreateThread(0, 0, threadentry_, threads+i, 0, 0);
+        if (!handles[i]) {
+            fn(arg, i);
+        }
+    }
+    fn(arg, 0);
+    for (i32 i = 1; i < n; i++) {
+        if (handles[i]) {
+            WaitForSingleObject(handles[i], -1);
+            CloseHandle(handles[i]);
+        }
+    }
 }
 
 void mainCRTStartup(void)
@@ -518,6 +1116,115 @@ void mainCRTStartup(void)
     arena scratch = {0};
     scratch.beg = VirtualAlloc(0, MEMORY_CAP, 0x3000, 4);
     scratch.end = scratch.beg + MEMORY_CAP;
-    i32 r = run(scratch);
+
+    // Convert arguments to UTF-8. The command line is limited to 32K
+    // code units, so this cannot exhaust the arena.
+    i32 argc;
+    u16 **wargv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    s8 *argv = new(&scratch, s8, argc);
+    for (i32 i = 0; i < argc; i++) {
+        i32 len = WideCharToMultiByte(65001, 0, wargv[i], -1, 0, 0, 0, 0);
+        argv[i].data = new(&scratch, u8, len);
+        argv[i].len = WideCharToMultiByte(
+            65001, 0, wargv[i], -1, argv[i].data, len, 0, 0
+        ) - 1;
+    }
+
+    i32 r = run(argc, argv, scratch);
     ExitProcess(r);
 }
+
+
+#else  // POSIX
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static i32 os_read(u8 *buf, i32 len)
+{
+    for (;;) {
+        ssize_t r = read(0, buf, (size_t)len);
+        if (r<0 && errno==EINTR) {
+            continue;
+        }
+        return r<0 ? 0 : (i32)r;
+    }
+}
+
+static b32 os_write(i32 fd, u8 *buf, i32 len)
+{
+    while (len) {
+        ssize_t r = write(fd, buf, (size_t)len);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        buf += r;
+        len -= (i32)r;
+    }
+    return 1;
+}
+
+static i32 os_ncpu(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n>1 ? (i32)n : 1;
+}
+
+typedef struct {
+    void (*fn)(void *, i32);
+    void  *arg;
+    i32    id;
+} thread_;
+
+static void *threadentry_(void *arg)
+{
+    thread_ *t = arg;
+    t->fn(t->arg, t->id);
+    return 0;
+}
+
+static void os_parallel(void (*fn)(void *, i32), void *arg, i32 n)
+{
+    thread_ threads[MAX_THREADS];
+    pthread_t handles[MAX_THREADS];
+    b32 started[MAX_THREADS] = {0};
+    for (i32 i = 1; i < n; i++) {
+        threads[i].fn = fn;
+        threads[i].arg = arg;
+        threads[i].id = i;
+        started[i] = !pthread_create(handles+i, 0, threadentry_, threads+i);
+        if (!started[i]) {
+            fn(arg, i);
+        }
+    }
+    fn(arg, 0);
+    for (i32 i = 1; i < n; i++) {
+        if (started[i]) {
+            pthread_join(handles[i], 0);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    arena scratch = {0};
+    scratch.beg = mmap(
+        0, MEMORY_CAP, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0
+    );
+    if (scratch.beg == MAP_FAILED) {
+        return 1;
+    }
+    scratch.end = scratch.beg + MEMORY_CAP;
+
+    s8 *args = new(&scratch, s8, argc);
+    for (i32 i = 0; i < argc; i++) {
+        args[i].data = (u8 *)argv[i];
+        for (; args[i].data[args[i].len]; args[i].len++) {}
+    }
+    return run(argc, args, scratch);
+}
+#endif